@@ -0,0 +1,1306 @@
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ngds_array_splay_tree.h"
+#include "ngds_array_splay_tree_private.h"
+#include "ngds_allocator.h"
+#include "bench_perf_counters.h"
+
+/* ========================================================================= */
+/* -- DEFINITIONS ---------------------------------------------------------- */
+/* ========================================================================= */
+
+#define DEFAULT_KEY_COUNT           ((1 << 14) - 1)
+#define DEFAULT_OPERATION_COUNT     200000
+#define DEFAULT_SEED                42
+
+/* Every n-th operation is timed on its own for the latency percentiles */
+#define LATENCY_SAMPLE_INTERVAL     8
+
+#define ZIPF_EXPONENT               0.99
+#define WORKING_SET_SIZE            1024
+#define WORKING_SET_SHIFTS          8
+
+/* Keys covered by each scan of the range workloads */
+#define RANGE_SCAN_LENGTH           16
+
+/* The cache workloads hold this fraction of the keys */
+#define CACHE_CAPACITY_DIVISOR      4
+
+/* Tombstones a lazily removing tree tolerates before compacting */
+#define LAZY_REMOVAL_RATIO          0.25
+
+/* Local lookups land this many keys either side of a sequential walk */
+#define LOCAL_ACCESS_SPAN           16
+
+/* Levels of hot set a warm start carries over from the previous run */
+#define WARM_HOT_SET_LEVELS         10
+
+/* ========================================================================= */
+/* -- TYPES ---------------------------------------------------------------- */
+/* ========================================================================= */
+
+typedef enum bench_format_e {
+  BENCH_FORMAT_TEXT,
+  BENCH_FORMAT_JSON,
+  BENCH_FORMAT_CSV
+} bench_format_t;
+
+typedef struct bench_context_s bench_context_t;
+
+/* Performs operation number ii of a workload; the tree is preloaded */
+typedef void (*bench_operation_fptr) (bench_context_t *, int ii);
+
+typedef struct bench_workload_s {
+  const char             *name;
+  bench_operation_fptr    operation;
+  bool                    should_perform_splay;
+  bool                    runs_once_per_key;
+  bool                    is_adaptive;
+} bench_workload_t;
+
+struct bench_context_s {
+  ngds_array_splay_tree_t  *tree;
+  int                       key_count;
+  int                       operation_count;
+  uint64_t                  rng;
+  bool                      should_perform_splay;
+
+  /* Key ranks in a random order, and the Zipf CDF over them */
+  int                      *permutation;
+  double                   *zipf_cdf;
+
+  uint64_t                  seed;
+  bool                      should_measure_counters;
+
+  /* Binary min-heap of the same keys, the pop-min baseline */
+  intptr_t                 *heap;
+  int                       heap_size;
+
+  /* Position of the scan workload, which restarts at the end */
+  ngds_array_splay_tree_cursor_t cursor;
+
+  uint64_t                  checksum;
+};
+
+/*
+ * Counter totals per phase, accumulated by the phase hook. Shifts nested
+ * in a splay are tracked apart, so that the splay can be reported
+ * without them.
+ */
+typedef struct bench_phase_state_s {
+  bench_counters_t         *counters;
+  int                       splay_depth;
+  double                    begin[NGDS_ARRAY_SPLAY_TREE_PHASE_COUNT]
+                                 [BENCH_COUNTER_COUNT];
+  double                    totals[NGDS_ARRAY_SPLAY_TREE_PHASE_COUNT]
+                                  [BENCH_COUNTER_COUNT];
+  double                    nested_shift_totals[BENCH_COUNTER_COUNT];
+} bench_phase_state_t;
+
+typedef struct bench_result_s {
+  const char             *workload;
+  int                     key_count;
+  int                     operation_count;
+  double                  seconds;
+  uint64_t                p50_ns;
+  uint64_t                p99_ns;
+  uint64_t                p999_ns;
+  double                  bytes_per_key;
+
+  /* Whether the tree held the keys it should once the workload was done */
+  bool                    is_verified;
+
+  /* Per operation, for the whole operation and each phase of it */
+  bool                    has_counters;
+  bool                    is_counter_available[BENCH_COUNTER_COUNT];
+  double                  counters[BENCH_COUNTER_COUNT];
+  double                  phase_counters[NGDS_ARRAY_SPLAY_TREE_PHASE_COUNT]
+                                        [BENCH_COUNTER_COUNT];
+} bench_result_t;
+
+/* ========================================================================= */
+/* -- STATIC DATA ---------------------------------------------------------- */
+/* ========================================================================= */
+
+/* Bytes currently held by the tree, maintained by the counting allocator */
+static int64_t live_bytes = 0;
+
+static const char *phase_names[NGDS_ARRAY_SPLAY_TREE_PHASE_COUNT] = {
+  "descent", "splay", "shift"
+};
+
+/* ========================================================================= */
+/* -- STATIC FUNCTIONS ----------------------------------------------------- */
+/* ========================================================================= */
+
+static int
+key_compare (
+  const void           *e1,
+  const void           *e2
+) {
+  return ((intptr_t) e1 > (intptr_t) e2) - ((intptr_t) e1 < (intptr_t) e2);
+} /* key_compare() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline uint64_t
+next_random (
+  bench_context_t      *ctx
+) {
+  /* xorshift64* */
+  ctx->rng ^= ctx->rng >> 12;
+  ctx->rng ^= ctx->rng << 25;
+  ctx->rng ^= ctx->rng >> 27;
+  return (ctx->rng * 2685821657736338717ULL);
+} /* next_random() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline uint64_t
+now_ns (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+} /* now_ns() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The heap allocator, counting what the tree holds so that the memory
+ * per key covers the node array and everything else it allocates.
+ */
+static void *
+counting_malloc (
+  void                 *context,
+  size_t                size
+) {
+  const ngds_allocator_t *heap = context;
+  void *ptr = heap->malloc(heap->context, size);
+
+  if (NULL != ptr) {
+    live_bytes += size;
+  }
+  return ptr;
+} /* counting_malloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+counting_realloc (
+  void                 *context,
+  void                 *ptr,
+  size_t                old_size,
+  size_t                new_size
+) {
+  const ngds_allocator_t *heap = context;
+  void *new_ptr = heap->realloc(heap->context, ptr, old_size, new_size);
+
+  if (NULL != new_ptr) {
+    live_bytes += (int64_t) new_size - (int64_t) old_size;
+  }
+  return new_ptr;
+} /* counting_realloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+counting_aligned_alloc (
+  void                 *context,
+  size_t                alignment,
+  size_t                size
+) {
+  const ngds_allocator_t *heap = context;
+  void *ptr = heap->aligned_alloc(heap->context, alignment, size);
+
+  if (NULL != ptr) {
+    live_bytes += size;
+  }
+  return ptr;
+} /* counting_aligned_alloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+counting_free (
+  void                 *context,
+  void                 *ptr,
+  size_t                size
+) {
+  const ngds_allocator_t *heap = context;
+
+  if (NULL != ptr) {
+    live_bytes -= size;
+  }
+  heap->free(heap->context, ptr, size);
+} /* counting_free() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Inserts ranks [lo, hi] median first, which yields a perfectly balanced
+ * tree without a single rotation.
+ */
+static void
+preload_balanced (
+  ngds_array_splay_tree_t  *tree,
+  int                       lo,
+  int                       hi,
+  int                       stride
+) {
+  int mid;
+
+  if (lo > hi) {
+    return;
+  }
+
+  mid = lo + ((hi - lo) / 2);
+  ngds_array_splay_tree_insert(tree, (void *) (intptr_t) ((mid + 1) * stride),
+    (void *) (intptr_t) ((mid + 1) * stride), false);
+  preload_balanced(tree, lo, (mid - 1), stride);
+  preload_balanced(tree, (mid + 1), hi, stride);
+} /* preload_balanced() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline void
+lookup (
+  bench_context_t      *ctx,
+  intptr_t              key
+) {
+  ctx->checksum += (uintptr_t) ngds_array_splay_tree_get(ctx->tree,
+    (void *) key, ctx->should_perform_splay);
+} /* lookup() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+uniform_get (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  (void) ii;
+  lookup(ctx, (intptr_t) (1 + (next_random(ctx) % ctx->key_count)));
+} /* uniform_get() */
+
+/* ------------------------------------------------------------------------- */
+
+static intptr_t
+zipfian_key (
+  bench_context_t      *ctx
+) {
+  double  u = (double) (next_random(ctx) >> 11) / (double) (1ULL << 53);
+  int     lo = 0;
+  int     hi = ctx->key_count - 1;
+
+  while (lo < hi) {
+    int mid = lo + ((hi - lo) / 2);
+    if (ctx->zipf_cdf[mid] < u) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return (intptr_t) (1 + ctx->permutation[lo]);
+} /* zipfian_key() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+zipfian_get (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  (void) ii;
+  lookup(ctx, zipfian_key(ctx));
+} /* zipfian_get() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Bumps a per-key counter the two-pass way, with a get and an insert */
+static void
+zipfian_count_get_insert (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  intptr_t  key = zipfian_key(ctx);
+  intptr_t  count = (intptr_t) ngds_array_splay_tree_get(ctx->tree,
+              (void *) key, ctx->should_perform_splay);
+
+  (void) ii;
+  ngds_array_splay_tree_insert(ctx->tree, (void *) key, (void *) (count + 1),
+    ctx->should_perform_splay);
+} /* zipfian_count_get_insert() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Bumps the same counter in place, with a single descent */
+static void
+zipfian_count_get_ref (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  void **count = ngds_array_splay_tree_get_ref(ctx->tree,
+    (void *) zipfian_key(ctx), ctx->should_perform_splay);
+
+  (void) ii;
+  *count = (void *) ((intptr_t) *count + 1);
+} /* zipfian_count_get_ref() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+sequential_get (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  lookup(ctx, (intptr_t) (1 + (ii % ctx->key_count)));
+} /* sequential_get() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Near-sequential: a key close to where a sequential walk would be */
+static void
+local_get (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  int offset = (int) (next_random(ctx) % ((2 * LOCAL_ACCESS_SPAN) + 1))
+    - LOCAL_ACCESS_SPAN;
+
+  lookup(ctx, (intptr_t) (1 + (((ii % ctx->key_count) + offset
+    + ctx->key_count) % ctx->key_count)));
+} /* local_get() */
+
+/* ------------------------------------------------------------------------- */
+
+/* The same lookups, on a tree searching from a finger */
+static void
+finger_sequential_get (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  sequential_get(ctx, ii);
+} /* finger_sequential_get() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+finger_local_get (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  local_get(ctx, ii);
+} /* finger_local_get() */
+
+/* ------------------------------------------------------------------------- */
+
+/* The same lookups, on a tree warmed up with a previous run's hot set */
+static void
+warm_zipfian_get (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  zipfian_get(ctx, ii);
+} /* warm_zipfian_get() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Visits the keys in order with a cursor, as get-sequential does by key */
+static void
+cursor_scan (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  if (0 == ii || false == ngds_array_splay_tree_cursor_next(&ctx->cursor)) {
+    ngds_array_splay_tree_cursor_first(ctx->tree, &ctx->cursor);
+  }
+  ctx->checksum += (uintptr_t) ngds_array_splay_tree_cursor_value(
+    &ctx->cursor);
+} /* cursor_scan() */
+
+/* ------------------------------------------------------------------------- */
+
+static bool
+sum_range (
+  const void           *key,
+  void                 *value,
+  void                 *context
+) {
+  (void) key;
+  *(uint64_t *) context += (uintptr_t) value;
+  return true;
+} /* sum_range() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Scans a short range of keys from a Zipfian start */
+static void
+zipfian_range (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  intptr_t lo = zipfian_key(ctx);
+
+  (void) ii;
+  ngds_array_splay_tree_range(ctx->tree, (void *) lo,
+    (void *) (lo + RANGE_SCAN_LENGTH), sum_range, &ctx->checksum,
+    ctx->should_perform_splay);
+} /* zipfian_range() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+zipfian_rank (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  (void) ii;
+  ctx->checksum += ngds_array_splay_tree_rank(ctx->tree,
+    (void *) zipfian_key(ctx), ctx->should_perform_splay);
+} /* zipfian_rank() */
+
+/* ------------------------------------------------------------------------- */
+
+/* A read-through cache over Zipfian keys, where every miss inserts */
+static void
+zipfian_cache (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  intptr_t  key = zipfian_key(ctx);
+  void     *value;
+
+  (void) ii;
+  value = ngds_array_splay_tree_get(ctx->tree, (void *) key,
+    ctx->should_perform_splay);
+  if (NULL == value) {
+    ngds_array_splay_tree_insert(ctx->tree, (void *) key, (void *) key,
+      ctx->should_perform_splay);
+  }
+  ctx->checksum += (uintptr_t) value;
+} /* zipfian_cache() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+pop_min (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  (void) ii;
+  ctx->checksum += (uintptr_t) ngds_array_splay_tree_pop_min(ctx->tree,
+    NULL);
+} /* pop_min() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+heap_sift_down (
+  bench_context_t      *ctx,
+  int                   idx
+) {
+  intptr_t key = ctx->heap[idx];
+
+  for (;;) {
+    int child = (2 * idx) + 1;
+
+    if (child >= ctx->heap_size) {
+      break;
+    }
+    if ((child + 1) < ctx->heap_size
+        && ctx->heap[child + 1] < ctx->heap[child]) {
+      ++child;
+    }
+    if (key <= ctx->heap[child]) {
+      break;
+    }
+    ctx->heap[idx] = ctx->heap[child];
+    idx = child;
+  }
+  ctx->heap[idx] = key;
+} /* heap_sift_down() */
+
+/* ------------------------------------------------------------------------- */
+
+/* The same drain on a binary heap; memory per key reports the tree's */
+static void
+heap_pop_min (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  (void) ii;
+  ctx->checksum += (uintptr_t) ctx->heap[0];
+  ctx->heap[0] = ctx->heap[--ctx->heap_size];
+  heap_sift_down(ctx, 0);
+} /* heap_pop_min() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Uniform over a window of keys that jumps to a new random position a
+ * fixed number of times over the run.
+ */
+static void
+shifting_get (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  int window = (WORKING_SET_SIZE < ctx->key_count)
+    ? WORKING_SET_SIZE : ctx->key_count;
+  int phase = ii / ((ctx->operation_count / WORKING_SET_SHIFTS) + 1);
+  int base = ctx->permutation[(phase * 7919) % ctx->key_count];
+
+  if (base > (ctx->key_count - window)) {
+    base = ctx->key_count - window;
+  }
+  lookup(ctx, (intptr_t) (1 + base + (next_random(ctx) % window)));
+} /* shifting_get() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Alternates between the two ends of the key space, closing in on the
+ * middle, so that every splay drags the opposite extreme down.
+ */
+static void
+adversarial_get (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  int step = (ii / 2) % ((ctx->key_count + 1) / 2);
+
+  lookup(ctx, (intptr_t) ((0 == (ii % 2)) ? (1 + step)
+    : (ctx->key_count - step)));
+} /* adversarial_get() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Inserts the odd keys between the preloaded even ones, in random order */
+static void
+random_insert (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  intptr_t key = (2 * (intptr_t) ctx->permutation[ii]) + 1;
+
+  ngds_array_splay_tree_insert(ctx->tree, (void *) key, (void *) key,
+    ctx->should_perform_splay);
+} /* random_insert() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+random_remove (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  ctx->checksum += (uintptr_t) ngds_array_splay_tree_remove(ctx->tree,
+    (void *) (intptr_t) (1 + ctx->permutation[ii]));
+} /* random_remove() */
+
+/* ------------------------------------------------------------------------- */
+
+/* The same removals, from a tree that leaves tombstones behind */
+static void
+random_lazy_remove (
+  bench_context_t      *ctx,
+  int                   ii
+) {
+  random_remove(ctx, ii);
+} /* random_lazy_remove() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+compare_uint64 (
+  const void           *e1,
+  const void           *e2
+) {
+  uint64_t a = *(const uint64_t *) e1;
+  uint64_t b = *(const uint64_t *) e2;
+
+  return (a > b) - (a < b);
+} /* compare_uint64() */
+
+/* ------------------------------------------------------------------------- */
+
+static uint64_t
+percentile (
+  const uint64_t       *samples,
+  int                   sample_count,
+  double                fraction
+) {
+  int idx = (int) ((fraction * sample_count) + 0.5);
+
+  if (0 == sample_count) {
+    return 0;
+  }
+  if (idx >= sample_count) {
+    idx = sample_count - 1;
+  }
+  return samples[idx];
+} /* percentile() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Plays a previous run: splays a tree into shape with Zipfian lookups
+ * from another random stream, and exports its hot set. The fresh tree
+ * then takes that hot set on top of its preloaded keys.
+ */
+static void
+warm_start (
+  bench_context_t                       *ctx,
+  const ngds_array_splay_tree_options_t *options
+) {
+  ngds_array_splay_tree_t *previous;
+  void                    *hot[(1 << WARM_HOT_SET_LEVELS) - 1];
+  int                      count;
+  int                      ii;
+
+  previous = ngds_array_splay_tree_new_with_options(options);
+  preload_balanced(previous, 0, (ctx->key_count - 1), 1);
+  ctx->rng = ~ctx->rng;
+  for (ii = 0; ii < ctx->key_count; ++ii) {
+    ngds_array_splay_tree_get(previous, (void *) zipfian_key(ctx), true);
+  }
+  ctx->rng = ~ctx->rng;
+
+  count = ngds_array_splay_tree_export_hot_set(previous,
+    WARM_HOT_SET_LEVELS, hot, ((1 << WARM_HOT_SET_LEVELS) - 1));
+  ngds_array_splay_tree_preload_hot_set(ctx->tree, hot, count);
+  ngds_array_splay_tree_destroy(previous);
+} /* warm_start() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Builds the preloaded tree a workload starts from, and rewinds the
+ * random number generator so that every pass performs the same
+ * operations. Returns how many operations the workload performs.
+ */
+static int
+prepare_workload (
+  bench_context_t          *ctx,
+  const bench_workload_t   *workload,
+  const ngds_allocator_t   *allocator
+) {
+  ngds_array_splay_tree_options_t options;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 1024;
+  options.compare = key_compare;
+  options.allocator = allocator;
+  options.has_order_statistics = (zipfian_rank == workload->operation);
+  ctx->tree = ngds_array_splay_tree_new_with_options(&options);
+  ctx->should_perform_splay = workload->should_perform_splay;
+  ctx->rng = (0 == ctx->seed) ? 1 : ctx->seed;
+
+  /* Inserts go between the preloaded keys, everything else onto them */
+  if (random_insert == workload->operation) {
+    preload_balanced(ctx->tree, 0, (ctx->key_count - 1), 2);
+  } else {
+    preload_balanced(ctx->tree, 0, (ctx->key_count - 1), 1);
+  }
+  if (true == workload->is_adaptive) {
+    ngds_array_splay_tree_set_adaptive_splay(ctx->tree, true);
+  }
+  if (zipfian_cache == workload->operation) {
+    ngds_array_splay_tree_set_capacity(ctx->tree,
+      (ctx->key_count / CACHE_CAPACITY_DIVISOR), NULL, NULL);
+  }
+  if (finger_sequential_get == workload->operation
+      || finger_local_get == workload->operation) {
+    ngds_array_splay_tree_set_finger_search(ctx->tree, true);
+  }
+  if (warm_zipfian_get == workload->operation) {
+    warm_start(ctx, &options);
+  }
+  if (random_lazy_remove == workload->operation) {
+    ngds_array_splay_tree_set_lazy_removal(ctx->tree, LAZY_REMOVAL_RATIO);
+  }
+  if (heap_pop_min == workload->operation) {
+    int ii;
+
+    for (ii = 0; ii < ctx->key_count; ++ii) {
+      ctx->heap[ii] = 1 + ctx->permutation[ii];
+    }
+    ctx->heap_size = ctx->key_count;
+    for (ii = (ctx->heap_size / 2) - 1; ii >= 0; --ii) {
+      heap_sift_down(ctx, ii);
+    }
+  }
+
+  return (true == workload->runs_once_per_key)
+    ? ctx->key_count : ctx->operation_count;
+} /* prepare_workload() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Checks the tree a workload leaves behind, so that failed operations
+ * cannot pass for fast ones. An in-order walk has to find ascending keys,
+ * as many as the tree counts, and every key the workload keeps or adds
+ * has to be found. Explains any mismatch on stderr.
+ */
+static bool
+verify_workload (
+  bench_context_t          *ctx,
+  const bench_workload_t   *workload
+) {
+  ngds_array_splay_tree_cursor_t cursor;
+  int       cardinality = ngds_array_splay_tree_cardinality(ctx->tree);
+  int       expected = ctx->key_count;
+  int       walked = 0;
+  intptr_t  previous = 0;
+  intptr_t  key;
+  bool      has_key;
+
+  if (random_insert == workload->operation) {
+    expected = 2 * ctx->key_count;
+  } else if (random_remove == workload->operation
+      || random_lazy_remove == workload->operation
+      || pop_min == workload->operation) {
+    expected = 0;
+  } else if (zipfian_cache == workload->operation) {
+    /* Which keys a cache keeps depends on its evictions */
+    expected = -1;
+    if (cardinality > (ctx->key_count / CACHE_CAPACITY_DIVISOR)) {
+      fprintf(stderr, "%s: %d keys in a cache of %d\n", workload->name,
+        cardinality, (ctx->key_count / CACHE_CAPACITY_DIVISOR));
+      return false;
+    }
+  }
+
+  if (0 <= expected && cardinality != expected) {
+    fprintf(stderr, "%s: %d keys, expected %d\n", workload->name,
+      cardinality, expected);
+    return false;
+  }
+
+  for (has_key = ngds_array_splay_tree_cursor_first(ctx->tree, &cursor);
+       true == has_key;
+       has_key = ngds_array_splay_tree_cursor_next(&cursor)) {
+    intptr_t current = (intptr_t) ngds_array_splay_tree_cursor_key(&cursor);
+
+    if (0 < walked && current <= previous) {
+      fprintf(stderr, "%s: key %ld follows %ld in order\n", workload->name,
+        (long) current, (long) previous);
+      return false;
+    }
+    previous = current;
+    ++walked;
+  }
+  if (walked != cardinality) {
+    fprintf(stderr, "%s: %d keys walked of %d\n", workload->name, walked,
+      cardinality);
+    return false;
+  }
+
+  for (key = 1; key <= expected; ++key) {
+    if (NULL == ngds_array_splay_tree_get(ctx->tree, (void *) key, false)) {
+      fprintf(stderr, "%s: key %ld missing\n", workload->name, (long) key);
+      return false;
+    }
+  }
+
+  return true;
+} /* verify_workload() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+phase_hook (
+  void                           *context,
+  ngds_array_splay_tree_phase_t   phase,
+  bool                            is_begin
+) {
+  bench_phase_state_t  *state = context;
+  double                values[BENCH_COUNTER_COUNT];
+  int                   ii;
+
+  bench_counters_read(state->counters, values);
+
+  if (true == is_begin) {
+    memcpy(state->begin[phase], values, sizeof(values));
+    if (NGDS_ARRAY_SPLAY_TREE_PHASE_SPLAY == phase) {
+      ++state->splay_depth;
+    }
+    return;
+  }
+
+  for (ii = 0; ii < BENCH_COUNTER_COUNT; ++ii) {
+    double delta = values[ii] - state->begin[phase][ii];
+
+    state->totals[phase][ii] += delta;
+    if (NGDS_ARRAY_SPLAY_TREE_PHASE_SHIFT == phase
+        && 0 < state->splay_depth) {
+      state->nested_shift_totals[ii] += delta;
+    }
+  }
+  if (NGDS_ARRAY_SPLAY_TREE_PHASE_SPLAY == phase) {
+    --state->splay_depth;
+  }
+} /* phase_hook() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Repeats a workload twice with hardware counters running: once measuring
+ * whole operations, and once with the phase hook installed, whose reads
+ * would otherwise be charged to the operations. Both passes start from
+ * a fresh tree and replay the same operations as the timed one.
+ */
+static void
+measure_counters (
+  bench_context_t          *ctx,
+  const bench_workload_t   *workload,
+  const ngds_allocator_t   *allocator,
+  bench_counters_t         *counters,
+  bench_result_t           *result
+) {
+  bench_phase_state_t   state;
+  double                before[BENCH_COUNTER_COUNT];
+  double                after[BENCH_COUNTER_COUNT];
+  int                   operation_count;
+  int                   ii;
+  int                   jj;
+
+  operation_count = prepare_workload(ctx, workload, allocator);
+  bench_counters_read(counters, before);
+  for (ii = 0; ii < operation_count; ++ii) {
+    workload->operation(ctx, ii);
+  }
+  bench_counters_read(counters, after);
+  ngds_array_splay_tree_destroy(ctx->tree);
+
+  memset(&state, 0, sizeof(state));
+  state.counters = counters;
+  operation_count = prepare_workload(ctx, workload, allocator);
+  ngds_array_splay_tree_set_phase_hook(ctx->tree, phase_hook, &state);
+  for (ii = 0; ii < operation_count; ++ii) {
+    workload->operation(ctx, ii);
+  }
+  ngds_array_splay_tree_destroy(ctx->tree);
+  ctx->tree = NULL;
+
+  result->has_counters = true;
+  for (ii = 0; ii < BENCH_COUNTER_COUNT; ++ii) {
+    result->is_counter_available[ii] =
+      bench_counters_is_available(counters, ii);
+    result->counters[ii] = (after[ii] - before[ii]) / operation_count;
+    state.totals[NGDS_ARRAY_SPLAY_TREE_PHASE_SPLAY][ii] -=
+      state.nested_shift_totals[ii];
+    for (jj = 0; jj < NGDS_ARRAY_SPLAY_TREE_PHASE_COUNT; ++jj) {
+      result->phase_counters[jj][ii] = state.totals[jj][ii] / operation_count;
+    }
+  }
+} /* measure_counters() */
+
+/* ------------------------------------------------------------------------- */
+
+static bench_result_t
+run_workload (
+  bench_context_t          *ctx,
+  const bench_workload_t   *workload,
+  const ngds_allocator_t   *allocator
+) {
+  bench_result_t        result;
+  uint64_t             *samples;
+  uint64_t              start;
+  int                   sample_count = 0;
+  int                   operation_count;
+  int                   ii;
+
+  memset(&result, 0, sizeof(result));
+
+  operation_count = prepare_workload(ctx, workload, allocator);
+
+  /* Removals end on an empty tree, so they are measured fully loaded */
+  result.bytes_per_key = (double) live_bytes
+    / ngds_array_splay_tree_cardinality(ctx->tree);
+
+  samples = calloc((operation_count / LATENCY_SAMPLE_INTERVAL) + 1,
+    sizeof(uint64_t));
+
+  start = now_ns();
+  for (ii = 0; ii < operation_count; ++ii) {
+    if (0 == (ii % LATENCY_SAMPLE_INTERVAL)) {
+      uint64_t op_start = now_ns();
+      workload->operation(ctx, ii);
+      samples[sample_count++] = now_ns() - op_start;
+    } else {
+      workload->operation(ctx, ii);
+    }
+  }
+  result.seconds = (double) (now_ns() - start) / 1e9;
+
+  qsort(samples, sample_count, sizeof(uint64_t), compare_uint64);
+  result.workload = workload->name;
+  result.key_count = ngds_array_splay_tree_cardinality(ctx->tree);
+  result.operation_count = operation_count;
+  result.p50_ns = percentile(samples, sample_count, 0.50);
+  result.p99_ns = percentile(samples, sample_count, 0.99);
+  result.p999_ns = percentile(samples, sample_count, 0.999);
+  if (0 < result.key_count) {
+    result.bytes_per_key = (double) live_bytes / result.key_count;
+  }
+  result.is_verified = verify_workload(ctx, workload);
+
+  free(samples);
+  ngds_array_splay_tree_destroy(ctx->tree);
+  ctx->tree = NULL;
+
+  return result;
+} /* run_workload() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Prints one set of per-operation counters in the given format. Counters
+ * that could not be opened come out as null, an empty field or n/a.
+ */
+static void
+print_counters (
+  FILE                 *out,
+  const bench_result_t *result,
+  const double          values[BENCH_COUNTER_COUNT],
+  bench_format_t        format
+) {
+  int ii;
+
+  for (ii = 0; ii < BENCH_COUNTER_COUNT; ++ii) {
+    bool is_available = result->is_counter_available[ii];
+
+    switch (format) {
+      case BENCH_FORMAT_JSON:
+        fprintf(out, (0 == ii) ? "\"%s\":" : ",\"%s\":",
+          bench_counter_name(ii));
+        if (true == is_available) {
+          fprintf(out, "%.2f", values[ii]);
+        } else {
+          fprintf(out, "null");
+        }
+        break;
+      case BENCH_FORMAT_CSV:
+        if (true == is_available) {
+          fprintf(out, ",%.2f", values[ii]);
+        } else {
+          fprintf(out, ",");
+        }
+        break;
+      default:
+        if (true == is_available) {
+          fprintf(out, " %14.2f", values[ii]);
+        } else {
+          fprintf(out, " %14s", "n/a");
+        }
+        break;
+    }
+  }
+} /* print_counters() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+print_result (
+  FILE                 *out,
+  const bench_result_t *result,
+  bench_format_t        format
+) {
+  double ops_per_second = (0.0 < result->seconds)
+    ? (result->operation_count / result->seconds) : 0.0;
+  int    ii;
+
+  switch (format) {
+    case BENCH_FORMAT_JSON:
+      fprintf(out, "{\"workload\":\"%s\",\"keys\":%d,\"operations\":%d,"
+        "\"seconds\":%.6f,\"ops_per_second\":%.0f,\"p50_ns\":%llu,"
+        "\"p99_ns\":%llu,\"p999_ns\":%llu,\"bytes_per_key\":%.1f",
+        result->workload, result->key_count, result->operation_count,
+        result->seconds, ops_per_second,
+        (unsigned long long) result->p50_ns,
+        (unsigned long long) result->p99_ns,
+        (unsigned long long) result->p999_ns, result->bytes_per_key);
+      if (true == result->has_counters) {
+        fprintf(out, ",\"counters\":{\"total\":{");
+        print_counters(out, result, result->counters, format);
+        for (ii = 0; ii < NGDS_ARRAY_SPLAY_TREE_PHASE_COUNT; ++ii) {
+          fprintf(out, "},\"%s\":{", phase_names[ii]);
+          print_counters(out, result, result->phase_counters[ii], format);
+        }
+        fprintf(out, "}}");
+      }
+      fprintf(out, "}\n");
+      break;
+    case BENCH_FORMAT_CSV:
+      fprintf(out, "%s,%d,%d,%.6f,%.0f,%llu,%llu,%llu,%.1f",
+        result->workload, result->key_count, result->operation_count,
+        result->seconds, ops_per_second,
+        (unsigned long long) result->p50_ns,
+        (unsigned long long) result->p99_ns,
+        (unsigned long long) result->p999_ns, result->bytes_per_key);
+      if (true == result->has_counters) {
+        print_counters(out, result, result->counters, format);
+        for (ii = 0; ii < NGDS_ARRAY_SPLAY_TREE_PHASE_COUNT; ++ii) {
+          print_counters(out, result, result->phase_counters[ii], format);
+        }
+      }
+      fprintf(out, "\n");
+      break;
+    default:
+      fprintf(out, "%-22s %9d %12.0f %9llu %9llu %9llu %10.1f\n",
+        result->workload, result->operation_count, ops_per_second,
+        (unsigned long long) result->p50_ns,
+        (unsigned long long) result->p99_ns,
+        (unsigned long long) result->p999_ns, result->bytes_per_key);
+      if (true == result->has_counters) {
+        fprintf(out, "  %-20s", "per op");
+        print_counters(out, result, result->counters, format);
+        fprintf(out, "\n");
+        for (ii = 0; ii < NGDS_ARRAY_SPLAY_TREE_PHASE_COUNT; ++ii) {
+          fprintf(out, "  %-20s", phase_names[ii]);
+          print_counters(out, result, result->phase_counters[ii], format);
+          fprintf(out, "\n");
+        }
+      }
+      break;
+  }
+} /* print_result() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+usage (
+  const char           *argv0
+) {
+  fprintf(stderr,
+    "usage: %s [-n keys] [-o operations] [-s seed] [-w workload]"
+    " [-f text|json|csv] [-p]\n", argv0);
+} /* usage() */
+
+/* ========================================================================= */
+/* -- MAIN ----------------------------------------------------------------- */
+/* ========================================================================= */
+
+int
+main (
+  int                   argc,
+  char                **argv
+) {
+  static const bench_workload_t workloads[] = {
+    { "insert",               random_insert,    false,  true,   false },
+    { "insert-splay",         random_insert,    true,   true,   false },
+    { "get-uniform",          uniform_get,      false,  false,  false },
+    { "get-uniform-splay",    uniform_get,      true,   false,  false },
+    { "get-uniform-adaptive", uniform_get,      true,   false,  true  },
+    { "get-zipfian",          zipfian_get,      false,  false,  false },
+    { "get-zipfian-splay",    zipfian_get,      true,   false,  false },
+    { "get-zipfian-adaptive", zipfian_get,      true,   false,  true  },
+    { "get-zipfian-warm",     warm_zipfian_get, false,  false,  false },
+    { "count-get-insert",     zipfian_count_get_insert, false, false, false },
+    { "count-get-ref",        zipfian_count_get_ref, false, false,  false },
+    { "range-zipfian",        zipfian_range,    false,  false,  false },
+    { "range-zipfian-splay",  zipfian_range,    true,   false,  false },
+    { "range-zipfian-adaptive", zipfian_range,  true,   false,  true  },
+    { "rank-zipfian",         zipfian_rank,     false,  false,  false },
+    { "rank-zipfian-splay",   zipfian_rank,     true,   false,  false },
+    { "cache-zipfian",        zipfian_cache,    false,  false,  false },
+    { "cache-zipfian-splay",  zipfian_cache,    true,   false,  false },
+    { "get-sequential",       sequential_get,   false,  false,  false },
+    { "scan-cursor",          cursor_scan,      false,  false,  false },
+    { "get-sequential-splay", sequential_get,   true,   false,  false },
+    { "get-sequential-finger", finger_sequential_get, false, false, false },
+    { "get-local",            local_get,        false,  false,  false },
+    { "get-local-finger",     finger_local_get, false,  false,  false },
+    { "get-shifting-splay",   shifting_get,     true,   false,  false },
+    { "get-adversarial-splay", adversarial_get, true,   false,  false },
+    { "remove",               random_remove,    false,  true,   false },
+    { "remove-lazy",          random_lazy_remove, false, true,  false },
+    { "pop-min",              pop_min,          false,  true,   false },
+    { "pop-min-heap",         heap_pop_min,     false,  true,   false }
+  };
+  ngds_allocator_t  allocator;
+  bench_context_t   ctx;
+  bench_counters_t  counters;
+  FILE             *out;
+  bench_format_t    format = BENCH_FORMAT_TEXT;
+  const char       *only = NULL;
+  int               status = 0;
+  double            zipf_sum = 0.0;
+  int               opt;
+  int               ii;
+
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.key_count = DEFAULT_KEY_COUNT;
+  ctx.operation_count = DEFAULT_OPERATION_COUNT;
+  ctx.seed = DEFAULT_SEED;
+
+  while (-1 != (opt = getopt(argc, argv, "n:o:s:w:f:ph"))) {
+    switch (opt) {
+      case 'n':
+        ctx.key_count = atoi(optarg);
+        break;
+      case 'o':
+        ctx.operation_count = atoi(optarg);
+        break;
+      case 's':
+        ctx.seed = strtoull(optarg, NULL, 10);
+        break;
+      case 'w':
+        only = optarg;
+        break;
+      case 'f':
+        if (0 == strcmp(optarg, "json")) {
+          format = BENCH_FORMAT_JSON;
+        } else if (0 == strcmp(optarg, "csv")) {
+          format = BENCH_FORMAT_CSV;
+        } else if (0 == strcmp(optarg, "text")) {
+          format = BENCH_FORMAT_TEXT;
+        } else {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'p':
+        ctx.should_measure_counters = true;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (0 >= ctx.key_count || 0 >= ctx.operation_count) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  allocator.context = (void *) ngds_allocator_heap();
+  allocator.malloc = counting_malloc;
+  allocator.realloc = counting_realloc;
+  allocator.aligned_alloc = counting_aligned_alloc;
+  allocator.free = counting_free;
+
+  /* Fisher-Yates over the key ranks, then the Zipf CDF in that order */
+  ctx.rng = (0 == ctx.seed) ? 1 : ctx.seed;
+  ctx.permutation = malloc(ctx.key_count * sizeof(int));
+  ctx.zipf_cdf = malloc(ctx.key_count * sizeof(double));
+  ctx.heap = malloc(ctx.key_count * sizeof(intptr_t));
+  for (ii = 0; ii < ctx.key_count; ++ii) {
+    ctx.permutation[ii] = ii;
+  }
+  for (ii = ctx.key_count - 1; ii > 0; --ii) {
+    int jj = next_random(&ctx) % (ii + 1);
+    int tmp = ctx.permutation[ii];
+    ctx.permutation[ii] = ctx.permutation[jj];
+    ctx.permutation[jj] = tmp;
+  }
+  for (ii = 0; ii < ctx.key_count; ++ii) {
+    zipf_sum += 1.0 / pow((double) (ii + 1), ZIPF_EXPONENT);
+    ctx.zipf_cdf[ii] = zipf_sum;
+  }
+  for (ii = 0; ii < ctx.key_count; ++ii) {
+    ctx.zipf_cdf[ii] /= zipf_sum;
+  }
+
+  /*
+   * The library reports trouble, such as a tree at its maximum size, on
+   * stdout. Results get a private copy of it, and everything else written
+   * to stdout goes to stderr, so that the output stays machine-readable.
+   */
+  out = fdopen(dup(STDOUT_FILENO), "w");
+  if (NULL == out) {
+    perror("fdopen");
+    return 1;
+  }
+  fflush(stdout);
+  dup2(STDERR_FILENO, STDOUT_FILENO);
+
+  /* Without any counter, e.g. in a VM, the timings are still worth having */
+  if (true == ctx.should_measure_counters
+      && 0 == bench_counters_open(&counters)) {
+    fprintf(stderr, "hardware counters unavailable (%s), measuring time "
+      "only\n", strerror(counters.first_error));
+    ctx.should_measure_counters = false;
+  }
+
+  switch (format) {
+    case BENCH_FORMAT_CSV:
+      fprintf(out, "workload,keys,operations,seconds,ops_per_second,p50_ns,"
+        "p99_ns,p999_ns,bytes_per_key");
+      if (true == ctx.should_measure_counters) {
+        int jj;
+
+        for (ii = -1; ii < NGDS_ARRAY_SPLAY_TREE_PHASE_COUNT; ++ii) {
+          for (jj = 0; jj < BENCH_COUNTER_COUNT; ++jj) {
+            fprintf(out, ",%s_%s", (0 > ii) ? "total" : phase_names[ii],
+              bench_counter_name(jj));
+          }
+        }
+      }
+      fprintf(out, "\n");
+      break;
+    case BENCH_FORMAT_TEXT:
+      fprintf(out, "%-22s %9s %12s %9s %9s %9s %10s\n", "workload", "ops",
+        "ops/sec", "p50 ns", "p99 ns", "p99.9 ns", "bytes/key");
+      if (true == ctx.should_measure_counters) {
+        fprintf(out, "  %-20s", "counters");
+        for (ii = 0; ii < BENCH_COUNTER_COUNT; ++ii) {
+          fprintf(out, " %14s", bench_counter_name(ii));
+        }
+        fprintf(out, "\n");
+      }
+      break;
+    default:
+      break;
+  }
+
+  for (ii = 0; ii < (int) (sizeof(workloads) / sizeof(workloads[0])); ++ii) {
+    bench_result_t result;
+
+    if (NULL != only && 0 != strcmp(only, workloads[ii].name)) {
+      continue;
+    }
+    result = run_workload(&ctx, &workloads[ii], &allocator);
+    if (false == result.is_verified) {
+      fprintf(stderr, "%s: the tree does not hold the keys it should, "
+        "stopping\n", result.workload);
+      status = 1;
+      break;
+    }
+    if (true == ctx.should_measure_counters) {
+      measure_counters(&ctx, &workloads[ii], &allocator, &counters, &result);
+    }
+    print_result(out, &result, format);
+  }
+
+  /* Keeps the lookups from being optimized away */
+  if (0 == ctx.checksum) {
+    fprintf(stderr, "checksum: 0\n");
+  }
+
+  if (true == ctx.should_measure_counters) {
+    bench_counters_close(&counters);
+  }
+  fclose(out);
+  free(ctx.permutation);
+  free(ctx.zipf_cdf);
+  free(ctx.heap);
+
+  return status;
+} /* main() */
+
+/* vi: set et sw=2 ts=2: */
@@ -0,0 +1,139 @@
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "bench_perf_counters.h"
+
+/* ========================================================================= */
+/* -- MACROS --------------------------------------------------------------- */
+/* ========================================================================= */
+
+#define CACHE_EVENT(cache, op, result)  \
+  ((cache) | ((op) << 8) | ((result) << 16))
+
+/* ========================================================================= */
+/* -- STATIC DATA ---------------------------------------------------------- */
+/* ========================================================================= */
+
+static const struct {
+  const char           *name;
+  uint32_t              type;
+  uint64_t              config;
+} counter_events[BENCH_COUNTER_COUNT] = {
+  { "cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "l1d_misses",       PERF_TYPE_HW_CACHE,
+    CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+      PERF_COUNT_HW_CACHE_RESULT_MISS) },
+  { "llc_misses",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { "dtlb_misses",      PERF_TYPE_HW_CACHE,
+    CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+      PERF_COUNT_HW_CACHE_RESULT_MISS) },
+  { "branch_misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+};
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTIONS ----------------------------------------------------- */
+/* ========================================================================= */
+
+int
+bench_counters_open (
+  bench_counters_t     *counters
+) {
+  int ii;
+
+  memset(counters, 0, sizeof(bench_counters_t));
+
+  for (ii = 0; ii < BENCH_COUNTER_COUNT; ++ii) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter_events[ii].type;
+    attr.config = counter_events[ii].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+      | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    counters->fds[ii] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+      0);
+    if (0 > counters->fds[ii]) {
+      if (0 == counters->first_error) {
+        counters->first_error = errno;
+      }
+      continue;
+    }
+    ++counters->open_count;
+  }
+
+  return counters->open_count;
+} /* bench_counters_open() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+bench_counters_read (
+  const bench_counters_t   *counters,
+  double                    values[BENCH_COUNTER_COUNT]
+) {
+  int ii;
+
+  for (ii = 0; ii < BENCH_COUNTER_COUNT; ++ii) {
+    uint64_t raw[3];
+
+    values[ii] = 0.0;
+    if (0 > counters->fds[ii]
+        || sizeof(raw) != read(counters->fds[ii], raw, sizeof(raw))
+        || 0 == raw[2]) {
+      continue;
+    }
+    values[ii] = (double) raw[0] * ((double) raw[1] / (double) raw[2]);
+  }
+} /* bench_counters_read() */
+
+/* ------------------------------------------------------------------------- */
+
+bool
+bench_counters_is_available (
+  const bench_counters_t   *counters,
+  bench_counter_id_t        id
+) {
+  return (0 <= counters->fds[id]);
+} /* bench_counters_is_available() */
+
+/* ------------------------------------------------------------------------- */
+
+const char *
+bench_counter_name (
+  bench_counter_id_t    id
+) {
+  return counter_events[id].name;
+} /* bench_counter_name() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+bench_counters_close (
+  bench_counters_t     *counters
+) {
+  int ii;
+
+  for (ii = 0; ii < BENCH_COUNTER_COUNT; ++ii) {
+    if (0 <= counters->fds[ii]) {
+      close(counters->fds[ii]);
+      counters->fds[ii] = -1;
+    }
+  }
+  counters->open_count = 0;
+} /* bench_counters_close() */
+
+/* vi: set et sw=2 ts=2: */
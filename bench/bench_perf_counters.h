@@ -0,0 +1,55 @@
+#ifndef BENCH_PERF_COUNTERS_H
+#define BENCH_PERF_COUNTERS_H
+
+#include <stdbool.h>
+
+/* ========================================================================= */
+/* -- TYPES ---------------------------------------------------------------- */
+/* ========================================================================= */
+
+typedef enum bench_counter_id_e {
+  BENCH_COUNTER_CYCLES,
+  BENCH_COUNTER_INSTRUCTIONS,
+  BENCH_COUNTER_L1D_MISSES,
+  BENCH_COUNTER_LLC_MISSES,
+  BENCH_COUNTER_DTLB_MISSES,
+  BENCH_COUNTER_BRANCH_MISSES,
+  BENCH_COUNTER_COUNT
+} bench_counter_id_t;
+
+/**
+ * Hardware counters of the calling thread, user space only. Each one is
+ * opened on its own, so that a counter the CPU or the kernel does not
+ * offer leaves the others usable; its descriptor is then -1.
+ */
+typedef struct bench_counters_s {
+  int                   fds[BENCH_COUNTER_COUNT];
+  int                   open_count;
+  int                   first_error;
+} bench_counters_t;
+
+/* ========================================================================= */
+/* -- FUNCTION PROTOTYPES -------------------------------------------------- */
+/* ========================================================================= */
+
+/**
+ * Opens and starts every counter available. Returns how many could be
+ * opened; when none could, first_error holds the errno of the first
+ * attempt.
+ */
+int bench_counters_open (bench_counters_t *counters);
+
+/**
+ * Reads the running totals, scaled up for the time the kernel had a
+ * counter multiplexed out. Unavailable counters read as zero.
+ */
+void bench_counters_read (const bench_counters_t *counters,
+  double values[BENCH_COUNTER_COUNT]);
+
+bool bench_counters_is_available (const bench_counters_t *counters,
+  bench_counter_id_t id);
+const char *bench_counter_name (bench_counter_id_t id);
+void bench_counters_close (bench_counters_t *counters);
+
+#endif /* BENCH_PERF_COUNTERS_H */
+/* vi: set et sw=2 ts=2: */
@@ -0,0 +1,706 @@
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/* Public */
+#include "ngds_allocator.h"
+
+/* ========================================================================= */
+/* -- DEFINITIONS ---------------------------------------------------------- */
+/* ========================================================================= */
+
+#define ARENA_ALIGNMENT             16
+
+/* Thread pool size classes: 16 bytes through 64 KiB */
+#define POOL_MIN_SHIFT              4
+#define POOL_MAX_SHIFT              16
+#define POOL_CLASS_COUNT            (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define POOL_MAX_CACHED_BLOCKS      256
+
+#define HUGE_PAGE_THRESHOLD         (NGDS_HUGE_PAGE_SIZE / 2)
+
+/* ========================================================================= */
+/* -- MACROS --------------------------------------------------------------- */
+/* ========================================================================= */
+
+#define ALIGN_UP(n, a)      (((n) + ((a) - 1)) & ~((uintptr_t) (a) - 1))
+#define MIN(x, y)           ((x) < (y) ? (x) : (y))
+
+/* ========================================================================= */
+/* -- TYPES ---------------------------------------------------------------- */
+/* ========================================================================= */
+
+typedef struct ngds_arena_chunk_s ngds_arena_chunk_t;
+typedef struct ngds_pool_block_s ngds_pool_block_t;
+typedef struct ngds_pool_cache_s ngds_pool_cache_t;
+typedef struct ngds_huge_mapping_s ngds_huge_mapping_t;
+
+struct ngds_arena_chunk_s {
+  ngds_arena_chunk_t         *next;
+  size_t                      size;
+  size_t                      used;
+  size_t                      pad;
+  char                        data[];
+};
+
+struct ngds_arena_s {
+  ngds_arena_chunk_t         *head;
+  size_t                      chunk_size;
+  void                       *last;
+  ngds_allocator_t            allocator;
+};
+
+struct ngds_pool_block_s {
+  ngds_pool_block_t          *next;
+};
+
+/* A thread's cached blocks, handed back to the heap when the thread exits */
+struct ngds_pool_cache_s {
+  ngds_pool_block_t          *free_list[POOL_CLASS_COUNT];
+  unsigned int                cached_count[POOL_CLASS_COUNT];
+  int                         is_registered;
+};
+
+/*
+ * A block the huge page allocator mapped itself. Large blocks can also come
+ * from the heap, when they need more than huge page alignment, so frees
+ * look blocks up here to tell which way to release them.
+ */
+struct ngds_huge_mapping_s {
+  ngds_huge_mapping_t        *next;
+  void                       *address;
+  size_t                      length;
+};
+
+/* ========================================================================= */
+/* -- STATIC DATA ---------------------------------------------------------- */
+/* ========================================================================= */
+
+static __thread ngds_pool_cache_t   pool_cache;
+static pthread_key_t                pool_cache_key;
+static pthread_once_t               pool_cache_key_once = PTHREAD_ONCE_INIT;
+
+static ngds_huge_mapping_t         *huge_mappings;
+static pthread_mutex_t              huge_mappings_lock =
+                                      PTHREAD_MUTEX_INITIALIZER;
+
+/* ========================================================================= */
+/* -- STATIC FUNCTIONS ----------------------------------------------------- */
+/* ========================================================================= */
+
+static void *
+heap_malloc (
+  void                       *context,
+  size_t                      size
+) {
+  (void) context;
+  return malloc(size);
+} /* heap_malloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+heap_realloc (
+  void                       *context,
+  void                       *ptr,
+  size_t                      old_size,
+  size_t                      new_size
+) {
+  (void) context;
+  (void) old_size;
+  return realloc(ptr, new_size);
+} /* heap_realloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+heap_aligned_alloc (
+  void                       *context,
+  size_t                      alignment,
+  size_t                      size
+) {
+  void *ptr;
+
+  (void) context;
+  if (alignment < sizeof(void *)) {
+    alignment = sizeof(void *);
+  }
+  if (0 != posix_memalign(&ptr, alignment, size)) {
+    return NULL;
+  }
+  return ptr;
+} /* heap_aligned_alloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+heap_free (
+  void                       *context,
+  void                       *ptr,
+  size_t                      size
+) {
+  (void) context;
+  (void) size;
+  free(ptr);
+} /* heap_free() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+pool_size_class (
+  size_t                      size
+) {
+  int shift = POOL_MIN_SHIFT;
+
+  while (shift <= POOL_MAX_SHIFT && ((size_t) 1 << shift) < size) {
+    ++shift;
+  }
+
+  return (shift <= POOL_MAX_SHIFT) ? (shift - POOL_MIN_SHIFT) : -1;
+} /* pool_size_class() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+pool_cache_release (
+  void                       *arg
+) {
+  ngds_pool_cache_t  *cache = arg;
+  int                 cls;
+
+  for (cls = 0; cls < POOL_CLASS_COUNT; ++cls) {
+    while (NULL != cache->free_list[cls]) {
+      ngds_pool_block_t *next = cache->free_list[cls]->next;
+      free(cache->free_list[cls]);
+      cache->free_list[cls] = next;
+    }
+    cache->cached_count[cls] = 0;
+  }
+  cache->is_registered = 0;
+} /* pool_cache_release() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+pool_cache_create_key (void) {
+  if (0 != pthread_key_create(&pool_cache_key, pool_cache_release)) {
+    assert(0);
+  }
+} /* pool_cache_create_key() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Arranges for the calling thread's cache to be released when it exits.
+ * Returns 0 when that is in place, -1 when the thread should not cache.
+ */
+static int
+pool_cache_register (void) {
+  if (0 != pool_cache.is_registered) {
+    return 0;
+  }
+
+  pthread_once(&pool_cache_key_once, pool_cache_create_key);
+  if (0 != pthread_setspecific(pool_cache_key, &pool_cache)) {
+    return -1;
+  }
+  pool_cache.is_registered = 1;
+
+  return 0;
+} /* pool_cache_register() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+pool_malloc (
+  void                       *context,
+  size_t                      size
+) {
+  ngds_pool_block_t  *block;
+  int                 cls = pool_size_class(size);
+
+  (void) context;
+
+  if (-1 == cls) {
+    return malloc(size);
+  }
+
+  block = pool_cache.free_list[cls];
+  if (NULL != block) {
+    pool_cache.free_list[cls] = block->next;
+    --pool_cache.cached_count[cls];
+    return block;
+  }
+
+  return malloc((size_t) 1 << (cls + POOL_MIN_SHIFT));
+} /* pool_malloc() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Blocks go back on the freeing thread's list, whichever thread they came
+ * from; once a class holds enough cached blocks the rest go to the heap,
+ * and so does the whole list when the thread exits.
+ */
+static void
+pool_free (
+  void                       *context,
+  void                       *ptr,
+  size_t                      size
+) {
+  ngds_pool_block_t  *block = ptr;
+  int                 cls = pool_size_class(size);
+
+  (void) context;
+
+  if (NULL == ptr) {
+    return;
+  }
+
+  if (-1 == cls || POOL_MAX_CACHED_BLOCKS <= pool_cache.cached_count[cls]
+      || 0 != pool_cache_register()) {
+    free(ptr);
+    return;
+  }
+
+  block->next = pool_cache.free_list[cls];
+  pool_cache.free_list[cls] = block;
+  ++pool_cache.cached_count[cls];
+} /* pool_free() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+pool_realloc (
+  void                       *context,
+  void                       *ptr,
+  size_t                      old_size,
+  size_t                      new_size
+) {
+  void *new_ptr;
+  int   old_cls = pool_size_class(old_size);
+  int   new_cls = pool_size_class(new_size);
+
+  if (NULL == ptr) {
+    return pool_malloc(context, new_size);
+  }
+
+  if (-1 != old_cls && old_cls == new_cls) {
+    return ptr;
+  }
+  if (-1 == old_cls && -1 == new_cls) {
+    return realloc(ptr, new_size);
+  }
+
+  new_ptr = pool_malloc(context, new_size);
+  if (NULL != new_ptr) {
+    memcpy(new_ptr, ptr, MIN(old_size, new_size));
+    pool_free(context, ptr, old_size);
+  }
+  return new_ptr;
+} /* pool_realloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+pool_aligned_alloc (
+  void                       *context,
+  size_t                      alignment,
+  size_t                      size
+) {
+  int cls = pool_size_class(size);
+
+  if (alignment <= ARENA_ALIGNMENT) {
+    return pool_malloc(context, size);
+  }
+
+  /* Round up to the class size so the block can be cached once freed */
+  if (-1 != cls) {
+    size = (size_t) 1 << (cls + POOL_MIN_SHIFT);
+  }
+  return heap_aligned_alloc(context, alignment, size);
+} /* pool_aligned_alloc() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Returns the mapping record of ptr, unlinked from the list when is_unlink */
+static ngds_huge_mapping_t *
+huge_page_find (
+  void                       *ptr,
+  int                         is_unlink
+) {
+  ngds_huge_mapping_t **link;
+  ngds_huge_mapping_t  *mapping;
+
+  pthread_mutex_lock(&huge_mappings_lock);
+  for (link = &huge_mappings; NULL != *link; link = &(*link)->next) {
+    if (ptr == (*link)->address) {
+      break;
+    }
+  }
+  mapping = *link;
+  if (NULL != mapping && 0 != is_unlink) {
+    *link = mapping->next;
+  }
+  pthread_mutex_unlock(&huge_mappings_lock);
+
+  return mapping;
+} /* huge_page_find() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+huge_page_map (
+  size_t                      size
+) {
+  size_t               length = ALIGN_UP(size, NGDS_HUGE_PAGE_SIZE);
+  ngds_huge_mapping_t *mapping;
+  char                *raw;
+  char                *aligned;
+
+  mapping = malloc(sizeof(ngds_huge_mapping_t));
+  if (NULL == mapping) {
+    return NULL;
+  }
+
+  /* Over-map by one huge page, then trim both ends to a 2 MiB boundary */
+  raw = mmap(NULL, (length + NGDS_HUGE_PAGE_SIZE), (PROT_READ | PROT_WRITE),
+    (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0);
+  if (MAP_FAILED == raw) {
+    free(mapping);
+    return NULL;
+  }
+
+  aligned = (char *) ALIGN_UP((uintptr_t) raw, NGDS_HUGE_PAGE_SIZE);
+  if (aligned != raw) {
+    munmap(raw, (aligned - raw));
+  }
+  munmap((aligned + length), (NGDS_HUGE_PAGE_SIZE - (aligned - raw)));
+
+#ifdef MADV_HUGEPAGE
+  madvise(aligned, length, MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+
+  mapping->address = aligned;
+  mapping->length = length;
+  pthread_mutex_lock(&huge_mappings_lock);
+  mapping->next = huge_mappings;
+  huge_mappings = mapping;
+  pthread_mutex_unlock(&huge_mappings_lock);
+
+  return aligned;
+} /* huge_page_map() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+huge_page_malloc (
+  void                       *context,
+  size_t                      size
+) {
+  (void) context;
+  return (size >= HUGE_PAGE_THRESHOLD) ? huge_page_map(size) : malloc(size);
+} /* huge_page_malloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+huge_page_free (
+  void                       *context,
+  void                       *ptr,
+  size_t                      size
+) {
+  ngds_huge_mapping_t *mapping = NULL;
+
+  (void) context;
+
+  if (NULL == ptr) {
+    return;
+  }
+
+  if (size >= HUGE_PAGE_THRESHOLD) {
+    mapping = huge_page_find(ptr, 1);
+  }
+  if (NULL != mapping) {
+    munmap(ptr, mapping->length);
+    free(mapping);
+  } else {
+    free(ptr);
+  }
+} /* huge_page_free() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+huge_page_realloc (
+  void                       *context,
+  void                       *ptr,
+  size_t                      old_size,
+  size_t                      new_size
+) {
+  ngds_huge_mapping_t *mapping = NULL;
+  void                *new_ptr;
+
+  if (NULL == ptr) {
+    return huge_page_malloc(context, new_size);
+  }
+
+  if (old_size >= HUGE_PAGE_THRESHOLD) {
+    mapping = huge_page_find(ptr, 0);
+  }
+  if (NULL == mapping && new_size < HUGE_PAGE_THRESHOLD) {
+    return realloc(ptr, new_size);
+  }
+  if (NULL != mapping && new_size >= HUGE_PAGE_THRESHOLD
+      && ALIGN_UP(new_size, NGDS_HUGE_PAGE_SIZE) == mapping->length) {
+    return ptr;
+  }
+
+  new_ptr = huge_page_malloc(context, new_size);
+  if (NULL != new_ptr) {
+    memcpy(new_ptr, ptr, MIN(old_size, new_size));
+    huge_page_free(context, ptr, old_size);
+  }
+  return new_ptr;
+} /* huge_page_realloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+huge_page_aligned_alloc (
+  void                       *context,
+  size_t                      alignment,
+  size_t                      size
+) {
+  if (size >= HUGE_PAGE_THRESHOLD && alignment <= NGDS_HUGE_PAGE_SIZE) {
+    return huge_page_map(size);
+  }
+  return heap_aligned_alloc(context, alignment, size);
+} /* huge_page_aligned_alloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+arena_aligned_alloc (
+  void                       *context,
+  size_t                      alignment,
+  size_t                      size
+) {
+  ngds_arena_t        *arena = context;
+  ngds_arena_chunk_t  *chunk = arena->head;
+  uintptr_t            start;
+  size_t               length;
+
+  if (alignment < ARENA_ALIGNMENT) {
+    alignment = ARENA_ALIGNMENT;
+  }
+
+  if (NULL != chunk) {
+    start = ALIGN_UP((uintptr_t) (chunk->data + chunk->used), alignment);
+    if ((start + size) <= (uintptr_t) (chunk->data + chunk->size)) {
+      chunk->used = (start + size) - (uintptr_t) chunk->data;
+      arena->last = (void *) start;
+      return arena->last;
+    }
+  }
+
+  length = size + alignment;
+  if (length < arena->chunk_size) {
+    length = arena->chunk_size;
+  }
+
+  chunk = malloc(sizeof(*chunk) + length);
+  if (NULL == chunk) {
+    return NULL;
+  }
+
+  chunk->size = length;
+  start = ALIGN_UP((uintptr_t) chunk->data, alignment);
+  chunk->used = (start + size) - (uintptr_t) chunk->data;
+  chunk->next = arena->head;
+  arena->head = chunk;
+  arena->last = (void *) start;
+
+  return arena->last;
+} /* arena_aligned_alloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+arena_malloc (
+  void                       *context,
+  size_t                      size
+) {
+  return arena_aligned_alloc(context, ARENA_ALIGNMENT, size);
+} /* arena_malloc() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Only the most recent allocation can give its space back.
+ */
+static void
+arena_free (
+  void                       *context,
+  void                       *ptr,
+  size_t                      size
+) {
+  ngds_arena_t *arena = context;
+
+  if (NULL != ptr && ptr == arena->last
+      && ((char *) ptr + size) == (arena->head->data + arena->head->used)) {
+    arena->head->used -= size;
+    arena->last = NULL;
+  }
+} /* arena_free() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+arena_realloc (
+  void                       *context,
+  void                       *ptr,
+  size_t                      old_size,
+  size_t                      new_size
+) {
+  ngds_arena_t  *arena = context;
+  void          *new_ptr;
+
+  if (NULL == ptr) {
+    return arena_malloc(context, new_size);
+  }
+
+  /* Grow or shrink the most recent allocation in place */
+  if (ptr == arena->last
+      && ((char *) ptr + old_size) == (arena->head->data + arena->head->used)
+      && ((char *) ptr + new_size) <= (arena->head->data + arena->head->size)) {
+    arena->head->used = ((char *) ptr + new_size) - arena->head->data;
+    return ptr;
+  }
+
+  if (new_size <= old_size) {
+    return ptr;
+  }
+
+  new_ptr = arena_malloc(context, new_size);
+  if (NULL != new_ptr) {
+    memcpy(new_ptr, ptr, old_size);
+  }
+  return new_ptr;
+} /* arena_realloc() */
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTIONS ----------------------------------------------------- */
+/* ========================================================================= */
+
+const ngds_allocator_t *
+ngds_allocator_heap (void) {
+  static const ngds_allocator_t heap = {
+    NULL, heap_malloc, heap_realloc, heap_aligned_alloc, heap_free
+  };
+  return &heap;
+} /* ngds_allocator_heap() */
+
+/* ------------------------------------------------------------------------- */
+
+const ngds_allocator_t *
+ngds_allocator_thread_pool (void) {
+  static const ngds_allocator_t pool = {
+    NULL, pool_malloc, pool_realloc, pool_aligned_alloc, pool_free
+  };
+  return &pool;
+} /* ngds_allocator_thread_pool() */
+
+/* ------------------------------------------------------------------------- */
+
+const ngds_allocator_t *
+ngds_allocator_huge_page (void) {
+  static const ngds_allocator_t huge_page = {
+    NULL, huge_page_malloc, huge_page_realloc, huge_page_aligned_alloc,
+    huge_page_free
+  };
+  return &huge_page;
+} /* ngds_allocator_huge_page() */
+
+/* ------------------------------------------------------------------------- */
+
+ngds_arena_t *
+ngds_arena_new (
+  size_t                      chunk_size
+) {
+  ngds_arena_t *arena;
+
+  arena = malloc(sizeof(ngds_arena_t));
+  if (NULL == arena) {
+    return NULL;
+  }
+
+  memset(arena, 0, sizeof(ngds_arena_t));
+  arena->chunk_size = chunk_size;
+  arena->allocator.context = arena;
+  arena->allocator.malloc = arena_malloc;
+  arena->allocator.realloc = arena_realloc;
+  arena->allocator.aligned_alloc = arena_aligned_alloc;
+  arena->allocator.free = arena_free;
+
+  return arena;
+} /* ngds_arena_new() */
+
+/* ------------------------------------------------------------------------- */
+
+const ngds_allocator_t *
+ngds_arena_allocator (
+  ngds_arena_t               *arena
+) {
+  return &arena->allocator;
+} /* ngds_arena_allocator() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Keeps the most recent chunk for reuse and releases all others.
+ */
+void
+ngds_arena_reset (
+  ngds_arena_t               *arena
+) {
+  ngds_arena_chunk_t *chunk;
+
+  if (NULL == arena->head) {
+    return;
+  }
+
+  chunk = arena->head->next;
+  while (NULL != chunk) {
+    ngds_arena_chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  arena->head->next = NULL;
+  arena->head->used = 0;
+  arena->last = NULL;
+} /* ngds_arena_reset() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_arena_destroy (
+  ngds_arena_t               *arena
+) {
+  while (NULL != arena->head) {
+    ngds_arena_chunk_t *next = arena->head->next;
+    free(arena->head);
+    arena->head = next;
+  }
+  free(arena);
+} /* ngds_arena_destroy() */
+
+/* vi: set et sw=2 ts=2: */
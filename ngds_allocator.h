@@ -0,0 +1,78 @@
+#ifndef NGDS_ALLOCATOR_H
+#define NGDS_ALLOCATOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* ========================================================================= */
+/* -- DEFINITIONS ---------------------------------------------------------- */
+/* ========================================================================= */
+
+#define NGDS_CACHE_LINE_SIZE        64
+#define NGDS_HUGE_PAGE_SIZE         (2 * 1024 * 1024)
+
+/* ========================================================================= */
+/* -- OPAQUE TYPES --------------------------------------------------------- */
+/* ========================================================================= */
+
+typedef struct ngds_arena_s ngds_arena_t;
+
+/* ========================================================================= */
+/* -- TYPES ---------------------------------------------------------------- */
+/* ========================================================================= */
+
+/**
+ * Allocator interface. Every entry point receives the context it was
+ * registered with. Sizes are passed back on realloc and free, so that
+ * backends need not keep per-block headers. Memory from aligned_alloc
+ * is released through free like any other block.
+ */
+typedef struct ngds_allocator_s {
+  void                 *context;
+  void               *(*malloc) (void *context, size_t size);
+  void               *(*realloc) (void *context, void *ptr, size_t old_size,
+                          size_t new_size);
+  void               *(*aligned_alloc) (void *context, size_t alignment,
+                          size_t size);
+  void                (*free) (void *context, void *ptr, size_t size);
+} ngds_allocator_t;
+
+/* ========================================================================= */
+/* -- FUNCTION PROTOTYPES -------------------------------------------------- */
+/* ========================================================================= */
+
+/**
+ * The process heap: malloc, realloc, posix_memalign and free.
+ */
+const ngds_allocator_t *ngds_allocator_heap (void);
+
+/**
+ * Power-of-two size classes up to 64 KiB, cached on per-thread free
+ * lists. Larger requests go straight to the heap.
+ */
+const ngds_allocator_t *ngds_allocator_thread_pool (void);
+
+/**
+ * Requests of at least half a huge page are mapped on 2 MiB boundaries
+ * and advised for transparent huge pages; smaller ones use the heap.
+ */
+const ngds_allocator_t *ngds_allocator_huge_page (void);
+
+/**
+ * Bump allocation out of chunks of at least chunk_size bytes. Individual
+ * frees are ignored; everything is released by reset or destroy.
+ */
+ngds_arena_t *ngds_arena_new (size_t chunk_size);
+const ngds_allocator_t *ngds_arena_allocator (ngds_arena_t *arena);
+void ngds_arena_reset (ngds_arena_t *arena);
+void ngds_arena_destroy (ngds_arena_t *arena);
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif /* NGDS_ALLOCATOR_H */
+/* vi: set et sw=2 ts=2: */
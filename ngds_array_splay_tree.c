@@ -7,6 +7,22 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#endif
+#if !defined(NGDS_ARRAY_SPLAY_TREE_WITHOUT_PROBES) && defined(__has_include)
+# if __has_include(<sys/sdt.h>)
+#  include <sys/sdt.h>
+#  define NGDS_ARRAY_SPLAY_TREE_HAS_PROBES
+# endif
+#endif
 
 /* Public */
 #include "ngds_array_splay_tree.h"
@@ -24,6 +40,35 @@
 # define NG_SPLAY_ROOT_INDEX    1
 #endif /* NG_SPLAY_ARRAY_HAS_ZERO_INDEX_ROOT */
 
+/*
+ * Adaptive splaying scores a regime as its hit depth plus the nodes it
+ * moves per operation, weighted in descent steps. The newest epoch gets
+ * half the weight of the moving averages, and the settled regime is only
+ * replaced by one at least 10% cheaper. The regime with the oldest
+ * estimate is retried every so many epochs, twice as long after every
+ * retry that changes nothing, as trying a bad regime can be costly. A
+ * retry that leaves the hits of a regime not splaying 2% deeper than
+ * before is undone by rebuilding the tree.
+ */
+#define ADAPTIVE_MOVE_COST              0.25
+#define ADAPTIVE_SMOOTHING              0.5
+#define ADAPTIVE_HYSTERESIS             0.10
+#define ADAPTIVE_TRIAL_TOLERANCE        0.02
+#define ADAPTIVE_EXPLORE_INTERVAL       16
+#define ADAPTIVE_MAX_EXPLORE_INTERVAL   4096
+
+/* Slots the lazy expiry sweep looks at on every insert */
+#define CACHE_SWEEP_SLOTS               4
+
+/* Levels a preloaded hot set may add to the height of a balanced tree */
+#define HOT_SET_EXTRA_LEVELS            1
+
+/* Levels splaying and inserting may add to the height of a balanced tree */
+#define SPARE_LEVELS                    4
+
+/* Levels a splaying regime on trial may add, as the array never shrinks */
+#define TRIAL_SPARE_LEVELS              1
+
 /* ========================================================================= */
 /* -- MACROS --------------------------------------------------------------- */
 /* ========================================================================= */
@@ -31,6 +76,12 @@
 #define max(x,y) ((x) < (y) ? (y) : (x))
 #define NODE_IS_EMPTY(me, index)    (NULL == (&me->node_array[index])->key)
 #define NODE_IS_VALID(me, index)    (index < me->allocated_element_count)
+#define NODE_IS_PRESENT(me, index)  (NODE_IS_VALID(me, index)             \
+                                      && false == NODE_IS_EMPTY(me, index))
+#define NODE_IS_TOMBSTONE(me, index)                                      \
+  (NULL != (me)->tombstones && 0 != (me)->tombstones[index])
+#define LIVE_ELEMENT_COUNT(me)                                            \
+  ((me)->utilized_element_count - (me)->tombstone_count)
 
 /* Bitset */
 #define BITMASK(b)          (1 << ((b) % sizeof(uint64_t)))
@@ -40,6 +91,92 @@
 #define BITTEST(a, b)       ((a)[BITSLOT(b)] & BITMASK(b))
 #define BITNSLOTS(nb)       ((nb + sizeof(uint64_t) - 1) / sizeof(uint64_t))
 
+/* File layout */
+#define FILE_ALIGNMENT      64
+#define PAYLOAD_ALIGNMENT   16
+#define ALIGN_UP(n, a)      (((n) + ((a) - 1)) & ~((uint64_t) (a) - 1))
+
+/* Byte size of a node array holding n slots */
+#define NODE_ARRAY_SIZE(n)  ((size_t) (n) * sizeof(ngds_array_splay_tree_node_t))
+
+/* Checkpoints track modifications at page granularity */
+#define CHECKPOINT_PAGE_SIZE        4096
+#define NODES_PER_PAGE              \
+  (CHECKPOINT_PAGE_SIZE / sizeof(ngds_array_splay_tree_node_t))
+#define PAGE_COUNT(me)              \
+  (((me)->allocated_element_count + NODES_PER_PAGE - 1) / NODES_PER_PAGE)
+
+/* Tree-owned keys and values */
+#define SLAB_CHUNK_SIZE             (64 * 1024)
+#define KEY_IS_INLINE(me)           \
+  (0 < (me)->key_size && sizeof(void *) > (me)->key_size)
+#define VALUE_IS_INLINE(me)         \
+  (0 < (me)->value_size && sizeof(void *) >= (me)->value_size)
+
+/* Operation counters compile out unless NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_STATS
+# define STATS_ADD(me, counter, n)  ((me)->stats.counter += (n))
+# define STATS_MAX(me, counter, n)  do {                                  \
+    if ((me)->stats.counter < (uint64_t) (n)) {                           \
+      (me)->stats.counter = (n);                                          \
+    }                                                                     \
+  } while (0)
+#else /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+# define STATS_ADD(me, counter, n)  ((void) 0)
+# define STATS_MAX(me, counter, n)  ((void) 0)
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+#define STATS_INC(me, counter)      STATS_ADD(me, counter, 1)
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_STATS
+# define HISTOGRAM_RECORD(me, id, value)                                  \
+  histogram_record((me), NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_##id, (value))
+#else /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+# define HISTOGRAM_RECORD(me, id, value)  ((void) 0)
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+
+/* Phase hooks compile out unless NGDS_ARRAY_SPLAY_TREE_WITH_PHASE_HOOKS */
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_PHASE_HOOKS
+# define PHASE_HOOK(me, phase, is_begin)  do {                            \
+    if (NULL != (me)->phase_hook) {                                       \
+      (me)->phase_hook((me)->phase_hook_context,                          \
+        NGDS_ARRAY_SPLAY_TREE_PHASE_##phase, (is_begin));                 \
+    }                                                                     \
+  } while (0)
+#else /* NGDS_ARRAY_SPLAY_TREE_WITH_PHASE_HOOKS */
+# define PHASE_HOOK(me, phase, is_begin)  ((void) 0)
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_PHASE_HOOKS */
+#define PHASE_BEGIN(me, phase)      PHASE_HOOK(me, phase, true)
+#define PHASE_END(me, phase)        PHASE_HOOK(me, phase, false)
+
+/*
+ * Static probes of the ngds provider. With <sys/sdt.h> each one is a nop
+ * plus an ELF note that bpftrace or perf can attach to, so they are built
+ * in unless NGDS_ARRAY_SPLAY_TREE_WITHOUT_PROBES is defined.
+ */
+#ifdef NGDS_ARRAY_SPLAY_TREE_HAS_PROBES
+# define PROBE2(name, a, b)         STAP_PROBE2(ngds, name, a, b)
+# define PROBE3(name, a, b, c)      STAP_PROBE3(ngds, name, a, b, c)
+# define PROBE4(name, a, b, c, d)   STAP_PROBE4(ngds, name, a, b, c, d)
+#else /* NGDS_ARRAY_SPLAY_TREE_HAS_PROBES */
+# define PROBE2(name, a, b)         ((void) (a), (void) (b))
+# define PROBE3(name, a, b, c)      ((void) (a), (void) (b), (void) (c))
+# define PROBE4(name, a, b, c, d)   \
+  ((void) (a), (void) (b), (void) (c), (void) (d))
+#endif /* NGDS_ARRAY_SPLAY_TREE_HAS_PROBES */
+
+/* Samples for the profiler; depth is -1 for misses */
+#define PROFILE_SAMPLE(me, key, depth)  do {                              \
+    if (NULL != (me)->profiler && 0 == --(me)->profiler->countdown) {     \
+      profile_sample((me), (key), (depth));                               \
+    }                                                                     \
+  } while (0)
+
+#define TRACE_RECORD(me, operation, key, should_perform_splay)  do {      \
+    if (NULL != (me)->trace) {                                            \
+      trace_record((me), NGDS_TRACE_##operation, (key),                   \
+        (should_perform_splay));                                          \
+    }                                                                     \
+  } while (0)
+
 /* ========================================================================= */
 /* -- FORWARD DECLARATIONS ------------------------------------------------- */
 /* ========================================================================= */
@@ -47,8 +184,36 @@
 static inline int left_child_of (const int);
 static inline int right_child_of (const int);
 static inline int parent_of (const int);
+static inline int depth_of (const int);
+static inline int subtree_side_of (const int, const int);
+static inline void *node_key (const ngds_array_splay_tree_t *,
+  const ngds_array_splay_tree_node_t *);
+static inline void *node_value (const ngds_array_splay_tree_t *,
+  const ngds_array_splay_tree_node_t *);
+static bool promote_mapped_node_array (ngds_array_splay_tree_t *);
+static bool resize_node_array (ngds_array_splay_tree_t *, int);
+static bool grow_node_array (ngds_array_splay_tree_t *);
+static int64_t levels_limit (const ngds_array_splay_tree_t *, int);
+static int64_t deepening_limit (const ngds_array_splay_tree_t *);
+static bool deepen_node_array (ngds_array_splay_tree_t *, int64_t);
+static inline void mark_dirty (ngds_array_splay_tree_t *, int);
+static inline void node_copy (ngds_array_splay_tree_t *, int, int);
+static inline void node_clear (ngds_array_splay_tree_t *, int);
+static inline void node_set (ngds_array_splay_tree_t *, int, void *, void *);
 static void perform_tree_print (ngds_array_splay_tree_t *,
   ngds_node_printer, int, int);
+static void profile_sample (ngds_array_splay_tree_t *, const void *, int);
+static int perform_splay_operation (ngds_array_splay_tree_t *, int);
+static bool evict_node_at (ngds_array_splay_tree_t *, int);
+static bool expire_if_due (ngds_array_splay_tree_t *, int);
+static void sweep_expired (ngds_array_splay_tree_t *);
+static int find_cold_leaf (ngds_array_splay_tree_t *);
+static inline int balanced_levels (int);
+static bool rebuild_scapegoat (ngds_array_splay_tree_t *, int);
+static bool rebuild_live_nodes (ngds_array_splay_tree_t *);
+static bool compact_tombstones (ngds_array_splay_tree_t *);
+static inline int descend_from (ngds_array_splay_tree_t *, const void *,
+  uint64_t, int);
 
 /* ========================================================================= */
 /* -- STATIC FUNCTIONS ----------------------------------------------------- */
@@ -98,500 +263,5520 @@ parent_of (
 
 /* ------------------------------------------------------------------------- */
 
-static void
-perform_tree_print (
-  ngds_array_splay_tree_t    *me,
-  ngds_node_printer           print_cb,
-  int                         idx,
-  int                         d
+/*
+ * Number of edges between idx and the root.
+ */
+static inline int
+depth_of (
+  const int             idx
 ) {
-  int ii;
+  return (31 - __builtin_clz((unsigned int) (idx + (1 - NG_SPLAY_ROOT_INDEX))));
+} /* depth_of() */
 
-  for (ii = 0; ii < d; ++ii) {
-    printf("  ");
-  }
+/* ------------------------------------------------------------------------- */
 
-  printf("[%d] %c ", idx,
-#ifdef NG_SPLAY_ARRAY_HAS_ZERO_INDEX_ROOT
-    (1 == (idx % 2))
-#else /* NG_SPLAY_ARRAY_HAS_ZERO_INDEX_ROOT */
-    (0 == (idx % 2))
-#endif /* NG_SPLAY_ARRAY_HAS_ZERO_INDEX_ROOT */
-    ? 'l' : 'r');
+/*
+ * Tells which half of the subtree at idx holds descendant_idx: negative for
+ * the left, positive for the right and zero when it is not below idx at all.
+ */
+static inline int
+subtree_side_of (
+  const int             idx,
+  const int             descendant_idx
+) {
+  unsigned int  ancestor = (unsigned int) (idx + (1 - NG_SPLAY_ROOT_INDEX));
+  unsigned int  node = (unsigned int) (descendant_idx + (1 - NG_SPLAY_ROOT_INDEX));
+  int           distance = (__builtin_clz(ancestor) - __builtin_clz(node));
 
-  if (me->allocated_element_count <= idx
-      || NULL == me->node_array[idx].key
-  ) {
-    printf("\n");
-    return;
+  if (0 >= distance || ancestor != (node >> distance)) {
+    return 0;
   }
 
-  if (NULL != print_cb) {
-    print_cb(&me->node_array[idx]);
-  } else {
-    printf("%p", me->node_array[idx].key);
-  }
-  printf("\n");
+  return ((node >> (distance - 1)) & 1) ? 1 : -1;
+} /* subtree_side_of() */
 
-  perform_tree_print(me, print_cb, left_child_of(idx), (d + 1));
-  perform_tree_print(me, print_cb, right_child_of(idx), (d + 1));
+/* ------------------------------------------------------------------------- */
 
-} /* perform_tree_print() */
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_STATS
 
-/* ------------------------------------------------------------------------- */
+/* Round-robin shard of the calling thread, assigned on first use */
+static __thread int   histogram_shard = -1;
+static int            next_histogram_shard = 0;
 
-#if 0
-static void
-__enlarge (
-  ngds_array_splay_tree_t *me
-) {
-  int ii, end;
-  ngds_array_splay_tree_node_t *array_n;
-
-printf("enlarging\n");
-  /* double capacity */
-  me->allocated_element_count *= 2;
-  array_n = calloc(me->allocated_element_count, sizeof(ngds_array_splay_tree_node_t));
-
-  /* copy old data across to new array */
-/* FIX FOR START */
-  for (ii = NG_SPLAY_ROOT_INDEX, end = ngds_array_splay_tree_cardinality(me)
-      ; ii < end
-      ; ii++
-  ) {
-    if (me->node_array[ii].key) {
-      memcpy(&array_n[ii], &me->node_array[ii], sizeof(ngds_array_splay_tree_node_t));
-    } else {
-      array_n[ii].key = NULL;
-    }
-  }
+static inline uint64_t
+read_cycle_counter (void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else /* __x86_64__ || __i386__ */
+  struct timespec ts;
 
-  /* swap arrays */
-  free(me->node_array);
-  me->node_array = array_n;
-}
-#endif
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+#endif /* __x86_64__ || __i386__ */
+} /* read_cycle_counter() */
 
 /* ------------------------------------------------------------------------- */
 
-static void
-perform_upward_shift (
-  ngds_array_splay_tree_t    *me,
-  int                         src_idx,
-  int                         dst_idx
+static inline void
+histogram_record (
+  ngds_array_splay_tree_t              *me,
+  ngds_array_splay_tree_histogram_id_t  id,
+  uint64_t                              value
 ) {
-  if (false == NODE_IS_VALID(me, src_idx)) {
-    printf("%s/%d: From node index (%d) is invalid\n",
-      __PRETTY_FUNCTION__, __LINE__, src_idx);
-    return;
+  ngds_array_splay_tree_histogram_shard_t *shard;
+  int                                      bucket = 0;
+
+  if (0 > histogram_shard) {
+    histogram_shard = __atomic_fetch_add(&next_histogram_shard, 1,
+      __ATOMIC_RELAXED) % NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_SHARDS;
   }
-  if (false == NODE_IS_VALID(me, dst_idx)) {
-    printf("%s/%d: To node index (%d) is invalid\n",
-      __PRETTY_FUNCTION__, __LINE__, dst_idx);
-    return;
+  if (0 != value) {
+    bucket = 64 - __builtin_clzll(value);
+    if (bucket >= NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_BUCKETS) {
+      bucket = NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_BUCKETS - 1;
+    }
   }
 
-  if (true == NODE_IS_EMPTY(me, src_idx)) {
-    return;
-  }
+  /* Shards are only shared once there are more threads than shards */
+  shard = &me->histogram_shards[histogram_shard];
+  __atomic_fetch_add(&shard->buckets[id][bucket], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&shard->sums[id], value, __ATOMIC_RELAXED);
+} /* histogram_record() */
 
-  memcpy(&me->node_array[dst_idx], &me->node_array[src_idx],
-    sizeof(ngds_array_splay_tree_node_t));
-  memset(&me->node_array[src_idx], 0, sizeof(ngds_array_splay_tree_node_t));
+/* ------------------------------------------------------------------------- */
 
-  perform_upward_shift(me, left_child_of(src_idx), left_child_of(dst_idx));
-  perform_upward_shift(me, right_child_of(src_idx), right_child_of(dst_idx));
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
 
-} /* perform_upward_shift() */
+static inline void *
+tree_malloc (
+  ngds_array_splay_tree_t    *me,
+  size_t                      size
+) {
+  return me->allocator.malloc(me->allocator.context, size);
+} /* tree_malloc() */
 
 /* ------------------------------------------------------------------------- */
 
-static int
-perform_downward_shift (
+static inline void *
+tree_realloc (
   ngds_array_splay_tree_t    *me,
-  int                         src_idx,
-  int                         dst_idx,
-  int                         depth
+  void                       *ptr,
+  size_t                      old_size,
+  size_t                      new_size
 ) {
-  if (0 == depth) {
-    memset(me->shifted_element_bitmap, 0,
-      me->shifted_element_bitmap_size_in_bytes);
-  }
-
-  if (false == NODE_IS_VALID(me, src_idx)) {
-    printf("%s/%d: From node index (%d) is invalid\n",
-      __PRETTY_FUNCTION__, __LINE__, src_idx);
-    return -1;
-  }
-  if (false == NODE_IS_VALID(me, dst_idx)) {
-    printf("%s/%d: To node index (%d) is invalid\n",
-      __PRETTY_FUNCTION__, __LINE__, dst_idx);
-    return -1;
-  }
-
-  if (true == NODE_IS_EMPTY(me, src_idx)) {
-    return src_idx;
-  }
-
-  if (BITTEST(me->shifted_element_bitmap, src_idx)) {
-    return src_idx;
-  }
-
-  perform_downward_shift(me, left_child_of(src_idx),
-    left_child_of(dst_idx), (depth + 1));
-  perform_downward_shift(me, right_child_of(src_idx),
-    right_child_of(dst_idx), (depth + 1));
-
-  if (!BITTEST(me->shifted_element_bitmap, src_idx)) {
-    memcpy(&me->node_array[dst_idx], &me->node_array[src_idx],
-      sizeof(ngds_array_splay_tree_node_t));
-    memset(&me->node_array[src_idx], 0, sizeof(ngds_array_splay_tree_node_t));
-    BITSET(me->shifted_element_bitmap, dst_idx);
-  }
-
-} /* perform_downward_shift() */
+  return me->allocator.realloc(me->allocator.context, ptr, old_size,
+    new_size);
+} /* tree_realloc() */
 
 /* ------------------------------------------------------------------------- */
 
-static int
-find_predecessor (
+static inline void *
+tree_aligned_alloc (
   ngds_array_splay_tree_t    *me,
-  int                         idx
+  size_t                      size
 ) {
-  int prev,i;
-
-  for (prev = -1, i = left_child_of(idx)
-        ; i < me->allocated_element_count && me->node_array[i].key
-        ; prev = i, i = right_child_of(i));
-
-  return prev;
-} /* find_predecessor() */
+  return me->allocator.aligned_alloc(me->allocator.context,
+    NGDS_CACHE_LINE_SIZE, size);
+} /* tree_aligned_alloc() */
 
 /* ------------------------------------------------------------------------- */
 
-static void
-perform_splay_operation (
-  ngds_array_splay_tree_t            *me,
-  int                   idx
+static inline void
+tree_free (
+  ngds_array_splay_tree_t    *me,
+  void                       *ptr,
+  size_t                      size
 ) {
-  while (NG_SPLAY_ROOT_INDEX != idx) {
-    int p = parent_of(idx);
-    int gp = 0;
-
-    if (NG_SPLAY_ROOT_INDEX == p) {
-      if (left_child_of(p) == idx) {
-        ngds_array_splay_tree_rotate_right(me, p);
-      } else {
-        ngds_array_splay_tree_rotate_left(me, p);
-      }
-      break;
-    } else {
-      gp = parent_of(p);
-    }
-
-    if (left_child_of(p) == idx && left_child_of(gp) == p) {
-      ngds_array_splay_tree_rotate_right(me, p);
-      ngds_array_splay_tree_rotate_right(me, gp);
-    } else if (right_child_of(p) == idx && right_child_of(gp) == p) {
-      ngds_array_splay_tree_rotate_left(me, p);
-      ngds_array_splay_tree_rotate_left(me, gp);
-    } else if (right_child_of(p) == idx && left_child_of(gp) == p) {
-      ngds_array_splay_tree_rotate_left(me, p);
-      ngds_array_splay_tree_rotate_right(me, gp);
-    } else if (left_child_of(p) == idx && right_child_of(gp) == p) {
-      ngds_array_splay_tree_rotate_right(me, p);
-      ngds_array_splay_tree_rotate_left(me, gp);
-    } else {
-      assert(0);
-    }
-    idx = gp;
-  }
-} /* perform_splay_operation() */
+  me->allocator.free(me->allocator.context, ptr, size);
+} /* tree_free() */
 
-/* ========================================================================= */
-/* -- PRIVATE FUNCTIONS ---------------------------------------------------- */
-/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
 
-int
-ngds_array_splay_tree_rotate_left (
-  ngds_array_splay_tree_t* me,
-  int idx
+/*
+ * Adapters that let plain malloc/free style hooks, as passed to
+ * ngds_array_splay_tree_new(), back the allocator interface. The context
+ * is the tree itself, which remembers the hooks.
+ */
+static void *
+legacy_malloc (
+  void                       *context,
+  size_t                      size
 ) {
-  perform_downward_shift(me, left_child_of(idx),
-    left_child_of(left_child_of(idx)), 0);
-  memcpy(&me->node_array[left_child_of(idx)], &me->node_array[idx],
-    sizeof(ngds_array_splay_tree_node_t));
-  perform_downward_shift(me, left_child_of(right_child_of(idx)),
-    right_child_of(left_child_of(idx)), 0);
-  me->node_array[left_child_of(right_child_of(idx))].key = NULL;
-  perform_upward_shift(me, right_child_of(idx), idx);
+  return ((ngds_array_splay_tree_t *) context)->legacy_malloc(size);
+} /* legacy_malloc() */
 
-  return right_child_of(idx);
+/* ------------------------------------------------------------------------- */
 
-} /* ngds_array_splay_tree_rotate_left() */
+static void
+legacy_free (
+  void                       *context,
+  void                       *ptr,
+  size_t                      size
+) {
+  (void) size;
+  ((ngds_array_splay_tree_t *) context)->legacy_free(ptr);
+} /* legacy_free() */
 
 /* ------------------------------------------------------------------------- */
 
-int
-ngds_array_splay_tree_rotate_right (
-  ngds_array_splay_tree_t* me,
-  int idx
+static void *
+legacy_realloc (
+  void                       *context,
+  void                       *ptr,
+  size_t                      old_size,
+  size_t                      new_size
 ) {
-  perform_downward_shift(me, right_child_of(idx),
-    right_child_of(right_child_of(idx)), 0);
-  memcpy(&me->node_array[right_child_of(idx)], &me->node_array[idx],
-    sizeof(ngds_array_splay_tree_node_t));
-  perform_downward_shift(me, right_child_of(left_child_of(idx)),
-    left_child_of(right_child_of(idx)), 0);
-  me->node_array[right_child_of(left_child_of(idx))].key = NULL;
-  perform_upward_shift(me, left_child_of(idx), idx);
-
-  return left_child_of(idx);
+  void *new_ptr = legacy_malloc(context, new_size);
 
-} /* ngds_array_splay_tree_rotate_right() */
+  if (NULL != new_ptr && NULL != ptr) {
+    memcpy(new_ptr, ptr, ((old_size < new_size) ? old_size : new_size));
+    legacy_free(context, ptr, old_size);
+  }
+  return new_ptr;
+} /* legacy_realloc() */
 
 /* ------------------------------------------------------------------------- */
 
-ngds_array_splay_tree_node_t *
-ngds_array_splay_tree_get_node_at_idx (
-  ngds_array_splay_tree_t    *me,
-  int                         idx
+static void *
+legacy_aligned_alloc (
+  void                       *context,
+  size_t                      alignment,
+  size_t                      size
 ) {
-  return &me->node_array[idx];
-} /* ngds_array_splay_tree_get_node_at_idx() */
+  /* Plain hooks only promise malloc alignment */
+  (void) alignment;
+  return legacy_malloc(context, size);
+} /* legacy_aligned_alloc() */
 
-/* ========================================================================= */
-/* -- PUBLIC FUNCTIONS ----------------------------------------------------- */
-/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
 
-ngds_array_splay_tree_t *
-ngds_array_splay_tree_new (
-  int                   initial_element_count,
-  ngds_comparator_fptr  comparefp,
-  ngds_malloc_fptr      mallocfp,
-  ngds_free_fptr        freefp
+/*
+ * Allocates a tree handle. When either legacy hook is given, the handle
+ * comes from it and both hooks back the allocator; otherwise allocator is
+ * used throughout. The node array is left to the
+ * caller, which either allocates it or points it into a mapping.
+ */
+static ngds_array_splay_tree_t *
+allocate_tree (
+  const ngds_allocator_t     *allocator,
+  ngds_malloc_fptr            mallocfp,
+  ngds_free_fptr              freefp,
+  int                         allocated_element_count,
+  int                         max_element_count,
+  ngds_comparator_fptr        comparefp
 ) {
   ngds_array_splay_tree_t  *me;
 
-  assert((initial_element_count > 0));
-  assert(comparefp);
+  if (NULL != mallocfp || NULL != freefp) {
+    if (NULL == mallocfp) {
+      mallocfp = malloc;
+    }
+    if (NULL == freefp) {
+      freefp = free;
+    }
+    me = mallocfp(sizeof(ngds_array_splay_tree_t));
+  } else {
+    if (NULL == allocator) {
+      allocator = ngds_allocator_heap();
+    }
+    me = allocator->malloc(allocator->context,
+      sizeof(ngds_array_splay_tree_t));
+  }
 
-  if (NULL == mallocfp) {
-    mallocfp = malloc;
+  if (NULL == me) {
+    return NULL;
   }
 
-  if (NULL == freefp) {
-    freefp = free;
+  memset(me, 0, sizeof(ngds_array_splay_tree_t));
+  if (NULL != mallocfp) {
+    me->legacy_malloc = mallocfp;
+    me->legacy_free = freefp;
+    me->allocator.context = me;
+    me->allocator.malloc = legacy_malloc;
+    me->allocator.realloc = legacy_realloc;
+    me->allocator.aligned_alloc = legacy_aligned_alloc;
+    me->allocator.free = legacy_free;
+  } else {
+    me->allocator = *allocator;
   }
 
-  /* TODO FIX CHECK FOR ALLOCATION FAILURES */
-  me = mallocfp(sizeof(ngds_array_splay_tree_t));
-  if (NULL == me) {
-    assert(0);
+  if (max_element_count < allocated_element_count) {
+    max_element_count = allocated_element_count;
   }
 
-  memset(me, 0, sizeof(ngds_array_splay_tree_t));
-  me->allocated_element_count = initial_element_count;
+  me->allocated_element_count = allocated_element_count;
+  me->max_element_count = max_element_count;
   me->utilized_element_count = 0;
-  me->shifted_element_bitmap_size_in_bytes =
-    (BITNSLOTS(initial_element_count) * sizeof(uint64_t));
-  me->shifted_element_bitmap =
-    mallocfp(me->shifted_element_bitmap_size_in_bytes);
-  memset(me->shifted_element_bitmap, 0,
-    me->shifted_element_bitmap_size_in_bytes);
-  me->node_array = mallocfp(
-    (me->allocated_element_count * sizeof(ngds_array_splay_tree_node_t)));
-  memset(me->node_array, 0,
-    (me->allocated_element_count * sizeof(ngds_array_splay_tree_node_t)));
   me->compare = comparefp;
-  me->malloc = mallocfp;
-  me->free = freefp;
 
   return me;
-} /* ngds_array_splay_tree_new() */
+} /* allocate_tree() */
 
 /* ------------------------------------------------------------------------- */
 
-void
-ngds_array_splay_tree_destroy (
+/*
+ * Histogram shards are allocated last, once the rest of the tree exists.
+ */
+static bool
+allocate_histograms (
   ngds_array_splay_tree_t    *me
 ) {
-  me->free(me->node_array);
-  me->free(me->shifted_element_bitmap);
-  me->free(me);
-} /* ngds_array_splay_tree_destroy() */
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_STATS
+  me->histogram_shards = tree_aligned_alloc(me,
+    (NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_SHARDS
+      * sizeof(ngds_array_splay_tree_histogram_shard_t)));
+  if (NULL == me->histogram_shards) {
+    return false;
+  }
+  memset(me->histogram_shards, 0, (NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_SHARDS
+    * sizeof(ngds_array_splay_tree_histogram_shard_t)));
+#else /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+  (void) me;
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+
+  return true;
+} /* allocate_histograms() */
 
 /* ------------------------------------------------------------------------- */
 
-void
-ngds_array_splay_tree_clear (
-  ngds_array_splay_tree_t    *me
+static inline void *
+node_key (
+  const ngds_array_splay_tree_t        *me,
+  const ngds_array_splay_tree_node_t   *node
 ) {
-  me->utilized_element_count = 0;
-  memset(me->node_array, 0,
-    (me->allocated_element_count * sizeof(ngds_array_splay_tree_node_t)));
-} /* ngds_array_splay_tree_clear() */
+  if (KEY_IS_INLINE(me)) {
+    return (void *) &node->key;
+  }
+  if (0 == me->key_base || NULL == node->key) {
+    return node->key;
+  }
+  return (void *) (me->key_base + (uintptr_t) node->key);
+} /* node_key() */
 
 /* ------------------------------------------------------------------------- */
 
-void
-ngds_array_splay_tree_print (
-  ngds_array_splay_tree_t    *me,
-  ngds_node_printer           print_cb
+static inline void *
+node_value (
+  const ngds_array_splay_tree_t        *me,
+  const ngds_array_splay_tree_node_t   *node
 ) {
-  printf("SPLAY Tree:\n");
-  perform_tree_print(me, print_cb, NG_SPLAY_ROOT_INDEX, 0);
-} /* ngds_array_splay_tree_print() */
+  if (VALUE_IS_INLINE(me)) {
+    return (void *) &node->value;
+  }
+  if (0 == me->value_base || NULL == node->value) {
+    return node->value;
+  }
+  return (void *) (me->value_base + (uintptr_t) node->value);
+} /* node_value() */
 
 /* ------------------------------------------------------------------------- */
 
-void
-ngds_array_splay_tree_insert (
+static inline void
+mark_dirty (
   ngds_array_splay_tree_t    *me,
-  void                       *key,
-  void                       *value,
-  bool                        should_perform_splay
+  int                         idx
 ) {
-  bool                          key_was_found = false;
-  int                           current = NG_SPLAY_ROOT_INDEX;
-  ngds_array_splay_tree_node_t *node;
-
-  /* If this is a brand new tree */
-  if (0 < me->utilized_element_count) {
-    int cmp = 0;
-    while (true == NODE_IS_VALID(me, current)
-            && false == NODE_IS_EMPTY(me, current)) {
-      node = &me->node_array[current];
-      cmp = me->compare(node->key, key);
-      if (0 == cmp) {
-        key_was_found = true;
-        break;
-      } else if (0 > cmp) {
-        current = left_child_of(current);
-      } else {
-        current = right_child_of(current);
-      }
-    }
-
-    if (false == NODE_IS_VALID(me, current)) {
-      printf("NEED TO EXPAND!\n");
-      assert(0);
-    }
-  }
-
-  if (false == key_was_found) {
-    ++me->utilized_element_count;
+  if (NULL != me->dirty_page_bitmap) {
+    BITSET(me->dirty_page_bitmap, (idx / NODES_PER_PAGE));
   }
+} /* mark_dirty() */
 
-  node = &me->node_array[current];
-  node->key = key;
-  node->value = value;
+/* ------------------------------------------------------------------------- */
 
-  if (true == should_perform_splay) {
-    perform_splay_operation(me, current);
-  }
+/*
+ * All writes into node_array go through the three helpers below, so that
+ * anything tracking slot modifications only has to hook in here.
+ */
+static inline void
+node_copy (
+  ngds_array_splay_tree_t    *me,
+  int                         dst_idx,
+  int                         src_idx
+) {
+  memcpy(&me->node_array[dst_idx], &me->node_array[src_idx],
+    sizeof(ngds_array_splay_tree_node_t));
+  if (NULL != me->key_prefixes) {
+    me->key_prefixes[dst_idx] = me->key_prefixes[src_idx];
+  }
+  if (NULL != me->subtree_counts) {
+    me->subtree_counts[dst_idx] = me->subtree_counts[src_idx];
+  }
+  if (NULL != me->cache.expiry_times) {
+    me->cache.expiry_times[dst_idx] = me->cache.expiry_times[src_idx];
+  }
+  if (NULL != me->tombstones) {
+    me->tombstones[dst_idx] = me->tombstones[src_idx];
+  }
+  mark_dirty(me, dst_idx);
+} /* node_copy() */
 
-} /* ngds_array_splay_tree_insert() */
+/* ------------------------------------------------------------------------- */
+
+static inline void
+node_clear (
+  ngds_array_splay_tree_t    *me,
+  int                         idx
+) {
+  memset(&me->node_array[idx], 0, sizeof(ngds_array_splay_tree_node_t));
+  if (NULL != me->key_prefixes) {
+    me->key_prefixes[idx] = 0;
+  }
+  if (NULL != me->subtree_counts) {
+    me->subtree_counts[idx] = 0;
+  }
+  if (NULL != me->cache.expiry_times) {
+    me->cache.expiry_times[idx] = 0;
+  }
+  if (NULL != me->tombstones) {
+    me->tombstones[idx] = 0;
+  }
+  mark_dirty(me, idx);
+} /* node_clear() */
 
 /* ------------------------------------------------------------------------- */
 
-void *
-ngds_array_splay_tree_get (
+static inline void
+node_set (
+  ngds_array_splay_tree_t    *me,
+  int                         idx,
+  void                       *key,
+  void                       *value
+) {
+  /* Only shared-memory trees are still offset-encoded when written to */
+  if (0 != me->key_base && NULL != key) {
+    key = (void *) ((uintptr_t) key - me->key_base);
+  }
+  if (0 != me->value_base && NULL != value) {
+    value = (void *) ((uintptr_t) value - me->value_base);
+  }
+
+  me->node_array[idx].key = key;
+  me->node_array[idx].value = value;
+  if (NULL != me->key_prefixes) {
+    me->key_prefixes[idx] = (NULL == key) ? 0
+      : me->key_prefix(node_key(me, &me->node_array[idx]));
+  }
+  mark_dirty(me, idx);
+} /* node_set() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shifts carry each slot's count along with its node, since they move
+ * whole subtrees. Only the nodes whose subtrees gain or lose a node need
+ * their count recomputed from their children.
+ */
+static inline int
+subtree_count (
+  const ngds_array_splay_tree_t  *me,
+  int                             idx
+) {
+  return (NODE_IS_VALID(me, idx)) ? me->subtree_counts[idx] : 0;
+} /* subtree_count() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline void
+refresh_subtree_count (
+  ngds_array_splay_tree_t    *me,
+  int                         idx
+) {
+  me->subtree_counts[idx] = (true == NODE_IS_EMPTY(me, idx)) ? 0
+    : ((NODE_IS_TOMBSTONE(me, idx) ? 0 : 1)
+      + subtree_count(me, left_child_of(idx))
+      + subtree_count(me, right_child_of(idx)));
+} /* refresh_subtree_count() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+refresh_subtree_counts_to_root (
+  ngds_array_splay_tree_t    *me,
+  int                         idx
+) {
+  if (NULL == me->subtree_counts) {
+    return;
+  }
+  refresh_subtree_count(me, idx);
+  while (NG_SPLAY_ROOT_INDEX != idx) {
+    idx = parent_of(idx);
+    refresh_subtree_count(me, idx);
+  }
+} /* refresh_subtree_counts_to_root() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Compares key against the key at idx, as compare(key, node_key) would,
+ * so a negative result sends the search left. Abbreviated prefixes
+ * settle most comparisons without touching the key.
+ */
+static inline int
+node_compare (
+  ngds_array_splay_tree_t        *me,
+  int                             idx,
+  const void                     *key,
+  uint64_t                        key_prefix
+) {
+  if (NULL != me->key_prefixes && me->key_prefixes[idx] != key_prefix) {
+    return (key_prefix < me->key_prefixes[idx]) ? -1 : 1;
+  }
+
+  STATS_INC(me, comparisons);
+  return me->compare(key, node_key(me, &me->node_array[idx]));
+} /* node_compare() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline uint64_t
+search_prefix (
+  const ngds_array_splay_tree_t  *me,
+  const void                     *key
+) {
+  return (NULL != me->key_prefixes) ? me->key_prefix(key) : 0;
+} /* search_prefix() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+trace_record (
   ngds_array_splay_tree_t    *me,
+  ngds_trace_operation_t      operation,
   const void                 *key,
   bool                        should_perform_splay
 ) {
-  ngds_array_splay_tree_node_t *node;
-  int                           current = NG_SPLAY_ROOT_INDEX;
-  int                           cmp = 0;
-  while (true == NODE_IS_VALID(me, current)
-          && false == NODE_IS_EMPTY(me, current)) {
-    node = &me->node_array[current];
-    cmp = me->compare(node->key, key);
-    if (0 == cmp) {
-      break;
-    } else if (0 > cmp) {
-      current = left_child_of(current);
-    } else {
-      current = right_child_of(current);
+  size_t key_length = 0;
+
+  if (NULL != me->trace_key_size) {
+    key_length = me->trace_key_size(key);
+  } else if (0 < me->key_size) {
+    key_length = me->key_size;
+  }
+  ngds_trace_writer_append(me->trace, operation, should_perform_splay, key,
+    key_length);
+} /* trace_record() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline double
+adaptive_score (
+  const ngds_array_splay_tree_adaptive_t *adaptive,
+  int                                     regime
+) {
+  return adaptive->depth[regime]
+    + (ADAPTIVE_MOVE_COST * adaptive->moved[regime]);
+} /* adaptive_score() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Folds the finished epoch into the estimate of the regime that ran it,
+ * settles on the cheapest regime, and picks the one to run next: a
+ * regime never measured, one due for a retry, or the settled one.
+ * Returns true when it rebuilt the tree, which moves every node.
+ */
+static bool
+adaptive_end_epoch (
+  ngds_array_splay_tree_t    *me
+) {
+  ngds_array_splay_tree_adaptive_t *adaptive = &me->adaptive;
+  int                               regime = adaptive->regime;
+  int                               settled = adaptive->settled_regime;
+  int                               best = settled;
+  int                               next;
+  double                            depth;
+  double                            moved;
+  bool                              is_rebuilt = false;
+  int                               ii;
+
+  depth = (double) adaptive->epoch_depth_total / adaptive->epoch_operations;
+  moved = (double) (me->moved_node_count
+    - adaptive->epoch_start_moved_node_count) / adaptive->epoch_operations;
+
+  /* Splaying on trial can leave the tree deeper for lookups that don't */
+  if (true == adaptive->is_trial_over) {
+    adaptive->is_trial_over = false;
+    if (NGDS_ARRAY_SPLAY_TREE_SPLAY_NONE == regime
+        && depth > ((1.0 + ADAPTIVE_TRIAL_TOLERANCE)
+          * adaptive->pre_trial_depth)
+        && true == rebuild_live_nodes(me)) {
+      STATS_INC(me, rebuilds);
+      depth = adaptive->pre_trial_depth;
+      is_rebuilt = true;
     }
   }
 
-  if (false == NODE_IS_VALID(me, current)
-      || true == NODE_IS_EMPTY(me, current)) {
-    return NULL;
+  if (true == adaptive->has_estimate[regime]) {
+    depth = (ADAPTIVE_SMOOTHING * depth)
+      + ((1.0 - ADAPTIVE_SMOOTHING) * adaptive->depth[regime]);
+    moved = (ADAPTIVE_SMOOTHING * moved)
+      + ((1.0 - ADAPTIVE_SMOOTHING) * adaptive->moved[regime]);
   }
+  adaptive->depth[regime] = depth;
+  adaptive->moved[regime] = moved;
+  adaptive->has_estimate[regime] = true;
+  adaptive->estimate_epoch[regime] = adaptive->epoch++;
 
-  if (true == should_perform_splay) {
-    perform_splay_operation(me, current);
-    return (&me->node_array[NG_SPLAY_ROOT_INDEX])->value;
+  for (ii = 0; ii < NGDS_ARRAY_SPLAY_TREE_SPLAY_REGIME_COUNT; ++ii) {
+    if (true == adaptive->has_estimate[ii]
+        && adaptive_score(adaptive, ii) < adaptive_score(adaptive, best)) {
+      best = ii;
+    }
+  }
+  if (false == adaptive->has_estimate[adaptive->settled_regime]
+      || adaptive_score(adaptive, best) < ((1.0 - ADAPTIVE_HYSTERESIS)
+        * adaptive_score(adaptive, adaptive->settled_regime))) {
+    adaptive->settled_regime = best;
+  }
+
+  if (settled != adaptive->settled_regime) {
+    adaptive->explore_interval = ADAPTIVE_EXPLORE_INTERVAL;
+  } else if (true == adaptive->is_exploring
+      && ADAPTIVE_MAX_EXPLORE_INTERVAL > adaptive->explore_interval) {
+    adaptive->explore_interval *= 2;
+  }
+
+  if (true == adaptive->is_exploring) {
+    adaptive->is_trial_over = true;
   } else {
-    return (&me->node_array[current])->value;
+    adaptive->pre_trial_depth = adaptive->depth[adaptive->settled_regime];
   }
 
-} /* ngds_array_splay_tree_get() */
+  next = adaptive->settled_regime;
+  adaptive->is_exploring = false;
+  for (ii = 0; ii < NGDS_ARRAY_SPLAY_TREE_SPLAY_REGIME_COUNT; ++ii) {
+    if (false == adaptive->has_estimate[ii]) {
+      next = ii;
+      adaptive->is_exploring = true;
+      break;
+    }
+  }
+  if (false == adaptive->is_exploring && adaptive->explore_interval
+      <= (adaptive->epoch - adaptive->last_explored_epoch)) {
+    for (ii = 0; ii < NGDS_ARRAY_SPLAY_TREE_SPLAY_REGIME_COUNT; ++ii) {
+      if (ii == adaptive->settled_regime) {
+        continue;
+      }
+      if (next == adaptive->settled_regime
+          || adaptive->estimate_epoch[ii] < adaptive->estimate_epoch[next]) {
+        next = ii;
+      }
+    }
+    adaptive->is_exploring = true;
+    adaptive->last_explored_epoch = adaptive->epoch;
+  }
+
+  adaptive->regime = next;
+  adaptive->epoch_operations = 0;
+  adaptive->epoch_depth_total = 0;
+  adaptive->epoch_start_moved_node_count = me->moved_node_count;
+
+  return is_rebuilt;
+} /* adaptive_end_epoch() */
 
 /* ------------------------------------------------------------------------- */
 
-int
-ngds_array_splay_tree_cardinality (
-  ngds_array_splay_tree_t    *me
+/*
+ * Records a hit on the node at *idx and decides whether to splay it under
+ * the regime in force. The threshold regime splays nodes deeper than the
+ * deepest level of a balanced tree of the same size. When the epoch ends
+ * in a rebuild, *idx is updated to where the node went.
+ */
+static bool
+adaptive_should_splay (
+  ngds_array_splay_tree_t    *me,
+  int                        *idx
 ) {
-  return me->utilized_element_count;
-}
+  ngds_array_splay_tree_adaptive_t *adaptive = &me->adaptive;
+  int                               depth = depth_of(*idx);
+
+  adaptive->epoch_depth_total += depth;
+  if (NGDS_ARRAY_SPLAY_TREE_ADAPTIVE_EPOCH == ++adaptive->epoch_operations) {
+    /* A key stored in the slot goes with the old array, so copy the node */
+    ngds_array_splay_tree_node_t  node = me->node_array[*idx];
+
+    if (true == adaptive_end_epoch(me)) {
+      const void *key = node_key(me, &node);
+
+      *idx = descend_from(me, key, search_prefix(me, key),
+        NG_SPLAY_ROOT_INDEX);
+    }
+  }
+
+  /* The splay runs under the regime its rotations will be limited by */
+  switch (adaptive->regime) {
+    case NGDS_ARRAY_SPLAY_TREE_SPLAY_FULL:
+      return true;
+    case NGDS_ARRAY_SPLAY_TREE_SPLAY_THRESHOLD:
+      return (depth > (31 - __builtin_clz(me->utilized_element_count)));
+    default:
+      return false;
+  }
+} /* adaptive_should_splay() */
 
 /* ------------------------------------------------------------------------- */
 
-int
-ngds_array_splay_tree_size (
-  ngds_array_splay_tree_t* me
+/*
+ * In-order walks, by index arithmetic alone: the extremes of a subtree
+ * are found by following one kind of child, and a node's neighbour is
+ * either an extreme of one of its subtrees or the first ancestor it is
+ * on the other side of. Each returns -1 when there is no such node.
+ */
+static int
+subtree_min (
+  const ngds_array_splay_tree_t  *me,
+  int                             idx
 ) {
-  return me->allocated_element_count;
-}
+  while (NODE_IS_PRESENT(me, left_child_of(idx))) {
+    idx = left_child_of(idx);
+  }
+  return idx;
+} /* subtree_min() */
 
 /* ------------------------------------------------------------------------- */
 
-void *
-ngds_array_splay_tree_remove (
+static int
+subtree_max (
+  const ngds_array_splay_tree_t  *me,
+  int                             idx
+) {
+  while (NODE_IS_PRESENT(me, right_child_of(idx))) {
+    idx = right_child_of(idx);
+  }
+  return idx;
+} /* subtree_max() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+inorder_successor (
+  const ngds_array_splay_tree_t  *me,
+  int                             idx
+) {
+  if (NODE_IS_PRESENT(me, right_child_of(idx))) {
+    return subtree_min(me, right_child_of(idx));
+  }
+  while (NG_SPLAY_ROOT_INDEX != idx) {
+    int parent = parent_of(idx);
+    if (idx == left_child_of(parent)) {
+      return parent;
+    }
+    idx = parent;
+  }
+  return -1;
+} /* inorder_successor() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+inorder_predecessor (
+  const ngds_array_splay_tree_t  *me,
+  int                             idx
+) {
+  if (NODE_IS_PRESENT(me, left_child_of(idx))) {
+    return subtree_max(me, left_child_of(idx));
+  }
+  while (NG_SPLAY_ROOT_INDEX != idx) {
+    int parent = parent_of(idx);
+    if (idx == right_child_of(parent)) {
+      return parent;
+    }
+    idx = parent;
+  }
+  return -1;
+} /* inorder_predecessor() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Moves on from idx in order, backwards when is_backward, to a live node */
+static int
+skip_tombstones (
+  const ngds_array_splay_tree_t  *me,
+  int                             idx,
+  bool                            is_backward
+) {
+  while (-1 != idx && NODE_IS_TOMBSTONE(me, idx)) {
+    idx = (true == is_backward) ? inorder_predecessor(me, idx)
+      : inorder_successor(me, idx);
+  }
+  return idx;
+} /* skip_tombstones() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Follows key down from idx to its node, or to the empty slot it fits */
+static inline int
+descend_from (
   ngds_array_splay_tree_t    *me,
-  void                       *key
+  const void                 *key,
+  uint64_t                    prefix,
+  int                         idx
 ) {
-  ngds_array_splay_tree_node_t *node;
-  int                           current = NG_SPLAY_ROOT_INDEX;
-  int                           cmp = 0;
-  while (true == NODE_IS_VALID(me, current)
-          && false == NODE_IS_EMPTY(me, current)) {
-    node = &me->node_array[current];
-    cmp = me->compare(node->key, key);
+  int cmp;
+
+  while (true == NODE_IS_VALID(me, idx) && false == NODE_IS_EMPTY(me, idx)) {
+    cmp = node_compare(me, idx, key, prefix);
+    if (0 == cmp) {
+      break;
+    }
+    idx = (0 > cmp) ? left_child_of(idx) : right_child_of(idx);
+  }
+
+  return idx;
+} /* descend_from() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Finds key as descend_from() does, but starting from the finger when
+ * there is one. The keys between a node and the nearest ancestor whose
+ * other subtree holds it all lie in the node's subtree on that side. So
+ * the search climbs from the finger, comparing only against those
+ * ancestors, until one is beyond key, and descends from the last node
+ * passed on the near side. Keys close to the finger take a short climb
+ * and a short descent, wherever the finger is.
+ */
+static int
+search_from_finger (
+  ngds_array_splay_tree_t    *me,
+  const void                 *key,
+  uint64_t                    prefix
+) {
+  int   near = me->finger;
+  int   idx;
+  int   cmp;
+  bool  is_left;
+
+  if (false == me->has_finger || false == NODE_IS_PRESENT(me, near)) {
+    return descend_from(me, key, prefix, NG_SPLAY_ROOT_INDEX);
+  }
+
+  cmp = node_compare(me, near, key, prefix);
+  if (0 == cmp) {
+    return near;
+  }
+  is_left = (0 > cmp);
+
+  for (;;) {
+    /* Up past the ancestors on this side, which are no help */
+    idx = near;
+    while (NG_SPLAY_ROOT_INDEX != idx
+            && idx == ((true == is_left) ? left_child_of(parent_of(idx))
+              : right_child_of(parent_of(idx)))) {
+      idx = parent_of(idx);
+    }
+    if (NG_SPLAY_ROOT_INDEX == idx) {
+      break;
+    }
+
+    idx = parent_of(idx);
+    cmp = node_compare(me, idx, key, prefix);
     if (0 == cmp) {
+      return idx;
+    }
+    if ((0 > cmp) != is_left) {
       break;
+    }
+    near = idx;
+  }
+
+  return descend_from(me, key, prefix, (true == is_left)
+    ? left_child_of(near) : right_child_of(near));
+} /* search_from_finger() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Leaves the finger on the node at idx, or on the node above the empty
+ * slot a search ended in.
+ */
+static inline void
+place_finger (
+  ngds_array_splay_tree_t    *me,
+  int                         idx
+) {
+  if (true == me->has_finger) {
+    me->finger = (false == NODE_IS_PRESENT(me, idx)
+      && NG_SPLAY_ROOT_INDEX != idx) ? parent_of(idx) : idx;
+  }
+} /* place_finger() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Finds the nearest key above key, or below it when is_below, taking key
+ * itself when is_inclusive. Every node passed on the wanted side of key
+ * is closer than the previous one. Returns -1 if there is none.
+ */
+static int
+bound_search (
+  ngds_array_splay_tree_t    *me,
+  const void                 *key,
+  bool                        is_below,
+  bool                        is_inclusive
+) {
+  int                           current = NG_SPLAY_ROOT_INDEX;
+  int                           found = -1;
+  int                           cmp;
+  uint64_t                      prefix = search_prefix(me, key);
+
+  while (NODE_IS_PRESENT(me, current)) {
+    cmp = node_compare(me, current, key, prefix);
+    if (0 == cmp) {
+      if (true == is_inclusive) {
+        return current;
+      }
+      current = (true == is_below) ? left_child_of(current)
+        : right_child_of(current);
     } else if (0 > cmp) {
+      if (false == is_below) {
+        found = current;
+      }
       current = left_child_of(current);
     } else {
+      if (true == is_below) {
+        found = current;
+      }
       current = right_child_of(current);
     }
   }
 
-  if (false == NODE_IS_VALID(me, current)
-      || true == NODE_IS_EMPTY(me, current)) {
-    return NULL;
+  return found;
+} /* bound_search() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Descends to key, growing the array when the key belongs on a level
+ * that does not exist yet. Returns the slot holding key, or the empty
+ * slot it goes into, or -1 when the tree cannot grow.
+ *
+ * Caches make room first. An expired key found on the way is evicted,
+ * a new key into a full cache evicts a cold leaf, and a key that would
+ * need a level beyond the maximum size evicts the node it would hang
+ * from. The descent starts over whenever that leaves its slot orphaned.
+ * In other trees, a key that would need a level past deepening_limit()
+ * has a subtree above it rebuilt balanced to make room, once, and the
+ * descent starts over.
+ *
+ * A tombstone of key is brought back to life, and reported as not found
+ * so that the node is stored and counted as a new one.
+ */
+static int
+locate_insertion_slot (
+  ngds_array_splay_tree_t    *me,
+  const void                 *key,
+  bool                       *key_was_found
+) {
+  int       current;
+  int       parent;
+  uint64_t  prefix = search_prefix(me, key);
+  bool      is_revived;
+  bool      is_rebuilt = false;
+
+  if (NULL != me->cache.expiry_times) {
+    sweep_expired(me);
   }
 
-  --me->utilized_element_count;
+restart:
+  current = NG_SPLAY_ROOT_INDEX;
+  *key_was_found = false;
 
-  void *k = node->key;
-  int predecessor = find_predecessor(me, current);
-  if (-1 == predecessor) {
-    memset(&me->node_array[current], 0, sizeof(ngds_array_splay_tree_node_t));
-  } else {
-    perform_upward_shift(me, left_child_of(predecessor),
-      right_child_of(parent_of(predecessor)));
-    perform_upward_shift(me, predecessor, current);
+  /* If this is a brand new tree */
+  if (0 == me->utilized_element_count) {
+    place_finger(me, current);
+    return current;
   }
 
-  return k;
+  current = search_from_finger(me, key, prefix);
+  parent = (NG_SPLAY_ROOT_INDEX == current) ? -1 : parent_of(current);
+  *key_was_found = NODE_IS_PRESENT(me, current);
 
-} /* ngds_array_splay_tree_remove() */
+  if (true == *key_was_found && true == expire_if_due(me, current)) {
+    goto restart;
+  }
+  is_revived = (true == *key_was_found && NODE_IS_TOMBSTONE(me, current));
+
+  if ((false == *key_was_found || true == is_revived)
+      && 0 < me->cache.capacity
+      && LIVE_ELEMENT_COUNT(me) >= me->cache.capacity) {
+    bool is_orphaned = false;
+
+    while (LIVE_ELEMENT_COUNT(me) >= me->cache.capacity) {
+      int victim = find_cold_leaf(me);
+
+      is_orphaned = (is_orphaned || victim == parent
+        || (true == is_revived && victim == current));
+      evict_node_at(me, victim);
+    }
+    if (true == is_orphaned) {
+      goto restart;
+    }
+  }
+
+  if (true == is_revived) {
+    me->tombstones[current] = 0;
+    --me->tombstone_count;
+    --me->utilized_element_count;
+    *key_was_found = false;
+  }
+
+  if (false == NODE_IS_VALID(me, current)
+      && false == deepen_node_array(me, deepening_limit(me))) {
+    if (0 < me->cache.capacity) {
+      evict_node_at(me, parent);
+      goto restart;
+    }
+    /* Once the tombstones are gone, a subtree can be rebuilt in place */
+    if (false == is_rebuilt
+        && true == ((0 < me->tombstone_count) ? compact_tombstones(me)
+          : rebuild_scapegoat(me, parent))) {
+      is_rebuilt = true;
+      goto restart;
+    }
+    return -1;
+  }
+
+  place_finger(me, current);
+  return current;
+} /* locate_insertion_slot() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Bookkeeping shared by the inserting operations once the slot at idx
+ * holds key, ending with the splay the caller or the adaptive policy
+ * asks for. Returns the slot the node ends up in.
+ */
+static int
+complete_insertion (
+  ngds_array_splay_tree_t    *me,
+  int                         idx,
+  const void                 *key,
+  bool                        key_was_found,
+  bool                        should_perform_splay
+) {
+  if (false == key_was_found) {
+    ++me->utilized_element_count;
+    refresh_subtree_counts_to_root(me, idx);
+    STATS_INC(me, insert_misses);
+    PROFILE_SAMPLE(me, key, -1);
+  } else {
+    STATS_INC(me, insert_hits);
+    PROFILE_SAMPLE(me, key, depth_of(idx));
+  }
+
+  if (true == me->adaptive.is_enabled) {
+    should_perform_splay = adaptive_should_splay(me, &idx);
+  }
+  if (true == should_perform_splay) {
+    idx = perform_splay_operation(me, idx);
+  }
+
+  return idx;
+} /* complete_insertion() */
+
+/* ------------------------------------------------------------------------- */
+
+/* The splitmix64 finalizer, which spreads weak hashes over all bits */
+static inline uint64_t
+mix_hash (
+  uint64_t                    h
+) {
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h;
+} /* mix_hash() */
+
+/* ------------------------------------------------------------------------- */
+
+static uint64_t
+profile_key_hash (
+  const ngds_array_splay_tree_t  *me,
+  const void                     *key
+) {
+  const unsigned char *bytes = key;
+  uint64_t             h = 0xcbf29ce484222325ULL;
+  size_t               ii;
+
+  if (NULL != me->profiler->key_hash) {
+    return mix_hash(me->profiler->key_hash(key));
+  }
+  if (0 == me->key_size) {
+    return mix_hash((uint64_t) (uintptr_t) key);
+  }
+
+  /* FNV-1a over the owned key bytes */
+  for (ii = 0; ii < me->key_size; ++ii) {
+    h = (h ^ bytes[ii]) * 0x100000001b3ULL;
+  }
+  return mix_hash(h);
+} /* profile_key_hash() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline void
+hyperloglog_add (
+  uint8_t                    *registers,
+  uint64_t                    h
+) {
+  int      idx = h >> (64 - NGDS_ARRAY_SPLAY_TREE_PROFILE_REGISTER_BITS);
+  uint64_t rest = h << NGDS_ARRAY_SPLAY_TREE_PROFILE_REGISTER_BITS;
+  uint8_t  rank = (0 == rest)
+    ? (64 - NGDS_ARRAY_SPLAY_TREE_PROFILE_REGISTER_BITS + 1)
+    : (__builtin_clzll(rest) + 1);
+
+  if (registers[idx] < rank) {
+    registers[idx] = rank;
+  }
+} /* hyperloglog_add() */
+
+/* ------------------------------------------------------------------------- */
+
+static double
+hyperloglog_estimate (
+  const uint8_t              *registers
+) {
+  const double  m = NGDS_ARRAY_SPLAY_TREE_PROFILE_REGISTERS;
+  double        sum = 0.0;
+  double        estimate;
+  int           zeros = 0;
+  int           ii;
+
+  for (ii = 0; ii < NGDS_ARRAY_SPLAY_TREE_PROFILE_REGISTERS; ++ii) {
+    sum += ldexp(1.0, -registers[ii]);
+    zeros += (0 == registers[ii]);
+  }
+  estimate = (0.7213 / (1.0 + (1.079 / m))) * m * m / sum;
+
+  /* Linear counting is more accurate while many registers are empty */
+  if (estimate <= (2.5 * m) && 0 < zeros) {
+    estimate = m * log(m / zeros);
+  }
+  return estimate;
+} /* hyperloglog_estimate() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+profile_sample (
+  ngds_array_splay_tree_t    *me,
+  const void                 *key,
+  int                         depth
+) {
+  ngds_array_splay_tree_profiler_t *profiler = me->profiler;
+  uint64_t                          h = profile_key_hash(me, key);
+  int                               min_slot = 0;
+  int                               ii;
+
+  profiler->countdown = profiler->sample_interval;
+  ++profiler->sampled_operations;
+  if (0 <= depth) {
+    ++profiler->hit_count;
+    profiler->hit_depth_total += depth;
+  }
+
+  hyperloglog_add(profiler->registers, h);
+  hyperloglog_add(profiler->window_registers, h);
+  if (NGDS_ARRAY_SPLAY_TREE_PROFILE_WINDOW == ++profiler->window_samples) {
+    memcpy(profiler->previous_window_registers, profiler->window_registers,
+      sizeof(profiler->window_registers));
+    memset(profiler->window_registers, 0,
+      sizeof(profiler->window_registers));
+    profiler->window_samples = 0;
+    profiler->has_previous_window = true;
+  }
+
+  /* Space-saving: a new key takes over the least frequent slot */
+  for (ii = 0; ii < NGDS_ARRAY_SPLAY_TREE_PROFILE_TOP_KEYS; ++ii) {
+    if (h == profiler->top_hashes[ii] && 0 < profiler->top_counts[ii]) {
+      ++profiler->top_counts[ii];
+      return;
+    }
+    if (profiler->top_counts[ii] < profiler->top_counts[min_slot]) {
+      min_slot = ii;
+    }
+  }
+  profiler->top_hashes[min_slot] = h;
+  profiler->top_errors[min_slot] = profiler->top_counts[min_slot];
+  ++profiler->top_counts[min_slot];
+} /* profile_sample() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+compare_counts_descending (
+  const void                 *e1,
+  const void                 *e2
+) {
+  uint64_t a = *(const uint64_t *) e1;
+  uint64_t b = *(const uint64_t *) e2;
+
+  return (a < b) - (a > b);
+} /* compare_counts_descending() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Fits frequency ~ rank^-s by least squares in log-log space, over the
+ * guaranteed counts of the sketch: what a key counted since it took its
+ * slot. Keys are only used while that exceeds the smallest count in the
+ * sketch, above which no untracked key can be, so that their ranks are
+ * exact; and at most over the upper half of the slots.
+ */
+static double
+fit_zipf_exponent (
+  const ngds_array_splay_tree_profiler_t *profiler
+) {
+  uint64_t  counts[NGDS_ARRAY_SPLAY_TREE_PROFILE_TOP_KEYS];
+  uint64_t  min_count = UINT64_MAX;
+  double    sum_x = 0.0;
+  double    sum_y = 0.0;
+  double    sum_xx = 0.0;
+  double    sum_xy = 0.0;
+  double    n;
+  int       point_count = 0;
+  int       ii;
+
+  for (ii = 0; ii < NGDS_ARRAY_SPLAY_TREE_PROFILE_TOP_KEYS; ++ii) {
+    counts[ii] = profiler->top_counts[ii] - profiler->top_errors[ii];
+    if (profiler->top_counts[ii] < min_count) {
+      min_count = profiler->top_counts[ii];
+    }
+  }
+  qsort(counts, NGDS_ARRAY_SPLAY_TREE_PROFILE_TOP_KEYS, sizeof(uint64_t),
+    compare_counts_descending);
+
+  for (ii = 0; ii < (NGDS_ARRAY_SPLAY_TREE_PROFILE_TOP_KEYS / 2); ++ii) {
+    uint64_t count = counts[ii];
+    double   x;
+    double   y;
+
+    if (2 > count || min_count >= count) {
+      break;
+    }
+    x = log(ii + 1);
+    y = log(count);
+    sum_x += x;
+    sum_y += y;
+    sum_xx += x * x;
+    sum_xy += x * y;
+    ++point_count;
+  }
+
+  if (4 > point_count) {
+    return 0.0;
+  }
+  n = point_count;
+  return -((n * sum_xy) - (sum_x * sum_y)) / ((n * sum_xx) - (sum_x * sum_x));
+} /* fit_zipf_exponent() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Carves size bytes out of the slab, starting a new backing buffer when
+ * the current one is exhausted. The remainder of the old one is wasted,
+ * which keeps allocation a pointer bump.
+ */
+static void *
+slab_alloc (
+  ngds_array_splay_tree_t    *me,
+  size_t                      size
+) {
+  void *ptr;
+
+  size = ALIGN_UP(size, sizeof(void *));
+  if (me->slab_available < size) {
+    ngds_array_splay_tree_backing_buffer_t *buffer;
+    size_t buffer_size = sizeof(*buffer) + max(size, SLAB_CHUNK_SIZE);
+
+    buffer = tree_malloc(me, buffer_size);
+    if (NULL == buffer) {
+      return NULL;
+    }
+    buffer->size = buffer_size;
+    buffer->next = me->backing_buffers;
+    me->backing_buffers = buffer;
+    me->slab_top = (char *) (buffer + 1);
+    me->slab_available = buffer_size - sizeof(*buffer);
+  }
+
+  ptr = me->slab_top;
+  me->slab_top += size;
+  me->slab_available -= size;
+
+  return ptr;
+} /* slab_alloc() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Returns what a slot stores for a tree-owned key or value: the bytes
+ * themselves when they fit, otherwise a pointer to a copy in the slab.
+ * Inline keys get a non-zero last byte, so that an occupied slot never
+ * reads as empty. Returns NULL if the copy could not be allocated.
+ */
+static void *
+own_payload (
+  ngds_array_splay_tree_t    *me,
+  const void                 *src,
+  size_t                      size,
+  bool                        is_key
+) {
+  void *word = NULL;
+
+  if (NULL == src) {
+    return NULL;
+  }
+
+  if ((true == is_key && KEY_IS_INLINE(me))
+      || (false == is_key && VALUE_IS_INLINE(me))) {
+    memcpy(&word, src, size);
+    if (true == is_key) {
+      ((unsigned char *) &word)[sizeof(void *) - 1] = 1;
+    }
+    return word;
+  }
+
+  word = slab_alloc(me, size);
+  if (NULL != word) {
+    memcpy(word, src, size);
+  }
+
+  return word;
+} /* own_payload() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline uint64_t
+monotonic_ns (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+} /* monotonic_ns() */
+
+/* ------------------------------------------------------------------------- */
+
+/* A node written by an insert lives for another ttl from now */
+static inline void
+restart_expiry (
+  ngds_array_splay_tree_t    *me,
+  int                         idx
+) {
+  if (NULL != me->cache.expiry_times) {
+    me->cache.expiry_times[idx] = monotonic_ns() + me->cache.ttl;
+  }
+} /* restart_expiry() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Writes key and value into the slot at idx, copying whichever the tree
+ * owns. A replaced key keeps its stored copy, and a replaced value is
+ * overwritten in place when it already has one in the slab.
+ */
+static bool
+node_store (
+  ngds_array_splay_tree_t    *me,
+  int                         idx,
+  const void                 *key,
+  const void                 *value,
+  bool                        is_replacement
+) {
+  ngds_array_splay_tree_node_t *node = &me->node_array[idx];
+  void                         *key_word = (void *) key;
+  void                         *value_word = (void *) value;
+
+  if (0 == me->key_size && 0 == me->value_size) {
+    node_set(me, idx, key_word, value_word);
+    restart_expiry(me, idx);
+    return true;
+  }
+
+  if (0 < me->key_size) {
+    key_word = (true == is_replacement) ? node->key
+      : own_payload(me, key, me->key_size, true);
+    if (NULL == key_word) {
+      return false;
+    }
+  }
+
+  if (0 < me->value_size) {
+    if (true == is_replacement && false == VALUE_IS_INLINE(me)
+        && NULL != node->value && NULL != value) {
+      if (node->value != value) {
+        memcpy(node->value, value, me->value_size);
+      }
+      value_word = node->value;
+    } else {
+      value_word = own_payload(me, value, me->value_size, false);
+      if (NULL == value_word && NULL != value && false == VALUE_IS_INLINE(me)) {
+        return false;
+      }
+    }
+  }
+
+  node_set(me, idx, key_word, value_word);
+  restart_expiry(me, idx);
+
+  return true;
+} /* node_store() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Releases every backing buffer, and with it the slab.
+ */
+static void
+release_backing_buffers (
+  ngds_array_splay_tree_t    *me
+) {
+  while (NULL != me->backing_buffers) {
+    ngds_array_splay_tree_backing_buffer_t *next = me->backing_buffers->next;
+    tree_free(me, me->backing_buffers, me->backing_buffers->size);
+    me->backing_buffers = next;
+  }
+  me->slab_top = NULL;
+  me->slab_available = 0;
+} /* release_backing_buffers() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The mapping of an opened tree is read-only, so before anything moves
+ * nodes around the node array is copied out and offsets are turned back
+ * into pointers. The mapping itself stays, as payloads still live there.
+ * Returns false, leaving the tree mapped, if memory runs out.
+ */
+static bool
+promote_mapped_node_array (
+  ngds_array_splay_tree_t    *me
+) {
+  ngds_array_splay_tree_node_t *array;
+  int                           ii;
+
+  if (false == me->node_array_is_mapped) {
+    return true;
+  }
+
+  array = tree_aligned_alloc(me,
+    NODE_ARRAY_SIZE(me->allocated_element_count));
+  if (NULL == array) {
+    return false;
+  }
+
+  for (ii = 0; ii < me->allocated_element_count; ++ii) {
+    array[ii].key = node_key(me, &me->node_array[ii]);
+    array[ii].value = node_value(me, &me->node_array[ii]);
+  }
+
+  me->node_array = array;
+  me->key_base = 0;
+  me->value_base = 0;
+  me->node_array_is_mapped = false;
+
+  return true;
+} /* promote_mapped_node_array() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Streams len bytes from src into fp, or zeroes when src is NULL.
+ */
+static int
+write_bytes (
+  FILE                       *fp,
+  const void                 *src,
+  uint64_t                    len
+) {
+  static const char zeroes[FILE_ALIGNMENT] = { 0 };
+
+  if (NULL != src) {
+    return (len == fwrite(src, 1, len, fp)) ? 0 : -1;
+  }
+
+  while (0 < len) {
+    size_t chunk = (len < sizeof(zeroes)) ? len : sizeof(zeroes);
+    if (chunk != fwrite(zeroes, 1, chunk, fp)) {
+      return -1;
+    }
+    len -= chunk;
+  }
+
+  return 0;
+} /* write_bytes() */
+
+/* ------------------------------------------------------------------------- */
+
+static uint32_t
+payload_flags (
+  ngds_payload_size_fptr      key_sizefp,
+  ngds_payload_size_fptr      value_sizefp
+) {
+  return ((NULL != key_sizefp) ? NGDS_ARRAY_SPLAY_TREE_FILE_KEY_OFFSETS : 0)
+    | ((NULL != value_sizefp) ? NGDS_ARRAY_SPLAY_TREE_FILE_VALUE_OFFSETS : 0);
+} /* payload_flags() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Writes count slots starting at first. Keys and values with a size
+ * function are replaced by the offset their payload will have once
+ * write_payload_range() is called over the same slots.
+ */
+static int
+write_node_range (
+  ngds_array_splay_tree_t    *me,
+  FILE                       *fp,
+  int                         first,
+  int                         count,
+  ngds_payload_size_fptr      key_sizefp,
+  ngds_payload_size_fptr      value_sizefp,
+  uint64_t                    payload_offset,
+  uint64_t                   *payload_cursor
+) {
+  int ii;
+
+  for (ii = first; ii < (first + count); ++ii) {
+    ngds_array_splay_tree_node_t out = { NULL, NULL };
+
+    if (ii < me->allocated_element_count) {
+      out.key = node_key(me, &me->node_array[ii]);
+      out.value = node_value(me, &me->node_array[ii]);
+    }
+
+    if (NULL != out.key && NULL != key_sizefp) {
+      uint64_t len = key_sizefp(out.key);
+      out.key = (void *) (uintptr_t) (payload_offset + *payload_cursor);
+      *payload_cursor += ALIGN_UP(len, PAYLOAD_ALIGNMENT);
+    }
+    if (NULL != out.key && NULL != out.value && NULL != value_sizefp) {
+      uint64_t len = value_sizefp(out.value);
+      out.value = (void *) (uintptr_t) (payload_offset + *payload_cursor);
+      *payload_cursor += ALIGN_UP(len, PAYLOAD_ALIGNMENT);
+    }
+
+    if (0 != write_bytes(fp, &out, sizeof(out))) {
+      return -1;
+    }
+  }
+
+  return 0;
+} /* write_node_range() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+write_payload_range (
+  ngds_array_splay_tree_t    *me,
+  FILE                       *fp,
+  int                         first,
+  int                         count,
+  ngds_payload_size_fptr      key_sizefp,
+  ngds_payload_size_fptr      value_sizefp
+) {
+  int ii;
+
+  for (ii = first;
+      ii < (first + count) && ii < me->allocated_element_count;
+      ++ii) {
+    void     *key = node_key(me, &me->node_array[ii]);
+    void     *value = node_value(me, &me->node_array[ii]);
+    uint64_t  len;
+
+    if (NULL == key) {
+      continue;
+    }
+    if (NULL != key_sizefp) {
+      len = key_sizefp(key);
+      if (0 != write_bytes(fp, key, len)
+          || 0 != write_bytes(fp, NULL,
+            (ALIGN_UP(len, PAYLOAD_ALIGNMENT) - len))) {
+        return -1;
+      }
+    }
+    if (NULL != value && NULL != value_sizefp) {
+      len = value_sizefp(value);
+      if (0 != write_bytes(fp, value, len)
+          || 0 != write_bytes(fp, NULL,
+            (ALIGN_UP(len, PAYLOAD_ALIGNMENT) - len))) {
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+} /* write_payload_range() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Applies one delta written by ngds_array_splay_tree_checkpoint(). When
+ * the delta carries payloads the file image is kept alive for as long as
+ * the tree, since restored keys and values point into it.
+ */
+static int
+apply_checkpoint_delta (
+  ngds_array_splay_tree_t    *me,
+  const char                 *path
+) {
+  const ngds_array_splay_tree_delta_header_t *header;
+  ngds_array_splay_tree_backing_buffer_t     *buffer;
+  char                                       *image;
+  FILE                                       *fp;
+  long                                        size;
+  uint64_t                                    record_size;
+  uint32_t                                    ii;
+  int                                         jj;
+
+  fp = fopen(path, "rb");
+  if (NULL == fp) {
+    return -1;
+  }
+
+  if (0 != fseek(fp, 0, SEEK_END) || 0 > (size = ftell(fp))
+      || 0 != fseek(fp, 0, SEEK_SET)
+      || (long) sizeof(*header) > size) {
+    fclose(fp);
+    return -1;
+  }
+
+  buffer = tree_malloc(me, sizeof(*buffer) + size);
+  if (NULL == buffer) {
+    fclose(fp);
+    return -1;
+  }
+  buffer->size = sizeof(*buffer) + size;
+  image = (char *) (buffer + 1);
+
+  if ((size_t) size != fread(image, 1, size, fp)) {
+    fclose(fp);
+    tree_free(me, buffer, buffer->size);
+    return -1;
+  }
+  fclose(fp);
+
+  header = (const ngds_array_splay_tree_delta_header_t *) image;
+  record_size = (sizeof(uint64_t) * 2)
+    + (header->nodes_per_page * sizeof(ngds_array_splay_tree_node_t));
+  if (0 != memcmp(header->magic, NGDS_ARRAY_SPLAY_TREE_DELTA_MAGIC,
+        sizeof(NGDS_ARRAY_SPLAY_TREE_DELTA_MAGIC))
+      || NGDS_ARRAY_SPLAY_TREE_FILE_VERSION != header->version
+      || NG_SPLAY_ROOT_INDEX != header->root_index
+      || sizeof(void *) != header->pointer_size
+      || NODES_PER_PAGE != header->nodes_per_page
+      || me->allocated_element_count > header->allocated_element_count
+      || (header->page_offset + (header->page_count * record_size))
+          > (uint64_t) size
+      || (header->payload_offset + header->payload_size) > (uint64_t) size
+      || false == resize_node_array(me, header->allocated_element_count)) {
+    tree_free(me, buffer, buffer->size);
+    return -1;
+  }
+
+  for (ii = 0; ii < header->page_count; ++ii) {
+    const char *record = image + header->page_offset + (ii * record_size);
+    const ngds_array_splay_tree_node_t *nodes =
+      (const ngds_array_splay_tree_node_t *) (record + (sizeof(uint64_t) * 2));
+    uint64_t page;
+
+    memcpy(&page, record, sizeof(page));
+    for (jj = 0; jj < (int) NODES_PER_PAGE; ++jj) {
+      uint64_t  idx = (page * NODES_PER_PAGE) + jj;
+      void     *key = nodes[jj].key;
+      void     *value = nodes[jj].value;
+
+      if (idx >= (uint64_t) me->allocated_element_count) {
+        break;
+      }
+      if (NULL != key
+          && (header->flags & NGDS_ARRAY_SPLAY_TREE_FILE_KEY_OFFSETS)) {
+        key = image + (uintptr_t) key;
+      }
+      if (NULL != key && NULL != value
+          && (header->flags & NGDS_ARRAY_SPLAY_TREE_FILE_VALUE_OFFSETS)) {
+        value = image + (uintptr_t) value;
+      }
+      node_set(me, (int) idx, key, value);
+    }
+  }
+
+  me->utilized_element_count = header->utilized_element_count;
+
+  if (0 == header->flags) {
+    tree_free(me, buffer, buffer->size);
+  } else {
+    buffer->next = me->backing_buffers;
+    me->backing_buffers = buffer;
+  }
+
+  return 0;
+} /* apply_checkpoint_delta() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+perform_tree_print (
+  ngds_array_splay_tree_t    *me,
+  ngds_node_printer           print_cb,
+  int                         idx,
+  int                         d
+) {
+  int ii;
+
+  for (ii = 0; ii < d; ++ii) {
+    printf("  ");
+  }
+
+  printf("[%d] %c ", idx,
+#ifdef NG_SPLAY_ARRAY_HAS_ZERO_INDEX_ROOT
+    (1 == (idx % 2))
+#else /* NG_SPLAY_ARRAY_HAS_ZERO_INDEX_ROOT */
+    (0 == (idx % 2))
+#endif /* NG_SPLAY_ARRAY_HAS_ZERO_INDEX_ROOT */
+    ? 'l' : 'r');
+
+  if (me->allocated_element_count <= idx
+      || NULL == me->node_array[idx].key
+  ) {
+    printf("\n");
+    return;
+  }
+
+  if (NULL != print_cb) {
+    print_cb(&me->node_array[idx]);
+  } else {
+    printf("%p", me->node_array[idx].key);
+  }
+  printf("\n");
+
+  perform_tree_print(me, print_cb, left_child_of(idx), (d + 1));
+  perform_tree_print(me, print_cb, right_child_of(idx), (d + 1));
+
+} /* perform_tree_print() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Resizes node_array, and everything sized after it, to hold
+ * element_count slots. Slot indices do not depend on the capacity, so
+ * existing nodes stay where they are and the new tail starts out empty.
+ */
+static bool
+resize_node_array (
+  ngds_array_splay_tree_t    *me,
+  int                         element_count
+) {
+  ngds_array_splay_tree_node_t *array;
+  size_t                        bitmap_size;
+  void                         *bitmap;
+
+  assert(false == me->node_array_is_mapped);
+
+  if (element_count <= me->allocated_element_count) {
+    return true;
+  }
+
+  array = tree_aligned_alloc(me, NODE_ARRAY_SIZE(element_count));
+  if (NULL == array) {
+    return false;
+  }
+
+  if (NULL != me->dirty_page_bitmap) {
+    bitmap_size = (BITNSLOTS(((element_count + NODES_PER_PAGE - 1)
+      / NODES_PER_PAGE)) * sizeof(uint64_t));
+    bitmap = tree_realloc(me, me->dirty_page_bitmap,
+      me->dirty_page_bitmap_size_in_bytes, bitmap_size);
+    if (NULL == bitmap) {
+      tree_free(me, array, NODE_ARRAY_SIZE(element_count));
+      return false;
+    }
+    memset(((char *) bitmap + me->dirty_page_bitmap_size_in_bytes), 0,
+      (bitmap_size - me->dirty_page_bitmap_size_in_bytes));
+    me->dirty_page_bitmap = bitmap;
+    me->dirty_page_bitmap_size_in_bytes = bitmap_size;
+  }
+
+  if (NULL != me->key_prefixes) {
+    uint64_t *prefixes = tree_realloc(me, me->key_prefixes,
+      (me->allocated_element_count * sizeof(uint64_t)),
+      (element_count * sizeof(uint64_t)));
+    if (NULL == prefixes) {
+      tree_free(me, array, NODE_ARRAY_SIZE(element_count));
+      return false;
+    }
+    memset(&prefixes[me->allocated_element_count], 0,
+      ((element_count - me->allocated_element_count) * sizeof(uint64_t)));
+    me->key_prefixes = prefixes;
+  }
+
+  if (NULL != me->subtree_counts) {
+    int *counts = tree_realloc(me, me->subtree_counts,
+      (me->allocated_element_count * sizeof(int)),
+      (element_count * sizeof(int)));
+    if (NULL == counts) {
+      tree_free(me, array, NODE_ARRAY_SIZE(element_count));
+      return false;
+    }
+    memset(&counts[me->allocated_element_count], 0,
+      ((element_count - me->allocated_element_count) * sizeof(int)));
+    me->subtree_counts = counts;
+  }
+
+  if (NULL != me->cache.expiry_times) {
+    uint64_t *expiry_times = tree_realloc(me, me->cache.expiry_times,
+      (me->allocated_element_count * sizeof(uint64_t)),
+      (element_count * sizeof(uint64_t)));
+    if (NULL == expiry_times) {
+      tree_free(me, array, NODE_ARRAY_SIZE(element_count));
+      return false;
+    }
+    memset(&expiry_times[me->allocated_element_count], 0,
+      ((element_count - me->allocated_element_count) * sizeof(uint64_t)));
+    me->cache.expiry_times = expiry_times;
+  }
+
+  if (NULL != me->tombstones) {
+    uint8_t *tombstones = tree_realloc(me, me->tombstones,
+      me->allocated_element_count, element_count);
+    if (NULL == tombstones) {
+      tree_free(me, array, NODE_ARRAY_SIZE(element_count));
+      return false;
+    }
+    memset(&tombstones[me->allocated_element_count], 0,
+      (element_count - me->allocated_element_count));
+    me->tombstones = tombstones;
+  }
+
+  memcpy(array, me->node_array, NODE_ARRAY_SIZE(me->allocated_element_count));
+  memset(&array[me->allocated_element_count], 0,
+    NODE_ARRAY_SIZE((element_count - me->allocated_element_count)));
+
+  tree_free(me, me->node_array, NODE_ARRAY_SIZE(me->allocated_element_count));
+  me->node_array = array;
+  me->allocated_element_count = element_count;
+
+  return true;
+} /* resize_node_array() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Number of slots needed for every child index of an existing slot to be
+ * valid, i.e. one past right_child_of(allocated_element_count - 1).
+ */
+static inline int64_t
+next_level_element_count (
+  const ngds_array_splay_tree_t  *me
+) {
+  return ((2 * (int64_t) me->allocated_element_count)
+    + (1 - NG_SPLAY_ROOT_INDEX));
+} /* next_level_element_count() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Adds one level: afterwards every child index of an existing slot is
+ * valid, unless that would exceed max_element_count.
+ */
+static bool
+grow_node_array (
+  ngds_array_splay_tree_t    *me
+) {
+  int64_t element_count;
+
+  if (me->allocated_element_count >= me->max_element_count) {
+    return false;
+  }
+
+  element_count = next_level_element_count(me);
+  if (element_count > me->max_element_count) {
+    element_count = me->max_element_count;
+  }
+
+  return resize_node_array(me, (int) element_count);
+} /* grow_node_array() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Slots of a tree of the given number of levels, within max_element_count */
+static int64_t
+levels_limit (
+  const ngds_array_splay_tree_t  *me,
+  int                             levels
+) {
+  int64_t limit = me->max_element_count;
+
+  if (levels < 62 && (NG_SPLAY_ROOT_INDEX + (1LL << levels) - 1) < limit) {
+    limit = NG_SPLAY_ROOT_INDEX + (1LL << levels) - 1;
+  }
+  return limit;
+} /* levels_limit() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The most slots splaying and inserting may grow the array to: a
+ * balanced tree of one more node than the tree holds, SPARE_LEVELS
+ * deeper. Each level doubles the array, and a splay tree
+ * can get as deep as it has nodes, so the array stops there. Rotations
+ * that would go deeper are skipped, and inserts that would go deeper
+ * rebuild a subtree balanced.
+ */
+static int64_t
+deepening_limit (
+  const ngds_array_splay_tree_t  *me
+) {
+  return levels_limit(me,
+    balanced_levels(LIVE_ELEMENT_COUNT(me) + 1) + SPARE_LEVELS);
+} /* deepening_limit() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The most slots rotations may grow the array to. A regime the adaptive
+ * policy is only trying out may go TRIAL_SPARE_LEVELS past a balanced
+ * tree, or use what the array already has, so that a trial that loses
+ * leaves the tree with at most twice the memory it needs.
+ */
+static int64_t
+rotation_limit (
+  const ngds_array_splay_tree_t  *me
+) {
+  int64_t limit;
+
+  if (false == me->adaptive.is_enabled
+      || false == me->adaptive.is_exploring) {
+    return deepening_limit(me);
+  }
+  limit = levels_limit(me,
+    balanced_levels(LIVE_ELEMENT_COUNT(me)) + TRIAL_SPARE_LEVELS);
+  if (limit < me->allocated_element_count) {
+    limit = me->allocated_element_count;
+  }
+  return limit;
+} /* rotation_limit() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Adds one level for a rotation or an insert, within the given limit */
+static bool
+deepen_node_array (
+  ngds_array_splay_tree_t    *me,
+  int64_t                     limit
+) {
+  if (me->allocated_element_count >= limit) {
+    return false;
+  }
+  return grow_node_array(me);
+} /* deepen_node_array() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * True when the subtree at src_idx can be moved to dst_idx without any
+ * node landing beyond the end of node_array.
+ */
+static bool
+shift_fits (
+  ngds_array_splay_tree_t    *me,
+  int                         src_idx,
+  int                         dst_idx
+) {
+  if (false == NODE_IS_VALID(me, src_idx) || true == NODE_IS_EMPTY(me, src_idx)) {
+    return true;
+  }
+  if (false == NODE_IS_VALID(me, dst_idx)) {
+    return false;
+  }
+
+  return shift_fits(me, left_child_of(src_idx), left_child_of(dst_idx))
+    && shift_fits(me, right_child_of(src_idx), right_child_of(dst_idx));
+} /* shift_fits() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * A rotation moves a subtree at most one level down. While the array can
+ * still deepen by a whole level, the shift grows it on demand; once it
+ * is near its limit, the subtree has to be checked up front so that no
+ * node is ever dropped.
+ */
+static bool
+ensure_shift_fits (
+  ngds_array_splay_tree_t    *me,
+  int                         src_idx,
+  int                         dst_idx
+) {
+  int64_t limit = rotation_limit(me);
+
+  if (next_level_element_count(me) <= limit) {
+    return true;
+  }
+
+  while (false == shift_fits(me, src_idx, dst_idx)) {
+    if (false == deepen_node_array(me, limit)) {
+      return false;
+    }
+  }
+
+  return true;
+} /* ensure_shift_fits() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Moves the subtree at src_idx so that it is rooted at dst_idx. When dst_idx
+ * is an ancestor of src_idx, the half of dst_idx that src_idx lives in is
+ * filled last; otherwise it would overwrite nodes of the other half before
+ * they have been read.
+ */
+static void
+perform_upward_shift (
+  ngds_array_splay_tree_t    *me,
+  int                         src_idx,
+  int                         dst_idx
+) {
+  /* Slots beyond the array are empty subtrees */
+  if (false == NODE_IS_VALID(me, src_idx)
+      || true == NODE_IS_EMPTY(me, src_idx)) {
+    return;
+  }
+
+  node_copy(me, dst_idx, src_idx);
+  node_clear(me, src_idx);
+  ++me->moved_node_count;
+  STATS_INC(me, nodes_moved);
+
+  if (0 > subtree_side_of(dst_idx, src_idx)) {
+    perform_upward_shift(me, right_child_of(src_idx), right_child_of(dst_idx));
+    perform_upward_shift(me, left_child_of(src_idx), left_child_of(dst_idx));
+  } else {
+    perform_upward_shift(me, left_child_of(src_idx), left_child_of(dst_idx));
+    perform_upward_shift(me, right_child_of(src_idx), right_child_of(dst_idx));
+  }
+
+} /* perform_upward_shift() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Moves the subtree at src_idx so that it is rooted at dst_idx, children
+ * before parents. When dst_idx lies below src_idx, the half of src_idx that
+ * contains it is moved first, as the other half is shifted into it.
+ */
+static int
+perform_downward_shift (
+  ngds_array_splay_tree_t    *me,
+  int                         src_idx,
+  int                         dst_idx
+) {
+  /* Slots beyond the array are empty subtrees */
+  if (false == NODE_IS_VALID(me, src_idx)
+      || true == NODE_IS_EMPTY(me, src_idx)) {
+    return src_idx;
+  }
+
+  if (false == NODE_IS_VALID(me, dst_idx) && false == grow_node_array(me)) {
+    printf("%s/%d: To node index (%d) is invalid\n",
+      __PRETTY_FUNCTION__, __LINE__, dst_idx);
+    return -1;
+  }
+
+  if (0 < subtree_side_of(src_idx, dst_idx)) {
+    perform_downward_shift(me, right_child_of(src_idx),
+      right_child_of(dst_idx));
+    perform_downward_shift(me, left_child_of(src_idx),
+      left_child_of(dst_idx));
+  } else {
+    perform_downward_shift(me, left_child_of(src_idx),
+      left_child_of(dst_idx));
+    perform_downward_shift(me, right_child_of(src_idx),
+      right_child_of(dst_idx));
+  }
+
+  node_copy(me, dst_idx, src_idx);
+  node_clear(me, src_idx);
+  ++me->moved_node_count;
+  STATS_INC(me, nodes_moved);
+
+  return dst_idx;
+
+} /* perform_downward_shift() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+find_predecessor (
+  ngds_array_splay_tree_t    *me,
+  int                         idx
+) {
+  int prev,i;
+
+  for (prev = -1, i = left_child_of(idx)
+        ; i < me->allocated_element_count && me->node_array[i].key
+        ; prev = i, i = right_child_of(i));
+
+  return prev;
+} /* find_predecessor() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Unlinks the node at idx. Its in-order predecessor takes its place, or
+ * its right subtree moves up when it has no left one.
+ */
+static void
+remove_node_at (
+  ngds_array_splay_tree_t    *me,
+  int                         idx
+) {
+  int predecessor = find_predecessor(me, idx);
+
+  if (NODE_IS_TOMBSTONE(me, idx)) {
+    --me->tombstone_count;
+  }
+  --me->utilized_element_count;
+
+  PHASE_BEGIN(me, SHIFT);
+  if (-1 == predecessor) {
+    node_clear(me, idx);
+    perform_upward_shift(me, right_child_of(idx), idx);
+    refresh_subtree_counts_to_root(me, idx);
+  } else {
+    node_copy(me, idx, predecessor);
+    node_clear(me, predecessor);
+    perform_upward_shift(me, left_child_of(predecessor), predecessor);
+    refresh_subtree_counts_to_root(me, predecessor);
+  }
+  PHASE_END(me, SHIFT);
+} /* remove_node_at() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Removes the node at idx from a cache, telling the eviction callback
+ * while its key and value are still in place. Traces record evictions
+ * as removals, so that replaying one needs no cache. A tombstone has
+ * already been removed, and just goes. Returns false, evicting nothing,
+ * if an opened tree cannot be copied out of its mapping.
+ */
+static bool
+evict_node_at (
+  ngds_array_splay_tree_t    *me,
+  int                         idx
+) {
+  ngds_array_splay_tree_node_t *node;
+
+  /* Promoting replaces the array, and turns offsets back into pointers */
+  if (false == promote_mapped_node_array(me)) {
+    return false;
+  }
+  node = &me->node_array[idx];
+  if (NODE_IS_TOMBSTONE(me, idx)) {
+    remove_node_at(me, idx);
+    return true;
+  }
+  TRACE_RECORD(me, REMOVE, node_key(me, node), false);
+  STATS_INC(me, evictions);
+  if (NULL != me->cache.evict) {
+    me->cache.evict(node_key(me, node), node_value(me, node),
+      me->cache.evict_context);
+  }
+  remove_node_at(me, idx);
+
+  return true;
+} /* evict_node_at() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Evicts the node at idx if its time to live is over */
+static bool
+expire_if_due (
+  ngds_array_splay_tree_t    *me,
+  int                         idx
+) {
+  if (NULL == me->cache.expiry_times
+      || me->cache.expiry_times[idx] > monotonic_ns()) {
+    return false;
+  }
+
+  /* Expired all the same if it cannot be evicted yet */
+  evict_node_at(me, idx);
+  return true;
+} /* expire_if_due() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Looks at the next few slots of a sweep that runs from the last slot
+ * towards the root and starts over at the bottom. The deepest levels
+ * hold the nodes touched least recently, so expired ones are found
+ * there first, and removing them moves little.
+ */
+static void
+sweep_expired (
+  ngds_array_splay_tree_t    *me
+) {
+  uint64_t  now = monotonic_ns();
+  int       ii;
+
+  for (ii = 0; ii < CACHE_SWEEP_SLOTS; ++ii) {
+    int idx = me->cache.sweep_idx;
+
+    if (idx < NG_SPLAY_ROOT_INDEX || idx >= me->allocated_element_count) {
+      idx = me->allocated_element_count - 1;
+    }
+    me->cache.sweep_idx = idx - 1;
+
+    if (false == NODE_IS_EMPTY(me, idx)
+        && me->cache.expiry_times[idx] <= now) {
+      evict_node_at(me, idx);
+    }
+  }
+} /* sweep_expired() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Follows random branches from the root down to a leaf */
+static int
+random_walk_to_leaf (
+  ngds_array_splay_tree_t    *me
+) {
+  int       idx = NG_SPLAY_ROOT_INDEX;
+  uint64_t  bits;
+
+  /* xorshift64, one bit per fork */
+  me->cache.walk_state ^= me->cache.walk_state << 13;
+  me->cache.walk_state ^= me->cache.walk_state >> 7;
+  me->cache.walk_state ^= me->cache.walk_state << 17;
+  bits = me->cache.walk_state;
+
+  for (;;) {
+    bool has_left = NODE_IS_PRESENT(me, left_child_of(idx));
+    bool has_right = NODE_IS_PRESENT(me, right_child_of(idx));
+
+    if (true == has_left && true == has_right) {
+      idx = (0 != (bits & 1)) ? right_child_of(idx) : left_child_of(idx);
+      bits >>= 1;
+    } else if (true == has_left) {
+      idx = left_child_of(idx);
+    } else if (true == has_right) {
+      idx = right_child_of(idx);
+    } else {
+      return idx;
+    }
+  }
+} /* random_walk_to_leaf() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Splaying pulls every node it touches towards the root, so the nodes
+ * left deepest are the ones used least recently. A single random walk
+ * ends at a leaf of any depth; the deeper of two is much more likely to
+ * be cold, without keeping any recency order. A leaf also leaves the
+ * tree without moving another node.
+ */
+static int
+find_cold_leaf (
+  ngds_array_splay_tree_t    *me
+) {
+  int first = random_walk_to_leaf(me);
+  int second = random_walk_to_leaf(me);
+
+  return (depth_of(second) > depth_of(first)) ? second : first;
+} /* find_cold_leaf() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Returns the index the node ends up at. That is the root, unless a
+ * rotation had to be skipped because the tree is at its maximum size.
+ */
+static int
+perform_splay_operation (
+  ngds_array_splay_tree_t            *me,
+  int                   idx
+) {
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_STATS
+  uint64_t start_cycles = read_cycle_counter();
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+
+  PHASE_BEGIN(me, SPLAY);
+  STATS_INC(me, splays);
+  STATS_ADD(me, splay_depth_total, depth_of(idx));
+  STATS_MAX(me, splay_depth_max, depth_of(idx));
+
+  while (NG_SPLAY_ROOT_INDEX != idx) {
+    int p = parent_of(idx);
+    int gp = 0;
+
+    if (NG_SPLAY_ROOT_INDEX == p) {
+      if (left_child_of(p) == idx) {
+        if (-1 != ngds_array_splay_tree_rotate_right(me, p)) {
+          idx = p;
+        }
+      } else {
+        if (-1 != ngds_array_splay_tree_rotate_left(me, p)) {
+          idx = p;
+        }
+      }
+      break;
+    } else {
+      gp = parent_of(p);
+    }
+
+    if (left_child_of(p) == idx && left_child_of(gp) == p) {
+      if (-1 == ngds_array_splay_tree_rotate_right(me, p)) {
+        break;
+      }
+      idx = p;
+      if (-1 == ngds_array_splay_tree_rotate_right(me, gp)) {
+        break;
+      }
+    } else if (right_child_of(p) == idx && right_child_of(gp) == p) {
+      if (-1 == ngds_array_splay_tree_rotate_left(me, p)) {
+        break;
+      }
+      idx = p;
+      if (-1 == ngds_array_splay_tree_rotate_left(me, gp)) {
+        break;
+      }
+    } else if (right_child_of(p) == idx && left_child_of(gp) == p) {
+      if (-1 == ngds_array_splay_tree_rotate_left(me, p)) {
+        break;
+      }
+      idx = p;
+      if (-1 == ngds_array_splay_tree_rotate_right(me, gp)) {
+        break;
+      }
+    } else if (left_child_of(p) == idx && right_child_of(gp) == p) {
+      if (-1 == ngds_array_splay_tree_rotate_right(me, p)) {
+        break;
+      }
+      idx = p;
+      if (-1 == ngds_array_splay_tree_rotate_left(me, gp)) {
+        break;
+      }
+    } else {
+      assert(0);
+    }
+    idx = gp;
+  }
+
+  HISTOGRAM_RECORD(me, SPLAY_CYCLES, (read_cycle_counter() - start_cycles));
+  PHASE_END(me, SPLAY);
+
+  return idx;
+} /* perform_splay_operation() */
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+int
+ngds_array_splay_tree_rotate_left (
+  ngds_array_splay_tree_t* me,
+  int idx
+) {
+  uint64_t moved_node_count = me->moved_node_count;
+  int      new_idx;
+
+  PROBE3(rotate_left_entry, me, idx, depth_of(idx));
+  if (false == promote_mapped_node_array(me)) {
+    PROBE3(rotate_left_return, me, -1, 0);
+    return -1;
+  }
+
+  if (false == NODE_IS_VALID(me, right_child_of(idx))
+      && false == deepen_node_array(me, rotation_limit(me))) {
+    PROBE3(rotate_left_return, me, -1, 0);
+    return -1;
+  }
+  if (false == ensure_shift_fits(me, left_child_of(idx),
+        left_child_of(left_child_of(idx)))
+      || false == ensure_shift_fits(me, left_child_of(right_child_of(idx)),
+        right_child_of(left_child_of(idx)))) {
+    PROBE3(rotate_left_return, me, -1, 0);
+    return -1;
+  }
+
+  PHASE_BEGIN(me, SHIFT);
+  perform_downward_shift(me, left_child_of(idx),
+    left_child_of(left_child_of(idx)));
+  node_copy(me, left_child_of(idx), idx);
+  perform_downward_shift(me, left_child_of(right_child_of(idx)),
+    right_child_of(left_child_of(idx)));
+  if (true == NODE_IS_VALID(me, left_child_of(right_child_of(idx)))) {
+    node_clear(me, left_child_of(right_child_of(idx)));
+  }
+  perform_upward_shift(me, right_child_of(idx), idx);
+  if (NULL != me->subtree_counts) {
+    refresh_subtree_count(me, left_child_of(idx));
+    refresh_subtree_count(me, idx);
+  }
+  PHASE_END(me, SHIFT);
+  STATS_INC(me, rotations);
+  HISTOGRAM_RECORD(me, ROTATION_NODES_MOVED,
+    (me->moved_node_count - moved_node_count));
+
+  new_idx = right_child_of(idx);
+  PROBE3(rotate_left_return, me, new_idx,
+    (me->moved_node_count - moved_node_count));
+
+  return new_idx;
+
+} /* ngds_array_splay_tree_rotate_left() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_rotate_right (
+  ngds_array_splay_tree_t* me,
+  int idx
+) {
+  uint64_t moved_node_count = me->moved_node_count;
+  int      new_idx;
+
+  PROBE3(rotate_right_entry, me, idx, depth_of(idx));
+  if (false == promote_mapped_node_array(me)) {
+    PROBE3(rotate_right_return, me, -1, 0);
+    return -1;
+  }
+
+  if (false == NODE_IS_VALID(me, right_child_of(idx))
+      && false == deepen_node_array(me, rotation_limit(me))) {
+    PROBE3(rotate_right_return, me, -1, 0);
+    return -1;
+  }
+  if (false == ensure_shift_fits(me, right_child_of(idx),
+        right_child_of(right_child_of(idx)))
+      || false == ensure_shift_fits(me, right_child_of(left_child_of(idx)),
+        left_child_of(right_child_of(idx)))) {
+    PROBE3(rotate_right_return, me, -1, 0);
+    return -1;
+  }
+
+  PHASE_BEGIN(me, SHIFT);
+  perform_downward_shift(me, right_child_of(idx),
+    right_child_of(right_child_of(idx)));
+  node_copy(me, right_child_of(idx), idx);
+  perform_downward_shift(me, right_child_of(left_child_of(idx)),
+    left_child_of(right_child_of(idx)));
+  if (true == NODE_IS_VALID(me, right_child_of(left_child_of(idx)))) {
+    node_clear(me, right_child_of(left_child_of(idx)));
+  }
+  perform_upward_shift(me, left_child_of(idx), idx);
+  if (NULL != me->subtree_counts) {
+    refresh_subtree_count(me, right_child_of(idx));
+    refresh_subtree_count(me, idx);
+  }
+  PHASE_END(me, SHIFT);
+  STATS_INC(me, rotations);
+  HISTOGRAM_RECORD(me, ROTATION_NODES_MOVED,
+    (me->moved_node_count - moved_node_count));
+
+  new_idx = left_child_of(idx);
+  PROBE3(rotate_right_return, me, new_idx,
+    (me->moved_node_count - moved_node_count));
+
+  return new_idx;
+
+} /* ngds_array_splay_tree_rotate_right() */
+
+/* ------------------------------------------------------------------------- */
+
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_PHASE_HOOKS
+
+void
+ngds_array_splay_tree_set_phase_hook (
+  ngds_array_splay_tree_t    *me,
+  ngds_phase_hook_fptr        hook,
+  void                       *context
+) {
+  me->phase_hook = hook;
+  me->phase_hook_context = context;
+} /* ngds_array_splay_tree_set_phase_hook() */
+
+/* ------------------------------------------------------------------------- */
+
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_PHASE_HOOKS */
+
+ngds_array_splay_tree_node_t *
+ngds_array_splay_tree_get_node_at_idx (
+  ngds_array_splay_tree_t    *me,
+  int                         idx
+) {
+  return &me->node_array[idx];
+} /* ngds_array_splay_tree_get_node_at_idx() */
+
+/* ------------------------------------------------------------------------- */
+
+static ngds_array_splay_tree_t *
+perform_tree_creation (
+  const ngds_array_splay_tree_options_t  *options,
+  ngds_malloc_fptr                        mallocfp,
+  ngds_free_fptr                          freefp
+) {
+  ngds_array_splay_tree_t  *me;
+
+  assert((options->initial_element_count > 0));
+  assert(options->compare);
+
+  me = allocate_tree(options->allocator, mallocfp, freefp,
+    options->initial_element_count, options->max_element_count,
+    options->compare);
+  if (NULL == me) {
+    return NULL;
+  }
+  me->key_size = options->key_size;
+  me->value_size = options->value_size;
+  me->key_prefix = options->key_prefix;
+
+  /* Once the node array exists, destroy can release a partial tree */
+  me->node_array = tree_aligned_alloc(me,
+    NODE_ARRAY_SIZE(me->allocated_element_count));
+  if (NULL == me->node_array) {
+    tree_free(me, me, sizeof(ngds_array_splay_tree_t));
+    return NULL;
+  }
+  memset(me->node_array, 0, NODE_ARRAY_SIZE(me->allocated_element_count));
+
+  if (NULL != me->key_prefix) {
+    me->key_prefixes = tree_malloc(me,
+      (me->allocated_element_count * sizeof(uint64_t)));
+    if (NULL == me->key_prefixes) {
+      ngds_array_splay_tree_destroy(me);
+      return NULL;
+    }
+    memset(me->key_prefixes, 0,
+      (me->allocated_element_count * sizeof(uint64_t)));
+  }
+  if (true == options->has_order_statistics) {
+    me->subtree_counts = tree_malloc(me,
+      (me->allocated_element_count * sizeof(int)));
+    if (NULL == me->subtree_counts) {
+      ngds_array_splay_tree_destroy(me);
+      return NULL;
+    }
+    memset(me->subtree_counts, 0,
+      (me->allocated_element_count * sizeof(int)));
+  }
+
+  if (false == allocate_histograms(me)) {
+    ngds_array_splay_tree_destroy(me);
+    return NULL;
+  }
+
+  return me;
+} /* perform_tree_creation() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Split and join move nodes between trees, which only works while the
+ * nodes do not point into memory owned by the tree they leave.
+ */
+static bool
+holds_payload_memory (
+  const ngds_array_splay_tree_t  *me
+) {
+  return (NULL != me->backing_buffers || NULL != me->mapping
+    || NULL != me->shm);
+} /* holds_payload_memory() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Expiry times for every slot, all of them zero */
+static bool
+allocate_expiry_times (
+  ngds_array_splay_tree_t    *me
+) {
+  me->cache.expiry_times = tree_malloc(me,
+    (me->allocated_element_count * sizeof(uint64_t)));
+  if (NULL == me->cache.expiry_times) {
+    return false;
+  }
+  memset(me->cache.expiry_times, 0,
+    (me->allocated_element_count * sizeof(uint64_t)));
+
+  return true;
+} /* allocate_expiry_times() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Tombstone flags for every slot, none of them set */
+static bool
+allocate_tombstones (
+  ngds_array_splay_tree_t    *me
+) {
+  me->tombstones = tree_malloc(me, me->allocated_element_count);
+  if (NULL == me->tombstones) {
+    return false;
+  }
+  memset(me->tombstones, 0, me->allocated_element_count);
+  me->tombstone_count = 0;
+
+  return true;
+} /* allocate_tombstones() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * An empty tree configured like me, allocating the way me does, or NULL
+ * if it could not be allocated. Expiry and lazy removal carry over, but
+ * capacity and the eviction callback do not.
+ */
+static ngds_array_splay_tree_t *
+create_sibling (
+  const ngds_array_splay_tree_t  *me
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_t        *sibling;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = NG_SPLAY_ROOT_INDEX + 1;
+  options.max_element_count = me->max_element_count;
+  options.compare = me->compare;
+  options.key_size = me->key_size;
+  options.value_size = me->value_size;
+  options.key_prefix = me->key_prefix;
+  options.has_order_statistics = (NULL != me->subtree_counts);
+
+  if (NULL != me->legacy_malloc) {
+    sibling = perform_tree_creation(&options, me->legacy_malloc,
+      me->legacy_free);
+  } else {
+    options.allocator = &me->allocator;
+    sibling = perform_tree_creation(&options, NULL, NULL);
+  }
+  if (NULL == sibling) {
+    return NULL;
+  }
+
+  if (NULL != me->cache.expiry_times) {
+    sibling->cache.ttl = me->cache.ttl;
+    if (false == allocate_expiry_times(sibling)) {
+      ngds_array_splay_tree_destroy(sibling);
+      return NULL;
+    }
+  }
+  if (NULL != me->tombstones) {
+    sibling->tombstone_ratio = me->tombstone_ratio;
+    if (false == allocate_tombstones(sibling)) {
+      ngds_array_splay_tree_destroy(sibling);
+      return NULL;
+    }
+  }
+
+  return sibling;
+} /* create_sibling() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Copies the subtree at src_idx of src to dst_idx of dst, one level at a
+ * time: the descendants of a slot on any level are a contiguous run of
+ * slots, so every level is a single block copy, trimmed to the part of
+ * the run that holds nodes. The run of dst must be empty. Returns how
+ * many nodes were copied, or -1 if dst cannot grow to hold them.
+ */
+static int
+copy_subtree_levels (
+  ngds_array_splay_tree_t        *dst,
+  int                             dst_idx,
+  const ngds_array_splay_tree_t  *src,
+  int                             src_idx
+) {
+  int src_first = src_idx;
+  int dst_first = dst_idx;
+  int width = 1;
+  int copied = 0;
+
+  while (src_first < src->allocated_element_count) {
+    int lo = 0;
+    int hi = width;
+    int ii;
+
+    if (hi > (src->allocated_element_count - src_first)) {
+      hi = src->allocated_element_count - src_first;
+    }
+    while (lo < hi && NULL == src->node_array[src_first + lo].key) {
+      ++lo;
+    }
+    while (hi > lo && NULL == src->node_array[src_first + hi - 1].key) {
+      --hi;
+    }
+
+    /* A level without nodes ends the subtree */
+    if (lo == hi) {
+      break;
+    }
+
+    while ((dst_first + hi) > dst->allocated_element_count) {
+      if (false == grow_node_array(dst)) {
+        return -1;
+      }
+    }
+
+    memcpy(&dst->node_array[dst_first + lo], &src->node_array[src_first + lo],
+      NODE_ARRAY_SIZE(hi - lo));
+    if (NULL != dst->key_prefixes && NULL != src->key_prefixes) {
+      memcpy(&dst->key_prefixes[dst_first + lo],
+        &src->key_prefixes[src_first + lo], ((hi - lo) * sizeof(uint64_t)));
+    }
+    if (NULL != dst->subtree_counts && NULL != src->subtree_counts) {
+      memcpy(&dst->subtree_counts[dst_first + lo],
+        &src->subtree_counts[src_first + lo], ((hi - lo) * sizeof(int)));
+    }
+    if (NULL != dst->cache.expiry_times && NULL != src->cache.expiry_times) {
+      memcpy(&dst->cache.expiry_times[dst_first + lo],
+        &src->cache.expiry_times[src_first + lo],
+        ((hi - lo) * sizeof(uint64_t)));
+    }
+    if (NULL != dst->tombstones && NULL != src->tombstones) {
+      memcpy(&dst->tombstones[dst_first + lo],
+        &src->tombstones[src_first + lo], (hi - lo));
+    }
+    for (ii = lo; ii < hi; ++ii) {
+      copied += (NULL != src->node_array[src_first + ii].key);
+    }
+    mark_dirty(dst, (dst_first + lo));
+    mark_dirty(dst, (dst_first + hi - 1));
+
+    src_first = left_child_of(src_first);
+    dst_first = left_child_of(dst_first);
+    width *= 2;
+  }
+
+  return copied;
+} /* copy_subtree_levels() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Copies one node, without its subtrees */
+static void
+copy_node_between (
+  ngds_array_splay_tree_t        *dst,
+  int                             dst_idx,
+  const ngds_array_splay_tree_t  *src,
+  int                             src_idx
+) {
+  dst->node_array[dst_idx] = src->node_array[src_idx];
+  if (NULL != dst->key_prefixes && NULL != src->key_prefixes) {
+    dst->key_prefixes[dst_idx] = src->key_prefixes[src_idx];
+  }
+  if (NULL != dst->cache.expiry_times && NULL != src->cache.expiry_times) {
+    dst->cache.expiry_times[dst_idx] = src->cache.expiry_times[src_idx];
+  }
+  if (NULL != dst->tombstones && NULL != src->tombstones) {
+    dst->tombstones[dst_idx] = src->tombstones[src_idx];
+  }
+  mark_dirty(dst, dst_idx);
+} /* copy_node_between() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Gives me the nodes of donor, and donor the ones of me, so that
+ * destroying donor releases what me held before. Every page of me
+ * counts as modified. Returns false, changing nothing, if the dirty
+ * page bitmap cannot be resized.
+ */
+static bool
+adopt_node_array (
+  ngds_array_splay_tree_t    *me,
+  ngds_array_splay_tree_t    *donor
+) {
+  ngds_array_splay_tree_node_t *node_array = me->node_array;
+  uint64_t                     *key_prefixes = me->key_prefixes;
+  int                          *subtree_counts = me->subtree_counts;
+  uint64_t                     *expiry_times = me->cache.expiry_times;
+  uint8_t                      *tombstones = me->tombstones;
+  int                           tombstone_count = me->tombstone_count;
+  int                           allocated_element_count =
+                                  me->allocated_element_count;
+  int                           utilized_element_count =
+                                  me->utilized_element_count;
+
+  if (NULL != me->dirty_page_bitmap) {
+    size_t    bitmap_size = (BITNSLOTS(((donor->allocated_element_count
+                + NODES_PER_PAGE - 1) / NODES_PER_PAGE)) * sizeof(uint64_t));
+    uint64_t *bitmap = me->dirty_page_bitmap;
+
+    if (bitmap_size > me->dirty_page_bitmap_size_in_bytes) {
+      bitmap = tree_realloc(me, me->dirty_page_bitmap,
+        me->dirty_page_bitmap_size_in_bytes, bitmap_size);
+      if (NULL == bitmap) {
+        return false;
+      }
+      me->dirty_page_bitmap = bitmap;
+      me->dirty_page_bitmap_size_in_bytes = bitmap_size;
+    }
+    memset(me->dirty_page_bitmap, 0xff, me->dirty_page_bitmap_size_in_bytes);
+  }
+
+  me->node_array = donor->node_array;
+  me->key_prefixes = donor->key_prefixes;
+  me->subtree_counts = donor->subtree_counts;
+  me->cache.expiry_times = donor->cache.expiry_times;
+  me->tombstones = donor->tombstones;
+  me->tombstone_count = donor->tombstone_count;
+  me->allocated_element_count = donor->allocated_element_count;
+  me->utilized_element_count = donor->utilized_element_count;
+
+  donor->node_array = node_array;
+  donor->key_prefixes = key_prefixes;
+  donor->subtree_counts = subtree_counts;
+  donor->cache.expiry_times = expiry_times;
+  donor->tombstones = tombstones;
+  donor->tombstone_count = tombstone_count;
+  donor->allocated_element_count = allocated_element_count;
+  donor->utilized_element_count = utilized_element_count;
+
+  return true;
+} /* adopt_node_array() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Lays out the sorted nodes [lo, hi] as a balanced subtree at idx, the
+ * median at the root of every subtree, counting them as it goes. Their
+ * expiry times, when the tree keeps them, come from the matching
+ * entries of expiry_times.
+ */
+static void
+place_sorted_nodes (
+  ngds_array_splay_tree_t            *me,
+  const ngds_array_splay_tree_node_t *sorted,
+  const uint64_t                     *expiry_times,
+  int                                 lo,
+  int                                 hi,
+  int                                 idx
+) {
+  int mid;
+
+  if (lo > hi) {
+    return;
+  }
+
+  mid = lo + ((hi - lo) / 2);
+  me->node_array[idx] = sorted[mid];
+  if (NULL != me->key_prefixes) {
+    me->key_prefixes[idx] = me->key_prefix(node_key(me, &sorted[mid]));
+  }
+  if (NULL != me->subtree_counts) {
+    me->subtree_counts[idx] = hi - lo + 1;
+  }
+  if (NULL != me->cache.expiry_times) {
+    me->cache.expiry_times[idx] = expiry_times[mid];
+  }
+  mark_dirty(me, idx);
+  place_sorted_nodes(me, sorted, expiry_times, lo, (mid - 1),
+    left_child_of(idx));
+  place_sorted_nodes(me, sorted, expiry_times, (mid + 1), hi,
+    right_child_of(idx));
+} /* place_sorted_nodes() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Levels a balanced tree of count nodes fills */
+static inline int
+balanced_levels (
+  int                         count
+) {
+  int levels = 0;
+
+  while ((1LL << levels) <= count) {
+    ++levels;
+  }
+  return levels;
+} /* balanced_levels() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Swaps the nodes of me for an empty array of exactly that many levels,
+ * which the caller then fills in. Returns false, leaving me as it was,
+ * if those levels exceed the maximum size or memory runs out.
+ */
+static bool
+replace_node_array (
+  ngds_array_splay_tree_t    *me,
+  int                         levels
+) {
+  ngds_array_splay_tree_t  *rebuilt;
+  int64_t                   element_count;
+
+  element_count = NG_SPLAY_ROOT_INDEX + (1LL << levels) - 1;
+  if (element_count < (NG_SPLAY_ROOT_INDEX + 1)) {
+    element_count = NG_SPLAY_ROOT_INDEX + 1;
+  }
+
+  rebuilt = create_sibling(me);
+  if (NULL == rebuilt) {
+    return false;
+  }
+  if (element_count > me->max_element_count
+      || false == resize_node_array(rebuilt, (int) element_count)
+      || false == adopt_node_array(me, rebuilt)) {
+    printf("%s/%d: Tree is at its maximum size (%d)\n",
+      __PRETTY_FUNCTION__, __LINE__, me->max_element_count);
+    ngds_array_splay_tree_destroy(rebuilt);
+    return false;
+  }
+  ngds_array_splay_tree_destroy(rebuilt);
+
+  return true;
+} /* replace_node_array() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Replaces the nodes of me with the count sorted ones, laid out as a
+ * balanced tree over just enough whole levels. Returns false, leaving me
+ * as it was, if that many levels exceed the maximum size.
+ */
+static bool
+rebuild_balanced (
+  ngds_array_splay_tree_t            *me,
+  const ngds_array_splay_tree_node_t *sorted,
+  const uint64_t                     *expiry_times,
+  int                                 count
+) {
+  if (false == replace_node_array(me, balanced_levels(count))) {
+    return false;
+  }
+
+  place_sorted_nodes(me, sorted, expiry_times, 0, (count - 1),
+    NG_SPLAY_ROOT_INDEX);
+  me->utilized_element_count = count;
+
+  return true;
+} /* rebuild_balanced() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Nodes in the subtree at idx */
+static int
+count_subtree_nodes (
+  const ngds_array_splay_tree_t  *me,
+  int                             idx
+) {
+  if (false == NODE_IS_PRESENT(me, idx)) {
+    return 0;
+  }
+  return 1 + count_subtree_nodes(me, left_child_of(idx))
+    + count_subtree_nodes(me, right_child_of(idx));
+} /* count_subtree_nodes() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+clear_subtree (
+  ngds_array_splay_tree_t    *me,
+  int                         idx
+) {
+  if (false == NODE_IS_PRESENT(me, idx)) {
+    return;
+  }
+  clear_subtree(me, left_child_of(idx));
+  clear_subtree(me, right_child_of(idx));
+  node_clear(me, idx);
+} /* clear_subtree() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Whole levels the node array holds */
+static int
+complete_levels (
+  const ngds_array_splay_tree_t  *me
+) {
+  int levels = 0;
+
+  while ((NG_SPLAY_ROOT_INDEX + (2LL << levels) - 1)
+      <= me->allocated_element_count) {
+    ++levels;
+  }
+  return levels;
+} /* complete_levels() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Makes room for a node below parent when the array cannot deepen, as a
+ * scapegoat tree would: the lowest ancestor of parent whose subtree,
+ * laid out balanced, leaves a level free below it is rebuilt in place.
+ * Only that subtree is read and written. Tombstones must have been
+ * compacted first. Returns false if no ancestor has room or memory runs
+ * out, leaving me as it was.
+ */
+static bool
+rebuild_scapegoat (
+  ngds_array_splay_tree_t    *me,
+  int                         parent
+) {
+  ngds_array_splay_tree_node_t *sorted;
+  uint64_t                     *expiry_times = NULL;
+  size_t                        sorted_size;
+  size_t                        expiry_times_size = 0;
+  int                           levels = complete_levels(me);
+  int                           idx = parent;
+  int                           count = count_subtree_nodes(me, parent);
+  int                           current;
+  int                           ii;
+
+  while ((depth_of(idx) + balanced_levels(count)) >= levels) {
+    int sibling;
+
+    if (NG_SPLAY_ROOT_INDEX == idx) {
+      return false;
+    }
+    sibling = (left_child_of(parent_of(idx)) == idx)
+      ? right_child_of(parent_of(idx)) : left_child_of(parent_of(idx));
+    count += 1 + count_subtree_nodes(me, sibling);
+    idx = parent_of(idx);
+  }
+
+  sorted_size = NODE_ARRAY_SIZE(count);
+  sorted = tree_malloc(me, sorted_size);
+  if (NULL == sorted) {
+    return false;
+  }
+  if (NULL != me->cache.expiry_times) {
+    expiry_times_size = count * sizeof(uint64_t);
+    expiry_times = tree_malloc(me, expiry_times_size);
+    if (NULL == expiry_times) {
+      tree_free(me, sorted, sorted_size);
+      return false;
+    }
+  }
+
+  current = subtree_min(me, idx);
+  for (ii = 0; ii < count; ++ii) {
+    if (NULL != expiry_times) {
+      expiry_times[ii] = me->cache.expiry_times[current];
+    }
+    sorted[ii] = me->node_array[current];
+    current = inorder_successor(me, current);
+  }
+
+  clear_subtree(me, idx);
+  place_sorted_nodes(me, sorted, expiry_times, 0, (count - 1), idx);
+  STATS_INC(me, rebuilds);
+
+  tree_free(me, sorted, sorted_size);
+  if (NULL != expiry_times) {
+    tree_free(me, expiry_times, expiry_times_size);
+  }
+
+  return true;
+} /* rebuild_scapegoat() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Lays out the sorted nodes [lo, hi] at idx within levels levels, the
+ * count hot ones at positions, ascending, as close to the top as that
+ * allows. Every subtree takes as its root the hottest node, by lowest
+ * hot_rank, that leaves both sides small enough for the levels below,
+ * or else the median. With hot ranks in level order, a shape exported
+ * from a tree comes back as it was wherever it fits.
+ */
+static void
+place_warm_nodes (
+  ngds_array_splay_tree_t            *me,
+  const ngds_array_splay_tree_node_t *sorted,
+  const uint64_t                     *expiry_times,
+  const int                          *hot_rank,
+  const int                          *positions,
+  int                                 count,
+  int                                 lo,
+  int                                 hi,
+  int                                 idx,
+  int                                 levels
+) {
+  int64_t half;
+  int     best = -1;
+  int     below = 0;
+  int     mid;
+  int     ii;
+
+  if (0 == count) {
+    place_sorted_nodes(me, sorted, expiry_times, lo, hi, idx);
+    return;
+  }
+
+  /* Nodes either side may fill no more than the levels below */
+  half = (1LL << (levels - 1)) - 1;
+
+  for (ii = 0; ii < count; ++ii) {
+    int position = positions[ii];
+
+    if ((position - lo) <= half && (hi - position) <= half
+        && (-1 == best || hot_rank[position] < hot_rank[positions[best]])) {
+      best = ii;
+    }
+  }
+  if (-1 == best) {
+    mid = lo + ((hi - lo) / 2);
+    while (below < count && positions[below] < mid) {
+      ++below;
+    }
+  } else {
+    mid = positions[best];
+    below = best;
+  }
+
+  me->node_array[idx] = sorted[mid];
+  if (NULL != me->key_prefixes) {
+    me->key_prefixes[idx] = me->key_prefix(node_key(me, &sorted[mid]));
+  }
+  if (NULL != me->subtree_counts) {
+    me->subtree_counts[idx] = hi - lo + 1;
+  }
+  if (NULL != me->cache.expiry_times) {
+    me->cache.expiry_times[idx] = expiry_times[mid];
+  }
+
+  place_warm_nodes(me, sorted, expiry_times, hot_rank, positions, below,
+    lo, (mid - 1), left_child_of(idx), (levels - 1));
+  ii = below + ((-1 == best) ? 0 : 1);
+  place_warm_nodes(me, sorted, expiry_times, hot_rank, &positions[ii],
+    (count - ii), (mid + 1), hi, right_child_of(idx), (levels - 1));
+} /* place_warm_nodes() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Lays the live nodes out again as a balanced tree over just enough
+ * levels, dropping any tombstones. Returns false, leaving me as it was,
+ * if memory runs out.
+ */
+static bool
+rebuild_live_nodes (
+  ngds_array_splay_tree_t    *me
+) {
+  ngds_array_splay_tree_cursor_t  cursor;
+  ngds_array_splay_tree_node_t   *sorted;
+  uint64_t                       *expiry_times = NULL;
+  size_t                          sorted_size;
+  size_t                          expiry_times_size = 0;
+  bool                            has_next;
+  bool                            is_rebuilt;
+  int                             count = 0;
+
+  if (false == promote_mapped_node_array(me)) {
+    return false;
+  }
+
+  sorted_size = NODE_ARRAY_SIZE(LIVE_ELEMENT_COUNT(me));
+  sorted = tree_malloc(me, sorted_size);
+  if (NULL == sorted && 0 < sorted_size) {
+    return false;
+  }
+  if (NULL != me->cache.expiry_times) {
+    expiry_times_size = LIVE_ELEMENT_COUNT(me) * sizeof(uint64_t);
+    expiry_times = tree_malloc(me, expiry_times_size);
+    if (NULL == expiry_times && 0 < expiry_times_size) {
+      tree_free(me, sorted, sorted_size);
+      return false;
+    }
+  }
+
+  for (has_next = ngds_array_splay_tree_cursor_first(me, &cursor)
+        ; true == has_next
+        ; has_next = ngds_array_splay_tree_cursor_next(&cursor)) {
+    if (NULL != expiry_times) {
+      expiry_times[count] = me->cache.expiry_times[cursor.idx];
+    }
+    sorted[count++] = me->node_array[cursor.idx];
+  }
+
+  is_rebuilt = rebuild_balanced(me, sorted, expiry_times, count);
+  tree_free(me, sorted, sorted_size);
+  if (NULL != expiry_times) {
+    tree_free(me, expiry_times, expiry_times_size);
+  }
+
+  return is_rebuilt;
+} /* rebuild_live_nodes() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Drops every tombstone at once, rebuilding the live nodes as a balanced
+ * tree. Returns false, leaving me as it was, if memory runs out.
+ */
+static bool
+compact_tombstones (
+  ngds_array_splay_tree_t    *me
+) {
+  if (0 == me->tombstone_count) {
+    return true;
+  }
+  if (false == rebuild_live_nodes(me)) {
+    return false;
+  }
+  STATS_INC(me, compactions);
+
+  return true;
+} /* compact_tombstones() */
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTIONS ----------------------------------------------------- */
+/* ========================================================================= */
+
+ngds_array_splay_tree_t *
+ngds_array_splay_tree_new (
+  int                   initial_element_count,
+  ngds_comparator_fptr  comparefp,
+  ngds_malloc_fptr      mallocfp,
+  ngds_free_fptr        freefp
+) {
+  ngds_array_splay_tree_options_t options;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = initial_element_count;
+  options.compare = comparefp;
+
+  return perform_tree_creation(&options, mallocfp, freefp);
+} /* ngds_array_splay_tree_new() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_array_splay_tree_options_init (
+  ngds_array_splay_tree_options_t  *options
+) {
+  memset(options, 0, sizeof(ngds_array_splay_tree_options_t));
+  options->max_element_count = NGDS_ARRAY_SPLAY_TREE_DEFAULT_MAX_ELEMENT_COUNT;
+} /* ngds_array_splay_tree_options_init() */
+
+/* ------------------------------------------------------------------------- */
+
+ngds_array_splay_tree_t *
+ngds_array_splay_tree_new_with_options (
+  const ngds_array_splay_tree_options_t  *options
+) {
+  return perform_tree_creation(options, NULL, NULL);
+} /* ngds_array_splay_tree_new_with_options() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_array_splay_tree_destroy (
+  ngds_array_splay_tree_t    *me
+) {
+  if (NULL != me->trace) {
+    ngds_array_splay_tree_trace_stop(me);
+  }
+  ngds_array_splay_tree_profile_stop(me);
+  release_backing_buffers(me);
+  if (false == me->node_array_is_mapped && NULL == me->shm) {
+    tree_free(me, me->node_array,
+      NODE_ARRAY_SIZE(me->allocated_element_count));
+  }
+  if (NULL != me->mapping) {
+    munmap(me->mapping, me->mapping_size);
+  }
+  if (NULL != me->dirty_page_bitmap) {
+    tree_free(me, me->dirty_page_bitmap,
+      me->dirty_page_bitmap_size_in_bytes);
+  }
+  if (NULL != me->key_prefixes) {
+    tree_free(me, me->key_prefixes,
+      (me->allocated_element_count * sizeof(uint64_t)));
+  }
+  if (NULL != me->subtree_counts) {
+    tree_free(me, me->subtree_counts,
+      (me->allocated_element_count * sizeof(int)));
+  }
+  if (NULL != me->cache.expiry_times) {
+    tree_free(me, me->cache.expiry_times,
+      (me->allocated_element_count * sizeof(uint64_t)));
+  }
+  if (NULL != me->tombstones) {
+    tree_free(me, me->tombstones, me->allocated_element_count);
+  }
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_STATS
+  if (NULL != me->histogram_shards) {
+    tree_free(me, me->histogram_shards,
+      (NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_SHARDS
+        * sizeof(ngds_array_splay_tree_histogram_shard_t)));
+  }
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+  tree_free(me, me, sizeof(ngds_array_splay_tree_t));
+} /* ngds_array_splay_tree_destroy() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_clear (
+  ngds_array_splay_tree_t    *me
+) {
+  if (false == promote_mapped_node_array(me)) {
+    return -1;
+  }
+  me->utilized_element_count = 0;
+  memset(me->node_array, 0,
+    (me->allocated_element_count * sizeof(ngds_array_splay_tree_node_t)));
+  if (NULL != me->key_prefixes) {
+    memset(me->key_prefixes, 0,
+      (me->allocated_element_count * sizeof(uint64_t)));
+  }
+  if (NULL != me->subtree_counts) {
+    memset(me->subtree_counts, 0,
+      (me->allocated_element_count * sizeof(int)));
+  }
+  if (NULL != me->cache.expiry_times) {
+    memset(me->cache.expiry_times, 0,
+      (me->allocated_element_count * sizeof(uint64_t)));
+  }
+  if (NULL != me->tombstones) {
+    memset(me->tombstones, 0, me->allocated_element_count);
+  }
+  me->tombstone_count = 0;
+  release_backing_buffers(me);
+  if (NULL != me->dirty_page_bitmap) {
+    memset(me->dirty_page_bitmap, 0xff, me->dirty_page_bitmap_size_in_bytes);
+  }
+
+  return 0;
+} /* ngds_array_splay_tree_clear() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_array_splay_tree_print (
+  ngds_array_splay_tree_t    *me,
+  ngds_node_printer           print_cb
+) {
+  printf("SPLAY Tree:\n");
+  perform_tree_print(me, print_cb, NG_SPLAY_ROOT_INDEX, 0);
+} /* ngds_array_splay_tree_print() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_insert (
+  ngds_array_splay_tree_t    *me,
+  void                       *key,
+  void                       *value,
+  bool                        should_perform_splay
+) {
+  bool                          key_was_found = false;
+  int                           current;
+  uint64_t                      moved_node_count = me->moved_node_count;
+
+  PROBE2(insert_entry, me, key);
+  if (false == promote_mapped_node_array(me)) {
+    PROBE4(insert_return, me, -1, 0, 0);
+    return -1;
+  }
+
+  /* After any evictions it causes, which are traced as removals */
+  current = locate_insertion_slot(me, key, &key_was_found);
+  TRACE_RECORD(me, INSERT, key, should_perform_splay);
+  if (-1 == current) {
+    PROBE4(insert_return, me, -1, 0, 0);
+    return -1;
+  }
+
+  if (false == node_store(me, current, key, value, key_was_found)) {
+    PROBE4(insert_return, me, -1, depth_of(current), 0);
+    return -1;
+  }
+
+  complete_insertion(me, current, key, key_was_found, should_perform_splay);
+  PROBE4(insert_return, me, current, depth_of(current),
+    (me->moved_node_count - moved_node_count));
+
+  return 0;
+
+} /* ngds_array_splay_tree_insert() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_upsert (
+  ngds_array_splay_tree_t    *me,
+  void                       *key,
+  ngds_upsert_fptr            updatefp,
+  void                       *context,
+  bool                        should_perform_splay,
+  void                      **stored_value
+) {
+  bool                          key_was_found = false;
+  void                         *value = NULL;
+  int                           current;
+
+  if (false == promote_mapped_node_array(me)) {
+    return -1;
+  }
+
+  current = locate_insertion_slot(me, key, &key_was_found);
+  TRACE_RECORD(me, INSERT, key, should_perform_splay);
+  if (-1 == current) {
+    return -1;
+  }
+
+  if (true == key_was_found) {
+    value = node_value(me, &me->node_array[current]);
+  }
+  value = updatefp(key, value, key_was_found, context);
+
+  if (false == node_store(me, current, key, value, key_was_found)) {
+    return -1;
+  }
+
+  current = complete_insertion(me, current, key, key_was_found,
+    should_perform_splay);
+  if (NULL != stored_value) {
+    *stored_value = node_value(me, &me->node_array[current]);
+  }
+
+  return (true == key_was_found) ? 0 : 1;
+
+} /* ngds_array_splay_tree_upsert() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_get_or_insert (
+  ngds_array_splay_tree_t    *me,
+  void                       *key,
+  void                       *value,
+  bool                        should_perform_splay,
+  void                      **stored_value
+) {
+  bool                          key_was_found = false;
+  int                           current;
+
+  if (false == promote_mapped_node_array(me)) {
+    return -1;
+  }
+
+  current = locate_insertion_slot(me, key, &key_was_found);
+  TRACE_RECORD(me, INSERT, key, should_perform_splay);
+  if (-1 == current) {
+    return -1;
+  }
+
+  if (false == key_was_found
+      && false == node_store(me, current, key, value, false)) {
+    return -1;
+  }
+
+  current = complete_insertion(me, current, key, key_was_found,
+    should_perform_splay);
+  if (NULL != stored_value) {
+    *stored_value = node_value(me, &me->node_array[current]);
+  }
+
+  return (true == key_was_found) ? 0 : 1;
+
+} /* ngds_array_splay_tree_get_or_insert() */
+
+/* ------------------------------------------------------------------------- */
+
+void *
+ngds_array_splay_tree_get (
+  ngds_array_splay_tree_t    *me,
+  const void                 *key,
+  bool                        should_perform_splay
+) {
+  int                           current;
+  uint64_t                      prefix = search_prefix(me, key);
+  uint64_t                      moved_node_count = me->moved_node_count;
+  void                         *value;
+
+  PROBE2(get_entry, me, key);
+  TRACE_RECORD(me, GET, key, should_perform_splay);
+  PHASE_BEGIN(me, DESCENT);
+  current = search_from_finger(me, key, prefix);
+  PHASE_END(me, DESCENT);
+  place_finger(me, current);
+
+  if (false == NODE_IS_VALID(me, current)
+      || true == NODE_IS_EMPTY(me, current)
+      || true == expire_if_due(me, current)
+      || NODE_IS_TOMBSTONE(me, current)) {
+    STATS_INC(me, get_misses);
+    PROFILE_SAMPLE(me, key, -1);
+    PROBE4(get_return, me, -1, depth_of(current), 0);
+    return NULL;
+  }
+  STATS_INC(me, get_hits);
+  HISTOGRAM_RECORD(me, GET_DEPTH, depth_of(current));
+  PROFILE_SAMPLE(me, key, depth_of(current));
+
+  if (true == me->adaptive.is_enabled) {
+    should_perform_splay = adaptive_should_splay(me, &current);
+  }
+  /* An opened tree that cannot be copied out of its mapping stays put */
+  if (true == should_perform_splay
+      && true == promote_mapped_node_array(me)) {
+    int found = current;
+
+    current = perform_splay_operation(me, current);
+    place_finger(me, current);
+    value = node_value(me, &me->node_array[current]);
+    PROBE4(get_return, me, found, depth_of(found),
+      (me->moved_node_count - moved_node_count));
+  } else {
+    value = node_value(me, &me->node_array[current]);
+    PROBE4(get_return, me, current, depth_of(current), 0);
+  }
+
+  return value;
+
+} /* ngds_array_splay_tree_get() */
+
+/* ------------------------------------------------------------------------- */
+
+void *
+ngds_array_splay_tree_get_ref (
+  ngds_array_splay_tree_t    *me,
+  const void                 *key,
+  bool                        should_perform_splay
+) {
+  int                           current;
+  uint64_t                      prefix = search_prefix(me, key);
+
+  /* Stored offsets would be overwritten by pointers */
+  if (NULL != me->shm) {
+    printf("%s/%d: Values are stored as offsets\n",
+      __PRETTY_FUNCTION__, __LINE__);
+    return NULL;
+  }
+
+  /* The caller writes to the slot, which holds offsets until promoted */
+  if (false == promote_mapped_node_array(me)) {
+    return NULL;
+  }
+
+  TRACE_RECORD(me, GET, key, should_perform_splay);
+  current = search_from_finger(me, key, prefix);
+  place_finger(me, current);
+
+  if (false == NODE_IS_VALID(me, current)
+      || true == NODE_IS_EMPTY(me, current)
+      || true == expire_if_due(me, current)
+      || NODE_IS_TOMBSTONE(me, current)) {
+    STATS_INC(me, get_misses);
+    PROFILE_SAMPLE(me, key, -1);
+    return NULL;
+  }
+  STATS_INC(me, get_hits);
+  HISTOGRAM_RECORD(me, GET_DEPTH, depth_of(current));
+  PROFILE_SAMPLE(me, key, depth_of(current));
+
+  if (true == me->adaptive.is_enabled) {
+    should_perform_splay = adaptive_should_splay(me, &current);
+  }
+  if (true == should_perform_splay) {
+    current = perform_splay_operation(me, current);
+    place_finger(me, current);
+  }
+  mark_dirty(me, current);
+
+  if (0 < me->value_size) {
+    return node_value(me, &me->node_array[current]);
+  }
+  return &me->node_array[current].value;
+
+} /* ngds_array_splay_tree_get_ref() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_cardinality (
+  ngds_array_splay_tree_t    *me
+) {
+  return LIVE_ELEMENT_COUNT(me);
+}
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_size (
+  ngds_array_splay_tree_t* me
+) {
+  return me->allocated_element_count;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void *
+ngds_array_splay_tree_remove (
+  ngds_array_splay_tree_t    *me,
+  void                       *key
+) {
+  ngds_array_splay_tree_node_t *node;
+  int                           current = NG_SPLAY_ROOT_INDEX;
+  int                           cmp = 0;
+  uint64_t                      prefix;
+  uint64_t                      moved_node_count = me->moved_node_count;
+
+  PROBE2(remove_entry, me, key);
+  TRACE_RECORD(me, REMOVE, key, false);
+  if (false == promote_mapped_node_array(me)) {
+    PROBE4(remove_return, me, -1, 0, 0);
+    return NULL;
+  }
+
+  prefix = search_prefix(me, key);
+  while (true == NODE_IS_VALID(me, current)
+          && false == NODE_IS_EMPTY(me, current)) {
+    node = &me->node_array[current];
+    cmp = node_compare(me, current, key, prefix);
+    if (0 == cmp) {
+      break;
+    } else if (0 > cmp) {
+      current = left_child_of(current);
+    } else {
+      current = right_child_of(current);
+    }
+  }
+
+  if (false == NODE_IS_VALID(me, current)
+      || true == NODE_IS_EMPTY(me, current)
+      || NODE_IS_TOMBSTONE(me, current)) {
+    STATS_INC(me, remove_misses);
+    PROBE4(remove_return, me, -1, depth_of(current), 0);
+    return NULL;
+  }
+  STATS_INC(me, remove_hits);
+
+  void *k = (0 < me->key_size) ? key : node_key(me, node);
+
+  /* Lazily, the node stays where it is until enough of them pile up */
+  if (NULL != me->tombstones) {
+    me->tombstones[current] = 1;
+    ++me->tombstone_count;
+    mark_dirty(me, current);
+    refresh_subtree_counts_to_root(me, current);
+    if (me->tombstone_count
+        > (me->tombstone_ratio * me->utilized_element_count)) {
+      compact_tombstones(me);
+    }
+    PROBE4(remove_return, me, current, depth_of(current), 0);
+    return k;
+  }
+
+  remove_node_at(me, current);
+  PROBE4(remove_return, me, current, depth_of(current),
+    (me->moved_node_count - moved_node_count));
+
+  return k;
+
+} /* ngds_array_splay_tree_remove() */
+
+/* ------------------------------------------------------------------------- */
+
+bool
+ngds_array_splay_tree_cursor_first (
+  ngds_array_splay_tree_t          *me,
+  ngds_array_splay_tree_cursor_t   *cursor
+) {
+  cursor->tree = me;
+  cursor->idx = -1;
+  if (NODE_IS_PRESENT(me, NG_SPLAY_ROOT_INDEX)) {
+    cursor->idx = skip_tombstones(me, subtree_min(me, NG_SPLAY_ROOT_INDEX),
+      false);
+  }
+  return (-1 != cursor->idx);
+} /* ngds_array_splay_tree_cursor_first() */
+
+/* ------------------------------------------------------------------------- */
+
+bool
+ngds_array_splay_tree_cursor_last (
+  ngds_array_splay_tree_t          *me,
+  ngds_array_splay_tree_cursor_t   *cursor
+) {
+  cursor->tree = me;
+  cursor->idx = -1;
+  if (NODE_IS_PRESENT(me, NG_SPLAY_ROOT_INDEX)) {
+    cursor->idx = skip_tombstones(me, subtree_max(me, NG_SPLAY_ROOT_INDEX),
+      true);
+  }
+  return (-1 != cursor->idx);
+} /* ngds_array_splay_tree_cursor_last() */
+
+/* ------------------------------------------------------------------------- */
+
+bool
+ngds_array_splay_tree_cursor_seek (
+  ngds_array_splay_tree_t          *me,
+  ngds_array_splay_tree_cursor_t   *cursor,
+  const void                       *key
+) {
+  return ngds_array_splay_tree_cursor_lower_bound(me, cursor, key);
+} /* ngds_array_splay_tree_cursor_seek() */
+
+/* ------------------------------------------------------------------------- */
+
+bool
+ngds_array_splay_tree_cursor_lower_bound (
+  ngds_array_splay_tree_t          *me,
+  ngds_array_splay_tree_cursor_t   *cursor,
+  const void                       *key
+) {
+  cursor->tree = me;
+  cursor->idx = skip_tombstones(me, bound_search(me, key, false, true),
+    false);
+  return (-1 != cursor->idx);
+} /* ngds_array_splay_tree_cursor_lower_bound() */
+
+/* ------------------------------------------------------------------------- */
+
+bool
+ngds_array_splay_tree_cursor_upper_bound (
+  ngds_array_splay_tree_t          *me,
+  ngds_array_splay_tree_cursor_t   *cursor,
+  const void                       *key
+) {
+  cursor->tree = me;
+  cursor->idx = skip_tombstones(me, bound_search(me, key, false, false),
+    false);
+  return (-1 != cursor->idx);
+} /* ngds_array_splay_tree_cursor_upper_bound() */
+
+/* ------------------------------------------------------------------------- */
+
+bool
+ngds_array_splay_tree_cursor_next (
+  ngds_array_splay_tree_cursor_t   *cursor
+) {
+  if (-1 != cursor->idx) {
+    cursor->idx = skip_tombstones(cursor->tree,
+      inorder_successor(cursor->tree, cursor->idx), false);
+  }
+  return (-1 != cursor->idx);
+} /* ngds_array_splay_tree_cursor_next() */
+
+/* ------------------------------------------------------------------------- */
+
+bool
+ngds_array_splay_tree_cursor_prev (
+  ngds_array_splay_tree_cursor_t   *cursor
+) {
+  if (-1 != cursor->idx) {
+    cursor->idx = skip_tombstones(cursor->tree,
+      inorder_predecessor(cursor->tree, cursor->idx), true);
+  }
+  return (-1 != cursor->idx);
+} /* ngds_array_splay_tree_cursor_prev() */
+
+/* ------------------------------------------------------------------------- */
+
+void *
+ngds_array_splay_tree_cursor_key (
+  const ngds_array_splay_tree_cursor_t *cursor
+) {
+  if (-1 == cursor->idx) {
+    return NULL;
+  }
+  return node_key(cursor->tree, &cursor->tree->node_array[cursor->idx]);
+} /* ngds_array_splay_tree_cursor_key() */
+
+/* ------------------------------------------------------------------------- */
+
+void *
+ngds_array_splay_tree_cursor_value (
+  const ngds_array_splay_tree_cursor_t *cursor
+) {
+  if (-1 == cursor->idx) {
+    return NULL;
+  }
+  return node_value(cursor->tree, &cursor->tree->node_array[cursor->idx]);
+} /* ngds_array_splay_tree_cursor_value() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shared by floor and ceil: reports the key found at idx, splaying it
+ * first if asked, and returns its value.
+ */
+static void *
+bound_result (
+  ngds_array_splay_tree_t    *me,
+  int                         idx,
+  bool                        should_perform_splay,
+  void                      **found_key
+) {
+  if (-1 == idx) {
+    STATS_INC(me, get_misses);
+    if (NULL != found_key) {
+      *found_key = NULL;
+    }
+    return NULL;
+  }
+  STATS_INC(me, get_hits);
+  HISTOGRAM_RECORD(me, GET_DEPTH, depth_of(idx));
+
+  if (true == me->adaptive.is_enabled) {
+    should_perform_splay = adaptive_should_splay(me, &idx);
+  }
+  if (true == should_perform_splay
+      && true == promote_mapped_node_array(me)) {
+    idx = perform_splay_operation(me, idx);
+  }
+  if (NULL != found_key) {
+    *found_key = node_key(me, &me->node_array[idx]);
+  }
+  return node_value(me, &me->node_array[idx]);
+} /* bound_result() */
+
+/* ------------------------------------------------------------------------- */
+
+void *
+ngds_array_splay_tree_floor (
+  ngds_array_splay_tree_t    *me,
+  const void                 *key,
+  bool                        should_perform_splay,
+  void                      **found_key
+) {
+  return bound_result(me,
+    skip_tombstones(me, bound_search(me, key, true, true), true),
+    should_perform_splay, found_key);
+} /* ngds_array_splay_tree_floor() */
+
+/* ------------------------------------------------------------------------- */
+
+void *
+ngds_array_splay_tree_ceil (
+  ngds_array_splay_tree_t    *me,
+  const void                 *key,
+  bool                        should_perform_splay,
+  void                      **found_key
+) {
+  return bound_result(me,
+    skip_tombstones(me, bound_search(me, key, false, true), false),
+    should_perform_splay, found_key);
+} /* ngds_array_splay_tree_ceil() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_range (
+  ngds_array_splay_tree_t    *me,
+  const void                 *lo,
+  const void                 *hi,
+  ngds_range_fptr             visitfp,
+  void                       *context,
+  bool                        should_perform_splay
+) {
+  ngds_array_splay_tree_cursor_t  cursor;
+  bool                            is_positioned;
+  int                             first;
+  int                             visited = 0;
+
+  if (NULL == lo) {
+    is_positioned = ngds_array_splay_tree_cursor_first(me, &cursor);
+  } else {
+    is_positioned = ngds_array_splay_tree_cursor_lower_bound(me, &cursor,
+      lo);
+  }
+  if (false == is_positioned) {
+    return 0;
+  }
+  first = cursor.idx;
+
+  do {
+    void *key = ngds_array_splay_tree_cursor_key(&cursor);
+
+    if (NULL != hi && 0 <= me->compare(key, hi)) {
+      break;
+    }
+    ++visited;
+    if (false == visitfp(key, ngds_array_splay_tree_cursor_value(&cursor),
+          context)) {
+      break;
+    }
+  } while (true == ngds_array_splay_tree_cursor_next(&cursor));
+
+  /* Only once the walk is over, as splaying moves the nodes */
+  if (0 < visited && true == me->adaptive.is_enabled) {
+    should_perform_splay = adaptive_should_splay(me, &first);
+  }
+  if (0 < visited && true == should_perform_splay
+      && true == promote_mapped_node_array(me)) {
+    perform_splay_operation(me, first);
+  }
+
+  return visited;
+} /* ngds_array_splay_tree_range() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The extremes end the spines from the root, and have no child on the
+ * far side, so detaching one only shifts its single subtree up a level.
+ */
+static void *
+peek_extreme (
+  ngds_array_splay_tree_t    *me,
+  bool                        is_max,
+  void                      **key
+) {
+  int idx = -1;
+
+  if (NODE_IS_PRESENT(me, NG_SPLAY_ROOT_INDEX)) {
+    idx = (true == is_max) ? subtree_max(me, NG_SPLAY_ROOT_INDEX)
+      : subtree_min(me, NG_SPLAY_ROOT_INDEX);
+    idx = skip_tombstones(me, idx, is_max);
+  }
+  if (-1 == idx) {
+    if (NULL != key) {
+      *key = NULL;
+    }
+    return NULL;
+  }
+
+  if (NULL != key) {
+    *key = node_key(me, &me->node_array[idx]);
+  }
+  return node_value(me, &me->node_array[idx]);
+} /* peek_extreme() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Detaches the extreme at idx, whose subtree moves up a level */
+static void
+detach_extreme (
+  ngds_array_splay_tree_t    *me,
+  bool                        is_max,
+  int                         idx
+) {
+  if (NODE_IS_TOMBSTONE(me, idx)) {
+    --me->tombstone_count;
+  }
+  --me->utilized_element_count;
+
+  PHASE_BEGIN(me, SHIFT);
+  node_clear(me, idx);
+  perform_upward_shift(me, (true == is_max) ? left_child_of(idx)
+    : right_child_of(idx), idx);
+  refresh_subtree_counts_to_root(me, idx);
+  PHASE_END(me, SHIFT);
+} /* detach_extreme() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Tombstones found at the extreme on the way are compacted away */
+static void *
+pop_extreme (
+  ngds_array_splay_tree_t    *me,
+  bool                        is_max,
+  void                      **key
+) {
+  int idx = -1;
+
+  if (false == promote_mapped_node_array(me)) {
+    if (NULL != key) {
+      *key = NULL;
+    }
+    return NULL;
+  }
+  while (NODE_IS_PRESENT(me, NG_SPLAY_ROOT_INDEX)) {
+    idx = (true == is_max) ? subtree_max(me, NG_SPLAY_ROOT_INDEX)
+      : subtree_min(me, NG_SPLAY_ROOT_INDEX);
+    if (false == NODE_IS_TOMBSTONE(me, idx)) {
+      break;
+    }
+    detach_extreme(me, is_max, idx);
+    idx = -1;
+  }
+  if (-1 == idx) {
+    if (NULL != key) {
+      *key = NULL;
+    }
+    return NULL;
+  }
+
+  me->popped_node = me->node_array[idx];
+  TRACE_RECORD(me, REMOVE, node_key(me, &me->popped_node), false);
+  STATS_INC(me, remove_hits);
+  detach_extreme(me, is_max, idx);
+
+  if (NULL != key) {
+    *key = node_key(me, &me->popped_node);
+  }
+  return node_value(me, &me->popped_node);
+} /* pop_extreme() */
+
+/* ------------------------------------------------------------------------- */
+
+void *
+ngds_array_splay_tree_peek_min (
+  ngds_array_splay_tree_t    *me,
+  void                      **key
+) {
+  return peek_extreme(me, false, key);
+} /* ngds_array_splay_tree_peek_min() */
+
+/* ------------------------------------------------------------------------- */
+
+void *
+ngds_array_splay_tree_peek_max (
+  ngds_array_splay_tree_t    *me,
+  void                      **key
+) {
+  return peek_extreme(me, true, key);
+} /* ngds_array_splay_tree_peek_max() */
+
+/* ------------------------------------------------------------------------- */
+
+void *
+ngds_array_splay_tree_pop_min (
+  ngds_array_splay_tree_t    *me,
+  void                      **key
+) {
+  return pop_extreme(me, false, key);
+} /* ngds_array_splay_tree_pop_min() */
+
+/* ------------------------------------------------------------------------- */
+
+void *
+ngds_array_splay_tree_pop_max (
+  ngds_array_splay_tree_t    *me,
+  void                      **key
+) {
+  return pop_extreme(me, true, key);
+} /* ngds_array_splay_tree_pop_max() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_rank (
+  ngds_array_splay_tree_t    *me,
+  const void                 *key,
+  bool                        should_perform_splay
+) {
+  int                           current = NG_SPLAY_ROOT_INDEX;
+  int                           last = -1;
+  int                           rank = 0;
+  int                           cmp;
+  uint64_t                      prefix;
+
+  if (NULL == me->subtree_counts) {
+    printf("%s/%d: Tree does not keep order statistics\n",
+      __PRETTY_FUNCTION__, __LINE__);
+    return -1;
+  }
+
+  prefix = search_prefix(me, key);
+  while (NODE_IS_PRESENT(me, current)) {
+    last = current;
+    cmp = node_compare(me, current, key, prefix);
+    if (0 == cmp) {
+      rank += subtree_count(me, left_child_of(current));
+      break;
+    } else if (0 > cmp) {
+      current = left_child_of(current);
+    } else {
+      rank += (NODE_IS_TOMBSTONE(me, current) ? 0 : 1)
+        + subtree_count(me, left_child_of(current));
+      current = right_child_of(current);
+    }
+  }
+
+  /* Ranks of nearby keys start from the last node looked at */
+  if (true == should_perform_splay && -1 != last
+      && true == promote_mapped_node_array(me)) {
+    perform_splay_operation(me, last);
+  }
+
+  return rank;
+} /* ngds_array_splay_tree_rank() */
+
+/* ------------------------------------------------------------------------- */
+
+void *
+ngds_array_splay_tree_select (
+  ngds_array_splay_tree_t    *me,
+  int                         k,
+  bool                        should_perform_splay,
+  void                      **found_key
+) {
+  int                           current = NG_SPLAY_ROOT_INDEX;
+  int                           left_count;
+
+  if (NULL != found_key) {
+    *found_key = NULL;
+  }
+  if (NULL == me->subtree_counts) {
+    printf("%s/%d: Tree does not keep order statistics\n",
+      __PRETTY_FUNCTION__, __LINE__);
+    return NULL;
+  }
+  if (0 > k || k >= subtree_count(me, NG_SPLAY_ROOT_INDEX)) {
+    return NULL;
+  }
+
+  for (;;) {
+    bool is_live = (false == NODE_IS_TOMBSTONE(me, current));
+
+    left_count = subtree_count(me, left_child_of(current));
+    if (k == left_count && true == is_live) {
+      break;
+    } else if (k < left_count) {
+      current = left_child_of(current);
+    } else {
+      k -= left_count + (true == is_live);
+      current = right_child_of(current);
+    }
+  }
+
+  if (true == should_perform_splay
+      && true == promote_mapped_node_array(me)) {
+    current = perform_splay_operation(me, current);
+  }
+  if (NULL != found_key) {
+    *found_key = node_key(me, &me->node_array[current]);
+  }
+  return node_value(me, &me->node_array[current]);
+} /* ngds_array_splay_tree_select() */
+
+/* ------------------------------------------------------------------------- */
+
+ngds_array_splay_tree_t *
+ngds_array_splay_tree_split (
+  ngds_array_splay_tree_t    *me,
+  const void                 *key
+) {
+  ngds_array_splay_tree_t      *lower;
+  ngds_array_splay_tree_t      *upper;
+  int                           current = NG_SPLAY_ROOT_INDEX;
+  int                           lower_idx = NG_SPLAY_ROOT_INDEX;
+  int                           upper_idx = NG_SPLAY_ROOT_INDEX;
+  int                           lower_last = -1;
+  int                           upper_last = -1;
+  int                           copied = 0;
+  int                           cmp;
+  uint64_t                      prefix = search_prefix(me, key);
+
+  if (true == holds_payload_memory(me)) {
+    printf("%s/%d: Keys or values live in memory owned by the tree\n",
+      __PRETTY_FUNCTION__, __LINE__);
+    return NULL;
+  }
+  if (false == compact_tombstones(me)) {
+    return NULL;
+  }
+
+  lower = create_sibling(me);
+  upper = create_sibling(me);
+  if (NULL == lower || NULL == upper) {
+    if (NULL != lower) {
+      ngds_array_splay_tree_destroy(lower);
+    }
+    if (NULL != upper) {
+      ngds_array_splay_tree_destroy(upper);
+    }
+    return NULL;
+  }
+
+  /*
+   * Top-down split along the search path. A node below key goes to the
+   * lower tree with its left subtree, and the path continues right; the
+   * next such node becomes its right child. The upper tree is built the
+   * same way on the other side.
+   */
+  while (NODE_IS_PRESENT(me, current) && 0 <= copied) {
+    cmp = node_compare(me, current, key, prefix);
+    if (0 < cmp) {
+      if (false == NODE_IS_VALID(lower, lower_idx)
+          && false == grow_node_array(lower)) {
+        copied = -1;
+        break;
+      }
+      copy_node_between(lower, lower_idx, me, current);
+      copied = copy_subtree_levels(lower, left_child_of(lower_idx), me,
+        left_child_of(current));
+      lower->utilized_element_count += 1 + copied;
+      lower_last = lower_idx;
+      lower_idx = right_child_of(lower_idx);
+      current = right_child_of(current);
+    } else {
+      if (false == NODE_IS_VALID(upper, upper_idx)
+          && false == grow_node_array(upper)) {
+        copied = -1;
+        break;
+      }
+      copy_node_between(upper, upper_idx, me, current);
+      copied = copy_subtree_levels(upper, right_child_of(upper_idx), me,
+        right_child_of(current));
+      upper->utilized_element_count += 1 + copied;
+      upper_last = upper_idx;
+      upper_idx = left_child_of(upper_idx);
+      current = left_child_of(current);
+    }
+  }
+
+  if (0 > copied || false == adopt_node_array(me, lower)) {
+    printf("%s/%d: Tree is at its maximum size (%d)\n",
+      __PRETTY_FUNCTION__, __LINE__, me->max_element_count);
+    ngds_array_splay_tree_destroy(lower);
+    ngds_array_splay_tree_destroy(upper);
+    return NULL;
+  }
+  ngds_array_splay_tree_destroy(lower);
+
+  /* Only the nodes of the two spines have new subtrees */
+  if (-1 != lower_last) {
+    refresh_subtree_counts_to_root(me, lower_last);
+  }
+  if (-1 != upper_last) {
+    refresh_subtree_counts_to_root(upper, upper_last);
+  }
+
+  return upper;
+} /* ngds_array_splay_tree_split() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_join (
+  ngds_array_splay_tree_t    *me,
+  ngds_array_splay_tree_t    *other
+) {
+  ngds_array_splay_tree_t      *joined;
+  void                         *lower_max;
+  void                         *upper_min;
+  int                           idx;
+
+  if (me == other
+      || true == holds_payload_memory(me) || true == holds_payload_memory(other)
+      || me->compare != other->compare || me->key_size != other->key_size
+      || me->value_size != other->value_size
+      || me->key_prefix != other->key_prefix
+      || (NULL == me->subtree_counts) != (NULL == other->subtree_counts)
+      || (NULL == me->cache.expiry_times)
+        != (NULL == other->cache.expiry_times)) {
+    printf("%s/%d: Trees are not compatible\n",
+      __PRETTY_FUNCTION__, __LINE__);
+    return -1;
+  }
+  if (false == compact_tombstones(me) || false == compact_tombstones(other)) {
+    return -1;
+  }
+
+  ngds_array_splay_tree_peek_max(me, &lower_max);
+  ngds_array_splay_tree_peek_min(other, &upper_min);
+  if (NULL != lower_max && NULL != upper_min
+      && 0 <= me->compare(lower_max, upper_min)) {
+    printf("%s/%d: Key ranges overlap\n", __PRETTY_FUNCTION__, __LINE__);
+    return -1;
+  }
+
+  /*
+   * Both trees go under a new root, the lower one to the left and the
+   * other to the right. The largest key of the lower tree then moves up
+   * into the root, as pop_max would remove it.
+   */
+  joined = create_sibling(me);
+  if (NULL == joined) {
+    return -1;
+  }
+  if (true == NODE_IS_VALID(joined, right_child_of(NG_SPLAY_ROOT_INDEX))
+      || true == grow_node_array(joined)) {
+    joined->utilized_element_count = copy_subtree_levels(joined,
+      left_child_of(NG_SPLAY_ROOT_INDEX), me, NG_SPLAY_ROOT_INDEX);
+    if (0 <= joined->utilized_element_count) {
+      idx = copy_subtree_levels(joined,
+        right_child_of(NG_SPLAY_ROOT_INDEX), other, NG_SPLAY_ROOT_INDEX);
+      joined->utilized_element_count = (0 > idx) ? -1
+        : (joined->utilized_element_count + idx);
+    }
+  } else {
+    joined->utilized_element_count = -1;
+  }
+
+  if (0 > joined->utilized_element_count) {
+    printf("%s/%d: Tree is at its maximum size (%d)\n",
+      __PRETTY_FUNCTION__, __LINE__, me->max_element_count);
+    joined->utilized_element_count = 0;
+    ngds_array_splay_tree_destroy(joined);
+    return -1;
+  }
+
+  if (true == NODE_IS_PRESENT(joined, left_child_of(NG_SPLAY_ROOT_INDEX))) {
+    idx = subtree_max(joined, left_child_of(NG_SPLAY_ROOT_INDEX));
+    node_copy(joined, NG_SPLAY_ROOT_INDEX, idx);
+    node_clear(joined, idx);
+    perform_upward_shift(joined, left_child_of(idx), idx);
+    refresh_subtree_counts_to_root(joined, idx);
+  } else {
+    /* Without a lower tree, the other one moves back up whole */
+    perform_upward_shift(joined, right_child_of(NG_SPLAY_ROOT_INDEX),
+      NG_SPLAY_ROOT_INDEX);
+  }
+
+  if (false == adopt_node_array(me, joined)) {
+    ngds_array_splay_tree_destroy(joined);
+    return -1;
+  }
+  ngds_array_splay_tree_destroy(joined);
+  ngds_array_splay_tree_destroy(other);
+
+  return 0;
+} /* ngds_array_splay_tree_join() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_merge (
+  ngds_array_splay_tree_t    *me,
+  ngds_array_splay_tree_t    *other,
+  ngds_merge_fptr             resolvefp,
+  void                       *context
+) {
+  ngds_array_splay_tree_cursor_t  mine;
+  ngds_array_splay_tree_cursor_t  theirs;
+  ngds_array_splay_tree_node_t   *sorted;
+  uint64_t                       *expiry_times = NULL;
+  uint64_t                        inserted_expiry_time = 0;
+  size_t                          sorted_size;
+  size_t                          expiry_times_size = 0;
+  bool                            has_mine;
+  bool                            has_theirs;
+  int                             count = 0;
+  int                             rc = -1;
+
+  if (me == other || NULL != me->shm || true == holds_payload_memory(other)
+      || me->compare != other->compare || me->key_size != other->key_size
+      || me->value_size != other->value_size) {
+    printf("%s/%d: Trees are not compatible\n",
+      __PRETTY_FUNCTION__, __LINE__);
+    return -1;
+  }
+  if (false == promote_mapped_node_array(me)) {
+    return -1;
+  }
+
+  sorted_size = NODE_ARRAY_SIZE((LIVE_ELEMENT_COUNT(me)
+    + LIVE_ELEMENT_COUNT(other)));
+  sorted = tree_malloc(me, sorted_size);
+  if (NULL == sorted && 0 < sorted_size) {
+    return -1;
+  }
+
+  /* Keys from other count as inserted now */
+  if (NULL != me->cache.expiry_times) {
+    expiry_times_size = (LIVE_ELEMENT_COUNT(me)
+      + LIVE_ELEMENT_COUNT(other)) * sizeof(uint64_t);
+    expiry_times = tree_malloc(me, expiry_times_size);
+    if (NULL == expiry_times && 0 < expiry_times_size) {
+      tree_free(me, sorted, sorted_size);
+      return -1;
+    }
+    inserted_expiry_time = monotonic_ns() + me->cache.ttl;
+  }
+
+  /* Both trees in order, as one sorted run of raw nodes */
+  has_mine = ngds_array_splay_tree_cursor_first(me, &mine);
+  has_theirs = ngds_array_splay_tree_cursor_first(other, &theirs);
+  while (true == has_mine || true == has_theirs) {
+    int cmp = 0;
+
+    if (false == has_theirs) {
+      cmp = -1;
+    } else if (false == has_mine) {
+      cmp = 1;
+    } else {
+      cmp = me->compare(ngds_array_splay_tree_cursor_key(&mine),
+        ngds_array_splay_tree_cursor_key(&theirs));
+    }
+
+    if (NULL != expiry_times) {
+      expiry_times[count] = (0 > cmp) ? me->cache.expiry_times[mine.idx]
+        : inserted_expiry_time;
+    }
+
+    if (0 > cmp) {
+      sorted[count++] = me->node_array[mine.idx];
+      has_mine = ngds_array_splay_tree_cursor_next(&mine);
+    } else if (0 < cmp) {
+      sorted[count++] = other->node_array[theirs.idx];
+      has_theirs = ngds_array_splay_tree_cursor_next(&theirs);
+    } else {
+      void *value = ngds_array_splay_tree_cursor_value(&mine);
+      void *other_value = ngds_array_splay_tree_cursor_value(&theirs);
+      void *kept = (NULL == resolvefp) ? other_value
+        : resolvefp(ngds_array_splay_tree_cursor_key(&mine), value,
+            other_value, context);
+
+      /* The key stays the one me already stores */
+      sorted[count] = me->node_array[mine.idx];
+      if (kept == other_value) {
+        sorted[count].value = other->node_array[theirs.idx].value;
+      } else if (kept != value) {
+        sorted[count].value = (0 == me->value_size) ? kept
+          : own_payload(me, kept, me->value_size, false);
+        /* Copies already taken stay in the slab until the tree goes */
+        if (NULL == sorted[count].value && NULL != kept
+            && 0 < me->value_size && false == VALUE_IS_INLINE(me)) {
+          goto done;
+        }
+      }
+      ++count;
+      has_mine = ngds_array_splay_tree_cursor_next(&mine);
+      has_theirs = ngds_array_splay_tree_cursor_next(&theirs);
+    }
+  }
+
+  rc = (true == rebuild_balanced(me, sorted, expiry_times, count)) ? 0 : -1;
+
+done:
+  tree_free(me, sorted, sorted_size);
+  if (NULL != expiry_times) {
+    tree_free(me, expiry_times, expiry_times_size);
+  }
+
+  return rc;
+} /* ngds_array_splay_tree_merge() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_array_splay_tree_stats (
+  ngds_array_splay_tree_t        *me,
+  ngds_array_splay_tree_stats_t  *stats
+) {
+  int idx;
+
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_STATS
+  memcpy(stats, &me->stats, sizeof(ngds_array_splay_tree_stats_t));
+#else /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+  memset(stats, 0, sizeof(ngds_array_splay_tree_stats_t));
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+
+  /* Deeper levels have higher indices, so the last used slot is deepest */
+  stats->height = 0;
+  for (idx = me->allocated_element_count - 1; idx >= NG_SPLAY_ROOT_INDEX;
+        --idx) {
+    if (false == NODE_IS_EMPTY(me, idx)) {
+      stats->height = depth_of(idx) + 1;
+      break;
+    }
+  }
+  stats->utilized_element_count = LIVE_ELEMENT_COUNT(me);
+  stats->allocated_element_count = me->allocated_element_count;
+} /* ngds_array_splay_tree_stats() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_array_splay_tree_stats_reset (
+  ngds_array_splay_tree_t    *me
+) {
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_STATS
+  memset(&me->stats, 0, sizeof(ngds_array_splay_tree_stats_t));
+#else /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+  (void) me;
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+} /* ngds_array_splay_tree_stats_reset() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_array_splay_tree_histogram (
+  ngds_array_splay_tree_t              *me,
+  ngds_array_splay_tree_histogram_id_t  id,
+  ngds_array_splay_tree_histogram_t    *histogram
+) {
+  memset(histogram, 0, sizeof(ngds_array_splay_tree_histogram_t));
+
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_STATS
+  int shard;
+  int bucket;
+
+  for (shard = 0; shard < NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_SHARDS; ++shard) {
+    const ngds_array_splay_tree_histogram_shard_t *src =
+      &me->histogram_shards[shard];
+
+    for (bucket = 0; bucket < NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_BUCKETS;
+          ++bucket) {
+      uint64_t n = __atomic_load_n(&src->buckets[id][bucket],
+        __ATOMIC_RELAXED);
+      histogram->buckets[bucket] += n;
+      histogram->count += n;
+    }
+    histogram->sum += __atomic_load_n(&src->sums[id], __ATOMIC_RELAXED);
+  }
+#else /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+  (void) me;
+  (void) id;
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+} /* ngds_array_splay_tree_histogram() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_array_splay_tree_histogram_reset (
+  ngds_array_splay_tree_t    *me
+) {
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_STATS
+  memset(me->histogram_shards, 0, (NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_SHARDS
+    * sizeof(ngds_array_splay_tree_histogram_shard_t)));
+#else /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+  (void) me;
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+} /* ngds_array_splay_tree_histogram_reset() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_profile_start (
+  ngds_array_splay_tree_t    *me,
+  int                         sample_interval,
+  ngds_key_hash_fptr          key_hashfp
+) {
+  if (0 >= sample_interval) {
+    printf("%s/%d: Sample interval (%d) must be positive\n",
+      __PRETTY_FUNCTION__, __LINE__, sample_interval);
+    return -1;
+  }
+
+  if (NULL == me->profiler) {
+    me->profiler = tree_malloc(me, sizeof(ngds_array_splay_tree_profiler_t));
+    if (NULL == me->profiler) {
+      return -1;
+    }
+  }
+  me->profiler->key_hash = key_hashfp;
+  me->profiler->sample_interval = sample_interval;
+  ngds_array_splay_tree_profile_reset(me);
+
+  return 0;
+} /* ngds_array_splay_tree_profile_start() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_array_splay_tree_profile_stop (
+  ngds_array_splay_tree_t    *me
+) {
+  if (NULL != me->profiler) {
+    tree_free(me, me->profiler, sizeof(ngds_array_splay_tree_profiler_t));
+    me->profiler = NULL;
+  }
+} /* ngds_array_splay_tree_profile_stop() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_profile (
+  ngds_array_splay_tree_t          *me,
+  ngds_array_splay_tree_profile_t  *profile
+) {
+  const ngds_array_splay_tree_profiler_t *profiler = me->profiler;
+
+  memset(profile, 0, sizeof(ngds_array_splay_tree_profile_t));
+  if (NULL == profiler) {
+    return -1;
+  }
+
+  profile->sampled_operations = profiler->sampled_operations;
+  profile->distinct_keys = hyperloglog_estimate(profiler->registers);
+  profile->working_set_keys = hyperloglog_estimate(
+    (true == profiler->has_previous_window)
+      ? profiler->previous_window_registers : profiler->window_registers);
+  if (0 < profiler->hit_count) {
+    profile->mean_hit_depth = (double) profiler->hit_depth_total
+      / profiler->hit_count;
+  }
+  profile->zipf_exponent = fit_zipf_exponent(profiler);
+
+  return 0;
+} /* ngds_array_splay_tree_profile() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_array_splay_tree_profile_reset (
+  ngds_array_splay_tree_t    *me
+) {
+  ngds_array_splay_tree_profiler_t *profiler = me->profiler;
+
+  if (NULL == profiler) {
+    return;
+  }
+
+  memset(profiler->registers, 0, sizeof(profiler->registers));
+  memset(profiler->window_registers, 0, sizeof(profiler->window_registers));
+  memset(profiler->top_counts, 0, sizeof(profiler->top_counts));
+  memset(profiler->top_errors, 0, sizeof(profiler->top_errors));
+  profiler->countdown = profiler->sample_interval;
+  profiler->sampled_operations = 0;
+  profiler->hit_count = 0;
+  profiler->hit_depth_total = 0;
+  profiler->window_samples = 0;
+  profiler->has_previous_window = false;
+} /* ngds_array_splay_tree_profile_reset() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_array_splay_tree_set_adaptive_splay (
+  ngds_array_splay_tree_t    *me,
+  bool                        is_enabled
+) {
+  memset(&me->adaptive, 0, sizeof(ngds_array_splay_tree_adaptive_t));
+  me->adaptive.is_enabled = is_enabled;
+  me->adaptive.regime = NGDS_ARRAY_SPLAY_TREE_SPLAY_NONE;
+  me->adaptive.settled_regime = NGDS_ARRAY_SPLAY_TREE_SPLAY_NONE;
+  me->adaptive.epoch_start_moved_node_count = me->moved_node_count;
+  me->adaptive.explore_interval = ADAPTIVE_EXPLORE_INTERVAL;
+} /* ngds_array_splay_tree_set_adaptive_splay() */
+
+/* ------------------------------------------------------------------------- */
+
+ngds_array_splay_tree_splay_regime_t
+ngds_array_splay_tree_splay_regime (
+  ngds_array_splay_tree_t    *me
+) {
+  return me->adaptive.settled_regime;
+} /* ngds_array_splay_tree_splay_regime() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_array_splay_tree_set_finger_search (
+  ngds_array_splay_tree_t    *me,
+  bool                        is_enabled
+) {
+  me->has_finger = is_enabled;
+  me->finger = NG_SPLAY_ROOT_INDEX;
+} /* ngds_array_splay_tree_set_finger_search() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_set_capacity (
+  ngds_array_splay_tree_t    *me,
+  int                         capacity,
+  ngds_evict_fptr             evictfp,
+  void                       *context
+) {
+  if (NULL != me->shm) {
+    printf("%s/%d: Shared memory trees cannot evict\n",
+      __PRETTY_FUNCTION__, __LINE__);
+    return -1;
+  }
+
+  me->cache.capacity = (0 < capacity) ? capacity : 0;
+  me->cache.evict = evictfp;
+  me->cache.evict_context = context;
+  if (0 == me->cache.walk_state) {
+    me->cache.walk_state = 0x9e3779b97f4a7c15ULL;
+  }
+
+  while (0 < me->cache.capacity
+          && LIVE_ELEMENT_COUNT(me) > me->cache.capacity) {
+    if (false == evict_node_at(me, find_cold_leaf(me))) {
+      return -1;
+    }
+  }
+
+  return 0;
+} /* ngds_array_splay_tree_set_capacity() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_set_ttl (
+  ngds_array_splay_tree_t    *me,
+  uint64_t                    ttl
+) {
+  uint64_t  expiry_time;
+  int       idx;
+
+  if (NULL != me->shm) {
+    printf("%s/%d: Shared memory trees cannot expire keys\n",
+      __PRETTY_FUNCTION__, __LINE__);
+    return -1;
+  }
+
+  if (0 == ttl) {
+    if (NULL != me->cache.expiry_times) {
+      tree_free(me, me->cache.expiry_times,
+        (me->allocated_element_count * sizeof(uint64_t)));
+      me->cache.expiry_times = NULL;
+    }
+    me->cache.ttl = 0;
+    return 0;
+  }
+
+  if (NULL == me->cache.expiry_times
+      && false == allocate_expiry_times(me)) {
+    return -1;
+  }
+
+  /* Keys already present live for ttl from now */
+  me->cache.ttl = ttl;
+  expiry_time = monotonic_ns() + ttl;
+  for (idx = NG_SPLAY_ROOT_INDEX; idx < me->allocated_element_count; ++idx) {
+    if (false == NODE_IS_EMPTY(me, idx)) {
+      me->cache.expiry_times[idx] = expiry_time;
+    }
+  }
+
+  return 0;
+} /* ngds_array_splay_tree_set_ttl() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_set_lazy_removal (
+  ngds_array_splay_tree_t    *me,
+  double                      max_tombstone_ratio
+) {
+  if (NULL != me->shm) {
+    printf("%s/%d: Shared memory trees remove eagerly\n",
+      __PRETTY_FUNCTION__, __LINE__);
+    return -1;
+  }
+
+  if (0.0 >= max_tombstone_ratio) {
+    if (false == compact_tombstones(me)) {
+      return -1;
+    }
+    if (NULL != me->tombstones) {
+      tree_free(me, me->tombstones, me->allocated_element_count);
+      me->tombstones = NULL;
+    }
+    me->tombstone_ratio = 0.0;
+    return 0;
+  }
+
+  if (NULL == me->tombstones && false == allocate_tombstones(me)) {
+    return -1;
+  }
+  me->tombstone_ratio = max_tombstone_ratio;
+
+  return 0;
+} /* ngds_array_splay_tree_set_lazy_removal() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_compact (
+  ngds_array_splay_tree_t    *me
+) {
+  return (true == compact_tombstones(me)) ? 0 : -1;
+} /* ngds_array_splay_tree_compact() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_export_hot_set (
+  ngds_array_splay_tree_t    *me,
+  int                         levels,
+  void                      **keys,
+  int                         max_keys
+) {
+  int64_t last = me->allocated_element_count;
+  int     count = 0;
+  int     idx;
+
+  if (0 >= levels || 0 >= max_keys) {
+    return 0;
+  }
+  if (levels < 31 && (NG_SPLAY_ROOT_INDEX + (1LL << levels) - 1) < last) {
+    last = NG_SPLAY_ROOT_INDEX + (1LL << levels) - 1;
+  }
+
+  /* Slot order is level order, so the hottest keys come first */
+  for (idx = NG_SPLAY_ROOT_INDEX; idx < last && count < max_keys; ++idx) {
+    if (false == NODE_IS_EMPTY(me, idx)
+        && false == NODE_IS_TOMBSTONE(me, idx)) {
+      keys[count++] = node_key(me, &me->node_array[idx]);
+    }
+  }
+
+  return count;
+} /* ngds_array_splay_tree_export_hot_set() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_preload_hot_set (
+  ngds_array_splay_tree_t    *me,
+  void *const                *keys,
+  int                         count
+) {
+  ngds_array_splay_tree_cursor_t  cursor;
+  ngds_array_splay_tree_node_t   *sorted;
+  uint64_t                       *expiry_times = NULL;
+  int                            *hot_rank;
+  int                            *positions;
+  size_t                          sorted_size;
+  size_t                          expiry_times_size = 0;
+  size_t                          rank_size;
+  bool                            has_next;
+  int                             element_count = LIVE_ELEMENT_COUNT(me);
+  int                             hot_count = 0;
+  int                             levels;
+  int                             ii;
+  int                             rc = -1;
+
+  if (NULL != me->shm) {
+    printf("%s/%d: Shared memory trees cannot be rebuilt\n",
+      __PRETTY_FUNCTION__, __LINE__);
+    return -1;
+  }
+  if (false == promote_mapped_node_array(me)) {
+    return -1;
+  }
+
+  sorted_size = NODE_ARRAY_SIZE(element_count);
+  sorted = tree_malloc(me, sorted_size);
+  if (NULL != me->cache.expiry_times) {
+    expiry_times_size = element_count * sizeof(uint64_t);
+    expiry_times = tree_malloc(me, expiry_times_size);
+  }
+  rank_size = element_count * sizeof(int);
+  hot_rank = tree_malloc(me, rank_size);
+  positions = tree_malloc(me, rank_size);
+  if (0 < element_count && (NULL == sorted || NULL == hot_rank
+        || NULL == positions
+        || (NULL != me->cache.expiry_times && NULL == expiry_times))) {
+    goto done;
+  }
+
+  element_count = 0;
+  for (has_next = ngds_array_splay_tree_cursor_first(me, &cursor)
+        ; true == has_next
+        ; has_next = ngds_array_splay_tree_cursor_next(&cursor)) {
+    if (NULL != expiry_times) {
+      expiry_times[element_count] = me->cache.expiry_times[cursor.idx];
+    }
+    hot_rank[element_count] = 0;
+    sorted[element_count++] = me->node_array[cursor.idx];
+  }
+
+  /* Ranks start at 1 for the first key, skipping missing and repeated ones */
+  for (ii = 0; ii < count; ++ii) {
+    int lo = 0;
+    int hi = element_count - 1;
+
+    while (lo <= hi) {
+      int mid = lo + ((hi - lo) / 2);
+      int cmp = me->compare(keys[ii], node_key(me, &sorted[mid]));
+
+      if (0 == cmp) {
+        if (0 == hot_rank[mid]) {
+          hot_rank[mid] = 1 + ii;
+        }
+        break;
+      } else if (0 > cmp) {
+        hi = mid - 1;
+      } else {
+        lo = mid + 1;
+      }
+    }
+  }
+  for (ii = 0; ii < element_count; ++ii) {
+    if (0 != hot_rank[ii]) {
+      positions[hot_count++] = ii;
+    }
+  }
+
+  levels = balanced_levels(element_count);
+  if ((levels + HOT_SET_EXTRA_LEVELS)
+      <= (balanced_levels(me->max_element_count) - 1)) {
+    levels += HOT_SET_EXTRA_LEVELS;
+  }
+  if (true == replace_node_array(me, levels)) {
+    place_warm_nodes(me, sorted, expiry_times, hot_rank, positions,
+      hot_count, 0, (element_count - 1), NG_SPLAY_ROOT_INDEX, levels);
+    me->utilized_element_count = element_count;
+    rc = 0;
+  }
+
+done:
+  tree_free(me, sorted, sorted_size);
+  if (NULL != expiry_times) {
+    tree_free(me, expiry_times, expiry_times_size);
+  }
+  tree_free(me, hot_rank, rank_size);
+  tree_free(me, positions, rank_size);
+
+  return rc;
+} /* ngds_array_splay_tree_preload_hot_set() */
+
+/* ------------------------------------------------------------------------- */
+
+uint64_t
+ngds_array_splay_tree_string_prefix (
+  const void                 *key
+) {
+  const unsigned char *str = key;
+  uint64_t             prefix = 0;
+  int                  ii;
+
+  for (ii = 0; ii < 8 && '\0' != str[ii]; ++ii) {
+    prefix |= ((uint64_t) str[ii] << (56 - (8 * ii)));
+  }
+
+  return prefix;
+} /* ngds_array_splay_tree_string_prefix() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_trace_start (
+  ngds_array_splay_tree_t    *me,
+  const char                 *path,
+  ngds_payload_size_fptr      key_sizefp
+) {
+  ngds_trace_key_encoding_t key_encoding = NGDS_TRACE_KEY_POINTER;
+
+  if (NULL != me->trace) {
+    printf("%s/%d: Tree is already being traced\n", __PRETTY_FUNCTION__,
+      __LINE__);
+    return -1;
+  }
+
+  if (NULL != key_sizefp || 0 < me->key_size) {
+    key_encoding = NGDS_TRACE_KEY_BYTES;
+  }
+  me->trace = ngds_trace_writer_open(path, key_encoding);
+  if (NULL == me->trace) {
+    printf("%s/%d: Cannot create trace %s\n", __PRETTY_FUNCTION__,
+      __LINE__, path);
+    return -1;
+  }
+  me->trace_key_size = key_sizefp;
+
+  return 0;
+} /* ngds_array_splay_tree_trace_start() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_trace_stop (
+  ngds_array_splay_tree_t    *me
+) {
+  int rc;
+
+  if (NULL == me->trace) {
+    return -1;
+  }
+
+  rc = ngds_trace_writer_close(me->trace);
+  me->trace = NULL;
+  me->trace_key_size = NULL;
+
+  return rc;
+} /* ngds_array_splay_tree_trace_stop() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_save (
+  ngds_array_splay_tree_t    *me,
+  const char                 *path,
+  ngds_payload_size_fptr      key_sizefp,
+  ngds_payload_size_fptr      value_sizefp
+) {
+  ngds_array_splay_tree_file_header_t   header;
+  FILE                                 *fp;
+  uint64_t                              node_array_size;
+  uint64_t                              payload_cursor = 0;
+
+  /* The file has no room for tombstones */
+  if (false == compact_tombstones(me)) {
+    return -1;
+  }
+
+  fp = fopen(path, "wb");
+  if (NULL == fp) {
+    return -1;
+  }
+
+  node_array_size =
+    (me->allocated_element_count * sizeof(ngds_array_splay_tree_node_t));
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, NGDS_ARRAY_SPLAY_TREE_FILE_MAGIC,
+    sizeof(NGDS_ARRAY_SPLAY_TREE_FILE_MAGIC));
+  header.version = NGDS_ARRAY_SPLAY_TREE_FILE_VERSION;
+  header.flags = payload_flags(key_sizefp, value_sizefp);
+  header.root_index = NG_SPLAY_ROOT_INDEX;
+  header.pointer_size = sizeof(void *);
+  header.allocated_element_count = me->allocated_element_count;
+  header.utilized_element_count = me->utilized_element_count;
+  header.node_array_offset = ALIGN_UP(sizeof(header), FILE_ALIGNMENT);
+  header.payload_offset =
+    ALIGN_UP((header.node_array_offset + node_array_size), FILE_ALIGNMENT);
+
+  /* Header and padding up to the node array */
+  if (0 != write_bytes(fp, NULL, header.node_array_offset)
+      || 0 != write_node_range(me, fp, 0, me->allocated_element_count,
+        key_sizefp, value_sizefp, header.payload_offset, &payload_cursor)
+      || 0 != write_bytes(fp, NULL, (header.payload_offset
+        - (header.node_array_offset + node_array_size)))
+      || 0 != write_payload_range(me, fp, 0, me->allocated_element_count,
+        key_sizefp, value_sizefp)) {
+    goto error;
+  }
+
+  header.payload_size = payload_cursor;
+  if (0 != fseek(fp, 0, SEEK_SET)
+      || 0 != write_bytes(fp, &header, sizeof(header))) {
+    goto error;
+  }
+
+  if (0 != fclose(fp)) {
+    return -1;
+  }
+
+  /* This snapshot is the new base for incremental checkpoints */
+  if (NULL != me->dirty_page_bitmap) {
+    memset(me->dirty_page_bitmap, 0, me->dirty_page_bitmap_size_in_bytes);
+  }
+
+  return 0;
+
+error:
+  fclose(fp);
+  return -1;
+
+} /* ngds_array_splay_tree_save() */
+
+/* ------------------------------------------------------------------------- */
+
+ngds_array_splay_tree_t *
+ngds_array_splay_tree_open (
+  const char           *path,
+  ngds_comparator_fptr  comparefp,
+  ngds_malloc_fptr      mallocfp,
+  ngds_free_fptr        freefp
+) {
+  const ngds_array_splay_tree_file_header_t  *header;
+  ngds_array_splay_tree_t                    *me;
+  struct stat                                 st;
+  void                                       *mapping;
+  int                                         fd;
+
+  assert(comparefp);
+
+  fd = open(path, O_RDONLY);
+  if (-1 == fd) {
+    return NULL;
+  }
+
+  if (0 != fstat(fd, &st) || st.st_size < (off_t) sizeof(*header)) {
+    close(fd);
+    return NULL;
+  }
+
+  mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == mapping) {
+    return NULL;
+  }
+
+  header = (const ngds_array_splay_tree_file_header_t *) mapping;
+  if (0 != memcmp(header->magic, NGDS_ARRAY_SPLAY_TREE_FILE_MAGIC,
+        sizeof(NGDS_ARRAY_SPLAY_TREE_FILE_MAGIC))
+      || NGDS_ARRAY_SPLAY_TREE_FILE_VERSION != header->version
+      || NG_SPLAY_ROOT_INDEX != header->root_index
+      || sizeof(void *) != header->pointer_size
+      || 0 >= header->allocated_element_count
+      || (header->node_array_offset + (header->allocated_element_count
+          * sizeof(ngds_array_splay_tree_node_t))) > (uint64_t) st.st_size
+      || (header->payload_offset + header->payload_size)
+          > (uint64_t) st.st_size) {
+    munmap(mapping, st.st_size);
+    return NULL;
+  }
+
+  me = allocate_tree(NULL, mallocfp, freefp,
+    header->allocated_element_count,
+    NGDS_ARRAY_SPLAY_TREE_DEFAULT_MAX_ELEMENT_COUNT, comparefp);
+  if (NULL == me) {
+    munmap(mapping, st.st_size);
+    return NULL;
+  }
+
+  me->utilized_element_count = header->utilized_element_count;
+  me->node_array = (ngds_array_splay_tree_node_t *)
+    ((char *) mapping + header->node_array_offset);
+  me->key_base = (header->flags & NGDS_ARRAY_SPLAY_TREE_FILE_KEY_OFFSETS)
+    ? (uintptr_t) mapping : 0;
+  me->value_base = (header->flags & NGDS_ARRAY_SPLAY_TREE_FILE_VALUE_OFFSETS)
+    ? (uintptr_t) mapping : 0;
+  me->mapping = mapping;
+  me->mapping_size = st.st_size;
+  me->node_array_is_mapped = true;
+
+  if (false == allocate_histograms(me)) {
+    ngds_array_splay_tree_destroy(me);
+    return NULL;
+  }
+
+  return me;
+} /* ngds_array_splay_tree_open() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_checkpoint_enable (
+  ngds_array_splay_tree_t    *me
+) {
+  if (NULL != me->dirty_page_bitmap) {
+    return 0;
+  }
+
+  me->dirty_page_bitmap_size_in_bytes =
+    (BITNSLOTS(PAGE_COUNT(me)) * sizeof(uint64_t));
+  me->dirty_page_bitmap = tree_malloc(me,
+    me->dirty_page_bitmap_size_in_bytes);
+  if (NULL == me->dirty_page_bitmap) {
+    return -1;
+  }
+  memset(me->dirty_page_bitmap, 0, me->dirty_page_bitmap_size_in_bytes);
+
+  return 0;
+} /* ngds_array_splay_tree_checkpoint_enable() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_checkpoint (
+  ngds_array_splay_tree_t    *me,
+  const char                 *path,
+  ngds_payload_size_fptr      key_sizefp,
+  ngds_payload_size_fptr      value_sizefp
+) {
+  ngds_array_splay_tree_delta_header_t  header;
+  FILE                                 *fp;
+  uint64_t                              record_size;
+  uint64_t                              payload_cursor = 0;
+  uint64_t                              page;
+  uint64_t                              pad;
+
+  if (NULL == me->dirty_page_bitmap || false == compact_tombstones(me)) {
+    return -1;
+  }
+
+  fp = fopen(path, "wb");
+  if (NULL == fp) {
+    return -1;
+  }
+
+  record_size = (sizeof(uint64_t) * 2)
+    + (NODES_PER_PAGE * sizeof(ngds_array_splay_tree_node_t));
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, NGDS_ARRAY_SPLAY_TREE_DELTA_MAGIC,
+    sizeof(NGDS_ARRAY_SPLAY_TREE_DELTA_MAGIC));
+  header.version = NGDS_ARRAY_SPLAY_TREE_FILE_VERSION;
+  header.flags = payload_flags(key_sizefp, value_sizefp);
+  header.root_index = NG_SPLAY_ROOT_INDEX;
+  header.pointer_size = sizeof(void *);
+  header.allocated_element_count = me->allocated_element_count;
+  header.utilized_element_count = me->utilized_element_count;
+  header.nodes_per_page = NODES_PER_PAGE;
+  header.page_offset = ALIGN_UP(sizeof(header), FILE_ALIGNMENT);
+
+  for (page = 0; page < PAGE_COUNT(me); ++page) {
+    if (BITTEST(me->dirty_page_bitmap, page)) {
+      ++header.page_count;
+    }
+  }
+  header.payload_offset = ALIGN_UP(
+    (header.page_offset + (header.page_count * record_size)), FILE_ALIGNMENT);
+
+  if (0 != write_bytes(fp, NULL, header.page_offset)) {
+    goto error;
+  }
+
+  /* Page records: page number, padding, then the page's slots */
+  for (page = 0; page < PAGE_COUNT(me); ++page) {
+    if (!BITTEST(me->dirty_page_bitmap, page)) {
+      continue;
+    }
+    pad = 0;
+    if (0 != write_bytes(fp, &page, sizeof(page))
+        || 0 != write_bytes(fp, &pad, sizeof(pad))
+        || 0 != write_node_range(me, fp, (page * NODES_PER_PAGE),
+          NODES_PER_PAGE, key_sizefp, value_sizefp, header.payload_offset,
+          &payload_cursor)) {
+      goto error;
+    }
+  }
+
+  if (0 != write_bytes(fp, NULL, (header.payload_offset
+      - (header.page_offset + (header.page_count * record_size))))) {
+    goto error;
+  }
+
+  for (page = 0; page < PAGE_COUNT(me); ++page) {
+    if (BITTEST(me->dirty_page_bitmap, page)
+        && 0 != write_payload_range(me, fp, (page * NODES_PER_PAGE),
+          NODES_PER_PAGE, key_sizefp, value_sizefp)) {
+      goto error;
+    }
+  }
+
+  header.payload_size = payload_cursor;
+  if (0 != fseek(fp, 0, SEEK_SET)
+      || 0 != write_bytes(fp, &header, sizeof(header))) {
+    goto error;
+  }
+
+  if (0 != fclose(fp)) {
+    return -1;
+  }
+
+  memset(me->dirty_page_bitmap, 0, me->dirty_page_bitmap_size_in_bytes);
+
+  return 0;
+
+error:
+  fclose(fp);
+  return -1;
+
+} /* ngds_array_splay_tree_checkpoint() */
+
+/* ------------------------------------------------------------------------- */
+
+ngds_array_splay_tree_t *
+ngds_array_splay_tree_restore (
+  const char           *base_path,
+  const char          **delta_paths,
+  int                   delta_count,
+  ngds_comparator_fptr  comparefp,
+  ngds_malloc_fptr      mallocfp,
+  ngds_free_fptr        freefp
+) {
+  ngds_array_splay_tree_t  *me;
+  int                       ii;
+
+  me = ngds_array_splay_tree_open(base_path, comparefp, mallocfp, freefp);
+  if (NULL == me) {
+    return NULL;
+  }
+
+  if (false == promote_mapped_node_array(me)) {
+    ngds_array_splay_tree_destroy(me);
+    return NULL;
+  }
+
+  for (ii = 0; ii < delta_count; ++ii) {
+    if (0 != apply_checkpoint_delta(me, delta_paths[ii])) {
+      ngds_array_splay_tree_destroy(me);
+      return NULL;
+    }
+  }
+
+  return me;
+} /* ngds_array_splay_tree_restore() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Builds the per-process handle around a mapped segment. Everything in
+ * it is local except node_array, which points into the segment.
+ */
+static ngds_array_splay_tree_t *
+attach_shm_segment (
+  void                       *mapping,
+  size_t                      mapping_size,
+  ngds_comparator_fptr        comparefp
+) {
+  ngds_array_splay_tree_shm_header_t *header = mapping;
+  ngds_array_splay_tree_t            *me;
+
+  /* The segment cannot be resized, so neither can the node array */
+  me = allocate_tree(ngds_allocator_heap(), NULL, NULL,
+    header->allocated_element_count, header->allocated_element_count,
+    comparefp);
+  if (NULL == me) {
+    return NULL;
+  }
+
+  me->utilized_element_count = header->utilized_element_count;
+  me->node_array = (ngds_array_splay_tree_node_t *)
+    ((char *) mapping + header->node_array_offset);
+  me->key_base = (uintptr_t) mapping;
+  me->value_base = (uintptr_t) mapping;
+  me->mapping = mapping;
+  me->mapping_size = mapping_size;
+  me->shm = header;
+
+  if (false == allocate_histograms(me)) {
+    me->mapping = NULL;
+    ngds_array_splay_tree_destroy(me);
+    return NULL;
+  }
+
+  return me;
+} /* attach_shm_segment() */
+
+/* ------------------------------------------------------------------------- */
+
+ngds_array_splay_tree_t *
+ngds_array_splay_tree_shm_create (
+  const char           *name,
+  size_t                segment_size,
+  int                   initial_element_count,
+  ngds_comparator_fptr  comparefp
+) {
+  ngds_array_splay_tree_shm_header_t *header;
+  ngds_array_splay_tree_t            *me;
+  pthread_rwlockattr_t                rwlock_attr;
+  pthread_mutexattr_t                 mutex_attr;
+  uint64_t                            node_array_offset;
+  uint64_t                            heap_offset;
+  void                               *mapping;
+  int                                 fd;
+
+  assert((initial_element_count > 0));
+  assert(comparefp);
+
+  node_array_offset = ALIGN_UP(sizeof(*header), FILE_ALIGNMENT);
+  heap_offset = ALIGN_UP((node_array_offset + (initial_element_count
+    * sizeof(ngds_array_splay_tree_node_t))), FILE_ALIGNMENT);
+  if (heap_offset >= segment_size) {
+    return NULL;
+  }
+
+  fd = shm_open(name, (O_CREAT | O_EXCL | O_RDWR), 0600);
+  if (-1 == fd) {
+    return NULL;
+  }
+
+  if (0 != ftruncate(fd, segment_size)) {
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+
+  mapping = mmap(NULL, segment_size, (PROT_READ | PROT_WRITE), MAP_SHARED,
+    fd, 0);
+  close(fd);
+  if (MAP_FAILED == mapping) {
+    shm_unlink(name);
+    return NULL;
+  }
+
+  /* ftruncate() zero-fills, so the node array starts out empty */
+  header = mapping;
+  header->version = NGDS_ARRAY_SPLAY_TREE_FILE_VERSION;
+  header->root_index = NG_SPLAY_ROOT_INDEX;
+  header->segment_size = segment_size;
+  header->allocated_element_count = initial_element_count;
+  header->utilized_element_count = 0;
+  header->node_array_offset = node_array_offset;
+  header->heap_offset = heap_offset;
+  header->heap_top = heap_offset;
+  header->free_list = 0;
+
+  pthread_rwlockattr_init(&rwlock_attr);
+  pthread_rwlockattr_setpshared(&rwlock_attr, PTHREAD_PROCESS_SHARED);
+  pthread_rwlock_init(&header->lock, &rwlock_attr);
+  pthread_rwlockattr_destroy(&rwlock_attr);
+
+  pthread_mutexattr_init(&mutex_attr);
+  pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutex_init(&header->heap_lock, &mutex_attr);
+  pthread_mutexattr_destroy(&mutex_attr);
+
+  /* Publish the segment only once it is fully initialized */
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(header->magic, NGDS_ARRAY_SPLAY_TREE_SHM_MAGIC,
+    sizeof(NGDS_ARRAY_SPLAY_TREE_SHM_MAGIC));
+
+  me = attach_shm_segment(mapping, segment_size, comparefp);
+  if (NULL == me) {
+    munmap(mapping, segment_size);
+    shm_unlink(name);
+  }
+
+  return me;
+} /* ngds_array_splay_tree_shm_create() */
+
+/* ------------------------------------------------------------------------- */
+
+ngds_array_splay_tree_t *
+ngds_array_splay_tree_shm_attach (
+  const char           *name,
+  ngds_comparator_fptr  comparefp
+) {
+  ngds_array_splay_tree_shm_header_t *header;
+  ngds_array_splay_tree_t            *me;
+  struct stat                         st;
+  void                               *mapping;
+  int                                 fd;
+
+  assert(comparefp);
+
+  fd = shm_open(name, O_RDWR, 0);
+  if (-1 == fd) {
+    return NULL;
+  }
+
+  if (0 != fstat(fd, &st) || st.st_size < (off_t) sizeof(*header)) {
+    close(fd);
+    return NULL;
+  }
+
+  mapping = mmap(NULL, st.st_size, (PROT_READ | PROT_WRITE), MAP_SHARED,
+    fd, 0);
+  close(fd);
+  if (MAP_FAILED == mapping) {
+    return NULL;
+  }
+
+  header = mapping;
+  if (0 != memcmp(header->magic, NGDS_ARRAY_SPLAY_TREE_SHM_MAGIC,
+        sizeof(NGDS_ARRAY_SPLAY_TREE_SHM_MAGIC))
+      || NGDS_ARRAY_SPLAY_TREE_FILE_VERSION != header->version
+      || NG_SPLAY_ROOT_INDEX != header->root_index
+      || (uint64_t) st.st_size != header->segment_size) {
+    munmap(mapping, st.st_size);
+    return NULL;
+  }
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+  me = attach_shm_segment(mapping, st.st_size, comparefp);
+  if (NULL == me) {
+    munmap(mapping, st.st_size);
+  }
+
+  return me;
+} /* ngds_array_splay_tree_shm_attach() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_array_splay_tree_shm_unlink (
+  const char                 *name
+) {
+  return shm_unlink(name);
+} /* ngds_array_splay_tree_shm_unlink() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * First-fit over the free list, falling back to bumping the heap top.
+ * Freed blocks are reused whole and never coalesced.
+ */
+void *
+ngds_array_splay_tree_shm_malloc (
+  ngds_array_splay_tree_t    *me,
+  size_t                      size
+) {
+  ngds_array_splay_tree_shm_header_t *header = me->shm;
+  ngds_array_splay_tree_shm_block_t  *block = NULL;
+  uint64_t                           *link;
+  char                               *base = me->mapping;
+
+  assert(header);
+
+  size = ALIGN_UP(size, PAYLOAD_ALIGNMENT);
+
+  pthread_mutex_lock(&header->heap_lock);
+
+  for (link = &header->free_list; 0 != *link;
+      link = &((ngds_array_splay_tree_shm_block_t *) (base + *link))->next) {
+    ngds_array_splay_tree_shm_block_t *candidate =
+      (ngds_array_splay_tree_shm_block_t *) (base + *link);
+    if (candidate->size >= size) {
+      *link = candidate->next;
+      block = candidate;
+      break;
+    }
+  }
+
+  if (NULL == block
+      && (header->heap_top + sizeof(*block) + size) <= header->segment_size) {
+    block = (ngds_array_splay_tree_shm_block_t *) (base + header->heap_top);
+    block->size = size;
+    header->heap_top += (sizeof(*block) + size);
+  }
+
+  pthread_mutex_unlock(&header->heap_lock);
+
+  if (NULL == block) {
+    return NULL;
+  }
+
+  block->next = 0;
+  return (block + 1);
+} /* ngds_array_splay_tree_shm_malloc() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_array_splay_tree_shm_free (
+  ngds_array_splay_tree_t    *me,
+  void                       *ptr
+) {
+  ngds_array_splay_tree_shm_header_t *header = me->shm;
+  ngds_array_splay_tree_shm_block_t  *block;
+
+  if (NULL == ptr) {
+    return;
+  }
+
+  assert(header);
+
+  block = ((ngds_array_splay_tree_shm_block_t *) ptr) - 1;
+
+  pthread_mutex_lock(&header->heap_lock);
+  block->next = header->free_list;
+  header->free_list = (uintptr_t) block - (uintptr_t) me->mapping;
+  pthread_mutex_unlock(&header->heap_lock);
+} /* ngds_array_splay_tree_shm_free() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_array_splay_tree_shm_read_lock (
+  ngds_array_splay_tree_t    *me
+) {
+  pthread_rwlock_rdlock(&me->shm->lock);
+  me->utilized_element_count = me->shm->utilized_element_count;
+} /* ngds_array_splay_tree_shm_read_lock() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_array_splay_tree_shm_write_lock (
+  ngds_array_splay_tree_t    *me
+) {
+  pthread_rwlock_wrlock(&me->shm->lock);
+  me->utilized_element_count = me->shm->utilized_element_count;
+  me->shm_is_write_locked = true;
+} /* ngds_array_splay_tree_shm_write_lock() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_array_splay_tree_shm_unlock (
+  ngds_array_splay_tree_t    *me
+) {
+  if (true == me->shm_is_write_locked) {
+    me->shm->utilized_element_count = me->utilized_element_count;
+    me->shm_is_write_locked = false;
+  }
+  pthread_rwlock_unlock(&me->shm->lock);
+} /* ngds_array_splay_tree_shm_unlock() */
 
 /* vi: set et sw=2 ts=2: */
 
@@ -6,6 +6,20 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ngds_allocator.h"
+
+/* ========================================================================= */
+/* -- DEFINITIONS ---------------------------------------------------------- */
+/* ========================================================================= */
+
+/* Trees grow on demand up to this many slots unless configured otherwise */
+#define NGDS_ARRAY_SPLAY_TREE_DEFAULT_MAX_ELEMENT_COUNT   (1 << 24)
+
+/* Histogram bucket 0 holds zero, bucket b > 0 holds [2^(b - 1), 2^b) */
+#define NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_BUCKETS           64
 
 /* ========================================================================= */
 /* -- OPAQUE TYPES --------------------------------------------------------- */
@@ -21,10 +35,188 @@ typedef struct ngds_array_splay_tree_s ngds_array_splay_tree_t;
  * Function used to compare two elements, returns positive in
  * case the first element is greater than the second, negative
  * in case the opposite happens and zero in case they are equal.
+ * Cursors, bounds, ranges, split and merge all follow this order.
  */
 typedef int (*ngds_comparator_fptr) (const void *, const void *);
 typedef void *(*ngds_malloc_fptr) (size_t);
-typedef void (*ngds_free_fptr) (size_t);
+typedef void (*ngds_free_fptr) (void *);
+
+/**
+ * Function used when saving a tree to return the number of bytes the
+ * given key (or value) occupies. When no such function is supplied, the
+ * pointer itself is stored verbatim, which suits keys encoded directly
+ * in the pointer.
+ */
+typedef size_t (*ngds_payload_size_fptr) (const void *);
+
+/**
+ * Function used by upsert to compute the value to store for key. value
+ * is the current one when is_present, and NULL otherwise; on trees that
+ * own their values it points to the tree's copy, which may be updated
+ * in place and returned.
+ */
+typedef void *(*ngds_upsert_fptr) (const void *key, void *value,
+  bool is_present, void *context);
+
+/**
+ * Function used by merge to settle a key present in both trees. It gets
+ * the value of each tree and returns the one to keep, or another value
+ * to store instead.
+ */
+typedef void *(*ngds_merge_fptr) (const void *key, void *value,
+  void *other_value, void *context);
+
+/**
+ * Function called by range for every key visited, in order. Returning
+ * false ends the scan. It must not modify the tree.
+ */
+typedef bool (*ngds_range_fptr) (const void *key, void *value,
+  void *context);
+
+/**
+ * Function called with every node a cache evicts, just before it leaves
+ * the tree. On trees that own their keys or values, they point to the
+ * tree's copies and must not be kept.
+ */
+typedef void (*ngds_evict_fptr) (const void *key, void *value,
+  void *context);
+
+/**
+ * Function used to abbreviate a key into an integer prefix. Prefixes
+ * must order keys the same way the comparator does, so that whenever
+ * the prefix of a is below that of b, compare(a, b) is negative; keys
+ * with equal prefixes are told apart by the comparator.
+ */
+typedef uint64_t (*ngds_key_prefix_fptr) (const void *);
+
+/**
+ * Function used by the profiler to hash a key. Equal keys must hash
+ * equally; the result is mixed further, so it need not be uniform.
+ */
+typedef uint64_t (*ngds_key_hash_fptr) (const void *);
+
+/**
+ * Tree construction options; initialize with
+ * ngds_array_splay_tree_options_init() before setting any field.
+ *
+ * The node array starts with initial_element_count slots and grows one
+ * level at a time, up to max_element_count slots and at most a few
+ * levels past a balanced tree of the keys it holds. Once it cannot grow,
+ * an insert that needs a new level rebuilds a subtree above it balanced,
+ * and fails only when that does not make room. Splaying stops short of
+ * any rotation that would push nodes past the end of the array. All memory
+ * comes from allocator, or the process heap when it is NULL.
+ *
+ * A non-zero key_size or value_size makes the tree keep its own copy of
+ * that many bytes from every key or value passed in. Keys shorter than a
+ * pointer and values no larger than one are stored in the slot itself;
+ * anything bigger goes to a slab released in bulk by clear and destroy.
+ * Comparators then receive pointers to the stored copies, and values
+ * returned by get point into the tree, so inline ones stay valid only
+ * until the next modification.
+ *
+ * When key_prefix is set, every slot also caches the prefix of its key,
+ * and searches only call compare when the prefixes are equal.
+ *
+ * has_order_statistics makes every slot also count the nodes of its
+ * subtree, which rank and select need, at the cost of updating the
+ * counts along the path on every insert and removal.
+ */
+typedef struct ngds_array_splay_tree_options_s {
+  int                       initial_element_count;
+  int                       max_element_count;
+  ngds_comparator_fptr      compare;
+  const ngds_allocator_t   *allocator;
+  size_t                    key_size;
+  size_t                    value_size;
+  ngds_key_prefix_fptr      key_prefix;
+  bool                      has_order_statistics;
+} ngds_array_splay_tree_options_t;
+
+/**
+ * Snapshot of a tree's counters. The operation counters are only kept
+ * when the library is built with NGDS_ARRAY_SPLAY_TREE_WITH_STATS and
+ * read as zero otherwise; height and occupancy are always filled in.
+ */
+typedef struct ngds_array_splay_tree_stats_s {
+  uint64_t                  comparisons;
+  uint64_t                  rotations;
+  uint64_t                  nodes_moved;
+  uint64_t                  splays;
+  uint64_t                  splay_depth_total;
+  uint64_t                  splay_depth_max;
+  uint64_t                  insert_hits;
+  uint64_t                  insert_misses;
+  uint64_t                  get_hits;
+  uint64_t                  get_misses;
+  uint64_t                  remove_hits;
+  uint64_t                  remove_misses;
+  uint64_t                  evictions;
+  uint64_t                  compactions;
+  uint64_t                  rebuilds;
+  int                       height;
+  int                       utilized_element_count;
+  int                       allocated_element_count;
+} ngds_array_splay_tree_stats_t;
+
+typedef enum ngds_array_splay_tree_histogram_id_e {
+  NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_GET_DEPTH,
+  NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_ROTATION_NODES_MOVED,
+  NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_SPLAY_CYCLES,
+  NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_COUNT
+} ngds_array_splay_tree_histogram_id_t;
+
+/**
+ * Log-bucketed distribution: the depth at which each get found its key,
+ * the nodes moved by each rotation, or the cycles spent in each splay.
+ * Like the counters, histograms are only kept in builds with
+ * NGDS_ARRAY_SPLAY_TREE_WITH_STATS.
+ */
+typedef struct ngds_array_splay_tree_histogram_s {
+  uint64_t                  buckets[NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_BUCKETS];
+  uint64_t                  count;
+  uint64_t                  sum;
+} ngds_array_splay_tree_histogram_t;
+
+/**
+ * Access pattern estimates from the sampling profiler, over the lookups
+ * and inserts sampled since it was started or last reset.
+ *
+ * distinct_keys counts the keys sampled at least once. working_set_keys
+ * counts those sampled in the last complete window of samples, which
+ * follows shifts of the hot set. zipf_exponent is fitted to the
+ * frequencies of the most sampled keys: near 0 for uniform traffic,
+ * near 1 and above for the skew splaying pays off on. It reads as 0
+ * until enough keys have recurred to fit it.
+ */
+typedef struct ngds_array_splay_tree_profile_s {
+  uint64_t              sampled_operations;
+  double                distinct_keys;
+  double                working_set_keys;
+  double                mean_hit_depth;
+  double                zipf_exponent;
+} ngds_array_splay_tree_profile_t;
+
+/**
+ * Splaying regimes of the adaptive policy: never, only for nodes found
+ * deeper than a balanced tree would place them, or always.
+ */
+typedef enum ngds_array_splay_tree_splay_regime_e {
+  NGDS_ARRAY_SPLAY_TREE_SPLAY_NONE,
+  NGDS_ARRAY_SPLAY_TREE_SPLAY_THRESHOLD,
+  NGDS_ARRAY_SPLAY_TREE_SPLAY_FULL,
+  NGDS_ARRAY_SPLAY_TREE_SPLAY_REGIME_COUNT
+} ngds_array_splay_tree_splay_regime_t;
+
+/**
+ * A position in an in-order walk of a tree, owned by the caller. Moving
+ * a cursor neither allocates nor splays. A cursor is invalidated by any
+ * change to the tree, splaying included.
+ */
+typedef struct ngds_array_splay_tree_cursor_s {
+  ngds_array_splay_tree_t    *tree;
+  int                         idx;
+} ngds_array_splay_tree_cursor_t;
 
 /* ========================================================================= */
 /* -- FUNCTION PROTOTYPES -------------------------------------------------- */
@@ -38,16 +230,429 @@ ngds_array_splay_tree_new (
   ngds_free_fptr        freefp
 );
 
-void ngds_array_splay_tree_clear (ngds_array_splay_tree_t *me);
-void ngds_array_splay_tree_insert (ngds_array_splay_tree_t *me,
+void ngds_array_splay_tree_options_init (
+  ngds_array_splay_tree_options_t *options);
+ngds_array_splay_tree_t *ngds_array_splay_tree_new_with_options (
+  const ngds_array_splay_tree_options_t *options);
+
+/**
+ * Removes every key. Returns 0 on success, or -1, leaving the tree as it
+ * was, when an opened tree cannot be copied out of its mapping.
+ */
+int ngds_array_splay_tree_clear (ngds_array_splay_tree_t *me);
+
+/**
+ * Stores value under key, replacing the value of a key already present.
+ * Returns 0 on success, or -1 when the key could not be stored, because
+ * the tree cannot make room for the level it needs or copying the key or
+ * value failed. The tree keeps the keys it had on failure.
+ */
+int ngds_array_splay_tree_insert (ngds_array_splay_tree_t *me,
   void *key, void *value, bool should_perform_splay);
 void *ngds_array_splay_tree_get (ngds_array_splay_tree_t *me, const void *key,
   bool should_perform_splay);
+
+/**
+ * Stores the value updatefp computes from the current one, inserting key
+ * if it is missing, with a single descent and at most one splay. The
+ * value as stored is written to stored_value when given. Returns 1 if
+ * key was inserted, 0 if it was updated, and -1 if it could not be
+ * stored, as for insert.
+ */
+int ngds_array_splay_tree_upsert (ngds_array_splay_tree_t *me, void *key,
+  ngds_upsert_fptr updatefp, void *context, bool should_perform_splay,
+  void **stored_value);
+
+/**
+ * Looks up key, inserting it with value first if missing, and writes the
+ * value as stored to stored_value when given. Returns 1 if key was
+ * inserted, 0 if it was present, and -1 if it could not be stored, as
+ * for insert.
+ */
+int ngds_array_splay_tree_get_or_insert (ngds_array_splay_tree_t *me,
+  void *key, void *value, bool should_perform_splay, void **stored_value);
+
+/**
+ * Like get, but returns where the value is kept so that it can be
+ * updated in place: the value pointer's slot, a void **, on trees that
+ * store values by reference, or the tree's copy of the value on trees
+ * that own them. The reference is valid until the tree is next modified.
+ * Returns NULL if key is missing, or on shared memory trees, whose values
+ * are stored as offsets. A tree opened from a file is first copied out
+ * of its mapping, like any tree that is about to be modified.
+ */
+void *ngds_array_splay_tree_get_ref (ngds_array_splay_tree_t *me,
+  const void *key, bool should_perform_splay);
+
+/**
+ * Removes key and returns the stored key, or NULL if it was not found.
+ * Trees that own their keys return the key passed in instead.
+ */
 void *ngds_array_splay_tree_remove(ngds_array_splay_tree_t *, void *);
+
+/**
+ * Cursor positioning: on the smallest key, on the largest one, on the
+ * smallest key not less than key (seek or lower_bound), or on the
+ * smallest key greater than key (upper_bound). next and prev step in key
+ * order. Each returns false when there is no such key, leaving the
+ * cursor past the end, where key and value read as NULL and every step
+ * fails.
+ */
+bool ngds_array_splay_tree_cursor_first (ngds_array_splay_tree_t *me,
+  ngds_array_splay_tree_cursor_t *cursor);
+bool ngds_array_splay_tree_cursor_last (ngds_array_splay_tree_t *me,
+  ngds_array_splay_tree_cursor_t *cursor);
+bool ngds_array_splay_tree_cursor_seek (ngds_array_splay_tree_t *me,
+  ngds_array_splay_tree_cursor_t *cursor, const void *key);
+bool ngds_array_splay_tree_cursor_lower_bound (ngds_array_splay_tree_t *me,
+  ngds_array_splay_tree_cursor_t *cursor, const void *key);
+bool ngds_array_splay_tree_cursor_upper_bound (ngds_array_splay_tree_t *me,
+  ngds_array_splay_tree_cursor_t *cursor, const void *key);
+bool ngds_array_splay_tree_cursor_next (
+  ngds_array_splay_tree_cursor_t *cursor);
+bool ngds_array_splay_tree_cursor_prev (
+  ngds_array_splay_tree_cursor_t *cursor);
+void *ngds_array_splay_tree_cursor_key (
+  const ngds_array_splay_tree_cursor_t *cursor);
+void *ngds_array_splay_tree_cursor_value (
+  const ngds_array_splay_tree_cursor_t *cursor);
+
+/**
+ * Return the value of the largest key not greater than key (floor) or of
+ * the smallest key not less than it (ceil), or NULL if there is none;
+ * found_key, when given, is set to that key. The node found is splayed
+ * when should_perform_splay.
+ */
+void *ngds_array_splay_tree_floor (ngds_array_splay_tree_t *me,
+  const void *key, bool should_perform_splay, void **found_key);
+void *ngds_array_splay_tree_ceil (ngds_array_splay_tree_t *me,
+  const void *key, bool should_perform_splay, void **found_key);
+
+/**
+ * Return the value of the smallest or largest key, or NULL if the tree is
+ * empty; key, when given, is set to that key. Peeking leaves the tree as
+ * it is, and popping removes the node. Neither compares keys nor splays.
+ * The key and value of a popped node stay valid until the next pop, even
+ * if the tree stores them in the slot.
+ */
+void *ngds_array_splay_tree_peek_min (ngds_array_splay_tree_t *me,
+  void **key);
+void *ngds_array_splay_tree_peek_max (ngds_array_splay_tree_t *me,
+  void **key);
+void *ngds_array_splay_tree_pop_min (ngds_array_splay_tree_t *me,
+  void **key);
+void *ngds_array_splay_tree_pop_max (ngds_array_splay_tree_t *me,
+  void **key);
+
+/**
+ * Returns how many keys are less than key, whether or not key itself is
+ * present, or -1 if the tree does not keep order statistics.
+ */
+int ngds_array_splay_tree_rank (ngds_array_splay_tree_t *me,
+  const void *key, bool should_perform_splay);
+
+/**
+ * Returns the value of the key of rank k, counting from zero, or NULL if
+ * there are no more than k keys or the tree does not keep order
+ * statistics; found_key, when given, is set to that key.
+ */
+void *ngds_array_splay_tree_select (ngds_array_splay_tree_t *me, int k,
+  bool should_perform_splay, void **found_key);
+
+/**
+ * Moves the keys not less than key into a new tree, configured like me,
+ * and returns it; me keeps the keys below. Subtrees move level by level
+ * as block copies, and only the nodes on the search path are compared.
+ * Returns NULL, leaving me as it was, if the tree owns memory its keys
+ * or values live in (slab copies, mapped files, shared memory), a tree
+ * would exceed its maximum size, or memory runs out.
+ */
+ngds_array_splay_tree_t *ngds_array_splay_tree_split (
+  ngds_array_splay_tree_t *me, const void *key);
+
+/**
+ * Moves every key of other, all of which must sort after those of me,
+ * into me and destroys other. The trees must be configured alike.
+ * Returns 0 on success, or -1 leaving both trees as they were.
+ */
+int ngds_array_splay_tree_join (ngds_array_splay_tree_t *me,
+  ngds_array_splay_tree_t *other);
+
+/**
+ * Adds every key of other to me, which is laid out again as a balanced
+ * tree, in time linear in the size of both. Keys present in both keep
+ * the value resolvefp picks, or the one from other when it is NULL.
+ * other is left as it was. The trees must compare and store keys alike,
+ * and other must not own memory its keys or values live in. Returns 0
+ * on success, or -1 leaving me as it was.
+ */
+int ngds_array_splay_tree_merge (ngds_array_splay_tree_t *me,
+  ngds_array_splay_tree_t *other, ngds_merge_fptr resolvefp, void *context);
+
+/**
+ * Calls visitfp on every key in [lo, hi), in order; a NULL bound leaves
+ * that end open. Returns how many keys were visited. With
+ * should_perform_splay, the first key visited is splayed once the scan
+ * is over, so that repeated scans of a hot range start near the root.
+ */
+int ngds_array_splay_tree_range (ngds_array_splay_tree_t *me,
+  const void *lo, const void *hi, ngds_range_fptr visitfp, void *context,
+  bool should_perform_splay);
+
 int ngds_array_splay_tree_cardinality (ngds_array_splay_tree_t *me);
 void ngds_array_splay_tree_destroy (ngds_array_splay_tree_t *);
 void ngds_array_splay_tree_empty (ngds_array_splay_tree_t *);
 
+/**
+ * Fills stats with the counters accumulated since the tree was created
+ * or last reset. Insert hits are replacements of an existing key, and
+ * rebuilds count subtrees laid out again to make room for an insert,
+ * and trees laid out again after adaptive splaying tried a regime.
+ */
+void ngds_array_splay_tree_stats (ngds_array_splay_tree_t *me,
+  ngds_array_splay_tree_stats_t *stats);
+void ngds_array_splay_tree_stats_reset (ngds_array_splay_tree_t *me);
+
+/**
+ * Merges the per-thread shards of one histogram into histogram. Threads
+ * record into their own shard, so concurrent readers do not contend.
+ */
+void ngds_array_splay_tree_histogram (ngds_array_splay_tree_t *me,
+  ngds_array_splay_tree_histogram_id_t id,
+  ngds_array_splay_tree_histogram_t *histogram);
+void ngds_array_splay_tree_histogram_reset (ngds_array_splay_tree_t *me);
+
+/**
+ * Starts sampling one in every sample_interval lookups and inserts. Keys
+ * are hashed with key_hashfp, as their key_size bytes on trees that own
+ * their keys, or by pointer otherwise. Updates from concurrent readers
+ * are not synchronized, which only costs accuracy. Returns 0 on
+ * success, -1 if the profiler cannot be allocated.
+ */
+int ngds_array_splay_tree_profile_start (ngds_array_splay_tree_t *me,
+  int sample_interval, ngds_key_hash_fptr key_hashfp);
+void ngds_array_splay_tree_profile_stop (ngds_array_splay_tree_t *me);
+
+/**
+ * Fills profile with the current estimates. Returns -1 when the tree is
+ * not being profiled.
+ */
+int ngds_array_splay_tree_profile (ngds_array_splay_tree_t *me,
+  ngds_array_splay_tree_profile_t *profile);
+void ngds_array_splay_tree_profile_reset (ngds_array_splay_tree_t *me);
+
+/**
+ * Lets the tree decide whether gets and inserts splay, ignoring their
+ * should_perform_splay argument. Every epoch of operations it measures
+ * the depth of hits and the nodes moved by restructuring under the
+ * current regime, now and then trying the others, and settles on the
+ * cheapest. It starts out not splaying, and a regime has to be clearly
+ * cheaper to be switched to. A regime on trial grows the array at most
+ * one level past a balanced tree, and a trial that leaves lookups deeper
+ * without splaying is undone by rebuilding the tree balanced.
+ * Disabling returns control to the callers.
+ */
+void ngds_array_splay_tree_set_adaptive_splay (ngds_array_splay_tree_t *me,
+  bool is_enabled);
+ngds_array_splay_tree_splay_regime_t ngds_array_splay_tree_splay_regime (
+  ngds_array_splay_tree_t *me);
+
+/**
+ * Lets gets and inserts start from the node the previous one ended at,
+ * climbing from it only as far as the key calls for before descending,
+ * instead of starting every search at the root. Keys near the previous
+ * one are then found in time logarithmic in their distance from it,
+ * which suits sequential and local access, above all without splaying.
+ */
+void ngds_array_splay_tree_set_finger_search (ngds_array_splay_tree_t *me,
+  bool is_enabled);
+
+/**
+ * Makes the tree a cache of at most capacity keys, or lifts the bound
+ * when capacity is zero. An insert of a new key into a full tree first
+ * evicts a leaf, the deeper of two found by descending along random
+ * paths, as the nodes splaying leaves deepest are those least recently
+ * used. An insert that would need a level beyond the maximum size
+ * evicts the deepest node on its search path instead of failing. Keys
+ * above capacity, say after a merge, are evicted by the next insert.
+ * evictfp, when given, is called with each evicted node. Returns 0 on
+ * success, or -1 for shared memory trees, or when an opened tree cannot
+ * be copied out of its mapping to evict from.
+ */
+int ngds_array_splay_tree_set_capacity (ngds_array_splay_tree_t *me,
+  int capacity, ngds_evict_fptr evictfp, void *context);
+
+/**
+ * Lets inserted keys expire ttl nanoseconds after they were last
+ * inserted, or never when ttl is zero. Expired keys are evicted lazily:
+ * when a get or insert finds one, and a few slots at a time by a sweep
+ * up from the deepest level on every insert. Until then they still
+ * count towards the cardinality and are seen by walks, cursors and
+ * bound queries. Returns 0 on success, or -1 for shared memory trees or
+ * when the expiry times cannot be allocated.
+ */
+int ngds_array_splay_tree_set_ttl (ngds_array_splay_tree_t *me,
+  uint64_t ttl);
+
+/**
+ * Makes removals lazy while max_tombstone_ratio is above zero. A removed
+ * node stays in its slot as a tombstone, moving nothing, and is skipped
+ * by every lookup, walk and count; inserting its key again revives it in
+ * place. Once tombstones make up more than max_tombstone_ratio of the
+ * nodes, all of them are dropped in one pass that rebuilds the live
+ * nodes as a balanced tree. Popping an extreme drops the tombstones it
+ * passes, and split, join, save and checkpoint compact first. Keys
+ * stored by reference must stay valid until their tombstone is gone. A
+ * ratio of zero compacts and returns to eager removal. Returns 0 on
+ * success, or -1 for shared memory trees or when memory runs out.
+ */
+int ngds_array_splay_tree_set_lazy_removal (ngds_array_splay_tree_t *me,
+  double max_tombstone_ratio);
+
+/**
+ * Drops every tombstone now. Returns 0 on success, or -1 when memory
+ * runs out, leaving the tree as it was.
+ */
+int ngds_array_splay_tree_compact (ngds_array_splay_tree_t *me);
+
+/**
+ * Writes up to max_keys keys from the top levels of the tree into keys,
+ * in level order, root first. Splaying keeps the keys used most often
+ * near the root, so this is the hot set, hottest first. Keys the tree
+ * owns point into its memory, and are only valid until it next changes.
+ * Returns how many keys were written, which is 0 when levels or max_keys
+ * is not positive.
+ */
+int ngds_array_splay_tree_export_hot_set (ngds_array_splay_tree_t *me,
+  int levels, void **keys, int max_keys);
+
+/**
+ * Rebuilds a loaded tree around a hot set exported earlier, say by the
+ * previous run of the process, within one level more than a balanced
+ * tree. Every subtree is rooted at the first of keys that leaves both
+ * sides room enough below, or else at its median, so an exported hot
+ * set comes back in its shape as far as that room allows, and the rest
+ * of the tree fills the levels below. Keys missing from the tree are
+ * skipped. Returns 0 on success, or -1 for shared memory trees or when
+ * memory runs out, leaving the tree as it was.
+ */
+int ngds_array_splay_tree_preload_hot_set (ngds_array_splay_tree_t *me,
+  void *const *keys, int count);
+
+/**
+ * Abbreviates a NUL-terminated string into its first eight bytes, most
+ * significant first, which orders strings as strcmp() does.
+ */
+uint64_t ngds_array_splay_tree_string_prefix (const void *key);
+
+/**
+ * Records every insert, get and remove from now on into a trace file at
+ * path, for replay with tools/ngds_replay. Keys are written with
+ * key_sizefp bytes each, or as key_size bytes on trees that own their
+ * keys; otherwise the pointer itself is recorded. Returns 0 on success,
+ * -1 on failure.
+ */
+int ngds_array_splay_tree_trace_start (ngds_array_splay_tree_t *me,
+  const char *path, ngds_payload_size_fptr key_sizefp);
+
+/**
+ * Stops recording and closes the trace. Returns 0 if every operation
+ * made it to the file, -1 otherwise. Destroying the tree stops it too.
+ */
+int ngds_array_splay_tree_trace_stop (ngds_array_splay_tree_t *me);
+
+/**
+ * Writes the tree to the file at path. Keys and values for which a size
+ * function is given are copied into the file and referenced by offset,
+ * all others are stored verbatim. Returns 0 on success, -1 on failure.
+ */
+int ngds_array_splay_tree_save (ngds_array_splay_tree_t *me, const char *path,
+  ngds_payload_size_fptr key_sizefp, ngds_payload_size_fptr value_sizefp);
+
+/**
+ * Maps a file written by ngds_array_splay_tree_save(). Lookups without
+ * splaying run directly against the mapping; the first operation that
+ * restructures the tree copies the node array into private memory.
+ * When that copy cannot be allocated, operations that modify the tree
+ * fail as they do when memory runs out and leave it mapped, and lookups
+ * skip their splay. Keys and values stored by offset point into the
+ * mapping for the life of the tree. Returns NULL if the file is missing
+ * or incompatible.
+ */
+ngds_array_splay_tree_t *
+ngds_array_splay_tree_open (
+  const char           *path,
+  ngds_comparator_fptr  comparefp,
+  ngds_malloc_fptr      mallocfp,
+  ngds_free_fptr        freefp
+);
+
+/**
+ * Starts tracking which pages of the node array are modified. Tracking
+ * is reset by every ngds_array_splay_tree_save(), which becomes the base
+ * the following checkpoints apply to. Returns 0 on success.
+ */
+int ngds_array_splay_tree_checkpoint_enable (ngds_array_splay_tree_t *me);
+
+/**
+ * Writes only the pages modified since the last save or checkpoint to
+ * path, then marks every page clean. Size functions behave as they do
+ * for ngds_array_splay_tree_save(). Returns 0 on success, -1 on failure.
+ */
+int ngds_array_splay_tree_checkpoint (ngds_array_splay_tree_t *me,
+  const char *path, ngds_payload_size_fptr key_sizefp,
+  ngds_payload_size_fptr value_sizefp);
+
+/**
+ * Rebuilds a tree from a base snapshot followed by its checkpoints, in
+ * the order they were written. Returns NULL if any file is unusable.
+ */
+ngds_array_splay_tree_t *
+ngds_array_splay_tree_restore (
+  const char           *base_path,
+  const char          **delta_paths,
+  int                   delta_count,
+  ngds_comparator_fptr  comparefp,
+  ngds_malloc_fptr      mallocfp,
+  ngds_free_fptr        freefp
+);
+
+/**
+ * Creates a POSIX shared memory segment of segment_size bytes holding a
+ * tree of initial_element_count slots. Keys and values inserted into it
+ * must be allocated with ngds_array_splay_tree_shm_malloc(), as slots
+ * store their offset within the segment rather than a pointer.
+ */
+ngds_array_splay_tree_t *
+ngds_array_splay_tree_shm_create (
+  const char           *name,
+  size_t                segment_size,
+  int                   initial_element_count,
+  ngds_comparator_fptr  comparefp
+);
+
+/**
+ * Maps an existing segment, at whatever address this process gets it.
+ */
+ngds_array_splay_tree_t *
+ngds_array_splay_tree_shm_attach (
+  const char           *name,
+  ngds_comparator_fptr  comparefp
+);
+
+int ngds_array_splay_tree_shm_unlink (const char *name);
+void *ngds_array_splay_tree_shm_malloc (ngds_array_splay_tree_t *me,
+  size_t size);
+void ngds_array_splay_tree_shm_free (ngds_array_splay_tree_t *me, void *ptr);
+
+/**
+ * Process-shared locking. Lookups without splaying need the read lock;
+ * inserts, removes and splaying lookups need the write lock.
+ */
+void ngds_array_splay_tree_shm_read_lock (ngds_array_splay_tree_t *me);
+void ngds_array_splay_tree_shm_write_lock (ngds_array_splay_tree_t *me);
+void ngds_array_splay_tree_shm_unlock (ngds_array_splay_tree_t *me);
+
 #if 0
 
 int ngds_array_splay_tree_cardinality(ngds_array_splay_tree_t* me);
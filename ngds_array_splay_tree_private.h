@@ -2,12 +2,46 @@
 #define NGDS_ARRAY_SPLAY_TREE_PRIVATE_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "ngds_trace.h"
 
 /* ========================================================================= */
 /* -- OPAQUE TYPES --------------------------------------------------------- */
 /* ========================================================================= */
 
 typedef struct ngds_array_splay_tree_node_s ngds_array_splay_tree_node_t;
+typedef struct ngds_array_splay_tree_backing_buffer_s
+  ngds_array_splay_tree_backing_buffer_t;
+typedef struct ngds_array_splay_tree_shm_header_s
+  ngds_array_splay_tree_shm_header_t;
+
+/* ========================================================================= */
+/* -- DEFINITIONS ---------------------------------------------------------- */
+/* ========================================================================= */
+
+#define NGDS_ARRAY_SPLAY_TREE_FILE_MAGIC            "NGDSAST"
+#define NGDS_ARRAY_SPLAY_TREE_DELTA_MAGIC           "NGDSASD"
+#define NGDS_ARRAY_SPLAY_TREE_SHM_MAGIC             "NGDSASM"
+#define NGDS_ARRAY_SPLAY_TREE_FILE_VERSION          1
+
+/* On-disk flags */
+#define NGDS_ARRAY_SPLAY_TREE_FILE_KEY_OFFSETS      0x00000001
+#define NGDS_ARRAY_SPLAY_TREE_FILE_VALUE_OFFSETS    0x00000002
+
+/* Threads are spread over this many histogram shards per tree */
+#define NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_SHARDS      8
+
+/* HyperLogLog registers, about 3% error, and keys tracked for skew */
+#define NGDS_ARRAY_SPLAY_TREE_PROFILE_REGISTER_BITS 10
+#define NGDS_ARRAY_SPLAY_TREE_PROFILE_REGISTERS     \
+  (1 << NGDS_ARRAY_SPLAY_TREE_PROFILE_REGISTER_BITS)
+#define NGDS_ARRAY_SPLAY_TREE_PROFILE_TOP_KEYS      64
+#define NGDS_ARRAY_SPLAY_TREE_PROFILE_WINDOW        4096
+
+/* Adaptive splaying re-evaluates its regime after every epoch */
+#define NGDS_ARRAY_SPLAY_TREE_ADAPTIVE_EPOCH        1024
 
 /* ========================================================================= */
 /* -- TYPES ---------------------------------------------------------------- */
@@ -15,22 +49,270 @@ typedef struct ngds_array_splay_tree_node_s ngds_array_splay_tree_node_t;
 
 typedef void (*ngds_node_printer) (const ngds_array_splay_tree_node_t *);
 
+/* Parts of an operation that can be bracketed by a phase hook */
+typedef enum ngds_array_splay_tree_phase_e {
+  NGDS_ARRAY_SPLAY_TREE_PHASE_DESCENT,
+  NGDS_ARRAY_SPLAY_TREE_PHASE_SPLAY,
+  NGDS_ARRAY_SPLAY_TREE_PHASE_SHIFT,
+  NGDS_ARRAY_SPLAY_TREE_PHASE_COUNT
+} ngds_array_splay_tree_phase_t;
+
+typedef void (*ngds_phase_hook_fptr) (void *context,
+  ngds_array_splay_tree_phase_t phase, bool is_begin);
+
 struct ngds_array_splay_tree_node_s {
   void                 *key;
   void                 *value;
 };
 
+/*
+ * Memory holding restored payloads or tree-owned keys and values,
+ * released when the tree is cleared or destroyed
+ */
+struct ngds_array_splay_tree_backing_buffer_s {
+  ngds_array_splay_tree_backing_buffer_t *next;
+  uint64_t                                size;
+};
+
+/* One thread's share of every histogram, on cache lines of its own */
+typedef struct ngds_array_splay_tree_histogram_shard_s {
+  uint64_t  buckets[NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_COUNT]
+                   [NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_BUCKETS];
+  uint64_t  sums[NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_COUNT];
+} __attribute__((aligned(NGDS_CACHE_LINE_SIZE)))
+  ngds_array_splay_tree_histogram_shard_t;
+
+/*
+ * Sampling profiler state. Distinct keys are counted by HyperLogLog,
+ * over the whole run and over windows of samples; the most frequent
+ * keys are tracked with the space-saving algorithm.
+ */
+typedef struct ngds_array_splay_tree_profiler_s {
+  ngds_key_hash_fptr  key_hash;
+  int                 sample_interval;
+  int                 countdown;
+  uint64_t            sampled_operations;
+  uint64_t            hit_count;
+  uint64_t            hit_depth_total;
+  int                 window_samples;
+  bool                has_previous_window;
+  uint8_t             registers[NGDS_ARRAY_SPLAY_TREE_PROFILE_REGISTERS];
+  uint8_t             window_registers
+                        [NGDS_ARRAY_SPLAY_TREE_PROFILE_REGISTERS];
+  uint8_t             previous_window_registers
+                        [NGDS_ARRAY_SPLAY_TREE_PROFILE_REGISTERS];
+  uint64_t            top_hashes[NGDS_ARRAY_SPLAY_TREE_PROFILE_TOP_KEYS];
+  uint64_t            top_counts[NGDS_ARRAY_SPLAY_TREE_PROFILE_TOP_KEYS];
+  uint64_t            top_errors[NGDS_ARRAY_SPLAY_TREE_PROFILE_TOP_KEYS];
+} ngds_array_splay_tree_profiler_t;
+
+/*
+ * Adaptive splaying state. Each regime keeps a moving average of the
+ * hit depth and of the nodes moved per operation seen while it ran, and
+ * the settled regime its hit depth from before the last trial of others.
+ */
+typedef struct ngds_array_splay_tree_adaptive_s {
+  bool        is_enabled;
+  bool        is_exploring;
+  bool        is_trial_over;
+  double      pre_trial_depth;
+  int         regime;
+  int         settled_regime;
+  int         epoch_operations;
+  uint64_t    epoch_depth_total;
+  uint64_t    epoch_start_moved_node_count;
+  uint64_t    epoch;
+  uint64_t    last_explored_epoch;
+  uint64_t    explore_interval;
+  bool        has_estimate[NGDS_ARRAY_SPLAY_TREE_SPLAY_REGIME_COUNT];
+  uint64_t    estimate_epoch[NGDS_ARRAY_SPLAY_TREE_SPLAY_REGIME_COUNT];
+  double      depth[NGDS_ARRAY_SPLAY_TREE_SPLAY_REGIME_COUNT];
+  double      moved[NGDS_ARRAY_SPLAY_TREE_SPLAY_REGIME_COUNT];
+} ngds_array_splay_tree_adaptive_t;
+
+/*
+ * Bounded cache mode, off while capacity and ttl are both zero. Every
+ * slot of expiry_times holds the monotonic time, in nanoseconds, after
+ * which the node in the matching slot of node_array has expired.
+ */
+typedef struct ngds_array_splay_tree_cache_s {
+  int                 capacity;
+  ngds_evict_fptr     evict;
+  void               *evict_context;
+  uint64_t            ttl;
+  uint64_t           *expiry_times;
+  int                 sweep_idx;
+  uint64_t            walk_state;
+} ngds_array_splay_tree_cache_t;
+
 struct ngds_array_splay_tree_s {
   int                             allocated_element_count;
   int                             utilized_element_count;
-  size_t                          shifted_element_bitmap_size_in_bytes;
-  uint64_t                       *shifted_element_bitmap;
   ngds_array_splay_tree_node_t   *node_array;
   ngds_comparator_fptr            compare;
-  ngds_malloc_fptr                malloc;
-  ngds_free_fptr                  free;
+  int                             max_element_count;
+
+  /* Trees created from plain hooks keep them for the allocator adapters */
+  ngds_allocator_t                allocator;
+  ngds_malloc_fptr                legacy_malloc;
+  ngds_free_fptr                  legacy_free;
+
+  /*
+   * Trees opened from a file keep their node array inside the mapping
+   * until the first mutation promotes it to private memory. While keys
+   * or values are offset-encoded, the base is added back on every read.
+   */
+  uintptr_t                       key_base;
+  uintptr_t                       value_base;
+  void                           *mapping;
+  size_t                          mapping_size;
+  bool                            node_array_is_mapped;
+
+  /* One bit per page of node_array modified since the last checkpoint */
+  size_t                                   dirty_page_bitmap_size_in_bytes;
+  uint64_t                                *dirty_page_bitmap;
+  ngds_array_splay_tree_backing_buffer_t  *backing_buffers;
+
+  /*
+   * Sizes of tree-owned keys and values, zero when stored by reference.
+   * Copies that do not fit in the slot are carved from the newest
+   * backing buffer.
+   */
+  size_t                                   key_size;
+  size_t                                   value_size;
+  char                                    *slab_top;
+  size_t                                   slab_available;
+
+  /* Abbreviated keys, one per slot of node_array */
+  ngds_key_prefix_fptr                     key_prefix;
+  uint64_t                                *key_prefixes;
+
+  /* Nodes in the subtree rooted at each slot, zero for empty ones */
+  int                                     *subtree_counts;
+
+  /*
+   * Lazy removal leaves removed nodes in place, flagged in the matching
+   * byte of tombstones, until they make up more than tombstone_ratio of
+   * the nodes in the array.
+   */
+  uint8_t                                 *tombstones;
+  int                                      tombstone_count;
+  double                                   tombstone_ratio;
+
+  /* Copy of the node last popped, which its key and value may point into */
+  ngds_array_splay_tree_node_t             popped_node;
+
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_STATS
+  /* Height and occupancy are derived when a snapshot is taken */
+  ngds_array_splay_tree_stats_t            stats;
+  ngds_array_splay_tree_histogram_shard_t *histogram_shards;
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_PHASE_HOOKS
+  /* Called around the descent of get, splaying and subtree shifts */
+  ngds_phase_hook_fptr                     phase_hook;
+  void                                    *phase_hook_context;
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_PHASE_HOOKS */
+
+  /* Running count of nodes moved by shifts, for probes and histograms */
+  uint64_t                                 moved_node_count;
+
+  /* Self-tuning choice of splaying, when enabled */
+  ngds_array_splay_tree_adaptive_t         adaptive;
+
+  /* Where the last lookup or insert ended, when finger search is on */
+  bool                                     has_finger;
+  int                                      finger;
+
+  /* Capacity and expiry of a tree used as a cache */
+  ngds_array_splay_tree_cache_t            cache;
+
+  /* Access pattern profiler, NULL unless started */
+  ngds_array_splay_tree_profiler_t        *profiler;
+
+  /* Operation recorder, and how much of each key it writes */
+  ngds_trace_writer_t                     *trace;
+  ngds_payload_size_fptr                   trace_key_size;
+
+  /* Shared-memory trees store offsets from the start of the segment */
+  ngds_array_splay_tree_shm_header_t      *shm;
+  bool                                     shm_is_write_locked;
+};
+
+/*
+ * On-disk layout, all offsets relative to the start of the file:
+ *
+ *   [header][pad][node_array (allocated_element_count nodes)][pad][payload]
+ *
+ * The node array is stored exactly as it is laid out in memory, so an
+ * opened tree can be queried straight out of the mapping. Keys and values
+ * are either stored verbatim (inline) or as offsets into the payload area.
+ */
+typedef struct ngds_array_splay_tree_file_header_s {
+  char                            magic[8];
+  uint32_t                        version;
+  uint32_t                        flags;
+  uint32_t                        root_index;
+  uint32_t                        pointer_size;
+  int64_t                         allocated_element_count;
+  int64_t                         utilized_element_count;
+  uint64_t                        node_array_offset;
+  uint64_t                        payload_offset;
+  uint64_t                        payload_size;
+} ngds_array_splay_tree_file_header_t;
+
+/*
+ * Checkpoint delta layout, all offsets relative to the start of the file:
+ *
+ *   [header][pad][page records][pad][payload]
+ *
+ * Each page record is the page number, eight bytes of padding and the
+ * nodes_per_page slots of that page, encoded as in the full snapshot.
+ */
+typedef struct ngds_array_splay_tree_delta_header_s {
+  char                            magic[8];
+  uint32_t                        version;
+  uint32_t                        flags;
+  uint32_t                        root_index;
+  uint32_t                        pointer_size;
+  int64_t                         allocated_element_count;
+  int64_t                         utilized_element_count;
+  uint32_t                        nodes_per_page;
+  uint32_t                        page_count;
+  uint64_t                        page_offset;
+  uint64_t                        payload_offset;
+  uint64_t                        payload_size;
+} ngds_array_splay_tree_delta_header_t;
+
+/*
+ * Shared-memory segment layout, all offsets relative to the segment:
+ *
+ *   [header][pad][node_array][pad][heap ... segment_size]
+ *
+ * The header holds the state every attached process must agree on; the
+ * per-process handle copies the counts in and out under the lock.
+ */
+struct ngds_array_splay_tree_shm_header_s {
+  char                            magic[8];
+  uint32_t                        version;
+  uint32_t                        root_index;
+  uint64_t                        segment_size;
+  int64_t                         allocated_element_count;
+  int64_t                         utilized_element_count;
+  uint64_t                        node_array_offset;
+  uint64_t                        heap_offset;
+  uint64_t                        heap_top;
+  uint64_t                        free_list;
+  pthread_rwlock_t                lock;
+  pthread_mutex_t                 heap_lock;
 };
 
+/* Prefix of every block handed out from the segment heap */
+typedef struct ngds_array_splay_tree_shm_block_s {
+  uint64_t                        size;
+  uint64_t                        next;
+} ngds_array_splay_tree_shm_block_t;
+
 /* ========================================================================= */
 /* -- FUNCTION PROTOTYPES -------------------------------------------------- */
 /* ========================================================================= */
@@ -45,6 +327,15 @@ ngds_array_splay_tree_node_t *ngds_array_splay_tree_get_node_at_idx (
 int ngds_array_splay_tree_rotate_left(ngds_array_splay_tree_t* me, int idx);
 int ngds_array_splay_tree_rotate_right(ngds_array_splay_tree_t* me, int idx);
 
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_PHASE_HOOKS
+/*
+ * Installs a hook called at the beginning and end of every phase, for
+ * measurement harnesses. Shifts happen within splays and removals.
+ */
+void ngds_array_splay_tree_set_phase_hook (ngds_array_splay_tree_t *me,
+  ngds_phase_hook_fptr hook, void *context);
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_PHASE_HOOKS */
+
 
 #endif /* NGDS_ARRAY_SPLAY_TREE_PRIVATE_H */
 /* vi: set et sw=2 ts=2: */
@@ -0,0 +1,295 @@
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Public */
+#include "ngds_trace.h"
+
+/* ========================================================================= */
+/* -- DEFINITIONS ---------------------------------------------------------- */
+/* ========================================================================= */
+
+#define TRACE_MAGIC                 "NGDSTRCE"
+#define TRACE_MAGIC_SIZE            8
+#define TRACE_VERSION               1
+
+/* Low bits of a record's first byte are the operation, the top one splay */
+#define TRACE_OPERATION_MASK        0x03
+#define TRACE_SPLAY_FLAG            0x80
+
+#define TRACE_BUFFER_SIZE           (1024 * 1024)
+
+/* Opcode byte plus a 64-bit value as LEB128 */
+#define TRACE_MAX_PREAMBLE_SIZE     11
+
+/* ========================================================================= */
+/* -- TYPES ---------------------------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * The file starts with this header, in host byte order, followed by the
+ * records: one opcode byte, the pointer or the key length as an LEB128
+ * varint and, for byte keys, the key itself.
+ */
+typedef struct ngds_trace_header_s {
+  char                        magic[TRACE_MAGIC_SIZE];
+  uint32_t                    version;
+  uint32_t                    key_encoding;
+} ngds_trace_header_t;
+
+struct ngds_trace_writer_s {
+  FILE                       *file;
+  char                       *buffer;
+  ngds_trace_key_encoding_t   key_encoding;
+  bool                        has_failed;
+};
+
+struct ngds_trace_reader_s {
+  FILE                       *file;
+  ngds_trace_key_encoding_t   key_encoding;
+  char                       *key_buffer;
+  size_t                      key_buffer_size;
+};
+
+/* ========================================================================= */
+/* -- STATIC FUNCTIONS ----------------------------------------------------- */
+/* ========================================================================= */
+
+static size_t
+encode_varint (
+  unsigned char        *buffer,
+  uint64_t              value
+) {
+  size_t length = 0;
+
+  while (0x80 <= value) {
+    buffer[length++] = (unsigned char) (value | 0x80);
+    value >>= 7;
+  }
+  buffer[length++] = (unsigned char) value;
+
+  return length;
+} /* encode_varint() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+decode_varint (
+  FILE                 *file,
+  uint64_t             *value
+) {
+  int shift;
+
+  *value = 0;
+  for (shift = 0; shift < 64; shift += 7) {
+    int c = getc_unlocked(file);
+    if (EOF == c) {
+      return -1;
+    }
+    *value |= (uint64_t) (c & 0x7f) << shift;
+    if (0 == (c & 0x80)) {
+      return 0;
+    }
+  }
+
+  return -1;
+} /* decode_varint() */
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTIONS ----------------------------------------------------- */
+/* ========================================================================= */
+
+ngds_trace_writer_t *
+ngds_trace_writer_open (
+  const char                 *path,
+  ngds_trace_key_encoding_t   key_encoding
+) {
+  ngds_trace_writer_t  *writer;
+  ngds_trace_header_t   header;
+
+  writer = calloc(1, sizeof(ngds_trace_writer_t));
+  if (NULL == writer) {
+    return NULL;
+  }
+
+  writer->file = fopen(path, "wb");
+  if (NULL == writer->file) {
+    free(writer);
+    return NULL;
+  }
+
+  /* A large buffer keeps the recorder off the write path most of the time */
+  writer->buffer = malloc(TRACE_BUFFER_SIZE);
+  if (NULL != writer->buffer) {
+    setvbuf(writer->file, writer->buffer, _IOFBF, TRACE_BUFFER_SIZE);
+  }
+  writer->key_encoding = key_encoding;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+  header.version = TRACE_VERSION;
+  header.key_encoding = key_encoding;
+  if (1 != fwrite(&header, sizeof(header), 1, writer->file)) {
+    ngds_trace_writer_close(writer);
+    return NULL;
+  }
+
+  return writer;
+} /* ngds_trace_writer_open() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_trace_writer_append (
+  ngds_trace_writer_t        *writer,
+  ngds_trace_operation_t      operation,
+  bool                        should_perform_splay,
+  const void                 *key,
+  size_t                      key_length
+) {
+  unsigned char preamble[TRACE_MAX_PREAMBLE_SIZE];
+  size_t        preamble_length = 0;
+
+  preamble[preamble_length++] = (unsigned char) operation
+    | ((true == should_perform_splay) ? TRACE_SPLAY_FLAG : 0);
+
+  if (NGDS_TRACE_KEY_POINTER == writer->key_encoding) {
+    preamble_length += encode_varint(&preamble[preamble_length],
+      (uint64_t) (uintptr_t) key);
+    key_length = 0;
+  } else {
+    preamble_length += encode_varint(&preamble[preamble_length],
+      (uint64_t) key_length);
+  }
+
+  flockfile(writer->file);
+  if (preamble_length != fwrite_unlocked(preamble, 1, preamble_length,
+        writer->file)
+      || key_length != fwrite_unlocked(key, 1, key_length, writer->file)) {
+    writer->has_failed = true;
+  }
+  funlockfile(writer->file);
+
+  return (true == writer->has_failed) ? -1 : 0;
+} /* ngds_trace_writer_append() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_trace_writer_close (
+  ngds_trace_writer_t        *writer
+) {
+  int rc = (true == writer->has_failed) ? -1 : 0;
+
+  if (0 != fclose(writer->file)) {
+    rc = -1;
+  }
+  free(writer->buffer);
+  free(writer);
+
+  return rc;
+} /* ngds_trace_writer_close() */
+
+/* ------------------------------------------------------------------------- */
+
+ngds_trace_reader_t *
+ngds_trace_reader_open (
+  const char                 *path
+) {
+  ngds_trace_reader_t  *reader;
+  ngds_trace_header_t   header;
+
+  reader = calloc(1, sizeof(ngds_trace_reader_t));
+  if (NULL == reader) {
+    return NULL;
+  }
+
+  reader->file = fopen(path, "rb");
+  if (NULL == reader->file) {
+    free(reader);
+    return NULL;
+  }
+
+  if (1 != fread(&header, sizeof(header), 1, reader->file)
+      || 0 != memcmp(header.magic, TRACE_MAGIC, TRACE_MAGIC_SIZE)
+      || TRACE_VERSION != header.version
+      || NGDS_TRACE_KEY_BYTES < header.key_encoding) {
+    ngds_trace_reader_close(reader);
+    return NULL;
+  }
+  reader->key_encoding = header.key_encoding;
+
+  return reader;
+} /* ngds_trace_reader_open() */
+
+/* ------------------------------------------------------------------------- */
+
+ngds_trace_key_encoding_t
+ngds_trace_reader_key_encoding (
+  const ngds_trace_reader_t  *reader
+) {
+  return reader->key_encoding;
+} /* ngds_trace_reader_key_encoding() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+ngds_trace_reader_next (
+  ngds_trace_reader_t        *reader,
+  ngds_trace_record_t        *record
+) {
+  uint64_t  value;
+  int       opcode = getc_unlocked(reader->file);
+
+  if (EOF == opcode) {
+    return 0;
+  }
+
+  record->operation = opcode & TRACE_OPERATION_MASK;
+  record->should_perform_splay = (0 != (opcode & TRACE_SPLAY_FLAG));
+  if (NGDS_TRACE_INSERT > record->operation
+      || NGDS_TRACE_REMOVE < record->operation
+      || 0 != decode_varint(reader->file, &value)) {
+    return -1;
+  }
+
+  if (NGDS_TRACE_KEY_POINTER == reader->key_encoding) {
+    record->key = (const void *) (uintptr_t) value;
+    record->key_length = 0;
+    return 1;
+  }
+
+  if (value > reader->key_buffer_size) {
+    char *key_buffer = realloc(reader->key_buffer, value);
+    if (NULL == key_buffer) {
+      return -1;
+    }
+    reader->key_buffer = key_buffer;
+    reader->key_buffer_size = value;
+  }
+  if (value != fread(reader->key_buffer, 1, value, reader->file)) {
+    return -1;
+  }
+  record->key = reader->key_buffer;
+  record->key_length = value;
+
+  return 1;
+} /* ngds_trace_reader_next() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+ngds_trace_reader_close (
+  ngds_trace_reader_t        *reader
+) {
+  fclose(reader->file);
+  free(reader->key_buffer);
+  free(reader);
+} /* ngds_trace_reader_close() */
+
+/* vi: set et sw=2 ts=2: */
@@ -0,0 +1,97 @@
+#ifndef NGDS_TRACE_H
+#define NGDS_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* ========================================================================= */
+/* -- OPAQUE TYPES --------------------------------------------------------- */
+/* ========================================================================= */
+
+typedef struct ngds_trace_writer_s ngds_trace_writer_t;
+typedef struct ngds_trace_reader_s ngds_trace_reader_t;
+
+/* ========================================================================= */
+/* -- TYPES ---------------------------------------------------------------- */
+/* ========================================================================= */
+
+typedef enum ngds_trace_operation_e {
+  NGDS_TRACE_INSERT = 1,
+  NGDS_TRACE_GET,
+  NGDS_TRACE_REMOVE
+} ngds_trace_operation_t;
+
+/**
+ * How keys are written. Pointer keys record the pointer itself, which
+ * suits integers encoded in it; byte keys record a length and that many
+ * bytes from the key.
+ */
+typedef enum ngds_trace_key_encoding_e {
+  NGDS_TRACE_KEY_POINTER,
+  NGDS_TRACE_KEY_BYTES
+} ngds_trace_key_encoding_t;
+
+/**
+ * One operation read back from a trace. For byte keys, key points into
+ * the reader and stays valid until the next record is read; for pointer
+ * keys it is the recorded pointer and key_length is zero.
+ */
+typedef struct ngds_trace_record_s {
+  ngds_trace_operation_t    operation;
+  bool                      should_perform_splay;
+  const void               *key;
+  size_t                    key_length;
+} ngds_trace_record_t;
+
+/* ========================================================================= */
+/* -- FUNCTION PROTOTYPES -------------------------------------------------- */
+/* ========================================================================= */
+
+/**
+ * Creates the trace file at path. Returns NULL if it cannot be written.
+ */
+ngds_trace_writer_t *ngds_trace_writer_open (const char *path,
+  ngds_trace_key_encoding_t key_encoding);
+
+/**
+ * Appends one operation; key_length is ignored for pointer keys. Records
+ * are written whole even when several threads append at once. Returns
+ * 0 on success, -1 once a write has failed.
+ */
+int ngds_trace_writer_append (ngds_trace_writer_t *writer,
+  ngds_trace_operation_t operation, bool should_perform_splay,
+  const void *key, size_t key_length);
+
+/**
+ * Flushes and closes the trace. Returns 0 if every record made it to
+ * the file, -1 otherwise.
+ */
+int ngds_trace_writer_close (ngds_trace_writer_t *writer);
+
+/**
+ * Opens a trace for reading. Returns NULL if the file is missing or not
+ * a trace of a version this library understands.
+ */
+ngds_trace_reader_t *ngds_trace_reader_open (const char *path);
+ngds_trace_key_encoding_t ngds_trace_reader_key_encoding (
+  const ngds_trace_reader_t *reader);
+
+/**
+ * Reads the next record. Returns 1 when one was read, 0 at the end of
+ * the trace and -1 if the trace is truncated or corrupt.
+ */
+int ngds_trace_reader_next (ngds_trace_reader_t *reader,
+  ngds_trace_record_t *record);
+void ngds_trace_reader_close (ngds_trace_reader_t *reader);
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif /* NGDS_TRACE_H */
+/* vi: set et sw=2 ts=2: */
@@ -1,14 +1,19 @@
 
 #include <stdbool.h>
+#include <limits.h>
 #include <assert.h>
 #include <setjmp.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #define NG_SPLAY_ARRAY_HAS_ZERO_INDEX_ROOT 0
 #include "ngds_array_splay_tree.h"
 #include "ngds_array_splay_tree_private.h"
+#include "ngds_allocator.h"
+#include "ngds_trace.h"
 
 #include "tests/CuTest.h"
 
@@ -26,7 +31,82 @@ static int uint_compare (
   const void *e1,
   const void *e2
 ) {
-  return (e2 - e1);
+  return (e1 - e2);
+}
+
+static int string_compare (
+  const void *e1,
+  const void *e2
+) {
+  return strcmp(e1, e2);
+}
+
+static int int_ptr_compare (
+  const void *e1,
+  const void *e2
+) {
+  return (*(const int *) e1 - *(const int *) e2);
+}
+
+/* Three-way, as in the header, without relying on a subtraction */
+static int ordered_compare (
+  const void *e1,
+  const void *e2
+) {
+  return ((intptr_t) e1 > (intptr_t) e2) - ((intptr_t) e1 < (intptr_t) e2);
+}
+
+static int comparison_count = 0;
+
+static int counting_string_compare (
+  const void *e1,
+  const void *e2
+) {
+  ++comparison_count;
+  return strcmp(e1, e2);
+}
+
+static void *histogram_reader (
+  void *tree
+) {
+  int ii;
+
+  for (ii = 0; ii < 1000; ++ii) {
+    ngds_array_splay_tree_get(tree, (void *) (1 + (ii % 5)), false);
+  }
+  return NULL;
+}
+
+static void insert_balanced (
+  ngds_array_splay_tree_t *t,
+  long lo,
+  long hi
+) {
+  long mid = lo + ((hi - lo) / 2);
+
+  if (lo > hi) {
+    return;
+  }
+  ngds_array_splay_tree_insert(t, (void *) mid, (void *) mid, false);
+  insert_balanced(t, lo, (mid - 1));
+  insert_balanced(t, (mid + 1), hi);
+}
+
+static size_t string_size (
+  const void *e
+) {
+  return (strlen(e) + 1);
+}
+
+static void make_temp_path (
+  char *path,
+  size_t len
+) {
+  int fd;
+
+  snprintf(path, len, "/tmp/ngds_array_splay_tree_XXXXXX");
+  fd = mkstemp(path);
+  close(fd);
 }
 
   //ngds_array_splay_tree_print(t, node_printer);
@@ -416,7 +496,7 @@ perform_custom_allocator_test (
 
   /* Point directly to the memory segment allocated for the node array */
   ngds_array_splay_tree_node_t *node_memory_segment =
-    (ngds_array_splay_tree_node_t *) allocations[2];
+    (ngds_array_splay_tree_node_t *) allocations[1];
   for (ii = 0; ii < sizeof(tests) / sizeof(int); ++ii) {
     ngds_array_splay_tree_node_t *node = &node_memory_segment[ii];
 
@@ -495,6 +575,2372 @@ perform_removal_with_predecessor_test (
 
 } /* perform_removal_with_predecessor_test() */
 
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Save and Open (Inline Keys)
+ *
+ * The opened tree answers lookups out of the mapping and is only copied
+ * into private memory once it gets splayed.
+ */
+void
+perform_save_and_open_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_t *t;
+  ngds_array_splay_tree_t *o;
+  int nodes[] = { 5, 6, 3, 2, 4 };
+  int tests[] = { 0, 3, 2, 5, 0, 0, 4, 6 };
+  char path[64];
+  int ii;
+
+  make_temp_path(path, sizeof(path));
+  t = ngds_array_splay_tree_new(128, uint_compare, NULL, NULL);
+
+  for (ii = 0; ii < sizeof(nodes) / sizeof(int); ++ii) {
+    ngds_array_splay_tree_insert(t,
+      (void *) nodes[ii], (void *) nodes[ii], false);
+  }
+
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_save(t, path, NULL, NULL));
+
+  o = ngds_array_splay_tree_open(path, uint_compare, NULL, NULL);
+  CuAssertPtrNotNull(tc, o);
+  CuAssertIntEquals(tc, 5, ngds_array_splay_tree_cardinality(o));
+
+  for (ii = 0; ii < 128; ++ii) {
+    CuAssertTrue(tc, ngds_array_splay_tree_get_node_at_idx(t, ii)->value
+      == ngds_array_splay_tree_get_node_at_idx(o, ii)->value);
+  }
+
+  CuAssertTrue(tc, 4 == (int) ngds_array_splay_tree_get(o, (void *) 4, false));
+  CuAssertTrue(tc, NULL == ngds_array_splay_tree_get(o, (void *) 7, false));
+  CuAssertTrue(tc, true == o->node_array_is_mapped);
+
+  CuAssertTrue(tc, 3 == (int) ngds_array_splay_tree_get(o, (void *) 3, true));
+  CuAssertTrue(tc, false == o->node_array_is_mapped);
+
+  for (ii = 0; ii < sizeof(tests) / sizeof(int); ++ii) {
+    ngds_array_splay_tree_node_t *node =
+      ngds_array_splay_tree_get_node_at_idx(o, ii);
+
+    CuAssertTrue(tc, tests[ii] == (int) node->value);
+  }
+
+  ngds_array_splay_tree_destroy(o);
+  ngds_array_splay_tree_destroy(t);
+  unlink(path);
+
+} /* perform_save_and_open_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Save and Open (Offset-Encoded Keys and Values)
+ */
+void
+perform_save_and_open_with_payload_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_t *t;
+  ngds_array_splay_tree_t *o;
+  char *keys[] = { "echo", "golf", "charlie", "alpha", "delta" };
+  char *values[] = { "ECHO", "GOLF", "CHARLIE", "ALPHA", "DELTA" };
+  char **ref;
+  char key[16];
+  char path[64];
+  int ii;
+
+  make_temp_path(path, sizeof(path));
+  t = ngds_array_splay_tree_new(128, string_compare, NULL, NULL);
+
+  for (ii = 0; ii < sizeof(keys) / sizeof(char *); ++ii) {
+    ngds_array_splay_tree_insert(t, keys[ii], values[ii], false);
+  }
+
+  CuAssertIntEquals(tc, 0,
+    ngds_array_splay_tree_save(t, path, string_size, string_size));
+  ngds_array_splay_tree_destroy(t);
+
+  o = ngds_array_splay_tree_open(path, string_compare, NULL, NULL);
+  CuAssertPtrNotNull(tc, o);
+
+  /* Search with a key that lives nowhere near the original strings */
+  strcpy(key, "delta");
+  CuAssertStrEquals(tc, "DELTA", ngds_array_splay_tree_get(o, key, false));
+  CuAssertTrue(tc, true == o->node_array_is_mapped);
+
+  /* A reference is into the promoted copy, which holds pointers */
+  ref = ngds_array_splay_tree_get_ref(o, "charlie", false);
+  CuAssertPtrNotNull(tc, ref);
+  CuAssertStrEquals(tc, "CHARLIE", *ref);
+  CuAssertTrue(tc, false == o->node_array_is_mapped);
+
+  for (ii = 0; ii < sizeof(keys) / sizeof(char *); ++ii) {
+    CuAssertStrEquals(tc, values[ii],
+      ngds_array_splay_tree_get(o, keys[ii], true));
+  }
+  CuAssertTrue(tc, false == o->node_array_is_mapped);
+
+  CuAssertStrEquals(tc, "alpha", ngds_array_splay_tree_remove(o, "alpha"));
+  CuAssertTrue(tc, NULL == ngds_array_splay_tree_get(o, "alpha", false));
+  CuAssertIntEquals(tc, 4, ngds_array_splay_tree_cardinality(o));
+
+  ngds_array_splay_tree_destroy(o);
+  unlink(path);
+
+} /* perform_save_and_open_with_payload_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Blocks budgeted_malloc() still gives out, or any number when negative */
+static int malloc_budget = -1;
+
+static void *
+budgeted_malloc (
+  size_t                size
+) {
+  if (0 == malloc_budget) {
+    return NULL;
+  }
+  if (0 < malloc_budget) {
+    --malloc_budget;
+  }
+  return malloc(size);
+} /* budgeted_malloc() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Open Without Memory to Promote
+ *
+ * An opened tree that cannot copy its node array out of the mapping
+ * stays mapped: changes fail, and lookups answer without splaying.
+ */
+void
+perform_open_allocation_failure_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_t *t;
+  ngds_array_splay_tree_t *o;
+  char *keys[] = { "echo", "golf", "charlie", "alpha", "delta" };
+  char path[64];
+  int ii;
+
+  make_temp_path(path, sizeof(path));
+  t = ngds_array_splay_tree_new(128, string_compare, NULL, NULL);
+  for (ii = 0; ii < sizeof(keys) / sizeof(char *); ++ii) {
+    ngds_array_splay_tree_insert(t, keys[ii], keys[ii], false);
+  }
+  CuAssertIntEquals(tc, 0,
+    ngds_array_splay_tree_save(t, path, string_size, string_size));
+  ngds_array_splay_tree_destroy(t);
+
+  o = ngds_array_splay_tree_open(path, string_compare, budgeted_malloc, free);
+  CuAssertPtrNotNull(tc, o);
+
+  malloc_budget = 0;
+  CuAssertIntEquals(tc, -1, ngds_array_splay_tree_insert(o, "bravo",
+    "bravo", false));
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_remove(o, "alpha"));
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_get_ref(o, "alpha",
+    false));
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_pop_min(o, NULL));
+  CuAssertIntEquals(tc, -1, ngds_array_splay_tree_clear(o));
+  CuAssertStrEquals(tc, "golf", ngds_array_splay_tree_get(o, "golf", true));
+  CuAssertTrue(tc, true == o->node_array_is_mapped);
+  CuAssertIntEquals(tc, 5, ngds_array_splay_tree_cardinality(o));
+
+  malloc_budget = -1;
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_insert(o, "bravo",
+    "bravo", false));
+  CuAssertTrue(tc, false == o->node_array_is_mapped);
+  CuAssertStrEquals(tc, "alpha", ngds_array_splay_tree_pop_min(o, NULL));
+  CuAssertIntEquals(tc, 5, ngds_array_splay_tree_cardinality(o));
+
+  ngds_array_splay_tree_destroy(o);
+  unlink(path);
+
+} /* perform_open_allocation_failure_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Incremental Checkpoints
+ *
+ * Only pages touched since the previous checkpoint are written, and the
+ * base plus its deltas restore the exact layout.
+ */
+void
+perform_checkpoint_and_restore_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_t *t;
+  ngds_array_splay_tree_t *r;
+  ngds_array_splay_tree_delta_header_t header;
+  char *keys[] = { "mike", "foxtrot", "tango", "charlie", "india",
+    "papa", "yankee" };
+  char base[64];
+  char delta[2][64];
+  const char *deltas[] = { delta[0], delta[1] };
+  FILE *fp;
+  int ii;
+
+  make_temp_path(base, sizeof(base));
+  make_temp_path(delta[0], sizeof(delta[0]));
+  make_temp_path(delta[1], sizeof(delta[1]));
+  t = ngds_array_splay_tree_new(1024, string_compare, NULL, NULL);
+
+  for (ii = 0; ii < 5; ++ii) {
+    ngds_array_splay_tree_insert(t, keys[ii], keys[ii], false);
+  }
+
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_checkpoint_enable(t));
+  CuAssertIntEquals(tc, 0,
+    ngds_array_splay_tree_save(t, base, string_size, string_size));
+
+  /* Touches only the top of the tree */
+  ngds_array_splay_tree_insert(t, keys[5], keys[5], false);
+  ngds_array_splay_tree_get(t, "india", true);
+  CuAssertIntEquals(tc, 0,
+    ngds_array_splay_tree_checkpoint(t, delta[0], string_size, string_size));
+
+  fp = fopen(delta[0], "rb");
+  CuAssertIntEquals(tc, 1, fread(&header, sizeof(header), 1, fp));
+  fclose(fp);
+  CuAssertTrue(tc, 0 < header.page_count && 4 > header.page_count);
+
+  ngds_array_splay_tree_insert(t, keys[6], keys[6], true);
+  ngds_array_splay_tree_remove(t, "foxtrot");
+  CuAssertIntEquals(tc, 0,
+    ngds_array_splay_tree_checkpoint(t, delta[1], string_size, string_size));
+
+  r = ngds_array_splay_tree_restore(base, deltas, 2, string_compare,
+    NULL, NULL);
+  CuAssertPtrNotNull(tc, r);
+  CuAssertIntEquals(tc, ngds_array_splay_tree_cardinality(t),
+    ngds_array_splay_tree_cardinality(r));
+
+  for (ii = 0; ii < 1024; ++ii) {
+    ngds_array_splay_tree_node_t *a = ngds_array_splay_tree_get_node_at_idx(t, ii);
+    ngds_array_splay_tree_node_t *b = ngds_array_splay_tree_get_node_at_idx(r, ii);
+
+    CuAssertTrue(tc, (NULL == a->key) == (NULL == b->key));
+    if (NULL != a->key) {
+      CuAssertStrEquals(tc, a->key, b->key);
+      CuAssertStrEquals(tc, a->value, b->value);
+    }
+  }
+
+  ngds_array_splay_tree_destroy(r);
+  ngds_array_splay_tree_destroy(t);
+  unlink(base);
+  unlink(delta[0]);
+  unlink(delta[1]);
+
+} /* perform_checkpoint_and_restore_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shared Memory
+ *
+ * Two handles map the same segment at different addresses; whatever one
+ * inserts, the other finds.
+ */
+void
+perform_shared_memory_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_t *writer;
+  ngds_array_splay_tree_t *reader;
+  int nodes[] = { 5, 6, 3, 2, 4 };
+  char name[64];
+  int key;
+  int *val;
+  int ii;
+
+  snprintf(name, sizeof(name), "/ngds_array_splay_tree_%d", (int) getpid());
+  writer = ngds_array_splay_tree_shm_create(name, (1 << 20), 128,
+    int_ptr_compare);
+  CuAssertPtrNotNull(tc, writer);
+
+  reader = ngds_array_splay_tree_shm_attach(name, int_ptr_compare);
+  CuAssertPtrNotNull(tc, reader);
+  CuAssertTrue(tc, writer->mapping != reader->mapping);
+
+  ngds_array_splay_tree_shm_write_lock(writer);
+  for (ii = 0; ii < sizeof(nodes) / sizeof(int); ++ii) {
+    int *k = ngds_array_splay_tree_shm_malloc(writer, sizeof(int));
+    int *v = ngds_array_splay_tree_shm_malloc(writer, sizeof(int));
+    *k = nodes[ii];
+    *v = nodes[ii] * 10;
+    ngds_array_splay_tree_insert(writer, k, v, false);
+  }
+  ngds_array_splay_tree_shm_unlock(writer);
+
+  ngds_array_splay_tree_shm_read_lock(reader);
+  CuAssertIntEquals(tc, 5, ngds_array_splay_tree_cardinality(reader));
+  key = 4;
+  val = ngds_array_splay_tree_get(reader, &key, false);
+  CuAssertPtrNotNull(tc, val);
+  CuAssertIntEquals(tc, 40, *val);
+  CuAssertTrue(tc, (char *) val > (char *) reader->mapping
+    && (char *) val < (char *) reader->mapping + reader->mapping_size);
+  ngds_array_splay_tree_shm_unlock(reader);
+
+  /* Splay through the reader, then check the shape from the writer */
+  ngds_array_splay_tree_shm_write_lock(reader);
+  key = 3;
+  CuAssertIntEquals(tc, 30,
+    *(int *) ngds_array_splay_tree_get(reader, &key, true));
+  key = 6;
+  ngds_array_splay_tree_shm_free(reader,
+    ngds_array_splay_tree_remove(reader, &key));
+  ngds_array_splay_tree_shm_unlock(reader);
+
+  ngds_array_splay_tree_shm_read_lock(writer);
+  CuAssertIntEquals(tc, 4, ngds_array_splay_tree_cardinality(writer));
+  /* Slots hold offsets into the segment, not pointers */
+  CuAssertIntEquals(tc, 3, *(int *) ((char *) writer->mapping
+    + (uintptr_t) ngds_array_splay_tree_get_node_at_idx(writer, 1)->key));
+  key = 6;
+  CuAssertTrue(tc, NULL == ngds_array_splay_tree_get(writer, &key, false));
+  ngds_array_splay_tree_shm_unlock(writer);
+
+  ngds_array_splay_tree_destroy(reader);
+  ngds_array_splay_tree_destroy(writer);
+  ngds_array_splay_tree_shm_unlink(name);
+
+} /* perform_shared_memory_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Growth
+ *
+ * Ascending inserts build a right spine deeper than the initial array,
+ * until it would run four levels below a balanced tree of its keys.
+ * The bottom of the spine is then rebuilt balanced in place instead.
+ */
+void
+perform_growth_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_t *t;
+  int ii;
+
+  t = ngds_array_splay_tree_new(8, uint_compare, NULL, NULL);
+
+  for (ii = 1; ii <= 8; ++ii) {
+    CuAssertIntEquals(tc, 0, ngds_array_splay_tree_insert(t, (void *) ii,
+      (void *) ii, false));
+  }
+  CuAssertIntEquals(tc, (1 << 8), t->allocated_element_count);
+  CuAssertPtrEquals(tc, (void *) 8, t->node_array[(1 << 8) - 1].key);
+
+  /* 9 and then 10 would need a 9th level, where 10 keys fit in 4 */
+  for (ii = 9; ii <= 10; ++ii) {
+    CuAssertIntEquals(tc, 0, ngds_array_splay_tree_insert(t, (void *) ii,
+      (void *) ii, false));
+  }
+  CuAssertIntEquals(tc, 10, ngds_array_splay_tree_cardinality(t));
+  CuAssertIntEquals(tc, (1 << 8), t->allocated_element_count);
+  CuAssertPtrEquals(tc, (void *) 4, t->node_array[15].key);
+  CuAssertPtrEquals(tc, (void *) 7, t->node_array[31].key);
+  CuAssertPtrEquals(tc, (void *) 10, t->node_array[255].key);
+
+  for (ii = 1; ii <= 10; ++ii) {
+    CuAssertTrue(tc, ii == (int) ngds_array_splay_tree_get(t, (void *) ii,
+      false));
+  }
+
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_growth_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Checks that t holds exactly the keys lo to hi, and ranks them right */
+static void
+assert_key_range (
+  CuTest                   *tc,
+  ngds_array_splay_tree_t  *t,
+  long                      lo,
+  long                      hi
+) {
+  ngds_array_splay_tree_cursor_t cursor;
+  long expected = lo;
+
+  if (true == ngds_array_splay_tree_cursor_first(t, &cursor)) {
+    do {
+      CuAssertPtrEquals(tc, (void *) expected,
+        ngds_array_splay_tree_cursor_key(&cursor));
+      CuAssertPtrEquals(tc, (void *) (expected - lo),
+        (void *) (long) ngds_array_splay_tree_rank(t, (void *) expected,
+          false));
+      ++expected;
+    } while (true == ngds_array_splay_tree_cursor_next(&cursor));
+  }
+  CuAssertIntEquals(tc, (int) (hi + 1), (int) expected);
+  CuAssertIntEquals(tc, (int) (hi - lo + 1),
+    ngds_array_splay_tree_cardinality(t));
+} /* assert_key_range() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Maximum Size
+ *
+ * A full tree refuses both new levels and rotations that would push
+ * nodes off the end of the array, and never loses a node. A tree that
+ * splays itself out of levels is rebuilt balanced to make room, and
+ * only refuses keys a balanced tree could not hold.
+ */
+void
+perform_maximum_size_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_t *t;
+  int nodes[] = { 4, 2, 6, 1, 3, 5, 7 };
+  int ii;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 8;
+  options.max_element_count = 8;
+  options.compare = uint_compare;
+  t = ngds_array_splay_tree_new_with_options(&options);
+
+  for (ii = 0; ii < sizeof(nodes) / sizeof(int); ++ii) {
+    CuAssertIntEquals(tc, 0, ngds_array_splay_tree_insert(t,
+      (void *) nodes[ii], (void *) nodes[ii], false));
+  }
+
+  CuAssertIntEquals(tc, -1, ngds_array_splay_tree_insert(t, (void *) 8,
+    (void *) 8, false));
+  CuAssertIntEquals(tc, -1, ngds_array_splay_tree_get_or_insert(t,
+    (void *) 8, (void *) 8, false, NULL));
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_insert(t, (void *) 7,
+    (void *) 70, false));
+  CuAssertIntEquals(tc, 7, ngds_array_splay_tree_cardinality(t));
+  CuAssertIntEquals(tc, 8, t->allocated_element_count);
+
+  CuAssertTrue(tc, 1 == (int) ngds_array_splay_tree_get(t, (void *) 1, true));
+
+  for (ii = 0; ii < sizeof(nodes) / sizeof(int); ++ii) {
+    CuAssertTrue(tc, ((7 == nodes[ii]) ? 70 : nodes[ii])
+      == (int) ngds_array_splay_tree_get(t, (void *) nodes[ii], false));
+  }
+
+  ngds_array_splay_tree_destroy(t);
+
+  /* Ascending splayed inserts leave a path, with 1 due on a 5th level */
+  options.max_element_count = 16;
+  options.has_order_statistics = true;
+  t = ngds_array_splay_tree_new_with_options(&options);
+  for (ii = 2; ii <= 5; ++ii) {
+    CuAssertIntEquals(tc, 0, ngds_array_splay_tree_insert(t, (void *) ii,
+      (void *) ii, true));
+  }
+  CuAssertPtrEquals(tc, (void *) 2, t->node_array[8].key);
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_insert(t, (void *) 1,
+    (void *) 1, false));
+  CuAssertIntEquals(tc, 16, t->allocated_element_count);
+  assert_key_range(tc, t, 1, 5);
+
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_maximum_size_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * An allocator that gives out a fixed number of blocks and counts those
+ * still live. The context holds the remaining budget and the live count.
+ */
+static void *
+rationed_malloc (
+  void                 *context,
+  size_t                size
+) {
+  int *counts = context;
+
+  if (0 >= counts[0]) {
+    return NULL;
+  }
+  --counts[0];
+  ++counts[1];
+  return malloc(size);
+} /* rationed_malloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+rationed_realloc (
+  void                 *context,
+  void                 *ptr,
+  size_t                old_size,
+  size_t                new_size
+) {
+  (void) context;
+  (void) old_size;
+  return realloc(ptr, new_size);
+} /* rationed_realloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+rationed_aligned_alloc (
+  void                 *context,
+  size_t                alignment,
+  size_t                size
+) {
+  (void) alignment;
+  return rationed_malloc(context, size);
+} /* rationed_aligned_alloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+rationed_free (
+  void                 *context,
+  void                 *ptr,
+  size_t                size
+) {
+  int *counts = context;
+
+  (void) size;
+  --counts[1];
+  free(ptr);
+} /* rationed_free() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Allocation Failures
+ *
+ * Creating a tree fails cleanly at whichever allocation runs out,
+ * releasing everything allocated before it.
+ */
+void
+perform_allocation_failure_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_allocator_t allocator;
+  ngds_array_splay_tree_t *t;
+  int counts[2];
+  int budget;
+
+  allocator.context = counts;
+  allocator.malloc = rationed_malloc;
+  allocator.realloc = rationed_realloc;
+  allocator.aligned_alloc = rationed_aligned_alloc;
+  allocator.free = rationed_free;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 128;
+  options.compare = string_compare;
+  options.allocator = &allocator;
+  options.key_prefix = ngds_array_splay_tree_string_prefix;
+  options.has_order_statistics = true;
+
+  for (budget = 0; ; ++budget) {
+    counts[0] = budget;
+    counts[1] = 0;
+    t = ngds_array_splay_tree_new_with_options(&options);
+    if (NULL != t) {
+      break;
+    }
+    CuAssertIntEquals(tc, 0, counts[1]);
+  }
+  CuAssertTrue(tc, 4 <= budget);
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_insert(t, "alpha", "alpha",
+    false));
+  ngds_array_splay_tree_destroy(t);
+  CuAssertIntEquals(tc, 0, counts[1]);
+
+} /* perform_allocation_failure_test() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+pool_churn (
+  void                 *arg
+) {
+  const ngds_allocator_t *pool = arg;
+  void *blocks[64];
+  int ii;
+
+  for (ii = 0; ii < 64; ++ii) {
+    blocks[ii] = pool->malloc(pool->context, 16 << (ii % 8));
+  }
+  for (ii = 0; ii < 64; ++ii) {
+    pool->free(pool->context, blocks[ii], 16 << (ii % 8));
+  }
+
+  return NULL;
+} /* pool_churn() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Allocator Backends
+ *
+ * Trees work from every backend. Threads leave nothing cached behind, and
+ * large heap blocks from the huge page allocator go back to the heap.
+ */
+void
+perform_allocator_backends_test (
+  CuTest               *tc
+) {
+  const ngds_allocator_t *allocators[3];
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_t *t;
+  ngds_arena_t *arena;
+  pthread_t thread;
+  char *block;
+  int nodes[] = { 5, 6, 3, 2, 4, 1 };
+  int ii, jj;
+
+  arena = ngds_arena_new(4096);
+  allocators[0] = ngds_arena_allocator(arena);
+  allocators[1] = ngds_allocator_thread_pool();
+  allocators[2] = ngds_allocator_huge_page();
+
+  for (jj = 0; jj < 3; ++jj) {
+    ngds_array_splay_tree_options_init(&options);
+    options.initial_element_count = (1 << 17);
+    options.compare = uint_compare;
+    options.allocator = allocators[jj];
+    t = ngds_array_splay_tree_new_with_options(&options);
+    CuAssertPtrNotNull(tc, t);
+    CuAssertTrue(tc, 0 == ((uintptr_t) t->node_array % NGDS_CACHE_LINE_SIZE));
+
+    for (ii = 0; ii < sizeof(nodes) / sizeof(int); ++ii) {
+      ngds_array_splay_tree_insert(t,
+        (void *) nodes[ii], (void *) nodes[ii], true);
+    }
+    for (ii = 0; ii < sizeof(nodes) / sizeof(int); ++ii) {
+      CuAssertTrue(tc, nodes[ii] == (int) ngds_array_splay_tree_get(t,
+        (void *) nodes[ii], true));
+    }
+
+    ngds_array_splay_tree_destroy(t);
+  }
+
+  ngds_arena_destroy(arena);
+
+  CuAssertIntEquals(tc, 0, pthread_create(&thread, NULL, pool_churn,
+    (void *) allocators[1]));
+  CuAssertIntEquals(tc, 0, pthread_join(thread, NULL));
+
+  block = allocators[2]->aligned_alloc(allocators[2]->context,
+    (2 * NGDS_HUGE_PAGE_SIZE), NGDS_HUGE_PAGE_SIZE);
+  CuAssertPtrNotNull(tc, block);
+  CuAssertTrue(tc, 0 == ((uintptr_t) block % (2 * NGDS_HUGE_PAGE_SIZE)));
+  memset(block, 0xff, NGDS_HUGE_PAGE_SIZE);
+  block = allocators[2]->realloc(allocators[2]->context, block,
+    NGDS_HUGE_PAGE_SIZE, (2 * NGDS_HUGE_PAGE_SIZE));
+  CuAssertPtrNotNull(tc, block);
+  CuAssertIntEquals(tc, 0xff, (unsigned char) block[NGDS_HUGE_PAGE_SIZE - 1]);
+  allocators[2]->free(allocators[2]->context, block,
+    (2 * NGDS_HUGE_PAGE_SIZE));
+
+} /* perform_allocator_backends_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Tree-Owned Keys and Values
+ *
+ * Integer keys live in the slot and strings in the slab, so the buffers
+ * passed to insert can be reused straight away.
+ */
+void
+perform_owned_storage_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_t *t;
+  int nodes[] = { 5, 6, 3, 2, 4, 1 };
+  char value[32];
+  char name[24];
+  int key;
+  int ii;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 128;
+  options.compare = int_ptr_compare;
+  options.key_size = sizeof(int);
+  options.value_size = sizeof(value);
+  t = ngds_array_splay_tree_new_with_options(&options);
+
+  for (ii = 0; ii < sizeof(nodes) / sizeof(int); ++ii) {
+    key = nodes[ii];
+    snprintf(value, sizeof(value), "value %d", key);
+    ngds_array_splay_tree_insert(t, &key, value, true);
+  }
+  key = 0;
+  memset(value, 0, sizeof(value));
+
+  CuAssertIntEquals(tc, 6, ngds_array_splay_tree_cardinality(t));
+  for (ii = 0; ii < sizeof(nodes) / sizeof(int); ++ii) {
+    snprintf(value, sizeof(value), "value %d", nodes[ii]);
+    CuAssertStrEquals(tc, value,
+      ngds_array_splay_tree_get(t, &nodes[ii], (ii % 2)));
+  }
+
+  key = 3;
+  ngds_array_splay_tree_insert(t, &key, "replaced", false);
+  CuAssertIntEquals(tc, 6, ngds_array_splay_tree_cardinality(t));
+  CuAssertStrEquals(tc, "replaced", ngds_array_splay_tree_get(t, &key, false));
+
+  CuAssertPtrEquals(tc, &key, ngds_array_splay_tree_remove(t, &key));
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_get(t, &key, false));
+
+  ngds_array_splay_tree_clear(t);
+  CuAssertPtrEquals(tc, NULL, t->backing_buffers);
+  ngds_array_splay_tree_destroy(t);
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 128;
+  options.compare = string_compare;
+  options.key_size = sizeof(name);
+  options.value_size = sizeof(int);
+  t = ngds_array_splay_tree_new_with_options(&options);
+
+  for (ii = 0; ii < sizeof(nodes) / sizeof(int); ++ii) {
+    memset(name, 0, sizeof(name));
+    snprintf(name, sizeof(name), "key %d", nodes[ii]);
+    ngds_array_splay_tree_insert(t, name, &nodes[ii], true);
+  }
+
+  for (ii = 0; ii < sizeof(nodes) / sizeof(int); ++ii) {
+    memset(name, 0, sizeof(name));
+    snprintf(name, sizeof(name), "key %d", nodes[ii]);
+    CuAssertIntEquals(tc, nodes[ii],
+      *(int *) ngds_array_splay_tree_get(t, name, true));
+  }
+
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_owned_storage_test() */
+
+/* ------------------------------------------------------------------------- */
+
+static bool
+collect_range (
+  const void           *key,
+  void                 *value,
+  void                 *context
+) {
+  long *keys = context;
+
+  keys[++keys[0]] = (long) key;
+  return (keys[0] < 8);
+} /* collect_range() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Abbreviated Keys
+ *
+ * Keys whose first eight bytes differ are found with a single call to
+ * the comparator, the one confirming the match, and prefixes order keys
+ * the way the comparator does, so ordered lookups and scans agree with
+ * those of a tree without them.
+ */
+void
+perform_abbreviated_key_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_cursor_t cursor;
+  ngds_array_splay_tree_t *trees[2];
+  ngds_array_splay_tree_t *t;
+  char *keys[] = { "echo", "bravo", "golf", "alpha", "delta", "charlie",
+    "foxtrot", "hotel-one", "hotel-two" };
+  long found[16];
+  int ii;
+  int jj;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 128;
+  options.compare = counting_string_compare;
+  options.key_prefix = ngds_array_splay_tree_string_prefix;
+  t = ngds_array_splay_tree_new_with_options(&options);
+
+  for (ii = 0; ii < sizeof(keys) / sizeof(char *); ++ii) {
+    ngds_array_splay_tree_insert(t, keys[ii], keys[ii], (ii % 2));
+  }
+
+  comparison_count = 0;
+  for (ii = 0; ii < 7; ++ii) {
+    CuAssertStrEquals(tc, keys[ii], ngds_array_splay_tree_get(t, keys[ii],
+      false));
+  }
+  CuAssertIntEquals(tc, 7, comparison_count);
+
+  for (ii = 0; ii < sizeof(keys) / sizeof(char *); ++ii) {
+    CuAssertStrEquals(tc, keys[ii], ngds_array_splay_tree_get(t, keys[ii],
+      true));
+  }
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_get(t, "hotel", false));
+
+  CuAssertPtrEquals(tc, keys[8], ngds_array_splay_tree_remove(t, "hotel-two"));
+  CuAssertStrEquals(tc, keys[7], ngds_array_splay_tree_get(t, "hotel-one",
+    false));
+
+  ngds_array_splay_tree_destroy(t);
+
+  for (jj = 0; jj < 2; ++jj) {
+    ngds_array_splay_tree_options_init(&options);
+    options.initial_element_count = 128;
+    options.compare = string_compare;
+    options.key_prefix = (0 == jj) ? NULL
+      : ngds_array_splay_tree_string_prefix;
+    trees[jj] = ngds_array_splay_tree_new_with_options(&options);
+    for (ii = 0; ii < sizeof(keys) / sizeof(char *); ++ii) {
+      ngds_array_splay_tree_insert(trees[jj], keys[ii], keys[ii], false);
+    }
+  }
+
+  for (jj = 0; jj < 2; ++jj) {
+    t = trees[jj];
+    CuAssertTrue(tc, true == ngds_array_splay_tree_cursor_first(t,
+      &cursor));
+    CuAssertStrEquals(tc, "alpha", ngds_array_splay_tree_cursor_key(&cursor));
+    CuAssertStrEquals(tc, "charlie", ngds_array_splay_tree_ceil(t, "c",
+      false, NULL));
+    CuAssertStrEquals(tc, "bravo", ngds_array_splay_tree_floor(t, "c",
+      false, NULL));
+
+    found[0] = 0;
+    CuAssertIntEquals(tc, 3, ngds_array_splay_tree_range(t, "b", "e",
+      collect_range, found, false));
+    CuAssertStrEquals(tc, "bravo", (char *) found[1]);
+    CuAssertStrEquals(tc, "charlie", (char *) found[2]);
+    CuAssertStrEquals(tc, "delta", (char *) found[3]);
+  }
+
+  ngds_array_splay_tree_destroy(trees[0]);
+  ngds_array_splay_tree_destroy(trees[1]);
+
+} /* perform_abbreviated_key_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Statistics
+ *
+ * Splaying 3 in the zig tree is a single rotation at the root.
+ */
+void
+perform_stats_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_stats_t stats;
+  ngds_array_splay_tree_t *t;
+  int nodes[] = { 5, 6, 3, 2, 4 };
+  int ii;
+
+  t = ngds_array_splay_tree_new(128, uint_compare, NULL, NULL);
+
+  for (ii = 0; ii < sizeof(nodes) / sizeof(int); ++ii) {
+    ngds_array_splay_tree_insert(t,
+      (void *) nodes[ii], (void *) nodes[ii], false);
+  }
+  ngds_array_splay_tree_insert(t, (void *) 6, (void *) 6, false);
+  ngds_array_splay_tree_get(t, (void *) 3, true);
+  ngds_array_splay_tree_get(t, (void *) 7, false);
+  ngds_array_splay_tree_remove(t, (void *) 7);
+  ngds_array_splay_tree_remove(t, (void *) 6);
+
+  ngds_array_splay_tree_stats(t, &stats);
+  CuAssertIntEquals(tc, 3, stats.height);
+  CuAssertIntEquals(tc, 4, stats.utilized_element_count);
+  CuAssertIntEquals(tc, 128, stats.allocated_element_count);
+
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_STATS
+  CuAssertIntEquals(tc, 5, (int) stats.insert_misses);
+  CuAssertIntEquals(tc, 1, (int) stats.insert_hits);
+  CuAssertIntEquals(tc, 1, (int) stats.get_hits);
+  CuAssertIntEquals(tc, 1, (int) stats.get_misses);
+  CuAssertIntEquals(tc, 1, (int) stats.remove_hits);
+  CuAssertIntEquals(tc, 1, (int) stats.remove_misses);
+  CuAssertIntEquals(tc, 1, (int) stats.splays);
+  CuAssertIntEquals(tc, 1, (int) stats.splay_depth_total);
+  CuAssertIntEquals(tc, 1, (int) stats.splay_depth_max);
+  CuAssertIntEquals(tc, 1, (int) stats.rotations);
+  CuAssertIntEquals(tc, 4, (int) stats.nodes_moved);
+  CuAssertTrue(tc, 0 < stats.comparisons);
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+
+  ngds_array_splay_tree_stats_reset(t);
+  ngds_array_splay_tree_stats(t, &stats);
+  CuAssertIntEquals(tc, 0, (int) stats.comparisons);
+  CuAssertIntEquals(tc, 0, (int) stats.rotations);
+  CuAssertIntEquals(tc, 4, stats.utilized_element_count);
+
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_stats_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Histograms
+ *
+ * The zig splay moves four nodes in one rotation; lookups from several
+ * threads land in separate shards and are merged on read.
+ */
+void
+perform_histogram_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_histogram_t histogram;
+  ngds_array_splay_tree_t *t;
+  pthread_t threads[4];
+  int nodes[] = { 5, 6, 3, 2, 4 };
+  int ii;
+
+  t = ngds_array_splay_tree_new(128, uint_compare, NULL, NULL);
+
+  for (ii = 0; ii < sizeof(nodes) / sizeof(int); ++ii) {
+    ngds_array_splay_tree_insert(t,
+      (void *) nodes[ii], (void *) nodes[ii], false);
+  }
+  ngds_array_splay_tree_get(t, (void *) 3, true);
+
+#ifdef NGDS_ARRAY_SPLAY_TREE_WITH_STATS
+  ngds_array_splay_tree_histogram(t,
+    NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_GET_DEPTH, &histogram);
+  CuAssertIntEquals(tc, 1, (int) histogram.count);
+  CuAssertIntEquals(tc, 1, (int) histogram.buckets[1]);
+
+  ngds_array_splay_tree_histogram(t,
+    NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_ROTATION_NODES_MOVED, &histogram);
+  CuAssertIntEquals(tc, 1, (int) histogram.count);
+  CuAssertIntEquals(tc, 4, (int) histogram.sum);
+  CuAssertIntEquals(tc, 1, (int) histogram.buckets[3]);
+
+  ngds_array_splay_tree_histogram(t,
+    NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_SPLAY_CYCLES, &histogram);
+  CuAssertIntEquals(tc, 1, (int) histogram.count);
+
+  ngds_array_splay_tree_histogram_reset(t);
+  for (ii = 0; ii < 4; ++ii) {
+    pthread_create(&threads[ii], NULL, histogram_reader, t);
+  }
+  for (ii = 0; ii < 4; ++ii) {
+    pthread_join(threads[ii], NULL);
+  }
+
+  ngds_array_splay_tree_histogram(t,
+    NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_GET_DEPTH, &histogram);
+  CuAssertIntEquals(tc, 3200, (int) histogram.count);
+  CuAssertIntEquals(tc, 800, (int) histogram.buckets[0]);
+#else /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+  ngds_array_splay_tree_histogram(t,
+    NGDS_ARRAY_SPLAY_TREE_HISTOGRAM_GET_DEPTH, &histogram);
+  CuAssertIntEquals(tc, 0, (int) histogram.count);
+  (void) threads;
+#endif /* NGDS_ARRAY_SPLAY_TREE_WITH_STATS */
+
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_histogram_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Trace Recording
+ *
+ * Every operation is recorded with its splay flag and key bytes, and
+ * nothing after the trace is stopped.
+ */
+void
+perform_trace_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_t *t;
+  ngds_trace_reader_t *reader;
+  ngds_trace_record_t record;
+  char path[64];
+
+  make_temp_path(path, sizeof(path));
+  t = ngds_array_splay_tree_new(128, string_compare, NULL, NULL);
+
+  CuAssertIntEquals(tc, 0,
+    ngds_array_splay_tree_trace_start(t, path, string_size));
+  ngds_array_splay_tree_insert(t, "bravo", "2", false);
+  ngds_array_splay_tree_insert(t, "alpha", "1", false);
+  ngds_array_splay_tree_get(t, "alpha", true);
+  ngds_array_splay_tree_remove(t, "bravo");
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_trace_stop(t));
+  ngds_array_splay_tree_get(t, "alpha", false);
+
+  reader = ngds_trace_reader_open(path);
+  CuAssertPtrNotNull(tc, reader);
+  CuAssertIntEquals(tc, NGDS_TRACE_KEY_BYTES,
+    ngds_trace_reader_key_encoding(reader));
+
+  CuAssertIntEquals(tc, 1, ngds_trace_reader_next(reader, &record));
+  CuAssertIntEquals(tc, NGDS_TRACE_INSERT, record.operation);
+  CuAssertTrue(tc, false == record.should_perform_splay);
+  CuAssertIntEquals(tc, 6, (int) record.key_length);
+  CuAssertStrEquals(tc, "bravo", record.key);
+
+  CuAssertIntEquals(tc, 1, ngds_trace_reader_next(reader, &record));
+  CuAssertIntEquals(tc, NGDS_TRACE_INSERT, record.operation);
+  CuAssertStrEquals(tc, "alpha", record.key);
+
+  CuAssertIntEquals(tc, 1, ngds_trace_reader_next(reader, &record));
+  CuAssertIntEquals(tc, NGDS_TRACE_GET, record.operation);
+  CuAssertTrue(tc, true == record.should_perform_splay);
+  CuAssertStrEquals(tc, "alpha", record.key);
+
+  CuAssertIntEquals(tc, 1, ngds_trace_reader_next(reader, &record));
+  CuAssertIntEquals(tc, NGDS_TRACE_REMOVE, record.operation);
+  CuAssertStrEquals(tc, "bravo", record.key);
+
+  CuAssertIntEquals(tc, 0, ngds_trace_reader_next(reader, &record));
+  ngds_trace_reader_close(reader);
+
+  ngds_array_splay_tree_destroy(t);
+  unlink(path);
+
+} /* perform_trace_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Workload Profile
+ *
+ * Uniform lookups over 200 keys show no skew; key k looked up 2000 / k
+ * times is Zipfian with an exponent of 1.
+ */
+void
+perform_profile_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_profile_t profile;
+  ngds_array_splay_tree_t *t;
+  long ii;
+  long jj;
+
+  t = ngds_array_splay_tree_new(1024, uint_compare, NULL, NULL);
+  insert_balanced(t, 1, 500);
+  CuAssertIntEquals(tc, -1, ngds_array_splay_tree_profile(t, &profile));
+
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_profile_start(t, 1, NULL));
+  for (ii = 0; ii < 20000; ++ii) {
+    ngds_array_splay_tree_get(t, (void *) (1 + (ii % 200)), false);
+  }
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_profile(t, &profile));
+  CuAssertIntEquals(tc, 20000, (int) profile.sampled_operations);
+  CuAssertDblEquals(tc, 200.0, profile.distinct_keys, 20.0);
+  CuAssertDblEquals(tc, 200.0, profile.working_set_keys, 20.0);
+  CuAssertDblEquals(tc, 0.0, profile.zipf_exponent, 0.2);
+  CuAssertTrue(tc, 6.0 < profile.mean_hit_depth);
+  CuAssertTrue(tc, 9.0 > profile.mean_hit_depth);
+
+  ngds_array_splay_tree_profile_reset(t);
+  for (ii = 1; ii <= 500; ++ii) {
+    for (jj = 0; jj < (2000 / ii); ++jj) {
+      ngds_array_splay_tree_get(t, (void *) ii, false);
+    }
+  }
+  ngds_array_splay_tree_profile(t, &profile);
+  CuAssertDblEquals(tc, 500.0, profile.distinct_keys, 50.0);
+  CuAssertDblEquals(tc, 1.0, profile.zipf_exponent, 0.25);
+
+  ngds_array_splay_tree_profile_stop(t);
+  CuAssertIntEquals(tc, -1, ngds_array_splay_tree_profile(t, &profile));
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_profile_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Adaptive Splaying
+ *
+ * Uniform lookups gain nothing from splaying, which only moves nodes,
+ * and trying it out must not leave the tree deeper or larger than one
+ * more level than it needs. Lookups of a few keys at the bottom of the tree are worth
+ * splaying, and bring those keys to the top.
+ */
+void
+perform_adaptive_splay_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_stats_t stats;
+  ngds_array_splay_tree_t *t;
+  long ii;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 1024;
+  options.max_element_count = 1 << 14;
+  options.compare = uint_compare;
+  t = ngds_array_splay_tree_new_with_options(&options);
+  insert_balanced(t, 1, 1023);
+
+  ngds_array_splay_tree_set_adaptive_splay(t, true);
+  CuAssertIntEquals(tc, NGDS_ARRAY_SPLAY_TREE_SPLAY_NONE,
+    ngds_array_splay_tree_splay_regime(t));
+
+  for (ii = 0; ii < (40 * NGDS_ARRAY_SPLAY_TREE_ADAPTIVE_EPOCH); ++ii) {
+    long key = 1 + ((ii * 389) % 1023);
+
+    CuAssertPtrEquals(tc, (void *) key, ngds_array_splay_tree_get(t,
+      (void *) key, true));
+  }
+  CuAssertIntEquals(tc, NGDS_ARRAY_SPLAY_TREE_SPLAY_NONE,
+    ngds_array_splay_tree_splay_regime(t));
+  CuAssertIntEquals(tc, 1023, ngds_array_splay_tree_cardinality(t));
+  ngds_array_splay_tree_stats(t, &stats);
+  CuAssertTrue(tc, 0 < stats.rebuilds);
+  CuAssertTrue(tc, 11 >= stats.height);
+  CuAssertTrue(tc, 2048 >= stats.allocated_element_count);
+
+  ngds_array_splay_tree_destroy(t);
+
+  t = ngds_array_splay_tree_new_with_options(&options);
+  insert_balanced(t, 1, 1023);
+  ngds_array_splay_tree_set_adaptive_splay(t, true);
+
+  for (ii = 0; ii < (40 * NGDS_ARRAY_SPLAY_TREE_ADAPTIVE_EPOCH); ++ii) {
+    ngds_array_splay_tree_get(t, (void *) (1 + (ii % 4)), false);
+  }
+  for (ii = 1; ii <= 4; ++ii) {
+    long idx;
+
+    for (idx = 1; idx < 8 && (void *) ii != t->node_array[idx].key; ++idx) {
+    }
+    CuAssertTrue(tc, 8 > idx);
+  }
+  CuAssertPtrEquals(tc, (void *) 1, ngds_array_splay_tree_get(t,
+    (void *) 1, false));
+
+  ngds_array_splay_tree_set_adaptive_splay(t, false);
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_adaptive_splay_test() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+count_update (
+  const void           *key,
+  void                 *value,
+  bool                  is_present,
+  void                 *context
+) {
+  ++*(int *) context;
+  return (void *) ((intptr_t) value + 1);
+} /* count_update() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Upsert, Get-or-Insert and Value References
+ *
+ * Counters kept as values are bumped with a single call, whether or not
+ * the key is present yet, and owned values are updated in place.
+ */
+void
+perform_upsert_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_t *t;
+  void *value;
+  void **ref;
+  int calls = 0;
+  int key;
+  int ii;
+
+  t = ngds_array_splay_tree_new(128, uint_compare, NULL, NULL);
+
+  for (ii = 0; ii < 30; ++ii) {
+    CuAssertIntEquals(tc, (3 > ii), ngds_array_splay_tree_upsert(t,
+      (void *) (intptr_t) (1 + (ii % 3)), count_update, &calls, (ii % 2),
+      &value));
+    CuAssertPtrEquals(tc, (void *) (intptr_t) (1 + (ii / 3)), value);
+  }
+  CuAssertIntEquals(tc, 30, calls);
+  CuAssertIntEquals(tc, 3, ngds_array_splay_tree_cardinality(t));
+  CuAssertPtrEquals(tc, (void *) 10, ngds_array_splay_tree_get(t,
+    (void *) 2, false));
+
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_get_or_insert(t,
+    (void *) 3, (void *) 99, true, &value));
+  CuAssertPtrEquals(tc, (void *) 10, value);
+  CuAssertIntEquals(tc, 1, ngds_array_splay_tree_get_or_insert(t,
+    (void *) 4, (void *) 99, false, &value));
+  CuAssertPtrEquals(tc, (void *) 99, value);
+  CuAssertIntEquals(tc, 4, ngds_array_splay_tree_cardinality(t));
+
+  ref = ngds_array_splay_tree_get_ref(t, (void *) 1, true);
+  CuAssertPtrEquals(tc, (void *) 10, *ref);
+  *ref = (void *) 11;
+  CuAssertPtrEquals(tc, (void *) 11, ngds_array_splay_tree_get(t,
+    (void *) 1, false));
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_get_ref(t,
+    (void *) 5, false));
+
+  ngds_array_splay_tree_destroy(t);
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 128;
+  options.compare = int_ptr_compare;
+  options.key_size = sizeof(int);
+  options.value_size = sizeof(int);
+  t = ngds_array_splay_tree_new_with_options(&options);
+
+  for (ii = 0; ii < 12; ++ii) {
+    void *count;
+
+    key = ii % 4;
+    CuAssertIntEquals(tc, (4 > ii), ngds_array_splay_tree_get_or_insert(t,
+      &key, &(int){ 0 }, (ii % 2), &count));
+    ++*(int *) count;
+  }
+  key = 2;
+  CuAssertIntEquals(tc, 3, *(int *) ngds_array_splay_tree_get(t, &key,
+    false));
+  ++*(int *) ngds_array_splay_tree_get_ref(t, &key, true);
+  CuAssertIntEquals(tc, 4, *(int *) ngds_array_splay_tree_get(t, &key,
+    false));
+
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_upsert_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Ordered Cursor
+ *
+ * A cursor visits every key in order, both ways, after removals and
+ * splays have reshaped the tree, and seeks to the first key not below
+ * the one given.
+ */
+void
+perform_cursor_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_cursor_t cursor;
+  ngds_array_splay_tree_t *t;
+  long expected;
+  long ii;
+
+  t = ngds_array_splay_tree_new(1024, uint_compare, NULL, NULL);
+  CuAssertTrue(tc, false == ngds_array_splay_tree_cursor_first(t, &cursor));
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_cursor_key(&cursor));
+
+  insert_balanced(t, 1, 255);
+  for (ii = 1; ii <= 255; ii += 2) {
+    ngds_array_splay_tree_remove(t, (void *) ii);
+  }
+  for (ii = 0; ii < 20; ++ii) {
+    ngds_array_splay_tree_get(t, (void *) (2 + ((ii * 37) % 254)), true);
+  }
+
+  expected = 2;
+  if (true == ngds_array_splay_tree_cursor_first(t, &cursor)) {
+    do {
+      CuAssertPtrEquals(tc, (void *) expected,
+        ngds_array_splay_tree_cursor_key(&cursor));
+      CuAssertPtrEquals(tc, (void *) expected,
+        ngds_array_splay_tree_cursor_value(&cursor));
+      expected += 2;
+    } while (true == ngds_array_splay_tree_cursor_next(&cursor));
+  }
+  CuAssertIntEquals(tc, 256, expected);
+  CuAssertTrue(tc, false == ngds_array_splay_tree_cursor_next(&cursor));
+
+  expected = 254;
+  if (true == ngds_array_splay_tree_cursor_last(t, &cursor)) {
+    do {
+      CuAssertPtrEquals(tc, (void *) expected,
+        ngds_array_splay_tree_cursor_key(&cursor));
+      expected -= 2;
+    } while (true == ngds_array_splay_tree_cursor_prev(&cursor));
+  }
+  CuAssertIntEquals(tc, 0, expected);
+
+  CuAssertTrue(tc, true == ngds_array_splay_tree_cursor_seek(t, &cursor,
+    (void *) 100));
+  CuAssertPtrEquals(tc, (void *) 100,
+    ngds_array_splay_tree_cursor_key(&cursor));
+  CuAssertTrue(tc, true == ngds_array_splay_tree_cursor_seek(t, &cursor,
+    (void *) 101));
+  CuAssertPtrEquals(tc, (void *) 102,
+    ngds_array_splay_tree_cursor_key(&cursor));
+  CuAssertTrue(tc, true == ngds_array_splay_tree_cursor_prev(&cursor));
+  CuAssertPtrEquals(tc, (void *) 100,
+    ngds_array_splay_tree_cursor_key(&cursor));
+  CuAssertTrue(tc, false == ngds_array_splay_tree_cursor_seek(t, &cursor,
+    (void *) 255));
+
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_cursor_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Range Queries
+ *
+ * Nearest keys are found on either side of keys that are missing, range
+ * scans stop at their upper bound or when the callback says so, and the
+ * start of a splayed scan ends up at the root.
+ */
+void
+perform_range_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_cursor_t cursor;
+  ngds_array_splay_tree_t *t;
+  void *found_key;
+  long keys[16];
+  long ii;
+
+  t = ngds_array_splay_tree_new(1024, uint_compare, NULL, NULL);
+  insert_balanced(t, 1, 255);
+  for (ii = 1; ii <= 255; ii += 2) {
+    ngds_array_splay_tree_remove(t, (void *) ii);
+  }
+
+  CuAssertPtrEquals(tc, (void *) 100, ngds_array_splay_tree_floor(t,
+    (void *) 101, false, &found_key));
+  CuAssertPtrEquals(tc, (void *) 100, found_key);
+  CuAssertPtrEquals(tc, (void *) 102, ngds_array_splay_tree_ceil(t,
+    (void *) 101, false, NULL));
+  CuAssertPtrEquals(tc, (void *) 100, ngds_array_splay_tree_ceil(t,
+    (void *) 100, true, NULL));
+  CuAssertPtrEquals(tc, (void *) 100, t->node_array[1].key);
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_floor(t, (void *) 1,
+    false, &found_key));
+  CuAssertPtrEquals(tc, NULL, found_key);
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_ceil(t, (void *) 255,
+    false, NULL));
+
+  CuAssertTrue(tc, true == ngds_array_splay_tree_cursor_upper_bound(t,
+    &cursor, (void *) 100));
+  CuAssertPtrEquals(tc, (void *) 102,
+    ngds_array_splay_tree_cursor_key(&cursor));
+  CuAssertTrue(tc, true == ngds_array_splay_tree_cursor_lower_bound(t,
+    &cursor, (void *) 100));
+  CuAssertPtrEquals(tc, (void *) 100,
+    ngds_array_splay_tree_cursor_key(&cursor));
+
+  keys[0] = 0;
+  CuAssertIntEquals(tc, 5, ngds_array_splay_tree_range(t, (void *) 49,
+    (void *) 59, collect_range, keys, true));
+  CuAssertIntEquals(tc, 5, keys[0]);
+  for (ii = 1; ii <= 5; ++ii) {
+    CuAssertIntEquals(tc, (48 + (2 * ii)), keys[ii]);
+  }
+  CuAssertPtrEquals(tc, (void *) 50, t->node_array[1].key);
+
+  keys[0] = 0;
+  CuAssertIntEquals(tc, 8, ngds_array_splay_tree_range(t, NULL, NULL,
+    collect_range, keys, false));
+  CuAssertIntEquals(tc, 2, keys[1]);
+  CuAssertIntEquals(tc, 16, keys[8]);
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_range(t, (void *) 255,
+    NULL, collect_range, keys, true));
+  CuAssertIntEquals(tc, 127, ngds_array_splay_tree_cardinality(t));
+
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_range_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Comparator Order
+ *
+ * Ordered operations follow compare() as the header defines it: a
+ * positive result means the first key is the greater one.
+ */
+void
+perform_comparator_order_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_cursor_t cursor;
+  ngds_array_splay_tree_t *upper;
+  ngds_array_splay_tree_t *t;
+  long nodes[] = { 30, 10, 50, 20, 40 };
+  void *found_key;
+  void *hot[3];
+  long keys[16];
+  long ii;
+
+  t = ngds_array_splay_tree_new(128, ordered_compare, NULL, NULL);
+  for (ii = 0; ii < sizeof(nodes) / sizeof(long); ++ii) {
+    ngds_array_splay_tree_insert(t, (void *) nodes[ii], (void *) nodes[ii],
+      true);
+  }
+
+  CuAssertTrue(tc, true == ngds_array_splay_tree_cursor_first(t, &cursor));
+  for (ii = 10; ii <= 50; ii += 10) {
+    CuAssertPtrEquals(tc, (void *) ii,
+      ngds_array_splay_tree_cursor_key(&cursor));
+    CuAssertTrue(tc, (50 != ii)
+      == ngds_array_splay_tree_cursor_next(&cursor));
+  }
+  CuAssertTrue(tc, true == ngds_array_splay_tree_cursor_last(t, &cursor));
+  CuAssertPtrEquals(tc, (void *) 50,
+    ngds_array_splay_tree_cursor_key(&cursor));
+
+  CuAssertPtrEquals(tc, (void *) 30, ngds_array_splay_tree_ceil(t,
+    (void *) 25, false, &found_key));
+  CuAssertPtrEquals(tc, (void *) 30, found_key);
+  CuAssertPtrEquals(tc, (void *) 20, ngds_array_splay_tree_floor(t,
+    (void *) 25, true, &found_key));
+  CuAssertPtrEquals(tc, (void *) 20, found_key);
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_ceil(t, (void *) 55,
+    false, NULL));
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_floor(t, (void *) 5,
+    false, NULL));
+
+  CuAssertTrue(tc, true == ngds_array_splay_tree_cursor_lower_bound(t,
+    &cursor, (void *) 20));
+  CuAssertPtrEquals(tc, (void *) 20,
+    ngds_array_splay_tree_cursor_key(&cursor));
+  CuAssertTrue(tc, true == ngds_array_splay_tree_cursor_upper_bound(t,
+    &cursor, (void *) 20));
+  CuAssertPtrEquals(tc, (void *) 30,
+    ngds_array_splay_tree_cursor_key(&cursor));
+
+  keys[0] = 0;
+  CuAssertIntEquals(tc, 2, ngds_array_splay_tree_range(t, (void *) 20,
+    (void *) 40, collect_range, keys, false));
+  CuAssertIntEquals(tc, 20, keys[1]);
+  CuAssertIntEquals(tc, 30, keys[2]);
+  keys[0] = 0;
+  CuAssertIntEquals(tc, 3, ngds_array_splay_tree_range(t, (void *) 25,
+    NULL, collect_range, keys, true));
+  CuAssertIntEquals(tc, 30, keys[1]);
+  CuAssertIntEquals(tc, 50, keys[3]);
+
+  CuAssertPtrEquals(tc, (void *) 10, ngds_array_splay_tree_peek_min(t,
+    &found_key));
+  CuAssertPtrEquals(tc, (void *) 10, found_key);
+  CuAssertPtrEquals(tc, (void *) 50, ngds_array_splay_tree_peek_max(t,
+    NULL));
+  CuAssertPtrEquals(tc, (void *) 10, ngds_array_splay_tree_pop_min(t,
+    NULL));
+  CuAssertPtrEquals(tc, (void *) 50, ngds_array_splay_tree_pop_max(t,
+    NULL));
+  CuAssertPtrEquals(tc, (void *) 20, ngds_array_splay_tree_peek_min(t,
+    NULL));
+  CuAssertPtrEquals(tc, (void *) 40, ngds_array_splay_tree_peek_max(t,
+    NULL));
+
+  ngds_array_splay_tree_destroy(t);
+
+  t = ngds_array_splay_tree_new(128, ordered_compare, NULL, NULL);
+  for (ii = 0; ii < sizeof(nodes) / sizeof(long); ++ii) {
+    ngds_array_splay_tree_insert(t, (void *) nodes[ii], (void *) nodes[ii],
+      false);
+  }
+
+  upper = ngds_array_splay_tree_split(t, (void *) 30);
+  CuAssertTrue(tc, NULL != upper);
+  CuAssertIntEquals(tc, 2, ngds_array_splay_tree_cardinality(t));
+  CuAssertPtrEquals(tc, (void *) 20, ngds_array_splay_tree_peek_max(t,
+    NULL));
+  CuAssertIntEquals(tc, 3, ngds_array_splay_tree_cardinality(upper));
+  CuAssertPtrEquals(tc, (void *) 30, ngds_array_splay_tree_peek_min(upper,
+    NULL));
+
+  CuAssertIntEquals(tc, -1, ngds_array_splay_tree_join(upper, t));
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_join(t, upper));
+  CuAssertIntEquals(tc, 5, ngds_array_splay_tree_cardinality(t));
+  keys[0] = 0;
+  CuAssertIntEquals(tc, 5, ngds_array_splay_tree_range(t, NULL, NULL,
+    collect_range, keys, false));
+  for (ii = 1; ii <= 5; ++ii) {
+    CuAssertIntEquals(tc, (10 * ii), keys[ii]);
+  }
+
+  ngds_array_splay_tree_destroy(t);
+
+  t = ngds_array_splay_tree_new(128, ordered_compare, NULL, NULL);
+  upper = ngds_array_splay_tree_new(128, ordered_compare, NULL, NULL);
+  for (ii = 10; ii <= 50; ii += 20) {
+    ngds_array_splay_tree_insert(t, (void *) ii, (void *) ii, false);
+  }
+  for (ii = 20; ii <= 40; ii += 10) {
+    ngds_array_splay_tree_insert(upper, (void *) ii, (void *) (ii + 1),
+      false);
+  }
+
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_merge(t, upper, NULL,
+    NULL));
+  CuAssertIntEquals(tc, 5, ngds_array_splay_tree_cardinality(t));
+  CuAssertPtrEquals(tc, (void *) 31, ngds_array_splay_tree_get(t,
+    (void *) 30, false));
+  CuAssertPtrEquals(tc, (void *) 10, ngds_array_splay_tree_get(t,
+    (void *) 10, false));
+  keys[0] = 0;
+  CuAssertIntEquals(tc, 5, ngds_array_splay_tree_range(t, NULL, NULL,
+    collect_range, keys, false));
+  for (ii = 1; ii <= 5; ++ii) {
+    CuAssertIntEquals(tc, (10 * ii), keys[ii]);
+  }
+
+  ngds_array_splay_tree_destroy(upper);
+
+  hot[0] = (void *) 40;
+  hot[1] = (void *) 25;
+  hot[2] = (void *) 20;
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_preload_hot_set(t, hot, 3));
+  CuAssertPtrEquals(tc, (void *) 40, t->node_array[1].key);
+  CuAssertIntEquals(tc, 3, ngds_array_splay_tree_export_hot_set(t, 2, hot,
+    3));
+  CuAssertPtrEquals(tc, (void *) 40, hot[0]);
+  CuAssertPtrEquals(tc, (void *) 20, hot[1]);
+  CuAssertPtrEquals(tc, (void *) 50, hot[2]);
+  keys[0] = 0;
+  CuAssertIntEquals(tc, 5, ngds_array_splay_tree_range(t, NULL, NULL,
+    collect_range, keys, false));
+  for (ii = 1; ii <= 5; ++ii) {
+    CuAssertIntEquals(tc, (10 * ii), keys[ii]);
+  }
+
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_comparator_order_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Order Statistics
+ *
+ * Ranks and selections stay exact while inserts, splaying gets and
+ * removals reshape the tree, splayed or not, and every slot's count
+ * matches its subtree.
+ */
+void
+perform_order_statistics_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_t *t;
+  void *found_key;
+  long ii;
+  int idx;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 1024;
+  options.compare = uint_compare;
+  options.has_order_statistics = true;
+  t = ngds_array_splay_tree_new_with_options(&options);
+
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_rank(t, (void *) 5,
+    false));
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_select(t, 0, false,
+    NULL));
+
+  insert_balanced(t, 1, 511);
+  for (ii = 0; ii < 200; ++ii) {
+    ngds_array_splay_tree_get(t, (void *) (1 + ((ii * 97) % 511)), true);
+  }
+  for (ii = 1; ii <= 511; ii += 2) {
+    ngds_array_splay_tree_remove(t, (void *) ii);
+  }
+  ngds_array_splay_tree_insert(t, (void *) 600, (void *) 600, true);
+
+  /* Keys are now 2, 4, ..., 510 and 600 */
+  for (ii = 0; ii < 255; ++ii) {
+    CuAssertIntEquals(tc, ii, ngds_array_splay_tree_rank(t,
+      (void *) (2 + (2 * ii)), (0 == (ii % 32))));
+    CuAssertIntEquals(tc, (ii + 1), ngds_array_splay_tree_rank(t,
+      (void *) (3 + (2 * ii)), false));
+    CuAssertPtrEquals(tc, (void *) (2 + (2 * ii)),
+      ngds_array_splay_tree_select(t, ii, (0 == (ii % 48)), &found_key));
+    CuAssertPtrEquals(tc, (void *) (2 + (2 * ii)), found_key);
+  }
+  CuAssertPtrEquals(tc, (void *) 600, ngds_array_splay_tree_select(t, 255,
+    true, NULL));
+  CuAssertPtrEquals(tc, (void *) 600, t->node_array[1].key);
+  CuAssertIntEquals(tc, 256, t->subtree_counts[1]);
+
+  for (idx = 1; idx < t->allocated_element_count; ++idx) {
+    int expected = 0;
+
+    if (NULL != t->node_array[idx].key) {
+      expected = 1;
+      if ((2 * idx) < t->allocated_element_count) {
+        expected += t->subtree_counts[2 * idx];
+      }
+      if (((2 * idx) + 1) < t->allocated_element_count) {
+        expected += t->subtree_counts[(2 * idx) + 1];
+      }
+    }
+    CuAssertIntEquals(tc, expected, t->subtree_counts[idx]);
+  }
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_select(t, 256, false,
+    NULL));
+  CuAssertIntEquals(tc, 256, ngds_array_splay_tree_rank(t, (void *) 1000,
+    false));
+
+  ngds_array_splay_tree_destroy(t);
+
+  t = ngds_array_splay_tree_new(128, uint_compare, NULL, NULL);
+  CuAssertIntEquals(tc, -1, ngds_array_splay_tree_rank(t, (void *) 5,
+    false));
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_order_statistics_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Priority Queue
+ *
+ * Pops drain the tree from both ends in order, keeping order statistics
+ * exact, and keys stored in the slot survive their removal.
+ */
+void
+perform_priority_queue_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_t *t;
+  void *key;
+  long lo = 1;
+  long hi = 255;
+  int value = 7;
+  int ii;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 1024;
+  options.compare = uint_compare;
+  options.has_order_statistics = true;
+  t = ngds_array_splay_tree_new_with_options(&options);
+
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_pop_min(t, &key));
+  CuAssertPtrEquals(tc, NULL, key);
+
+  insert_balanced(t, lo, hi);
+  for (ii = 0; ii < 20; ++ii) {
+    ngds_array_splay_tree_get(t, (void *) (long) (1 + ((ii * 37) % 255)),
+      true);
+  }
+
+  while (lo <= hi) {
+    CuAssertPtrEquals(tc, (void *) lo, ngds_array_splay_tree_peek_min(t,
+      &key));
+    CuAssertPtrEquals(tc, (void *) lo, key);
+    CuAssertPtrEquals(tc, (void *) hi, ngds_array_splay_tree_peek_max(t,
+      NULL));
+    CuAssertPtrEquals(tc, (void *) lo, ngds_array_splay_tree_pop_min(t,
+      NULL));
+    ++lo;
+    if (0 == (lo % 3) && lo <= hi) {
+      CuAssertPtrEquals(tc, (void *) hi, ngds_array_splay_tree_pop_max(t,
+        &key));
+      CuAssertPtrEquals(tc, (void *) hi, key);
+      --hi;
+    }
+    CuAssertIntEquals(tc, (int) (hi - lo + 1),
+      ngds_array_splay_tree_cardinality(t));
+    if (lo <= hi) {
+      CuAssertPtrEquals(tc, (void *) lo, ngds_array_splay_tree_select(t, 0,
+        false, NULL));
+    }
+  }
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_peek_max(t, NULL));
+  ngds_array_splay_tree_destroy(t);
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 128;
+  options.compare = int_ptr_compare;
+  options.key_size = sizeof(int);
+  options.value_size = sizeof(int);
+  t = ngds_array_splay_tree_new_with_options(&options);
+
+  for (ii = 10; ii > 0; --ii) {
+    ngds_array_splay_tree_insert(t, &ii, &value, false);
+  }
+  CuAssertIntEquals(tc, 7, *(int *) ngds_array_splay_tree_pop_max(t,
+    &key));
+  CuAssertIntEquals(tc, 10, *(int *) key);
+  CuAssertIntEquals(tc, 7, *(int *) ngds_array_splay_tree_pop_min(t,
+    &key));
+  CuAssertIntEquals(tc, 1, *(int *) key);
+  CuAssertIntEquals(tc, 8, ngds_array_splay_tree_cardinality(t));
+
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_priority_queue_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Split and Join
+ *
+ * Splitting at any key hands the keys at or above it to a new tree,
+ * with ranks intact, and joining the halves restores the whole.
+ */
+void
+perform_split_and_join_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_t *t;
+  ngds_array_splay_tree_t *upper;
+  ngds_array_splay_tree_t *other;
+  long ii;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 1024;
+  options.compare = uint_compare;
+  options.has_order_statistics = true;
+  t = ngds_array_splay_tree_new_with_options(&options);
+
+  insert_balanced(t, 1, 511);
+  for (ii = 0; ii < 20; ++ii) {
+    ngds_array_splay_tree_get(t, (void *) (1 + ((ii * 37) % 511)), true);
+  }
+
+  upper = ngds_array_splay_tree_split(t, (void *) 200);
+  CuAssertTrue(tc, NULL != upper);
+  assert_key_range(tc, t, 1, 199);
+  assert_key_range(tc, upper, 200, 511);
+
+  other = ngds_array_splay_tree_split(upper, (void *) 1000);
+  assert_key_range(tc, upper, 200, 511);
+  assert_key_range(tc, other, 1, 0);
+
+  CuAssertIntEquals(tc, -1, ngds_array_splay_tree_join(upper, t));
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_join(t, upper));
+  assert_key_range(tc, t, 1, 511);
+
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_join(other, t));
+  assert_key_range(tc, other, 1, 511);
+  ngds_array_splay_tree_insert(other, (void *) 600, (void *) 600, true);
+  CuAssertPtrEquals(tc, (void *) 600, ngds_array_splay_tree_get(other,
+    (void *) 600, false));
+
+  ngds_array_splay_tree_destroy(other);
+
+} /* perform_split_and_join_test() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+resolve_merge (
+  const void           *key,
+  void                 *value,
+  void                 *other_value,
+  void                 *context
+) {
+  ++*(int *) context;
+  if (0 == ((long) key % 5)) {
+    return (void *) ((long) key + 7);
+  }
+  return (0 == ((long) key % 2)) ? other_value : value;
+} /* resolve_merge() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Merge
+ *
+ * Merging overlapping trees yields every key once, in a balanced tree
+ * with exact ranks, with shared keys settled by the callback and the
+ * other tree left untouched.
+ */
+void
+perform_merge_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_stats_t stats;
+  ngds_array_splay_tree_t *t;
+  ngds_array_splay_tree_t *other;
+  int conflicts = 0;
+  long ii;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 256;
+  options.compare = uint_compare;
+  options.has_order_statistics = true;
+  t = ngds_array_splay_tree_new_with_options(&options);
+  other = ngds_array_splay_tree_new_with_options(&options);
+
+  insert_balanced(t, 1, 200);
+  for (ii = 101; ii <= 300; ++ii) {
+    ngds_array_splay_tree_insert(other, (void *) ii, (void *) (ii * 1000),
+      true);
+  }
+
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_merge(t, other,
+    resolve_merge, &conflicts));
+  CuAssertIntEquals(tc, 100, conflicts);
+  assert_key_range(tc, t, 1, 300);
+  ngds_array_splay_tree_stats(t, &stats);
+  CuAssertIntEquals(tc, 9, stats.height);
+
+  CuAssertPtrEquals(tc, (void *) 100, ngds_array_splay_tree_get(t,
+    (void *) 100, false));
+  CuAssertPtrEquals(tc, (void *) 117, ngds_array_splay_tree_get(t,
+    (void *) 110, false));
+  CuAssertPtrEquals(tc, (void *) 102000, ngds_array_splay_tree_get(t,
+    (void *) 102, false));
+  CuAssertPtrEquals(tc, (void *) 103, ngds_array_splay_tree_get(t,
+    (void *) 103, false));
+  CuAssertPtrEquals(tc, (void *) 250000, ngds_array_splay_tree_get(t,
+    (void *) 250, true));
+  assert_key_range(tc, other, 101, 300);
+
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_merge(t, other, NULL,
+    NULL));
+  CuAssertPtrEquals(tc, (void *) 103000, ngds_array_splay_tree_get(t,
+    (void *) 103, false));
+  CuAssertIntEquals(tc, -1, ngds_array_splay_tree_merge(t, t, NULL, NULL));
+
+  ngds_array_splay_tree_destroy(other);
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_merge_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * An allocator that refuses blocks larger than a limit, such as a slab
+ * chunk, and counts those still live. The context holds the limit and
+ * the live count, which rationed_free keeps the same way.
+ */
+static void *
+capped_malloc (
+  void                 *context,
+  size_t                size
+) {
+  int *counts = context;
+
+  if ((size_t) counts[0] < size) {
+    return NULL;
+  }
+  ++counts[1];
+  return malloc(size);
+} /* capped_malloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+capped_aligned_alloc (
+  void                 *context,
+  size_t                alignment,
+  size_t                size
+) {
+  (void) alignment;
+  return capped_malloc(context, size);
+} /* capped_aligned_alloc() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+resolve_to_context (
+  const void           *key,
+  void                 *value,
+  void                 *other_value,
+  void                 *context
+) {
+  (void) key;
+  (void) value;
+  (void) other_value;
+  return context;
+} /* resolve_to_context() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Merge Allocation Failure
+ *
+ * A merge whose resolved value cannot be copied into the tree fails and
+ * leaves both trees as they were.
+ */
+void
+perform_merge_allocation_failure_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_allocator_t allocator;
+  ngds_array_splay_tree_t *t;
+  ngds_array_splay_tree_t *other;
+  char resolved[32] = "resolved";
+  int counts[2] = { INT_MAX, 0 };
+  int live;
+  long ii;
+
+  allocator.context = counts;
+  allocator.malloc = capped_malloc;
+  allocator.realloc = rationed_realloc;
+  allocator.aligned_alloc = capped_aligned_alloc;
+  allocator.free = rationed_free;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 64;
+  options.compare = uint_compare;
+  options.value_size = sizeof(resolved);
+  options.allocator = &allocator;
+  t = ngds_array_splay_tree_new_with_options(&options);
+  other = ngds_array_splay_tree_new_with_options(&options);
+
+  /* Without values, neither tree has a slab yet */
+  for (ii = 1; ii <= 20; ++ii) {
+    ngds_array_splay_tree_insert(t, (void *) ii, NULL, false);
+    ngds_array_splay_tree_insert(other, (void *) (ii + 10), NULL, false);
+  }
+
+  /* Room for the sorted run and the rebuild, but not a 64 KB slab chunk */
+  counts[0] = 64 * 1024;
+  live = counts[1];
+  CuAssertIntEquals(tc, -1, ngds_array_splay_tree_merge(t, other,
+    resolve_to_context, resolved));
+  CuAssertIntEquals(tc, live, counts[1]);
+  CuAssertIntEquals(tc, 20, ngds_array_splay_tree_cardinality(t));
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_get(t, (void *) 15,
+    false));
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_get(t, (void *) 25,
+    false));
+  CuAssertIntEquals(tc, 20, ngds_array_splay_tree_cardinality(other));
+
+  counts[0] = INT_MAX;
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_merge(t, other,
+    resolve_to_context, resolved));
+  CuAssertIntEquals(tc, 30, ngds_array_splay_tree_cardinality(t));
+  CuAssertStrEquals(tc, "resolved", ngds_array_splay_tree_get(t,
+    (void *) 15, false));
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_get(t, (void *) 25,
+    false));
+
+  ngds_array_splay_tree_destroy(other);
+  ngds_array_splay_tree_destroy(t);
+  CuAssertIntEquals(tc, 0, counts[1]);
+
+} /* perform_merge_allocation_failure_test() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+count_eviction (
+  const void           *key,
+  void                 *value,
+  void                 *context
+) {
+  long *evicted = context;
+
+  CuAssertPtrEquals((CuTest *) evicted[2], (void *) key, value);
+  ++evicted[0];
+  evicted[1] = (long) key;
+} /* count_eviction() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Cache Mode
+ *
+ * A full cache evicts a leaf for every new key and keeps the latest one,
+ * a tree at its maximum size evicts along the search path instead of
+ * refusing inserts, and expired keys are evicted when touched or swept.
+ */
+void
+perform_cache_mode_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_stats_t stats;
+  ngds_array_splay_tree_t *t;
+  long evicted[3] = { 0, 0, (long) tc };
+  void *value;
+  long ii;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 16;
+  options.max_element_count = 64;
+  options.compare = uint_compare;
+  options.has_order_statistics = true;
+  t = ngds_array_splay_tree_new_with_options(&options);
+
+  /* Bounded by capacity */
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_set_capacity(t, 10,
+    count_eviction, evicted));
+  for (ii = 1; ii <= 100; ++ii) {
+    ngds_array_splay_tree_insert(t, (void *) ii, (void *) ii, true);
+    CuAssertIntEquals(tc, ((ii < 10) ? ii : 10),
+      ngds_array_splay_tree_cardinality(t));
+  }
+  CuAssertIntEquals(tc, 90, evicted[0]);
+  CuAssertPtrEquals(tc, (void *) 100, ngds_array_splay_tree_get(t,
+    (void *) 100, false));
+  CuAssertIntEquals(tc, 10, ngds_array_splay_tree_rank(t, (void *) 101,
+    false));
+  ngds_array_splay_tree_insert(t, (void *) 100, (void *) 100, true);
+  CuAssertIntEquals(tc, 90, evicted[0]);
+
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_set_capacity(t, 4,
+    count_eviction, evicted));
+  CuAssertIntEquals(tc, 4, ngds_array_splay_tree_cardinality(t));
+  CuAssertIntEquals(tc, 96, evicted[0]);
+
+  /* Bounded by the maximum size, where a right spine runs out of levels */
+  ngds_array_splay_tree_clear(t);
+  evicted[0] = 0;
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_set_capacity(t, 1000,
+    count_eviction, evicted));
+  for (ii = 1; ii <= 20; ++ii) {
+    ngds_array_splay_tree_insert(t, (void *) ii, (void *) ii, false);
+  }
+  CuAssertIntEquals(tc, 14, evicted[0]);
+  CuAssertIntEquals(tc, 19, evicted[1]);
+  CuAssertIntEquals(tc, 6, ngds_array_splay_tree_cardinality(t));
+  CuAssertPtrEquals(tc, (void *) 20, ngds_array_splay_tree_get(t,
+    (void *) 20, false));
+  CuAssertPtrEquals(tc, (void *) 5, ngds_array_splay_tree_get(t,
+    (void *) 5, false));
+
+  /* Bounded in time */
+  ngds_array_splay_tree_clear(t);
+  evicted[0] = 0;
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_set_capacity(t, 0,
+    count_eviction, evicted));
+  insert_balanced(t, 1, 50);
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_set_ttl(t,
+    3600000000000ULL));
+  CuAssertPtrEquals(tc, (void *) 25, ngds_array_splay_tree_get(t,
+    (void *) 25, true));
+
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_set_ttl(t, 1));
+  usleep(1000);
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_get(t,
+    (void *) 25, false));
+  CuAssertIntEquals(tc, 1, evicted[0]);
+  CuAssertIntEquals(tc, 25, evicted[1]);
+  CuAssertIntEquals(tc, 1, ngds_array_splay_tree_get_or_insert(t,
+    (void *) 26, (void *) 26, false, &value));
+  CuAssertPtrEquals(tc, (void *) 26, value);
+  CuAssertIntEquals(tc, 26, evicted[1]);
+
+  /* The sweep clears the rest from the bottom up */
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_set_ttl(t, 0));
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_set_ttl(t, 1));
+  usleep(1000);
+  for (ii = 0; ii < 64; ++ii) {
+    ngds_array_splay_tree_insert(t, (void *) 1000, (void *) 1000, false);
+  }
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_set_ttl(t, 0));
+  CuAssertIntEquals(tc, 1, ngds_array_splay_tree_cardinality(t));
+  CuAssertIntEquals(tc, 1, ngds_array_splay_tree_rank(t, (void *) 1001,
+    false));
+
+  ngds_array_splay_tree_stats(t, &stats);
+  CuAssertIntEquals(tc, 96 + 14 + evicted[0], (int) stats.evictions);
+
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_cache_mode_test() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+check_string_eviction (
+  const void           *key,
+  void                 *value,
+  void                 *context
+) {
+  long *evicted = context;
+
+  CuAssertStrEquals((CuTest *) evicted[2], key, value);
+  ++evicted[0];
+} /* check_string_eviction() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Cache Mode (Offset-Encoded Keys and Values)
+ *
+ * Evicting from an opened tree hands the callback the keys and values
+ * themselves, not their offsets in the file.
+ */
+void
+perform_mapped_cache_eviction_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_t *t;
+  ngds_array_splay_tree_t *o;
+  char *keys[] = { "echo", "golf", "charlie", "alpha", "delta" };
+  long evicted[3] = { 0, 0, (long) tc };
+  char path[64];
+  int ii;
+
+  make_temp_path(path, sizeof(path));
+  t = ngds_array_splay_tree_new(128, string_compare, NULL, NULL);
+  for (ii = 0; ii < sizeof(keys) / sizeof(char *); ++ii) {
+    ngds_array_splay_tree_insert(t, keys[ii], keys[ii], false);
+  }
+  CuAssertIntEquals(tc, 0,
+    ngds_array_splay_tree_save(t, path, string_size, string_size));
+  ngds_array_splay_tree_destroy(t);
+
+  o = ngds_array_splay_tree_open(path, string_compare, NULL, NULL);
+  CuAssertPtrNotNull(tc, o);
+  CuAssertTrue(tc, true == o->node_array_is_mapped);
+
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_set_capacity(o, 3,
+    check_string_eviction, evicted));
+  CuAssertIntEquals(tc, 2, evicted[0]);
+  CuAssertIntEquals(tc, 3, ngds_array_splay_tree_cardinality(o));
+  CuAssertTrue(tc, false == o->node_array_is_mapped);
+
+  ngds_array_splay_tree_destroy(o);
+  unlink(path);
+
+} /* perform_mapped_cache_eviction_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Lazy Removal
+ *
+ * Removed keys stay behind as tombstones that no lookup, walk or count
+ * sees, come back when inserted again, and are compacted away once they
+ * make up too much of the tree.
+ */
+void
+perform_lazy_removal_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_cursor_t cursor;
+  ngds_array_splay_tree_stats_t stats;
+  ngds_array_splay_tree_t *t;
+  void *key;
+  long ii;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 128;
+  options.compare = uint_compare;
+  options.has_order_statistics = true;
+  t = ngds_array_splay_tree_new_with_options(&options);
+
+  insert_balanced(t, 1, 31);
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_set_lazy_removal(t, 0.5));
+
+  for (ii = 2; ii <= 10; ii += 2) {
+    CuAssertPtrEquals(tc, (void *) ii, ngds_array_splay_tree_remove(t,
+      (void *) ii));
+  }
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_remove(t, (void *) 4));
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_get(t, (void *) 4,
+    false));
+  CuAssertIntEquals(tc, 26, ngds_array_splay_tree_cardinality(t));
+  CuAssertIntEquals(tc, 5, ngds_array_splay_tree_rank(t, (void *) 11,
+    false));
+  CuAssertPtrEquals(tc, (void *) 5, ngds_array_splay_tree_select(t, 2,
+    false, NULL));
+  CuAssertPtrEquals(tc, (void *) 3, ngds_array_splay_tree_floor(t,
+    (void *) 4, false, NULL));
+  CuAssertPtrEquals(tc, (void *) 5, ngds_array_splay_tree_ceil(t,
+    (void *) 4, false, NULL));
+
+  /* Walks skip tombstones in both directions */
+  CuAssertTrue(tc, ngds_array_splay_tree_cursor_upper_bound(t, &cursor,
+    (void *) 5));
+  CuAssertPtrEquals(tc, (void *) 7, ngds_array_splay_tree_cursor_key(
+    &cursor));
+  CuAssertTrue(tc, ngds_array_splay_tree_cursor_prev(&cursor));
+  CuAssertPtrEquals(tc, (void *) 5, ngds_array_splay_tree_cursor_key(
+    &cursor));
+
+  /* Inserting a removed key revives its node */
+  ngds_array_splay_tree_insert(t, (void *) 4, (void *) 4, false);
+  CuAssertPtrEquals(tc, (void *) 4, ngds_array_splay_tree_get(t,
+    (void *) 4, false));
+  CuAssertIntEquals(tc, 27, ngds_array_splay_tree_cardinality(t));
+
+  /* Pops drop the tombstones they pass */
+  CuAssertPtrEquals(tc, (void *) 1, ngds_array_splay_tree_pop_min(t, &key));
+  CuAssertPtrEquals(tc, (void *) 3, ngds_array_splay_tree_pop_min(t, &key));
+  CuAssertPtrEquals(tc, (void *) 3, key);
+  ngds_array_splay_tree_stats(t, &stats);
+  CuAssertIntEquals(tc, 0, (int) stats.compactions);
+
+  /* Compacted when tombstones outnumber half the nodes */
+  for (ii = 11; ii <= 31; ++ii) {
+    ngds_array_splay_tree_remove(t, (void *) ii);
+  }
+  ngds_array_splay_tree_stats(t, &stats);
+  CuAssertIntEquals(tc, 2, (int) stats.compactions);
+  CuAssertIntEquals(tc, 4, stats.utilized_element_count);
+  CuAssertPtrEquals(tc, (void *) 9, ngds_array_splay_tree_peek_max(t,
+    NULL));
+
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_set_lazy_removal(t, 0));
+  ngds_array_splay_tree_stats(t, &stats);
+  CuAssertIntEquals(tc, 3, (int) stats.compactions);
+  CuAssertIntEquals(tc, 3, stats.height);
+  CuAssertPtrEquals(tc, (void *) 5, ngds_array_splay_tree_remove(t,
+    (void *) 5));
+  CuAssertPtrEquals(tc, (void *) 7, ngds_array_splay_tree_select(t, 1,
+    false, NULL));
+  CuAssertIntEquals(tc, 3, ngds_array_splay_tree_cardinality(t));
+
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_lazy_removal_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Finger Search
+ *
+ * Searches that start from the previous node find every key, present or
+ * not, and a sequential pass compares far fewer keys than descents from
+ * the root do.
+ */
+void
+perform_finger_search_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_stats_t stats;
+  ngds_array_splay_tree_t *t;
+  uint64_t root_comparisons;
+  long ii;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 256;
+  options.compare = uint_compare;
+  options.has_order_statistics = true;
+  t = ngds_array_splay_tree_new_with_options(&options);
+  insert_balanced(t, 1, 255);
+
+  ngds_array_splay_tree_stats_reset(t);
+  for (ii = 1; ii <= 255; ++ii) {
+    ngds_array_splay_tree_get(t, (void *) ii, false);
+  }
+  ngds_array_splay_tree_stats(t, &stats);
+  root_comparisons = stats.comparisons;
+
+  ngds_array_splay_tree_set_finger_search(t, true);
+  ngds_array_splay_tree_stats_reset(t);
+  for (ii = 1; ii <= 255; ++ii) {
+    CuAssertPtrEquals(tc, (void *) ii, ngds_array_splay_tree_get(t,
+      (void *) ii, false));
+  }
+  ngds_array_splay_tree_stats(t, &stats);
+  CuAssertTrue(tc, (2 * stats.comparisons) < root_comparisons);
+
+  /* Long jumps in both directions, misses and splays */
+  for (ii = 0; ii < 256; ++ii) {
+    long key = 1 + ((ii * 97) % 255);
+
+    CuAssertPtrEquals(tc, (void *) key, ngds_array_splay_tree_get(t,
+      (void *) key, (0 == (ii % 16))));
+    CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_get(t,
+      (void *) (1000 + key), false));
+  }
+  CuAssertPtrEquals(tc, NULL, ngds_array_splay_tree_get(t, (void *) 0,
+    false));
+
+  /* Inserts start from the finger too */
+  for (ii = 264; ii > 259; --ii) {
+    ngds_array_splay_tree_insert(t, (void *) ii, (void *) ii, false);
+  }
+  for (ii = 256; ii < 260; ++ii) {
+    ngds_array_splay_tree_insert(t, (void *) ii, (void *) ii, false);
+  }
+  assert_key_range(tc, t, 1, 264);
+
+  ngds_array_splay_tree_destroy(t);
+
+} /* perform_finger_search_test() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Hot Set
+ *
+ * The top levels a splayed tree exports come back on top of a freshly
+ * loaded tree, in the same shape as far as a single level more than a
+ * balanced tree allows, with every other key still below them.
+ */
+void
+perform_hot_set_test (
+  CuTest               *tc
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_stats_t stats;
+  ngds_array_splay_tree_t *t;
+  ngds_array_splay_tree_t *warm;
+  void *hot[10];
+  void *rewarmed[10];
+  int count;
+  int ii;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = 128;
+  options.compare = uint_compare;
+  options.has_order_statistics = true;
+  t = ngds_array_splay_tree_new_with_options(&options);
+  warm = ngds_array_splay_tree_new_with_options(&options);
+  insert_balanced(t, 1, 63);
+  insert_balanced(warm, 1, 63);
+
+  ngds_array_splay_tree_get(t, (void *) 50, true);
+  ngds_array_splay_tree_get(t, (void *) 7, true);
+  ngds_array_splay_tree_get(t, (void *) 33, true);
+  count = ngds_array_splay_tree_export_hot_set(t, 3, hot, 8);
+  CuAssertIntEquals(tc, 7, count);
+  CuAssertPtrEquals(tc, (void *) 33, hot[0]);
+  CuAssertIntEquals(tc, 2, ngds_array_splay_tree_export_hot_set(t, 3, hot,
+    2));
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_export_hot_set(t, 0, hot,
+    8));
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_export_hot_set(t, -1, hot,
+    8));
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_export_hot_set(t, 3, hot,
+    -1));
+
+  /* Missing and repeated keys are skipped */
+  count = ngds_array_splay_tree_export_hot_set(t, 3, hot, 8);
+  hot[count] = (void *) 1000;
+  hot[count + 1] = hot[1];
+  CuAssertIntEquals(tc, 0, ngds_array_splay_tree_preload_hot_set(warm, hot,
+    (count + 2)));
+  CuAssertIntEquals(tc, count, ngds_array_splay_tree_export_hot_set(warm, 3,
+    rewarmed, 10));
+  for (ii = 0; ii < count; ++ii) {
+    if (4 != ii) {
+      CuAssertPtrEquals(tc, hot[ii], rewarmed[ii]);
+    }
+  }
+  assert_key_range(tc, warm, 1, 63);
+
+  /* 32 under 7 would leave 24 keys for the 4 levels below it */
+  CuAssertPtrEquals(tc, (void *) 32, hot[4]);
+  CuAssertPtrEquals(tc, (void *) 20, rewarmed[4]);
+  ngds_array_splay_tree_stats(warm, &stats);
+  CuAssertIntEquals(tc, 7, stats.height);
+
+  ngds_array_splay_tree_destroy(t);
+  ngds_array_splay_tree_destroy(warm);
+
+} /* perform_hot_set_test() */
+
 void
 test_zagzig2 (void) {
 
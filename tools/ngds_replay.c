@@ -0,0 +1,378 @@
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ngds_array_splay_tree.h"
+#include "ngds_allocator.h"
+#include "ngds_trace.h"
+
+/* ========================================================================= */
+/* -- DEFINITIONS ---------------------------------------------------------- */
+/* ========================================================================= */
+
+#define DEFAULT_INITIAL_ELEMENT_COUNT   1024
+
+/* Every n-th operation is timed on its own for the latency percentiles */
+#define LATENCY_SAMPLE_INTERVAL         8
+
+#define KEY_ARENA_CHUNK_SIZE            (1024 * 1024)
+
+/* ========================================================================= */
+/* -- TYPES ---------------------------------------------------------------- */
+/* ========================================================================= */
+
+/* Byte keys are replayed from copies that carry their length */
+typedef struct replay_key_s {
+  size_t                length;
+  unsigned char         bytes[];
+} replay_key_t;
+
+/* A trace decoded up front, so that replay does no parsing */
+typedef struct replay_trace_s {
+  ngds_trace_key_encoding_t   key_encoding;
+  unsigned char              *operations;
+  bool                       *should_perform_splay;
+  void                      **keys;
+  size_t                      count;
+  size_t                      capacity;
+  ngds_arena_t               *key_arena;
+} replay_trace_t;
+
+/* ========================================================================= */
+/* -- STATIC FUNCTIONS ----------------------------------------------------- */
+/* ========================================================================= */
+
+static int
+pointer_compare (
+  const void           *e1,
+  const void           *e2
+) {
+  return ((intptr_t) e1 > (intptr_t) e2) - ((intptr_t) e1 < (intptr_t) e2);
+} /* pointer_compare() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Bytewise, shorter keys first on a common prefix */
+static int
+bytes_compare (
+  const void           *e1,
+  const void           *e2
+) {
+  const replay_key_t *k1 = e1;
+  const replay_key_t *k2 = e2;
+  size_t              length = (k1->length < k2->length)
+                        ? k1->length : k2->length;
+  int                 cmp = memcmp(k1->bytes, k2->bytes, length);
+
+  if (0 != cmp) {
+    return cmp;
+  }
+  return (k1->length > k2->length) - (k1->length < k2->length);
+} /* bytes_compare() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline uint64_t
+now_ns (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+} /* now_ns() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+compare_uint64 (
+  const void           *e1,
+  const void           *e2
+) {
+  uint64_t a = *(const uint64_t *) e1;
+  uint64_t b = *(const uint64_t *) e2;
+
+  return (a > b) - (a < b);
+} /* compare_uint64() */
+
+/* ------------------------------------------------------------------------- */
+
+static uint64_t
+percentile (
+  const uint64_t       *samples,
+  size_t                sample_count,
+  double                fraction
+) {
+  size_t idx = (size_t) ((fraction * sample_count) + 0.5);
+
+  if (0 == sample_count) {
+    return 0;
+  }
+  if (idx >= sample_count) {
+    idx = sample_count - 1;
+  }
+  return samples[idx];
+} /* percentile() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+load_trace (
+  const char           *path,
+  replay_trace_t       *trace
+) {
+  const ngds_allocator_t *key_allocator;
+  ngds_trace_reader_t    *reader;
+  ngds_trace_record_t     record;
+  int                     rc;
+
+  memset(trace, 0, sizeof(replay_trace_t));
+
+  reader = ngds_trace_reader_open(path);
+  if (NULL == reader) {
+    fprintf(stderr, "%s: not a readable trace\n", path);
+    return -1;
+  }
+  trace->key_encoding = ngds_trace_reader_key_encoding(reader);
+  trace->key_arena = ngds_arena_new(KEY_ARENA_CHUNK_SIZE);
+  key_allocator = ngds_arena_allocator(trace->key_arena);
+
+  while (1 == (rc = ngds_trace_reader_next(reader, &record))) {
+    void *key = (void *) record.key;
+
+    if (trace->count == trace->capacity) {
+      trace->capacity = (0 == trace->capacity) ? 4096 : (2 * trace->capacity);
+      trace->operations = realloc(trace->operations, trace->capacity);
+      trace->should_perform_splay = realloc(trace->should_perform_splay,
+        trace->capacity * sizeof(bool));
+      trace->keys = realloc(trace->keys, trace->capacity * sizeof(void *));
+      if (NULL == trace->operations || NULL == trace->should_perform_splay
+          || NULL == trace->keys) {
+        fprintf(stderr, "%s: out of memory\n", path);
+        rc = -1;
+        break;
+      }
+    }
+
+    /* Inserted keys are referenced by the tree, so every copy is kept */
+    if (NGDS_TRACE_KEY_BYTES == trace->key_encoding) {
+      replay_key_t *copy = key_allocator->malloc(key_allocator->context,
+        sizeof(replay_key_t) + record.key_length);
+      copy->length = record.key_length;
+      memcpy(copy->bytes, record.key, record.key_length);
+      key = copy;
+    }
+
+    trace->operations[trace->count] = (unsigned char) record.operation;
+    trace->should_perform_splay[trace->count] = record.should_perform_splay;
+    trace->keys[trace->count] = key;
+    ++trace->count;
+  }
+  ngds_trace_reader_close(reader);
+
+  if (0 > rc) {
+    fprintf(stderr, "%s: truncated or corrupt after %zu operations\n", path,
+      trace->count);
+    return -1;
+  }
+  return 0;
+} /* load_trace() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+free_trace (
+  replay_trace_t       *trace
+) {
+  free(trace->operations);
+  free(trace->should_perform_splay);
+  free(trace->keys);
+  if (NULL != trace->key_arena) {
+    ngds_arena_destroy(trace->key_arena);
+  }
+} /* free_trace() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+usage (
+  const char           *argv0
+) {
+  fprintf(stderr,
+    "usage: %s [-i initial-slots] [-m max-slots] [-f text|json] trace\n",
+    argv0);
+} /* usage() */
+
+/* ========================================================================= */
+/* -- MAIN ----------------------------------------------------------------- */
+/* ========================================================================= */
+
+int
+main (
+  int                   argc,
+  char                **argv
+) {
+  ngds_array_splay_tree_options_t options;
+  ngds_array_splay_tree_stats_t   stats;
+  ngds_array_splay_tree_t        *tree;
+  replay_trace_t                  trace;
+  FILE                           *out;
+  uint64_t                       *samples;
+  uint64_t                        counts[NGDS_TRACE_REMOVE + 1];
+  uint64_t                        hits = 0;
+  uint64_t                        start;
+  double                          seconds;
+  double                          ops_per_second;
+  bool                            is_json = false;
+  size_t                          sample_count = 0;
+  size_t                          ii;
+  int                             opt;
+
+  ngds_array_splay_tree_options_init(&options);
+  options.initial_element_count = DEFAULT_INITIAL_ELEMENT_COUNT;
+
+  while (-1 != (opt = getopt(argc, argv, "i:m:f:h"))) {
+    switch (opt) {
+      case 'i':
+        options.initial_element_count = atoi(optarg);
+        break;
+      case 'm':
+        options.max_element_count = atoi(optarg);
+        break;
+      case 'f':
+        if (0 == strcmp(optarg, "json")) {
+          is_json = true;
+        } else if (0 == strcmp(optarg, "text")) {
+          is_json = false;
+        } else {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if ((optind + 1) != argc || 0 >= options.initial_element_count) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (0 != load_trace(argv[optind], &trace)) {
+    free_trace(&trace);
+    return 1;
+  }
+
+  /*
+   * The library reports trouble, such as a tree at its maximum size, on
+   * stdout. The report gets a private copy of it, and everything else
+   * written to stdout goes to stderr.
+   */
+  out = fdopen(dup(STDOUT_FILENO), "w");
+  if (NULL == out) {
+    perror("fdopen");
+    free_trace(&trace);
+    return 1;
+  }
+  fflush(stdout);
+  dup2(STDERR_FILENO, STDOUT_FILENO);
+
+  options.compare = (NGDS_TRACE_KEY_BYTES == trace.key_encoding)
+    ? bytes_compare : pointer_compare;
+  tree = ngds_array_splay_tree_new_with_options(&options);
+  if (NULL == tree) {
+    fprintf(stderr, "cannot create a tree of %d slots\n",
+      options.initial_element_count);
+    free_trace(&trace);
+    return 1;
+  }
+
+  samples = calloc((trace.count / LATENCY_SAMPLE_INTERVAL) + 1,
+    sizeof(uint64_t));
+  memset(counts, 0, sizeof(counts));
+
+  start = now_ns();
+  for (ii = 0; ii < trace.count; ++ii) {
+    uint64_t  op_start = 0;
+    void     *key = trace.keys[ii];
+
+    if (0 == (ii % LATENCY_SAMPLE_INTERVAL)) {
+      op_start = now_ns();
+    }
+    switch (trace.operations[ii]) {
+      case NGDS_TRACE_INSERT:
+        ngds_array_splay_tree_insert(tree, key, key,
+          trace.should_perform_splay[ii]);
+        break;
+      case NGDS_TRACE_GET:
+        hits += (NULL != ngds_array_splay_tree_get(tree, key,
+          trace.should_perform_splay[ii]));
+        break;
+      default:
+        hits += (NULL != ngds_array_splay_tree_remove(tree, key));
+        break;
+    }
+    if (0 == (ii % LATENCY_SAMPLE_INTERVAL)) {
+      samples[sample_count++] = now_ns() - op_start;
+    }
+  }
+  seconds = (double) (now_ns() - start) / 1e9;
+  ops_per_second = (0.0 < seconds) ? (trace.count / seconds) : 0.0;
+
+  for (ii = 0; ii < trace.count; ++ii) {
+    ++counts[trace.operations[ii]];
+  }
+  qsort(samples, sample_count, sizeof(uint64_t), compare_uint64);
+  ngds_array_splay_tree_stats(tree, &stats);
+
+  if (true == is_json) {
+    fprintf(out, "{\"operations\":%zu,\"inserts\":%llu,\"gets\":%llu,"
+      "\"removes\":%llu,\"hits\":%llu,\"seconds\":%.6f,"
+      "\"ops_per_second\":%.0f,\"p50_ns\":%llu,\"p99_ns\":%llu,"
+      "\"p999_ns\":%llu,\"cardinality\":%d,\"height\":%d,"
+      "\"allocated_slots\":%d}\n", trace.count,
+      (unsigned long long) counts[NGDS_TRACE_INSERT],
+      (unsigned long long) counts[NGDS_TRACE_GET],
+      (unsigned long long) counts[NGDS_TRACE_REMOVE],
+      (unsigned long long) hits, seconds, ops_per_second,
+      (unsigned long long) percentile(samples, sample_count, 0.50),
+      (unsigned long long) percentile(samples, sample_count, 0.99),
+      (unsigned long long) percentile(samples, sample_count, 0.999),
+      stats.utilized_element_count, stats.height,
+      stats.allocated_element_count);
+  } else {
+    fprintf(out, "operations      %zu (%llu inserts, %llu gets, "
+      "%llu removes)\n", trace.count,
+      (unsigned long long) counts[NGDS_TRACE_INSERT],
+      (unsigned long long) counts[NGDS_TRACE_GET],
+      (unsigned long long) counts[NGDS_TRACE_REMOVE]);
+    fprintf(out, "hits            %llu gets and removes\n",
+      (unsigned long long) hits);
+    fprintf(out, "throughput      %.0f ops/sec over %.6f s\n", ops_per_second,
+      seconds);
+    fprintf(out, "latency         p50 %llu ns, p99 %llu ns, p99.9 %llu ns\n",
+      (unsigned long long) percentile(samples, sample_count, 0.50),
+      (unsigned long long) percentile(samples, sample_count, 0.99),
+      (unsigned long long) percentile(samples, sample_count, 0.999));
+    fprintf(out, "final tree      %d keys, height %d, %d slots allocated\n",
+      stats.utilized_element_count, stats.height,
+      stats.allocated_element_count);
+  }
+
+  fclose(out);
+  free(samples);
+  ngds_array_splay_tree_destroy(tree);
+  free_trace(&trace);
+
+  return 0;
+} /* main() */
+
+/* vi: set et sw=2 ts=2: */